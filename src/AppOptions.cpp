@@ -0,0 +1,287 @@
+#include "AppOptions.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+const char* cameraPathName(CameraPath path)
+{
+	switch (path)
+	{
+	case CameraPath::GRAZING: return "grazing";
+	case CameraPath::FLYTHROUGH: return "flythrough";
+	default: return "orbit";
+	}
+}
+
+AppOptions AppOptions::parse(int argc, char** argv)
+{
+	AppOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		// fetches the value following an option like "--objects 1000"
+		auto next_value = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for option " + arg);
+			}
+			return argv[++i];
+		};
+
+		if (arg == "--objects")
+		{
+			options.object_count = (uint32_t)std::stoul(next_value());
+			if (options.object_count == 0)
+			{
+				throw std::runtime_error("--objects must be at least 1");
+			}
+		}
+		else if (arg == "--gpu-culling")
+		{
+			options.gpu_culling = true;
+		}
+		else if (arg == "--occlusion-culling")
+		{
+			options.gpu_culling = true;
+			options.occlusion_culling = true;
+		}
+		else if (arg == "--cpu-culling")
+		{
+			options.cpu_culling = true;
+		}
+		else if (arg == "--simd")
+		{
+			options.simd_level = next_value();
+		}
+		else if (arg == "--bvh-culling")
+		{
+			options.cpu_culling = true;
+			options.bvh_culling = true;
+		}
+		else if (arg == "--depth-prepass")
+		{
+			options.depth_prepass = true;
+		}
+		else if (arg == "--camera")
+		{
+			std::string path = next_value();
+			bool found = false;
+			for (auto camera_path : { CameraPath::ORBIT, CameraPath::GRAZING, CameraPath::FLYTHROUGH })
+			{
+				if (path == cameraPathName(camera_path))
+				{
+					options.camera_path = camera_path;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				throw std::runtime_error("Unknown camera path " + path);
+			}
+		}
+		else if (arg == "--frames")
+		{
+			options.frame_count = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--dynamic-resolution")
+		{
+			options.gpu_time_target_ms = std::stof(next_value());
+			if (options.gpu_time_target_ms <= 0.0f)
+			{
+				throw std::runtime_error("--dynamic-resolution needs a positive frame time in milliseconds");
+			}
+		}
+		else if (arg == "--min-scale")
+		{
+			options.min_resolution_scale = std::stof(next_value());
+			if (options.min_resolution_scale <= 0.0f || options.min_resolution_scale > 1.0f)
+			{
+				throw std::runtime_error("--min-scale must be in (0, 1]");
+			}
+		}
+		else if (arg == "--pacing")
+		{
+			options.pacing_preset = next_value();
+		}
+		else if (arg == "--present-mode")
+		{
+			options.present_mode = next_value();
+		}
+		else if (arg == "--swapchain-images")
+		{
+			options.swapchain_images = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--fps-limit")
+		{
+			options.fps_limit = std::stof(next_value());
+			if (options.fps_limit < 0.0f)
+			{
+				throw std::runtime_error("--fps-limit can't be negative");
+			}
+		}
+		else if (arg == "--resize-settle")
+		{
+			options.resize_settle_ms = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--resize-sweep")
+		{
+			options.resize_sweep_frames = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--capture")
+		{
+			options.capture_path = next_value();
+		}
+		else if (arg == "--capture-format")
+		{
+			options.capture_format = next_value();
+		}
+		else if (arg == "--capture-workers")
+		{
+			options.capture_workers = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--benchmark")
+		{
+			options.benchmark = true;
+		}
+		else if (arg == "--warmup")
+		{
+			options.warmup_frames = (uint32_t)std::stoul(next_value());
+		}
+		else if (arg == "--timestep")
+		{
+			options.timestep_ms = std::stof(next_value());
+			if (options.timestep_ms <= 0.0f)
+			{
+				throw std::runtime_error("--timestep must be positive");
+			}
+		}
+		else if (arg == "--benchmark-output")
+		{
+			options.benchmark_output = next_value();
+		}
+		else if (arg == "--benchmark-format")
+		{
+			options.benchmark_format = next_value();
+			if (options.benchmark_format != "json" && options.benchmark_format != "csv")
+			{
+				throw std::runtime_error("--benchmark-format must be json or csv");
+			}
+		}
+		else if (arg == "--gpu-profile")
+		{
+			options.gpu_profile = true;
+		}
+		else if (arg == "--pipeline-statistics")
+		{
+			options.gpu_profile = true;
+			options.pipeline_statistics = true;
+		}
+		else if (arg == "--trace")
+		{
+			options.trace_path = next_value();
+		}
+		else if (arg == "--archive")
+		{
+			options.asset_archive = next_value();
+		}
+		else if (arg == "--loose-files")
+		{
+			options.asset_archive.clear();
+		}
+		else if (arg == "--device")
+		{
+			options.device = next_value();
+		}
+		else if (arg == "--serial-init")
+		{
+			options.serial_init = true;
+		}
+		else if (arg == "--job-workers")
+		{
+			options.job_workers = std::stoi(next_value());
+			if (options.job_workers < 0)
+			{
+				throw std::runtime_error("--job-workers can't be negative");
+			}
+		}
+		else if (arg == "--headless")
+		{
+			options.headless = true;
+		}
+		else if (arg == "--help" || arg == "-h")
+		{
+			printUsage();
+			exit(EXIT_SUCCESS);
+		}
+		else
+		{
+			printUsage();
+			throw std::runtime_error("Unknown option " + arg);
+		}
+	}
+
+	if (options.gpu_culling && options.cpu_culling)
+	{
+		throw std::runtime_error("--gpu-culling and --cpu-culling can't be used together");
+	}
+
+	if (options.benchmark && options.frame_count == 0)
+	{
+		options.frame_count = 1000;
+	}
+
+	if (options.headless && options.frame_count == 0)
+	{
+		throw std::runtime_error("--headless needs --frames, there is no window to close");
+	}
+	if (options.headless && options.resize_sweep_frames > 0)
+	{
+		throw std::runtime_error("--resize-sweep needs a window to resize");
+	}
+
+	return options;
+}
+
+void AppOptions::printUsage()
+{
+	std::cout << "usage: vulkan_helloworld [options]" << std::endl
+		<< "\t--objects <n>\tnumber of model instances to draw (default 1)" << std::endl
+		<< "\t--gpu-culling\tfrustum cull on the GPU and draw with a single indirect draw" << std::endl
+		<< "\t--occlusion-culling\tGPU culling plus occlusion culling against a depth pyramid, P cycles its debug view" << std::endl
+		<< "\t--cpu-culling\tfrustum cull on the CPU and record draws for visible objects only" << std::endl
+		<< "\t--simd <level>\tCPU culling instruction set: scalar, sse or avx2 (default: best available)" << std::endl
+		<< "\t--bvh-culling\tCPU culling through a BVH over the object bounds" << std::endl
+		<< "\t--depth-prepass\tstart with the depth pre-pass on, Z toggles it" << std::endl
+		<< "\t--camera <path>\torbit, grazing or flythrough (default orbit)" << std::endl
+		<< "\t--frames <n>\tquit after n frames" << std::endl
+		<< "\t--dynamic-resolution <ms>\tscale the render resolution to keep the GPU frame time under ms" << std::endl
+		<< "\t--min-scale <s>\tlowest resolution scale for --dynamic-resolution (default 0.5)" << std::endl
+		<< "\t--pacing <preset>\tdefault, low-latency or throughput: present mode and swap chain length" << std::endl
+		<< "\t--present-mode <mode>\tfifo, fifo-relaxed, mailbox or immediate, overrides the preset" << std::endl
+		<< "\t--swapchain-images <n>\tswap chain length, overrides the preset" << std::endl
+		<< "\t--fps-limit <fps>\tcap the frame rate, sleeping then spinning until each frame is due" << std::endl
+		<< "\t--resize-settle <ms>\trecreate the swap chain once the window size is still for ms, 0 on every resize (default 50)" << std::endl
+		<< "\t--resize-sweep <n>\tresize the window every frame for n frames and report the frame times" << std::endl
+		<< "\t--headless\trender offscreen without a window or swap chain, needs --frames" << std::endl
+		<< "\t--capture <path>\tsave every frame, to a folder for ppm and png or a file or pipe for raw" << std::endl
+		<< "\t--capture-format <f>\tppm, png or raw RGBA8 frames (default ppm)" << std::endl
+		<< "\t--capture-workers <n>\tthreads encoding captured frames (default 2)" << std::endl
+		<< "\t--benchmark\tmeasure --frames frames (default 1000) after a warm-up with a fixed timestep" << std::endl
+		<< "\t--warmup <n>\tframes rendered before measuring (default 60)" << std::endl
+		<< "\t--timestep <ms>\tsimulated time per frame in benchmark mode (default 16.67)" << std::endl
+		<< "\t--benchmark-output <file>\twhere the results go (default stdout)" << std::endl
+		<< "\t--benchmark-format <f>\tjson summary or csv of every frame (default json)" << std::endl
+		<< "\t--gpu-profile\tmeasure the GPU time of every pass with timestamp queries" << std::endl
+		<< "\t--pipeline-statistics\t--gpu-profile plus vertex and fragment invocation counts per pass" << std::endl
+		<< "\t--trace <file>\twrite a Chrome trace of startup and every frame at exit, T writes it while running" << std::endl
+		<< "\t--archive <file>\tpacked assets to map instead of loose files (default content.pak, if it exists)" << std::endl
+		<< "\t--loose-files\tread every asset from its own file even when there is an archive" << std::endl
+		<< "\t--serial-init\tload the texture and model after device setup instead of in parallel with it" << std::endl
+		<< "\t--job-workers <n>\tjob system threads next to the main one (default: one per hardware thread but the main one)" << std::endl
+		<< "\t--device <gpu>\trender on the GPU with this name part, UUID or index instead of the highest scoring one" << std::endl;
+}
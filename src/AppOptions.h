@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// how the camera moves, the non-orbit paths look across the object grid for lots of overdraw
+enum class CameraPath
+{
+	ORBIT, // the model spinning below a fixed camera
+	GRAZING, // from a corner of the grid across it at model height, swaying slowly
+	FLYTHROUGH, // along the grid rows at model height
+};
+
+const char* cameraPathName(CameraPath path);
+
+// Runtime switches, filled from the command line
+struct AppOptions
+{
+	// number of model instances, laid out on a square grid
+	uint32_t object_count = 1;
+
+	// cull objects in a compute pass and draw the survivors with one indirect draw
+	bool gpu_culling = false;
+
+	// two phase hierarchical-z occlusion culling on top of gpu_culling
+	bool occlusion_culling = false;
+
+	// cull objects on the CPU every frame and record draws for the survivors only
+	bool cpu_culling = false;
+	// instruction set of the CPU culling kernels: scalar, sse or avx2, empty picks the best one
+	std::string simd_level;
+	// CPU culling walks a BVH over the object bounds instead of testing every object, implies cpu_culling
+	bool bvh_culling = false;
+
+	// lay down depth with a position-only pass first, then shade with an EQUAL depth test,
+	// can be toggled at runtime
+	bool depth_prepass = false;
+
+	CameraPath camera_path = CameraPath::ORBIT;
+	// closes the window after this many frames, 0 runs until it is closed
+	uint32_t frame_count = 0;
+
+	// GPU frame time the render resolution is scaled to meet, 0 renders at the swap chain size
+	float gpu_time_target_ms = 0.0f;
+	// lowest resolution scale dynamic resolution may pick, per axis
+	float min_resolution_scale = 0.5f;
+
+	// frame pacing preset: default, low-latency or throughput
+	std::string pacing_preset = "default";
+	// fifo, fifo-relaxed, mailbox or immediate, empty takes the one of the preset
+	std::string present_mode;
+	// swap chain length, 0 takes the one of the preset
+	uint32_t swapchain_images = 0;
+	// caps the frame rate on the CPU, 0 for no limit
+	float fps_limit = 0.0f;
+	// the swap chain is recreated once the window size stopped changing for this long, 0 on every resize
+	uint32_t resize_settle_ms = 50;
+	// resizes the window every frame for this many frames, after the first 60, like a drag back
+	// and forth, and reports the frame times during it
+	uint32_t resize_sweep_frames = 0;
+
+	// no window, surface or swap chain, frames render into offscreen images; needs frame_count
+	bool headless = false;
+
+	// where captured frames go, a folder for ppm and png, a file or pipe for raw; empty disables capture
+	std::string capture_path;
+	// ppm, png or raw
+	std::string capture_format = "ppm";
+	// threads encoding captured frames, raw always uses one
+	uint32_t capture_workers = 2;
+
+	// benchmark mode: frame_count measured frames after warmup_frames, animated with a fixed
+	// timestep so every run renders the same frames, per frame CPU timings written at exit
+	bool benchmark = false;
+	uint32_t warmup_frames = 60;
+	float timestep_ms = 1000.0f / 60.0f;
+	// file the results go to, empty for stdout
+	std::string benchmark_output;
+	// json or csv
+	std::string benchmark_format = "json";
+
+	// GPU timestamps around every pass and upload, summarized at exit and in the benchmark results
+	bool gpu_profile = false;
+	// vertex, fragment and compute invocation counts per pass as well, implies gpu_profile
+	bool pipeline_statistics = false;
+
+	// Chrome trace JSON of CPU markers in every init step, upload and frame phase, written at exit
+	// and when T is pressed; empty disables tracing
+	std::string trace_path;
+
+	// load the texture and model on the main thread once the device is set up, instead of on
+	// worker threads from the start, to compare the time to the first frame
+	bool serial_init = false;
+
+	// job system workers next to the main thread, -1 starts one per hardware thread but the
+	// main one; 0 runs every job on the main thread
+	int job_workers = -1;
+
+	// packed assets, mapped at startup; when it doesn't exist or is empty assets are loose files
+	std::string asset_archive = "content.pak";
+
+	// the GPU to render on: part of its name, its UUID or its index as listed at startup; empty
+	// picks the highest scoring one
+	std::string device;
+
+	static AppOptions parse(int argc, char** argv);
+	static void printUsage();
+};
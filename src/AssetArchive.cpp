@@ -0,0 +1,397 @@
+#include "AssetArchive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_MATCH_OFFSET = 0xFFFF;
+static const int MATCH_HASH_BITS = 16;
+
+uint64_t assetChecksum(const char* data, size_t size)
+{
+	const uint64_t FNV_PRIME = 1099511628211ull;
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ (uint8_t)data[i]) * FNV_PRIME;
+	}
+	// multiplying only carries upwards, fold the high bits back down
+	hash ^= hash >> 29;
+	hash *= FNV_PRIME;
+	return hash ^ (hash >> 32);
+}
+
+static uint32_t load32(const char* data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+// the part of a length past the 15 that fit into the token, 255 continues
+static void writeLength(std::vector<char>& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back((char)255);
+		length -= 255;
+	}
+	out.push_back((char)length);
+}
+
+static bool readLength(const uint8_t* data, size_t size, size_t& position, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (position >= size)
+		{
+			return false;
+		}
+		byte = data[position++];
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// token (literal count << 4 | match length - MIN_MATCH), literals, match offset, the last sequence
+// only has literals and ends the data
+static void writeSequence(std::vector<char>& out, const char* literals, size_t literal_count
+	, size_t match_offset, size_t match_length)
+{
+	size_t match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+	out.push_back((char)((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15)));
+	if (literal_count >= 15)
+	{
+		writeLength(out, literal_count - 15);
+	}
+	out.insert(out.end(), literals, literals + literal_count);
+	if (match_length == 0)
+	{
+		return;
+	}
+	out.push_back((char)(match_offset & 0xFF));
+	out.push_back((char)(match_offset >> 8));
+	if (match_code >= 15)
+	{
+		writeLength(out, match_code - 15);
+	}
+}
+
+std::vector<char> compressAsset(const char* data, size_t size)
+{
+	std::vector<char> out;
+	out.reserve(size / 2 + 16);
+	// last position of each hashed 4 byte sequence, +1 so that 0 is empty
+	std::vector<size_t> last_positions(size_t(1) << MATCH_HASH_BITS, 0);
+	size_t anchor = 0;
+	size_t position = 0;
+	size_t misses = 0;
+	while (position + MIN_MATCH <= size)
+	{
+		uint32_t sequence = load32(data + position);
+		size_t hash = (sequence * 2654435761u) >> (32 - MATCH_HASH_BITS);
+		size_t candidate = last_positions[hash];
+		last_positions[hash] = position + 1;
+		if (candidate == 0 || position - (candidate - 1) > MAX_MATCH_OFFSET || load32(data + candidate - 1) != sequence)
+		{
+			// skip ahead faster through data that doesn't compress, e.g. jpg
+			position += 1 + (misses++ >> 6);
+			continue;
+		}
+		candidate--;
+		size_t length = MIN_MATCH;
+		while (position + length < size && data[candidate + length] == data[position + length])
+		{
+			length++;
+		}
+		writeSequence(out, data + anchor, position - anchor, position - candidate, length);
+		position += length;
+		anchor = position;
+		misses = 0;
+	}
+	writeSequence(out, data + anchor, size - anchor, 0, 0);
+	return out;
+}
+
+std::vector<char> decompressAsset(const char* data, size_t stored_size, size_t size)
+{
+	const uint8_t* in = (const uint8_t*)data;
+	std::vector<char> out(size);
+	size_t in_position = 0;
+	size_t out_position = 0;
+	auto corrupt = []() { return std::runtime_error("Corrupt compressed asset"); };
+	while (true)
+	{
+		if (in_position >= stored_size)
+		{
+			throw corrupt();
+		}
+		uint8_t token = in[in_position++];
+		size_t literal_count = token >> 4;
+		if (literal_count == 15 && !readLength(in, stored_size, in_position, literal_count))
+		{
+			throw corrupt();
+		}
+		if (literal_count > stored_size - in_position || literal_count > size - out_position)
+		{
+			throw corrupt();
+		}
+		memcpy(out.data() + out_position, in + in_position, literal_count);
+		in_position += literal_count;
+		out_position += literal_count;
+		if (in_position == stored_size)
+		{
+			break;
+		}
+
+		if (stored_size - in_position < 2)
+		{
+			throw corrupt();
+		}
+		size_t match_offset = in[in_position] | (size_t(in[in_position + 1]) << 8);
+		in_position += 2;
+		size_t match_length = token & 15;
+		if (match_length == 15 && !readLength(in, stored_size, in_position, match_length))
+		{
+			throw corrupt();
+		}
+		match_length += MIN_MATCH;
+		if (match_offset == 0 || match_offset > out_position || match_length > size - out_position)
+		{
+			throw corrupt();
+		}
+		// an overlapping match repeats its last match_offset bytes, copied a period at a time
+		char* match = out.data() + out_position;
+		if (match_offset == 1)
+		{
+			memset(match, match[-1], match_length);
+		}
+		else
+		{
+			for (size_t copied = 0; copied < match_length; copied += match_offset)
+			{
+				memcpy(match + copied, match + copied - match_offset, std::min(match_offset, match_length - copied));
+			}
+		}
+		out_position += match_length;
+	}
+	if (out_position != size)
+	{
+		throw corrupt();
+	}
+	return out;
+}
+
+AssetBytes::AssetBytes(const char* mapped_data, size_t mapped_size)
+	: mapped_data(mapped_data)
+	, mapped_size(mapped_size)
+{}
+
+AssetBytes::AssetBytes(std::vector<char> buffer)
+	: buffer(std::move(buffer))
+{}
+
+static int compareNames(const char* a, size_t a_length, const char* b, size_t b_length)
+{
+	int result = memcmp(a, b, std::min(a_length, b_length));
+	if (result != 0)
+	{
+		return result;
+	}
+	return a_length < b_length ? -1 : a_length > b_length ? 1 : 0;
+}
+
+AssetArchive::AssetArchive(const std::string& path)
+	: path(path)
+{
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING
+		, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		file_handle = nullptr;
+		throw std::runtime_error("Failed to open asset archive " + path);
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size))
+	{
+		unmap();
+		throw std::runtime_error("Failed to open asset archive " + path);
+	}
+	mapped_size = (size_t)file_size.QuadPart;
+	if (mapped_size >= sizeof(AssetArchiveHeader))
+	{
+		mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		mapped = mapping_handle ? (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!mapped)
+		{
+			unmap();
+			throw std::runtime_error("Failed to map asset archive " + path);
+		}
+	}
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	struct stat file_stat;
+	if (file < 0 || fstat(file, &file_stat) != 0)
+	{
+		if (file >= 0)
+		{
+			close(file);
+		}
+		throw std::runtime_error("Failed to open asset archive " + path);
+	}
+	mapped_size = (size_t)file_stat.st_size;
+	if (mapped_size >= sizeof(AssetArchiveHeader))
+	{
+		void* mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, file, 0);
+		mapped = mapping != MAP_FAILED ? (const char*)mapping : nullptr;
+	}
+	// the mapping keeps the file open
+	close(file);
+	if (mapped_size >= sizeof(AssetArchiveHeader) && !mapped)
+	{
+		throw std::runtime_error("Failed to map asset archive " + path);
+	}
+#endif
+
+	// sizes are checked so that a truncated or foreign file can't make reads go past the mapping
+	auto invalid = [&path](const std::string& reason)
+	{
+		return std::runtime_error("Invalid asset archive " + path + ": " + reason);
+	};
+	if (!mapped)
+	{
+		unmap();
+		throw invalid("too short");
+	}
+	try
+	{
+		AssetArchiveHeader header;
+		memcpy(&header, mapped, sizeof(header));
+		if (memcmp(header.magic, ASSET_ARCHIVE_MAGIC, sizeof(header.magic)) != 0)
+		{
+			throw invalid("not an archive");
+		}
+		if (header.version != ASSET_ARCHIVE_VERSION)
+		{
+			throw invalid("version " + std::to_string(header.version) + " instead of " + std::to_string(ASSET_ARCHIVE_VERSION));
+		}
+		if (header.entries_offset % alignof(AssetArchiveEntry) != 0 || header.entries_offset > mapped_size
+			|| header.entry_count > (mapped_size - header.entries_offset) / sizeof(AssetArchiveEntry)
+			|| header.names_offset > mapped_size || header.names_size > mapped_size - header.names_offset)
+		{
+			throw invalid("table of contents out of range");
+		}
+		entries = (const AssetArchiveEntry*)(mapped + header.entries_offset);
+		entry_count = header.entry_count;
+		names = mapped + header.names_offset;
+
+		for (uint32_t i = 0; i < entry_count; i++)
+		{
+			const auto& entry = entries[i];
+			if (entry.name_offset > header.names_size || entry.name_length > header.names_size - entry.name_offset)
+			{
+				throw invalid("name out of range");
+			}
+			if (entry.offset % ASSET_ALIGNMENT != 0 || entry.offset > mapped_size || entry.stored_size > mapped_size - entry.offset
+				|| (!(entry.flags & ASSET_COMPRESSED) && entry.stored_size != entry.size))
+			{
+				throw invalid("payload out of range");
+			}
+			if (i > 0 && compareNames(names + entries[i - 1].name_offset, entries[i - 1].name_length
+				, names + entry.name_offset, entry.name_length) >= 0)
+			{
+				throw invalid("table of contents not sorted");
+			}
+		}
+	}
+	catch (...)
+	{
+		unmap();
+		throw;
+	}
+}
+
+AssetArchive::~AssetArchive()
+{
+	unmap();
+}
+
+void AssetArchive::unmap()
+{
+#ifdef _WIN32
+	if (mapped)
+	{
+		UnmapViewOfFile(mapped);
+	}
+	if (mapping_handle)
+	{
+		CloseHandle(mapping_handle);
+	}
+	if (file_handle)
+	{
+		CloseHandle(file_handle);
+	}
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (mapped)
+	{
+		munmap((void*)mapped, mapped_size);
+	}
+#endif
+	mapped = nullptr;
+}
+
+const AssetArchiveEntry* AssetArchive::findEntry(const std::string& name) const
+{
+	auto end = entries + entry_count;
+	auto entry = std::lower_bound(entries, end, name, [this](const AssetArchiveEntry& entry, const std::string& name)
+	{
+		return compareNames(names + entry.name_offset, entry.name_length, name.data(), name.size()) < 0;
+	});
+	if (entry == end || compareNames(names + entry->name_offset, entry->name_length, name.data(), name.size()) != 0)
+	{
+		return nullptr;
+	}
+	return entry;
+}
+
+AssetBytes AssetArchive::read(const std::string& name) const
+{
+	const AssetArchiveEntry* entry = findEntry(name);
+	if (!entry)
+	{
+		throw std::runtime_error("No " + name + " in asset archive " + path);
+	}
+	const char* payload = mapped + entry->offset;
+	AssetBytes bytes = (entry->flags & ASSET_COMPRESSED)
+		? AssetBytes(decompressAsset(payload, (size_t)entry->stored_size, (size_t)entry->size))
+		: AssetBytes(payload, (size_t)entry->size);
+	if (assetChecksum(bytes.data(), bytes.size()) != entry->checksum)
+	{
+		throw std::runtime_error("Checksum mismatch of " + name + " in asset archive " + path);
+	}
+	return bytes;
+}
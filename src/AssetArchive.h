@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Packed asset archive, written by asset_packer and memory mapped by the application:
+//   header | table of contents, sorted by name | names | payloads, each ASSET_ALIGNMENT aligned
+// All numbers are little endian.
+
+const char ASSET_ARCHIVE_MAGIC[8] = { 'V', 'K', 'A', 'S', 'S', 'E', 'T', 'S' };
+const uint32_t ASSET_ARCHIVE_VERSION = 1;
+const uint64_t ASSET_ALIGNMENT = 64; // payload offsets, enough for SPIR-V words and cache lines
+
+const uint32_t ASSET_COMPRESSED = 1; // payload holds compressAsset output
+
+struct AssetArchiveHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_count;
+	uint64_t entries_offset;
+	uint64_t names_offset;
+	uint64_t names_size;
+	uint8_t reserved[24];
+};
+static_assert(sizeof(AssetArchiveHeader) == 64, "archive header layout");
+
+struct AssetArchiveEntry
+{
+	uint64_t offset; // of the payload
+	uint64_t stored_size; // of the payload
+	uint64_t size; // once decompressed
+	uint64_t checksum; // assetChecksum of the decompressed bytes
+	uint32_t name_offset; // into the names, which aren't terminated
+	uint32_t name_length;
+	uint32_t flags;
+	uint32_t reserved;
+};
+static_assert(sizeof(AssetArchiveEntry) == 48, "archive entry layout");
+
+// 64 bit FNV-1a over 8 byte words, fast enough to check every asset as it is loaded
+uint64_t assetChecksum(const char* data, size_t size);
+// LZ77 with byte aligned sequences in the manner of LZ4, decompresses at memory speed
+std::vector<char> compressAsset(const char* data, size_t size);
+// throws when the data is corrupt or doesn't decompress to size bytes
+std::vector<char> decompressAsset(const char* data, size_t stored_size, size_t size);
+
+// The bytes of an asset: a view into a mapped archive when stored uncompressed,
+// otherwise a buffer of its own. Either way at least 4 byte aligned.
+class AssetBytes
+{
+public:
+	AssetBytes() = default;
+	AssetBytes(const char* mapped_data, size_t mapped_size);
+	explicit AssetBytes(std::vector<char> buffer);
+
+	const char* data() const { return mapped_data ? mapped_data : buffer.data(); }
+	size_t size() const { return mapped_data ? mapped_size : buffer.size(); }
+
+private:
+	const char* mapped_data = nullptr;
+	size_t mapped_size = 0;
+	std::vector<char> buffer;
+};
+
+// A mapped asset archive. Reads may come from any thread; the AssetBytes they
+// return may point into the mapping, so it has to outlive them.
+class AssetArchive
+{
+public:
+	// maps the file and validates its table of contents, throws when it isn't an archive
+	explicit AssetArchive(const std::string& path);
+	~AssetArchive();
+
+	AssetArchive(const AssetArchive&) = delete;
+	AssetArchive& operator=(const AssetArchive&) = delete;
+
+	bool contains(const std::string& name) const { return findEntry(name) != nullptr; }
+	// verifies the checksum, throws for unknown names and corrupt entries
+	AssetBytes read(const std::string& name) const;
+	uint32_t getEntryCount() const { return entry_count; }
+
+private:
+	const char* mapped = nullptr;
+	size_t mapped_size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+	std::string path;
+	const AssetArchiveEntry* entries = nullptr;
+	uint32_t entry_count = 0;
+	const char* names = nullptr;
+
+	// binary search in the sorted table of contents
+	const AssetArchiveEntry* findEntry(const std::string& name) const;
+	void unmap();
+};
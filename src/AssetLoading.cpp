@@ -0,0 +1,170 @@
+// the header includes tiny_obj_loader.h, so the implementation has to be asked for first
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "AssetLoading.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <unordered_map>
+
+// reads a span of memory in place, for parsers that take streams
+struct MemoryStreamBuffer : std::streambuf
+{
+	MemoryStreamBuffer(const char* data, size_t size)
+	{
+		char* begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+};
+
+std::vector<char> readFile(const std::string& filename) 
+{
+	std::ifstream file_stream(filename, std::ios::ate | std::ios::binary);
+
+	if (!file_stream.is_open()) 
+	{
+		throw std::runtime_error("failed to open file!");
+	}
+
+	// starts reading at the end of file to determine file size (ate)
+	size_t file_size = (size_t)file_stream.tellg();
+	std::vector<char> buffer(file_size);
+
+	file_stream.seekg(0);
+	file_stream.read(buffer.data(), file_size);
+
+	file_stream.close();
+	return buffer;
+}
+
+void ImagePixelsDeleter::operator()(unsigned char* pixels) const
+{
+	stbi_image_free(pixels);
+}
+
+LoadedImage loadImage(const std::string& path)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		throw std::runtime_error("Failed to load texture image " + path);
+	}
+	LoadedImage image;
+	image.width = (uint32_t)width;
+	image.height = (uint32_t)height;
+	image.pixels.reset(pixels);
+	return image;
+}
+
+LoadedImage decodeImage(const char* data, size_t size)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load_from_memory((const stbi_uc*)data, (int)size, &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		throw std::runtime_error(std::string("Failed to decode texture image: ") + stbi_failure_reason());
+	}
+	LoadedImage image;
+	image.width = (uint32_t)width;
+	image.height = (uint32_t)height;
+	image.pixels.reset(pixels);
+	return image;
+}
+
+void parseObj(const std::string& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes)
+{
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str())) 
+	{
+		throw std::runtime_error(err);
+	}
+}
+
+void parseObj(const char* data, size_t size, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes)
+{
+	MemoryStreamBuffer buffer(data, size);
+	std::istream stream(&buffer);
+	// what LoadObj uses for files without a base path
+	tinyobj::MaterialFileReader material_reader("");
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &stream, &material_reader))
+	{
+		throw std::runtime_error(err);
+	}
+}
+
+LoadedModel buildIndexedModel(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes)
+{
+	LoadedModel model;
+	std::unordered_map<Vertex, size_t> unique_vertices = {};
+	for (const auto& shape : shapes) 
+	{
+		for (const auto& index : shape.mesh.indices) 
+		{
+			Vertex vertex = {};
+
+			vertex.pos = {
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
+			};
+
+			// since the y axis of obj's texture coordinate points up
+			vertex.tex_coord = { 
+				attrib.texcoords[2 * index.texcoord_index + 0],
+				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+			};
+
+			if (unique_vertices.count(vertex) == 0)
+			{
+				unique_vertices[vertex] = model.vertices.size(); // auto incrementing size
+				model.vertices.push_back(vertex);
+			}
+
+			model.indices.push_back((uint32_t)unique_vertices[vertex]);
+		}
+	}
+
+	// bounding sphere around the center of the bounding box
+	glm::vec3 box_min = model.vertices.empty() ? glm::vec3() : model.vertices[0].pos;
+	glm::vec3 box_max = box_min;
+	for (const auto& vertex : model.vertices)
+	{
+		box_min = glm::min(box_min, vertex.pos);
+		box_max = glm::max(box_max, vertex.pos);
+	}
+	glm::vec3 center = (box_min + box_max) * 0.5f;
+	float radius = 0.0f;
+	for (const auto& vertex : model.vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+	model.bounding_sphere = glm::vec4(center, radius);
+	return model;
+}
+
+LoadedModel loadObjModel(const std::string& path)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	parseObj(path, attrib, shapes);
+	return buildIndexedModel(attrib, shapes);
+}
+
+LoadedModel loadObjModel(const char* data, size_t size)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	parseObj(data, size, attrib, shapes);
+	return buildIndexedModel(attrib, shapes);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#ifndef GLM_FORCE_RADIANS
+#define GLM_FORCE_RADIANS
+#endif
+#ifndef GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <tiny_obj_loader.h>
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Loading of files, models and their vertex layout, free of any Vulkan device
+// so that it can be benchmarked on its own.
+
+// the whole file, throws when it can't be opened
+std::vector<char> readFile(const std::string& filename);
+
+// frees pixels returned by stb_image
+struct ImagePixelsDeleter
+{
+	void operator()(unsigned char* pixels) const;
+};
+
+struct LoadedImage
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::unique_ptr<unsigned char, ImagePixelsDeleter> pixels; // RGBA8, row after row
+
+	size_t getSize() const { return (size_t)width * height * 4; }
+};
+
+// decodes an image file to RGBA8, throws when it can't be loaded
+LoadedImage loadImage(const std::string& path);
+// the same from an image file in memory
+LoadedImage decodeImage(const char* data, size_t size);
+
+struct Vertex
+{
+	glm::vec3 pos;
+	glm::vec3 color;
+	glm::vec2 tex_coord;
+
+	static VkVertexInputBindingDescription getBindingDesciption()
+	{
+		VkVertexInputBindingDescription binding_description = {};
+		binding_description.binding = 0; // index of the binding, defined in vertex shader
+		binding_description.stride = sizeof(Vertex);
+		binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // move to next data engty after each vertex
+		return binding_description;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 3> attr_descriptions = {};
+		attr_descriptions[0].binding = 0; 
+		attr_descriptions[0].location = 0;
+		attr_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attr_descriptions[0].offset = offsetof(Vertex, pos); //bytes of a member since beginning of struct
+		attr_descriptions[1].binding = 0;
+		attr_descriptions[1].location = 1;
+		attr_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attr_descriptions[1].offset = offsetof(Vertex, color); //bytes of a member since beginning of struct
+		attr_descriptions[2].binding = 0;
+		attr_descriptions[2].location = 2;
+		attr_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+		attr_descriptions[2].offset = offsetof(Vertex, tex_coord);
+
+		return attr_descriptions;
+	}
+
+	bool operator==(const Vertex& other) const 
+	{
+		return pos == other.pos && color == other.color && tex_coord == other.tex_coord;
+	}
+};
+
+namespace std {
+	// hash function for Vertex
+	template<> struct hash<Vertex> 
+	{
+		size_t operator()(Vertex const& vertex) const 
+		{
+			return ((hash<glm::vec3>()(vertex.pos) ^
+				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
+				(hash<glm::vec2>()(vertex.tex_coord) << 1);
+		}
+	};
+}
+
+struct LoadedModel
+{
+	std::vector<Vertex> vertices; // each one unique
+	std::vector<uint32_t> indices;
+	glm::vec4 bounding_sphere; // around the center of the bounding box, in model space
+};
+
+// parses an OBJ file, throws on errors
+void parseObj(const std::string& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes);
+// the same from an OBJ file in memory, materials are still read from files in the working directory
+void parseObj(const char* data, size_t size, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes);
+// merges the vertices the faces of shapes share
+LoadedModel buildIndexedModel(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes);
+// parseObj followed by buildIndexedModel
+LoadedModel loadObjModel(const std::string& path);
+LoadedModel loadObjModel(const char* data, size_t size);
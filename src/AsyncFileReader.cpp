@@ -0,0 +1,530 @@
+#include "AsyncFileReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ASYNC_READS_IO_URING 1
+#endif
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef ASYNC_READS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+struct FileReadRequest
+{
+	std::string path;
+	char* destination = nullptr;
+	size_t size = 0;
+	FileReadCallback on_complete;
+	int file = -1;
+	uint32_t chunks_left = 0;
+	std::string error;
+};
+
+struct FileReadChunk
+{
+	FileReadRequest* request;
+	uint64_t offset;
+	size_t length;
+#ifdef ASYNC_READS_IO_URING
+	iovec buffer; // has to stay put until the read is submitted
+#endif
+};
+
+const char* fileReadBackendName(FileReadBackend backend)
+{
+	switch (backend)
+	{
+	case FileReadBackend::IO_URING: return "io_uring";
+	default: return "thread pool";
+	}
+}
+
+static std::string errorText(int error)
+{
+	return std::system_category().message(error);
+}
+
+#ifdef ASYNC_READS_IO_URING
+// the rings shared with the kernel, set up without liburing
+struct IoUring
+{
+	int fd = -1;
+	void* sq_ring = nullptr;
+	size_t sq_ring_size = 0;
+	void* cq_ring = nullptr;
+	size_t cq_ring_size = 0;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqes_size = 0;
+	uint32_t sq_entries = 0;
+
+	unsigned* sq_head = nullptr;
+	unsigned* sq_tail = nullptr;
+	unsigned* sq_mask = nullptr;
+	unsigned* sq_array = nullptr;
+	unsigned* cq_head = nullptr;
+	unsigned* cq_tail = nullptr;
+	unsigned* cq_mask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	~IoUring()
+	{
+		if (sqes)
+		{
+			munmap(sqes, sqes_size);
+		}
+		if (cq_ring && cq_ring != sq_ring)
+		{
+			munmap(cq_ring, cq_ring_size);
+		}
+		if (sq_ring)
+		{
+			munmap(sq_ring, sq_ring_size);
+		}
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+
+	// submits what was added to the submission queue, with wait_for_one blocks for a completion
+	int enter(bool wait_for_one)
+	{
+		unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		if (to_submit == 0 && !wait_for_one)
+		{
+			return 0;
+		}
+		return (int)syscall(__NR_io_uring_enter, fd, to_submit, wait_for_one ? 1 : 0
+			, wait_for_one ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+	}
+};
+
+// nullptr when the kernel doesn't have io_uring or a seccomp filter forbids it, e.g. in containers
+static std::unique_ptr<IoUring> createIoUring(uint32_t entries)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	std::unique_ptr<IoUring> ring(new IoUring());
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+	{
+		return nullptr;
+	}
+	ring->sq_entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap)
+	{
+		ring->sq_ring_size = ring->cq_ring_size = std::max(ring->sq_ring_size, ring->cq_ring_size);
+	}
+
+	auto map = [&ring](size_t size, off_t offset) -> void*
+	{
+		void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+		return memory == MAP_FAILED ? nullptr : memory;
+	};
+	ring->sq_ring = map(ring->sq_ring_size, IORING_OFF_SQ_RING);
+	ring->cq_ring = single_mmap ? ring->sq_ring : map(ring->cq_ring_size, IORING_OFF_CQ_RING);
+	ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	ring->sqes = (io_uring_sqe*)map(ring->sqes_size, IORING_OFF_SQES);
+	if (!ring->sq_ring || !ring->cq_ring || !ring->sqes)
+	{
+		return nullptr;
+	}
+
+	char* sq = (char*)ring->sq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	char* cq = (char*)ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+	return ring;
+}
+#else
+struct IoUring
+{
+};
+#endif
+
+AsyncFileReader::AsyncFileReader(bool prefer_io_uring, uint32_t worker_count)
+{
+#ifdef ASYNC_READS_IO_URING
+	if (prefer_io_uring)
+	{
+		ring = createIoUring(QUEUE_DEPTH);
+	}
+#else
+	(void)prefer_io_uring;
+#endif
+	if (ring)
+	{
+		backend = FileReadBackend::IO_URING;
+		return;
+	}
+	for (uint32_t i = 0; i < std::max(worker_count, 1u); i++)
+	{
+		workers.emplace_back(&AsyncFileReader::workerLoop, this);
+	}
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+	try
+	{
+		while (pending_requests > 0)
+		{
+			if (ring)
+			{
+				reapCompletions(true);
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!ring)
+			{
+				done_condition.wait(lock, [this]() { return !done_requests.empty(); });
+			}
+			for (auto* request : done_requests)
+			{
+				delete request;
+				pending_requests--;
+			}
+			done_requests.clear();
+		}
+	}
+	catch (const std::runtime_error&)
+	{
+		// the kernel may still write into the destinations, nothing more can be done
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_condition.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void AsyncFileReader::registerMemory(void* memory, size_t size)
+{
+#ifdef ASYNC_READS_IO_URING
+	if (!ring || registered_memory || pending_requests > 0)
+	{
+		return;
+	}
+	iovec region = { memory, size };
+	// fails without enough RLIMIT_MEMLOCK, the reads then pin pages as usual
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &region, 1) == 0)
+	{
+		registered_memory = (char*)memory;
+		registered_size = size;
+	}
+#else
+	(void)memory;
+	(void)size;
+#endif
+}
+
+void AsyncFileReader::read(const std::string& path, void* destination, size_t size, FileReadCallback on_complete)
+{
+	std::unique_ptr<FileReadRequest> request(new FileReadRequest());
+	request->path = path;
+	request->destination = (char*)destination;
+	request->size = size;
+	request->on_complete = std::move(on_complete);
+	queued.push_back(std::move(request));
+}
+
+void AsyncFileReader::submit()
+{
+	for (auto& queued_request : queued)
+	{
+		FileReadRequest* request = queued_request.release();
+		pending_requests++;
+		if (ring)
+		{
+			if (!startChunks(request))
+			{
+				finish(request);
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			work_requests.push_back(request);
+		}
+	}
+	queued.clear();
+	if (ring)
+	{
+		reapCompletions(false);
+	}
+	else
+	{
+		work_condition.notify_all();
+	}
+}
+
+size_t AsyncFileReader::poll()
+{
+	if (ring)
+	{
+		reapCompletions(false);
+	}
+	while (true)
+	{
+		std::unique_ptr<FileReadRequest> request;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (done_requests.empty())
+			{
+				break;
+			}
+			request.reset(done_requests.front());
+			done_requests.pop_front();
+		}
+		pending_requests--;
+		if (request->on_complete)
+		{
+			FileReadResult result;
+			result.path = request->path;
+			result.data = request->destination;
+			result.size = request->size;
+			result.error = request->error;
+			request->on_complete(result);
+		}
+	}
+	return pending_requests;
+}
+
+void AsyncFileReader::wait()
+{
+	submit();
+	while (poll() > 0)
+	{
+		if (ring)
+		{
+			reapCompletions(true);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done_condition.wait(lock, [this]() { return !done_requests.empty(); });
+		}
+	}
+}
+
+uint64_t AsyncFileReader::getFileSize(const std::string& path)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open " + path);
+	}
+	return (uint64_t)file.tellg();
+}
+
+void AsyncFileReader::workerLoop()
+{
+	while (true)
+	{
+		FileReadRequest* request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_condition.wait(lock, [this]() { return stopping || !work_requests.empty(); });
+			if (work_requests.empty())
+			{
+				return;
+			}
+			request = work_requests.front();
+			work_requests.pop_front();
+		}
+
+#ifdef _WIN32
+		std::ifstream file(request->path, std::ios::binary);
+		if (!file)
+		{
+			request->error = "Failed to open " + request->path;
+		}
+		else if (!file.read(request->destination, request->size))
+		{
+			request->error = "File ended early";
+		}
+#else
+		request->file = open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (request->file < 0)
+		{
+			request->error = errorText(errno);
+		}
+		size_t done = 0;
+		while (request->file >= 0 && done < request->size)
+		{
+			ssize_t result = pread(request->file, request->destination + done, request->size - done, (off_t)done);
+			if (result < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (result <= 0)
+			{
+				request->error = result < 0 ? errorText(errno) : "File ended early";
+				break;
+			}
+			done += (size_t)result;
+		}
+#endif
+		finish(request);
+	}
+}
+
+bool AsyncFileReader::startChunks(FileReadRequest* request)
+{
+#ifdef ASYNC_READS_IO_URING
+	request->file = open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (request->file < 0)
+	{
+		request->error = errorText(errno);
+		return false;
+	}
+	for (uint64_t offset = 0; offset < request->size; offset += CHUNK_SIZE)
+	{
+		auto* chunk = new FileReadChunk();
+		chunk->request = request;
+		chunk->offset = offset;
+		chunk->length = (size_t)std::min<uint64_t>(CHUNK_SIZE, request->size - offset);
+		unsubmitted_chunks.push_back(chunk);
+		request->chunks_left++;
+	}
+	return request->chunks_left > 0;
+#else
+	(void)request;
+	return false;
+#endif
+}
+
+void AsyncFileReader::fillSubmissionQueue()
+{
+#ifdef ASYNC_READS_IO_URING
+	unsigned tail = *ring->sq_tail;
+	// at most a submission queue of reads in flight, so that the completion queue can't overflow
+	while (!unsubmitted_chunks.empty() && chunks_in_flight < ring->sq_entries)
+	{
+		FileReadChunk* chunk = unsubmitted_chunks.front();
+		unsubmitted_chunks.pop_front();
+		char* destination = chunk->request->destination + chunk->offset;
+
+		unsigned index = tail & *ring->sq_mask;
+		io_uring_sqe& sqe = ring->sqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.fd = chunk->request->file;
+		sqe.off = chunk->offset;
+		sqe.user_data = (uint64_t)(uintptr_t)chunk;
+		if (registered_memory && destination >= registered_memory
+			&& destination + chunk->length <= registered_memory + registered_size)
+		{
+			sqe.opcode = IORING_OP_READ_FIXED;
+			sqe.addr = (uint64_t)(uintptr_t)destination;
+			sqe.len = (uint32_t)chunk->length;
+			sqe.buf_index = 0;
+		}
+		else
+		{
+			chunk->buffer.iov_base = destination;
+			chunk->buffer.iov_len = chunk->length;
+			sqe.opcode = IORING_OP_READV;
+			sqe.addr = (uint64_t)(uintptr_t)&chunk->buffer;
+			sqe.len = 1;
+		}
+		ring->sq_array[index] = index;
+		tail++;
+		chunks_in_flight++;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+#endif
+}
+
+void AsyncFileReader::reapCompletions(bool wait_for_one)
+{
+#ifdef ASYNC_READS_IO_URING
+	fillSubmissionQueue();
+	if (ring->enter(wait_for_one && chunks_in_flight > 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	{
+		throw std::runtime_error("io_uring_enter failed: " + errorText(errno));
+	}
+
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+		const io_uring_cqe& cqe = ring->cqes[head & *ring->cq_mask];
+		auto* chunk = (FileReadChunk*)(uintptr_t)cqe.user_data;
+		int result = cqe.res;
+		chunks_in_flight--;
+
+		FileReadRequest* request = chunk->request;
+		if (result == -EAGAIN || result == -EINTR)
+		{
+			unsubmitted_chunks.push_back(chunk);
+			continue;
+		}
+		if (result > 0 && (size_t)result < chunk->length)
+		{
+			// short read, the rest goes in again
+			chunk->offset += result;
+			chunk->length -= result;
+			unsubmitted_chunks.push_back(chunk);
+			continue;
+		}
+		if (result <= 0 && request->error.empty())
+		{
+			request->error = result < 0 ? errorText(-result) : "File ended early";
+		}
+		delete chunk;
+		if (--request->chunks_left == 0)
+		{
+			finish(request);
+		}
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	fillSubmissionQueue();
+	ring->enter(false);
+#else
+	(void)wait_for_one;
+#endif
+}
+
+void AsyncFileReader::finish(FileReadRequest* request)
+{
+#ifndef _WIN32
+	if (request->file >= 0)
+	{
+		close(request->file);
+		request->file = -1;
+	}
+#endif
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done_requests.push_back(request);
+	}
+	done_condition.notify_one();
+}
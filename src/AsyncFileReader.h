@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads whole files into memory the caller provides, e.g. a mapped staging
+// buffer, in batches of asynchronous reads. On Linux the reads go through
+// io_uring, elsewhere or when the kernel refuses it worker threads pread.
+
+enum class FileReadBackend
+{
+	IO_URING, // batched submissions, the reads are split into chunks in flight at once
+	THREAD_POOL, // a blocking read per file on worker threads
+};
+
+const char* fileReadBackendName(FileReadBackend backend);
+
+struct FileReadResult
+{
+	std::string path;
+	void* data = nullptr; // the destination passed to read
+	size_t size = 0;
+	std::string error; // empty when the whole size was read
+};
+
+// called by poll or wait, on the thread calling them
+using FileReadCallback = std::function<void(const FileReadResult&)>;
+
+struct FileReadRequest;
+struct FileReadChunk;
+struct IoUring;
+
+// Owned by one thread, which queues, submits and polls.
+class AsyncFileReader
+{
+public:
+	// io_uring when available and prefer_io_uring, otherwise worker_count threads
+	explicit AsyncFileReader(bool prefer_io_uring = true, uint32_t worker_count = 4);
+	// waits for the reads in flight, their callbacks aren't called
+	~AsyncFileReader();
+
+	AsyncFileReader(const AsyncFileReader&) = delete;
+	AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+	FileReadBackend getBackend() const { return backend; }
+
+	// With io_uring, reads into registered memory skip pinning its pages for every
+	// chunk. One region, registered before the first read; ignored by the thread pool.
+	void registerMemory(void* memory, size_t size);
+
+	// size bytes from the start of the file into destination, sent with the next submit
+	void read(const std::string& path, void* destination, size_t size, FileReadCallback on_complete);
+	void submit();
+	// calls the callbacks of the finished reads, returns how many are still pending
+	size_t poll();
+	// submits and blocks until every callback was called
+	void wait();
+
+	// throws when the file can't be opened
+	static uint64_t getFileSize(const std::string& path);
+
+	// io_uring reads are split into chunks of this size
+	static const size_t CHUNK_SIZE = 1 << 20;
+	// io_uring submission queue entries
+	static const uint32_t QUEUE_DEPTH = 64;
+
+private:
+	FileReadBackend backend = FileReadBackend::THREAD_POOL;
+	std::vector<std::unique_ptr<FileReadRequest>> queued; // until submit
+	size_t pending_requests = 0; // submitted, callback not called yet
+
+	// io_uring
+	std::unique_ptr<IoUring> ring;
+	std::deque<FileReadChunk*> unsubmitted_chunks; // waiting for free submission queue entries
+	uint32_t chunks_in_flight = 0;
+	char* registered_memory = nullptr;
+	size_t registered_size = 0;
+
+	// thread pool, finished requests are handed back through done_requests
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_condition;
+	std::condition_variable done_condition;
+	std::deque<FileReadRequest*> work_requests;
+	std::deque<FileReadRequest*> done_requests;
+	bool stopping = false;
+
+	void workerLoop();
+	bool startChunks(FileReadRequest* request);
+	void fillSubmissionQueue();
+	// with wait_for_one blocks until a completion comes in
+	void reapCompletions(bool wait_for_one);
+	void finish(FileReadRequest* request);
+};
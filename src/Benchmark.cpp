@@ -0,0 +1,207 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+double percentile(std::vector<double> values, double fraction)
+{
+	if (values.empty())
+	{
+		return 0.0;
+	}
+	size_t rank = (size_t)std::ceil(fraction * values.size());
+	rank = std::min(std::max<size_t>(rank, 1), values.size());
+	std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+	return values[rank - 1];
+}
+
+TimingSummary summarizeTimings(const std::vector<double>& values_ms)
+{
+	TimingSummary summary;
+	if (values_ms.empty())
+	{
+		return summary;
+	}
+	summary.mean_ms = std::accumulate(values_ms.begin(), values_ms.end(), 0.0) / values_ms.size();
+	summary.p50_ms = percentile(values_ms, 0.50);
+	summary.p90_ms = percentile(values_ms, 0.90);
+	summary.p99_ms = percentile(values_ms, 0.99);
+	summary.max_ms = *std::max_element(values_ms.begin(), values_ms.end());
+	double variance = 0.0;
+	for (double value : values_ms)
+	{
+		variance += (value - summary.mean_ms) * (value - summary.mean_ms);
+	}
+	summary.stddev_ms = std::sqrt(variance / values_ms.size());
+	return summary;
+}
+
+const char* benchmarkFormatName(BenchmarkFormat format)
+{
+	return format == BenchmarkFormat::CSV ? "csv" : "json";
+}
+
+BenchmarkFormat parseBenchmarkFormat(const std::string& name)
+{
+	for (auto format : { BenchmarkFormat::JSON, BenchmarkFormat::CSV })
+	{
+		if (name == benchmarkFormatName(format))
+		{
+			return format;
+		}
+	}
+	throw std::runtime_error("Unknown benchmark output format " + name);
+}
+
+BenchmarkRecorder::BenchmarkRecorder(uint32_t warmup_frames, uint32_t measured_frames)
+	: warmup_frames(warmup_frames)
+	, measured_frames(measured_frames)
+{
+	frames.reserve(measured_frames);
+}
+
+void BenchmarkRecorder::addFrame(const FrameTimings& timings)
+{
+	if (seen_frames++ < warmup_frames || isComplete())
+	{
+		return;
+	}
+	frames.push_back(timings);
+}
+
+TimingSummary BenchmarkRecorder::summarize(uint64_t FrameTimings::* phase) const
+{
+	std::vector<double> values_ms;
+	values_ms.reserve(frames.size());
+	for (const auto& frame : frames)
+	{
+		values_ms.push_back(frame.*phase / 1e6);
+	}
+	return summarizeTimings(values_ms);
+}
+
+// the strings written are device names and option values, quotes and backslashes are all that needs escaping
+static std::string jsonString(const std::string& value)
+{
+	std::string escaped = "\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped + "\"";
+}
+
+static const std::pair<const char*, uint64_t FrameTimings::*> PHASES[] = {
+	{ "total", &FrameTimings::total_ns },
+	{ "update", &FrameTimings::update_ns },
+	{ "record", &FrameTimings::record_ns },
+	{ "submit", &FrameTimings::submit_ns },
+	{ "present_wait", &FrameTimings::present_wait_ns },
+};
+
+void BenchmarkRecorder::writeJson(std::ostream& out, const BenchmarkInfo& info) const
+{
+	out << "{" << std::endl
+		<< "  \"device\": " << jsonString(info.device_name) << "," << std::endl
+		<< "  \"mode\": \"" << (info.headless ? "headless" : "windowed") << "\"," << std::endl
+		<< "  \"width\": " << info.width << "," << std::endl
+		<< "  \"height\": " << info.height << "," << std::endl
+		<< "  \"objects\": " << info.object_count << "," << std::endl
+		<< "  \"timestep_ms\": " << info.timestep_ms << "," << std::endl
+		<< "  \"warmup_frames\": " << info.warmup_frames << "," << std::endl
+		<< "  \"frames\": " << frames.size() << "," << std::endl
+		<< "  \"settings\": {";
+	for (size_t i = 0; i < info.settings.size(); i++)
+	{
+		out << (i == 0 ? "" : ",") << std::endl
+			<< "    " << jsonString(info.settings[i].first) << ": " << jsonString(info.settings[i].second);
+	}
+	out << std::endl << "  }," << std::endl
+		<< "  \"cpu_frame_ms\": {";
+	bool first = true;
+	for (const auto& phase : PHASES)
+	{
+		auto summary = summarize(phase.second);
+		out << (first ? "" : ",") << std::endl
+			<< "    \"" << phase.first << "\": { \"mean\": " << summary.mean_ms
+			<< ", \"p50\": " << summary.p50_ms << ", \"p90\": " << summary.p90_ms
+			<< ", \"p99\": " << summary.p99_ms << ", \"max\": " << summary.max_ms
+			<< ", \"stddev\": " << summary.stddev_ms << " }";
+		first = false;
+	}
+	out << std::endl << "  }";
+	if (!info.gpu_passes.empty())
+	{
+		out << "," << std::endl
+			<< "  \"gpu_pass_ms\": {";
+		for (size_t i = 0; i < info.gpu_passes.size(); i++)
+		{
+			const auto& pass = info.gpu_passes[i];
+			out << (i == 0 ? "" : ",") << std::endl
+				<< "    " << jsonString(pass.name) << ": { \"mean\": " << pass.time.mean_ms
+				<< ", \"p50\": " << pass.time.p50_ms << ", \"p90\": " << pass.time.p90_ms
+				<< ", \"p99\": " << pass.time.p99_ms << ", \"max\": " << pass.time.max_ms
+				<< ", \"stddev\": " << pass.time.stddev_ms;
+			if (pass.has_statistics)
+			{
+				out << ", \"vertex_invocations\": " << pass.vertex_invocations
+					<< ", \"clipping_primitives\": " << pass.clipping_primitives
+					<< ", \"fragment_invocations\": " << pass.fragment_invocations
+					<< ", \"compute_invocations\": " << pass.compute_invocations;
+			}
+			out << " }";
+		}
+		out << std::endl << "  }";
+	}
+	if (!info.startup_ms.empty())
+	{
+		out << "," << std::endl
+			<< "  \"startup_ms\": {";
+		for (size_t i = 0; i < info.startup_ms.size(); i++)
+		{
+			out << (i == 0 ? "" : ",") << std::endl
+				<< "    " << jsonString(info.startup_ms[i].first) << ": " << info.startup_ms[i].second;
+		}
+		out << std::endl << "  }";
+	}
+	out << std::endl << "}" << std::endl;
+}
+
+void BenchmarkRecorder::writeCsv(std::ostream& out) const
+{
+	out << "frame";
+	for (const auto& phase : PHASES)
+	{
+		out << "," << phase.first << "_ms";
+	}
+	out << std::endl;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		out << i;
+		for (const auto& phase : PHASES)
+		{
+			out << "," << frames[i].*phase.second / 1e6;
+		}
+		out << std::endl;
+	}
+}
+
+void BenchmarkRecorder::write(std::ostream& out, BenchmarkFormat format, const BenchmarkInfo& info) const
+{
+	auto precision = out.precision(9);
+	if (format == BenchmarkFormat::CSV)
+	{
+		writeCsv(out);
+	}
+	else
+	{
+		writeJson(out, info);
+	}
+	out.precision(precision);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+// Per frame CPU timings of a benchmark run and their summaries as JSON or CSV,
+// along with GPU pass timings when they were measured.
+
+// nearest rank percentile, fraction in [0, 1], 0 for no values
+double percentile(std::vector<double> values, double fraction);
+
+// where the CPU time of a frame went, in nanoseconds
+struct FrameTimings
+{
+	uint64_t update_ns = 0; // input, uniform buffer and culling data
+	uint64_t record_ns = 0; // command buffers recorded for this frame
+	uint64_t submit_ns = 0; // vkQueueSubmit calls
+	uint64_t present_wait_ns = 0; // acquiring and presenting, blocked on the display
+	uint64_t total_ns = 0;
+};
+
+struct TimingSummary
+{
+	double mean_ms = 0.0;
+	double p50_ms = 0.0;
+	double p90_ms = 0.0;
+	double p99_ms = 0.0;
+	double max_ms = 0.0;
+	double stddev_ms = 0.0;
+};
+
+TimingSummary summarizeTimings(const std::vector<double>& values_ms);
+
+// GPU time and pipeline statistics of one pass over the measured frames
+struct GpuPassSummary
+{
+	std::string name;
+	TimingSummary time;
+	bool has_statistics = false;
+	// means per frame
+	double vertex_invocations = 0.0;
+	double clipping_primitives = 0.0; // primitives leaving clipping, i.e. rasterized
+	double fragment_invocations = 0.0;
+	double compute_invocations = 0.0;
+};
+
+enum class BenchmarkFormat
+{
+	JSON, // run description and summaries
+	CSV, // a row per measured frame
+};
+
+const char* benchmarkFormatName(BenchmarkFormat format);
+// from the name returned by benchmarkFormatName, throws on unknown names
+BenchmarkFormat parseBenchmarkFormat(const std::string& name);
+
+// what was measured, written along with the results
+struct BenchmarkInfo
+{
+	std::string device_name;
+	bool headless = false;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t object_count = 0;
+	double timestep_ms = 0.0;
+	uint32_t warmup_frames = 0;
+	std::vector<std::pair<std::string, std::string>> settings; // extra key/value pairs, e.g. culling mode
+	std::vector<GpuPassSummary> gpu_passes; // when profiled, written as gpu_pass_ms to JSON only
+	std::vector<std::pair<std::string, double>> startup_ms; // milestones since launch, JSON only
+};
+
+class BenchmarkRecorder
+{
+public:
+	BenchmarkRecorder(uint32_t warmup_frames, uint32_t measured_frames);
+
+	// the first warmup_frames calls are not recorded
+	void addFrame(const FrameTimings& timings);
+	bool isComplete() const { return frames.size() >= measured_frames; }
+	size_t getMeasuredFrameCount() const { return frames.size(); }
+
+	TimingSummary summarize(uint64_t FrameTimings::* phase) const;
+
+	void writeJson(std::ostream& out, const BenchmarkInfo& info) const;
+	void writeCsv(std::ostream& out) const;
+	void write(std::ostream& out, BenchmarkFormat format, const BenchmarkInfo& info) const;
+
+private:
+	uint32_t warmup_frames;
+	uint32_t measured_frames;
+	uint32_t seen_frames = 0;
+	std::vector<FrameTimings> frames;
+};
@@ -0,0 +1,911 @@
+#include "Bvh.h"
+#include "JobSystem.h"
+#include "TraceProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+	const float INFINITE_DISTANCE = std::numeric_limits<float>::infinity();
+	// of visiting a node, in object tests
+	const float TRAVERSAL_COST = 2.0f;
+	// deeper nodes are split at their median, which bounds the depth of degenerate inputs
+	const uint32_t MAX_SAH_DEPTH = 48;
+	// deeper than any tree: MAX_SAH_DEPTH levels, then at most 32 halvings of a 32 bit count
+	const size_t STACK_SIZE = 128;
+
+	const uint32_t ALL_PLANES = (1u << Frustum::PLANE_COUNT) - 1;
+	const uint32_t OUTSIDE = ~0u;
+
+	BvhBox emptyBox()
+	{
+		return { glm::vec3(INFINITE_DISTANCE), glm::vec3(-INFINITE_DISTANCE) };
+	}
+
+	void growBox(BvhBox& box, const BvhBox& other)
+	{
+		box.box_min = glm::min(box.box_min, other.box_min);
+		box.box_max = glm::max(box.box_max, other.box_max);
+	}
+
+	void growBox(BvhBox& box, const glm::vec3& point)
+	{
+		box.box_min = glm::min(box.box_min, point);
+		box.box_max = glm::max(box.box_max, point);
+	}
+
+	float surfaceArea(const BvhBox& box)
+	{
+		glm::vec3 extent = box.box_max - box.box_min;
+		if (extent.x < 0.0f)
+		{
+			return 0.0f; // empty
+		}
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+	glm::vec3 centroid(const BvhBox& box)
+	{
+		return (box.box_min + box.box_max) * 0.5f;
+	}
+
+	BvhBox objectBox(const SphereBoundsSoA& bounds, size_t i)
+	{
+		glm::vec3 center = { bounds.center_x[i], bounds.center_y[i], bounds.center_z[i] };
+		glm::vec3 radius(bounds.radius[i]);
+		return { center - radius, center + radius };
+	}
+
+	BvhBox objectBox(const BoxBoundsSoA& bounds, size_t i)
+	{
+		return { { bounds.min_x[i], bounds.min_y[i], bounds.min_z[i] }, { bounds.max_x[i], bounds.max_y[i], bounds.max_z[i] } };
+	}
+
+	// body(begin, end) on batches of [begin, end), in parallel when there are enough items and threads
+	template <typename Body>
+	void forRange(JobSystem* jobs, const char* name, size_t begin, size_t end, const Body& body)
+	{
+		if (jobs && end - begin >= Bvh::PARALLEL_THRESHOLD && jobs->getThreadCount() > 1)
+		{
+			jobs->parallelFor(name, begin, end, Bvh::PARALLEL_THRESHOLD / 4, body);
+		}
+		else
+		{
+			body(begin, end);
+		}
+	}
+
+	// Frustum planes the box is not entirely inside of, of the ones in planes, or OUTSIDE.
+	// Planes a parent is inside of, its children are inside of as well.
+	uint32_t classifyBox(const Frustum& frustum, const glm::vec3& box_min, const glm::vec3& box_max, uint32_t planes)
+	{
+		uint32_t remaining = planes;
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			if ((planes & (1u << p)) == 0)
+			{
+				continue;
+			}
+			const glm::vec4& plane = frustum.planes[p];
+			// the box corners furthest along and against the plane normal
+			glm::vec3 positive_vertex = {
+				plane.x >= 0.0f ? box_max.x : box_min.x,
+				plane.y >= 0.0f ? box_max.y : box_min.y,
+				plane.z >= 0.0f ? box_max.z : box_min.z
+			};
+			glm::vec3 negative_vertex = {
+				plane.x >= 0.0f ? box_min.x : box_max.x,
+				plane.y >= 0.0f ? box_min.y : box_max.y,
+				plane.z >= 0.0f ? box_min.z : box_max.z
+			};
+			if (glm::dot(glm::vec3(plane), positive_vertex) + plane.w < 0.0f)
+			{
+				return OUTSIDE;
+			}
+			if (glm::dot(glm::vec3(plane), negative_vertex) + plane.w >= 0.0f)
+			{
+				remaining &= ~(1u << p);
+			}
+		}
+		return remaining;
+	}
+
+	// where the ray enters the box, INFINITE_DISTANCE when it misses it or enters after max_distance
+	float intersectBox(const glm::vec3& origin, const glm::vec3& inverse_direction
+		, const glm::vec3& box_min, const glm::vec3& box_max, float max_distance)
+	{
+		glm::vec3 t0 = (box_min - origin) * inverse_direction;
+		glm::vec3 t1 = (box_max - origin) * inverse_direction;
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+		float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+		float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+		return enter <= exit ? enter : INFINITE_DISTANCE;
+	}
+
+	struct Bin
+	{
+		BvhBox box;
+		uint32_t count;
+	};
+
+	// nodes of few objects use fewer bins than BIN_COUNT, there are no more split candidates anyway
+	struct Bins
+	{
+		Bin bins[3][Bvh::BIN_COUNT];
+		uint32_t count;
+
+		void clear(uint32_t bin_count)
+		{
+			count = bin_count;
+			for (auto& axis_bins : bins)
+			{
+				for (uint32_t b = 0; b < count; b++)
+				{
+					axis_bins[b] = { emptyBox(), 0 };
+				}
+			}
+		}
+
+		void add(const Bins& other)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (uint32_t b = 0; b < count; b++)
+				{
+					growBox(bins[axis][b].box, other.bins[axis][b].box);
+					bins[axis][b].count += other.bins[axis][b].count;
+				}
+			}
+		}
+	};
+
+	// binning and partitioning have to agree on every object's bin
+	inline uint32_t binIndex(float value, float axis_min, float axis_scale, uint32_t bin_count)
+	{
+		uint32_t bin = (uint32_t)((value - axis_min) * axis_scale);
+		return bin < bin_count ? bin : bin_count - 1;
+	}
+
+	// partitioned together with its object, so that nodes read the boxes of their range in order
+	struct BuildObject
+	{
+		BvhBox box;
+		uint32_t object;
+	};
+
+	// the root is nodes[0], the two children of an inner node are next to each other
+	struct BuildNode
+	{
+		BvhBox box;
+		uint32_t begin; // of the build objects
+		uint32_t end;
+		uint32_t child; // the left one, 0 for leaves
+		uint32_t node_count; // of the subtree, itself included
+	};
+
+	class BvhBuilder
+	{
+	public:
+		// reorders objects so that the objects of every node are a range of them
+		BvhBuilder(JobSystem* jobs, BuildObject* objects, uint32_t object_count)
+			: jobs(jobs)
+			, objects(objects)
+			// a binary tree with a leaf per object at worst, pages of nodes that aren't used are never touched
+			, nodes(new BuildNode[2 * (size_t)object_count - 1])
+		{
+		}
+
+		void build(const BvhBox& root_box, const BvhBox& root_centroids, uint32_t object_count)
+		{
+			nodes[0].box = root_box;
+			nodes[0].begin = 0;
+			nodes[0].end = object_count;
+			buildNode(0, root_centroids, 1);
+		}
+
+		const BuildNode* getNodes() const { return nodes.get(); }
+		uint32_t getDepth() const { return depth.load(); }
+
+	private:
+		JobSystem* jobs;
+		BuildObject* objects;
+		std::unique_ptr<BuildNode[]> nodes;
+		std::atomic<uint32_t> next_node{ 1 };
+		std::atomic<uint32_t> depth{ 0 };
+
+		bool isParallel(uint32_t count) const
+		{
+			return jobs && count >= Bvh::PARALLEL_THRESHOLD && jobs->getThreadCount() > 1;
+		}
+
+		void binObjects(uint32_t begin, uint32_t end, const BvhBox& centroid_bounds, uint32_t bin_count, Bins& bins) const
+		{
+			glm::vec3 extent = centroid_bounds.box_max - centroid_bounds.box_min;
+			glm::vec3 scale;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				scale[axis] = extent[axis] > 0.0f ? bin_count / extent[axis] : 0.0f;
+			}
+			auto bin_range = [&](size_t range_begin, size_t range_end, Bins& range_bins)
+			{
+				for (size_t i = range_begin; i < range_end; i++)
+				{
+					const BvhBox& box = objects[i].box;
+					glm::vec3 center = centroid(box);
+					for (int axis = 0; axis < 3; axis++)
+					{
+						Bin& bin = range_bins.bins[axis][binIndex(center[axis], centroid_bounds.box_min[axis], scale[axis], bin_count)];
+						growBox(bin.box, box);
+						bin.count++;
+					}
+				}
+			};
+
+			bins.clear(bin_count);
+			if (!isParallel(end - begin))
+			{
+				bin_range(begin, end, bins);
+				return;
+			}
+			std::mutex bins_mutex;
+			jobs->parallelFor("Bvh::build binning", begin, end, Bvh::PARALLEL_THRESHOLD / 4, [&](size_t range_begin, size_t range_end)
+			{
+				Bins range_bins;
+				range_bins.clear(bin_count);
+				bin_range(range_begin, range_end, range_bins);
+				std::lock_guard<std::mutex> lock(bins_mutex);
+				bins.add(range_bins);
+			});
+		}
+
+		// the bounds of the objects in [begin, end) and of their centroids
+		void boundObjects(uint32_t begin, uint32_t end, BvhBox& box, BvhBox& centroids) const
+		{
+			box = emptyBox();
+			centroids = emptyBox();
+			std::mutex bounds_mutex;
+			forRange(jobs, "Bvh::build bounds", begin, end, [&](size_t range_begin, size_t range_end)
+			{
+				BvhBox range_box = emptyBox();
+				BvhBox range_centroids = emptyBox();
+				for (size_t i = range_begin; i < range_end; i++)
+				{
+					growBox(range_box, objects[i].box);
+					growBox(range_centroids, centroid(objects[i].box));
+				}
+				std::lock_guard<std::mutex> lock(bounds_mutex);
+				growBox(box, range_box);
+				growBox(centroids, range_centroids);
+			});
+		}
+
+		void buildNode(uint32_t node_index, const BvhBox& centroid_bounds, uint32_t node_depth)
+		{
+			BuildNode& node = nodes[node_index];
+			uint32_t count = node.end - node.begin;
+			node.child = 0;
+			node.node_count = 1;
+			uint32_t deepest = depth.load(std::memory_order_relaxed);
+			while (node_depth > deepest && !depth.compare_exchange_weak(deepest, node_depth))
+			{
+			}
+			if (count <= 1)
+			{
+				return;
+			}
+
+			// the cheapest of the splits between bins on every axis, costs relative to the node's area
+			int split_axis = -1;
+			uint32_t split_bin = 0;
+			float split_cost = INFINITE_DISTANCE;
+			Bins bins;
+			glm::vec3 centroid_extent = centroid_bounds.box_max - centroid_bounds.box_min;
+			uint32_t bin_count = std::min(count, (uint32_t)Bvh::BIN_COUNT);
+			if (node_depth < MAX_SAH_DEPTH)
+			{
+				binObjects(node.begin, node.end, centroid_bounds, bin_count, bins);
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (centroid_extent[axis] <= 0.0f)
+					{
+						continue;
+					}
+					const Bin* axis_bins = bins.bins[axis];
+					float right_costs[Bvh::BIN_COUNT];
+					BvhBox right_box = emptyBox();
+					uint32_t right_count = 0;
+					for (uint32_t b = bin_count - 1; b > 0; b--)
+					{
+						growBox(right_box, axis_bins[b].box);
+						right_count += axis_bins[b].count;
+						right_costs[b] = surfaceArea(right_box) * right_count;
+					}
+					BvhBox left_box = emptyBox();
+					uint32_t left_count = 0;
+					for (uint32_t b = 0; b + 1 < bin_count; b++)
+					{
+						growBox(left_box, axis_bins[b].box);
+						left_count += axis_bins[b].count;
+						float cost = surfaceArea(left_box) * left_count + right_costs[b + 1];
+						if (left_count > 0 && left_count < count && cost < split_cost)
+						{
+							split_axis = axis;
+							split_bin = b + 1;
+							split_cost = cost;
+						}
+					}
+				}
+			}
+
+			float node_area = surfaceArea(node.box);
+			bool split_pays = split_axis >= 0 && (node_area <= 0.0f || TRAVERSAL_COST + split_cost / node_area < (float)count);
+			if (count <= Bvh::MAX_LEAF_SIZE && !split_pays)
+			{
+				return;
+			}
+
+			uint32_t child = next_node.fetch_add(2, std::memory_order_relaxed);
+			uint32_t middle;
+			if (split_axis >= 0)
+			{
+				float axis_min = centroid_bounds.box_min[split_axis];
+				float axis_scale = bin_count / centroid_extent[split_axis];
+				int axis = split_axis;
+				BuildObject* middle_object = std::partition(objects + node.begin, objects + node.end, [&](const BuildObject& object)
+				{
+					return binIndex(centroid(object.box)[axis], axis_min, axis_scale, bin_count) < split_bin;
+				});
+				middle = (uint32_t)(middle_object - objects);
+			}
+			else
+			{
+				// too deep, or every centroid is in the same place: halve along the longest axis
+				int axis = 0;
+				if (centroid_extent.y > centroid_extent[axis]) axis = 1;
+				if (centroid_extent.z > centroid_extent[axis]) axis = 2;
+				middle = node.begin + count / 2;
+				std::nth_element(objects + node.begin, objects + middle, objects + node.end, [&](const BuildObject& a, const BuildObject& b)
+				{
+					return centroid(a.box)[axis] < centroid(b.box)[axis];
+				});
+			}
+
+			BuildNode& left = nodes[child];
+			BuildNode& right = nodes[child + 1];
+			BvhBox left_centroids;
+			BvhBox right_centroids;
+			boundObjects(node.begin, middle, left.box, left_centroids);
+			boundObjects(middle, node.end, right.box, right_centroids);
+			left.begin = node.begin;
+			left.end = middle;
+			right.begin = middle;
+			right.end = node.end;
+			node.child = child;
+
+			if (isParallel(count))
+			{
+				JobCounter left_built;
+				jobs->run("Bvh::build subtree", [this, child, left_centroids, node_depth]()
+				{
+					buildNode(child, left_centroids, node_depth + 1);
+				}, &left_built);
+				buildNode(child + 1, right_centroids, node_depth + 1);
+				jobs->wait(left_built);
+			}
+			else
+			{
+				buildNode(child, left_centroids, node_depth + 1);
+				buildNode(child + 1, right_centroids, node_depth + 1);
+			}
+			node.node_count = 1 + left.node_count + right.node_count;
+		}
+	};
+
+	// where flattening writes to, every array is already sized
+	struct FlatTree
+	{
+		Bvh::Node* nodes;
+		uint32_t* parents;
+		BvhRange* subtree_ranges;
+		uint32_t* object_leaves;
+		const uint32_t* objects;
+	};
+
+	// Depth first: the left child right after its parent, the right one after the left subtree.
+	// Subtrees are disjoint parts of the arrays, large ones are written by jobs.
+	void flattenNode(JobSystem* jobs, const BuildNode* build_nodes, uint32_t build_index, uint32_t index, uint32_t parent
+		, const FlatTree& tree)
+	{
+		const BuildNode& build_node = build_nodes[build_index];
+		Bvh::Node& node = tree.nodes[index];
+		node.box_min = build_node.box.box_min;
+		node.box_max = build_node.box.box_max;
+		tree.parents[index] = parent;
+		tree.subtree_ranges[index] = { build_node.begin, build_node.end };
+		if (build_node.child == 0)
+		{
+			node.offset = build_node.begin;
+			node.count = build_node.end - build_node.begin;
+			for (uint32_t slot = build_node.begin; slot < build_node.end; slot++)
+			{
+				tree.object_leaves[tree.objects[slot]] = index;
+			}
+			return;
+		}
+
+		uint32_t left = index + 1;
+		uint32_t right = left + build_nodes[build_node.child].node_count;
+		node.offset = right;
+		node.count = 0;
+		if (jobs && build_node.end - build_node.begin >= Bvh::PARALLEL_THRESHOLD && jobs->getThreadCount() > 1)
+		{
+			JobCounter left_written;
+			uint32_t left_build_index = build_node.child;
+			jobs->run("Bvh::build flatten", [jobs, build_nodes, left_build_index, left, index, &tree]()
+			{
+				flattenNode(jobs, build_nodes, left_build_index, left, index, tree);
+			}, &left_written);
+			flattenNode(jobs, build_nodes, build_node.child + 1, right, index, tree);
+			jobs->wait(left_written);
+		}
+		else
+		{
+			flattenNode(jobs, build_nodes, build_node.child, left, index, tree);
+			flattenNode(jobs, build_nodes, build_node.child + 1, right, index, tree);
+		}
+	}
+}
+
+Bvh::Bvh(JobSystem* jobs)
+	: jobs(jobs)
+{
+}
+
+unsigned Bvh::getThreadCount() const
+{
+	return jobs ? jobs->getThreadCount() : 1;
+}
+
+void Bvh::build(const SphereBoundsSoA& bounds)
+{
+	buildFrom(bounds);
+}
+
+void Bvh::build(const BoxBoundsSoA& bounds)
+{
+	buildFrom(bounds);
+}
+
+void Bvh::refit(const SphereBoundsSoA& bounds)
+{
+	refitFrom(bounds);
+}
+
+void Bvh::refit(const BoxBoundsSoA& bounds)
+{
+	refitFrom(bounds);
+}
+
+void Bvh::refit(const SphereBoundsSoA& bounds, const std::vector<uint32_t>& changed_objects)
+{
+	refitFrom(bounds, changed_objects);
+}
+
+void Bvh::refit(const BoxBoundsSoA& bounds, const std::vector<uint32_t>& changed_objects)
+{
+	refitFrom(bounds, changed_objects);
+}
+
+template <typename Bounds>
+void Bvh::buildFrom(const Bounds& bounds)
+{
+	TRACE_SCOPE("Bvh::build");
+	uint32_t object_count = (uint32_t)bounds.size();
+	objects.resize(object_count);
+	slot_boxes.resize(object_count);
+	object_leaves.resize(object_count);
+	refit_flags.clear();
+	if (object_count == 0)
+	{
+		nodes.clear();
+		parents.clear();
+		subtree_ranges.clear();
+		depth = 0;
+		return;
+	}
+
+	// the root's bounds along the way
+	std::vector<BuildObject> build_objects(object_count);
+	BvhBox root_box = emptyBox();
+	BvhBox root_centroids = emptyBox();
+	std::mutex root_mutex;
+	forRange(jobs, "Bvh::build boxes", 0, object_count, [&](size_t begin, size_t end)
+	{
+		BvhBox range_box = emptyBox();
+		BvhBox range_centroids = emptyBox();
+		for (size_t i = begin; i < end; i++)
+		{
+			BvhBox box = objectBox(bounds, i);
+			build_objects[i] = { box, (uint32_t)i };
+			growBox(range_box, box);
+			growBox(range_centroids, centroid(box));
+		}
+		std::lock_guard<std::mutex> lock(root_mutex);
+		growBox(root_box, range_box);
+		growBox(root_centroids, range_centroids);
+	});
+
+	BvhBuilder builder(jobs, build_objects.data(), object_count);
+	builder.build(root_box, root_centroids, object_count);
+	depth = builder.getDepth();
+	forRange(jobs, "Bvh::build slots", 0, object_count, [&](size_t begin, size_t end)
+	{
+		for (size_t slot = begin; slot < end; slot++)
+		{
+			objects[slot] = build_objects[slot].object;
+			slot_boxes[slot] = build_objects[slot].box;
+		}
+	});
+
+	{
+		TRACE_SCOPE("Bvh::build flatten");
+		uint32_t node_count = builder.getNodes()[0].node_count;
+		nodes.resize(node_count);
+		parents.resize(node_count);
+		subtree_ranges.resize(node_count);
+		FlatTree tree = { nodes.data(), parents.data(), subtree_ranges.data(), object_leaves.data(), objects.data() };
+		flattenNode(jobs, builder.getNodes(), 0, 0, 0, tree);
+	}
+}
+
+template <typename Bounds>
+void Bvh::refitFrom(const Bounds& bounds)
+{
+	TRACE_SCOPE("Bvh::refit");
+	forRange(jobs, "Bvh::refit slot boxes", 0, objects.size(), [&](size_t begin, size_t end)
+	{
+		for (size_t slot = begin; slot < end; slot++)
+		{
+			slot_boxes[slot] = objectBox(bounds, objects[slot]);
+		}
+	});
+	if (nodes.empty())
+	{
+		return;
+	}
+	if (getThreadCount() > 1)
+	{
+		refitSubtree(0);
+		return;
+	}
+	// children come after their parents
+	for (size_t node = nodes.size(); node-- > 0;)
+	{
+		refitNode((uint32_t)node);
+	}
+}
+
+template <typename Bounds>
+void Bvh::refitFrom(const Bounds& bounds, const std::vector<uint32_t>& changed_objects)
+{
+	// past an eighth of the objects most of the tree changes anyway
+	if (changed_objects.size() * 8 > objects.size())
+	{
+		refitFrom(bounds);
+		return;
+	}
+
+	TRACE_SCOPE("Bvh::refit changed");
+	refit_flags.resize(nodes.size());
+	refit_nodes.clear();
+	for (uint32_t object : changed_objects)
+	{
+		uint32_t leaf = object_leaves[object];
+		const Node& leaf_node = nodes[leaf];
+		for (uint32_t slot = leaf_node.offset; slot < leaf_node.offset + leaf_node.count; slot++)
+		{
+			if (objects[slot] == object)
+			{
+				slot_boxes[slot] = objectBox(bounds, object);
+				break;
+			}
+		}
+		// up to the root, or to a node another object already flagged; the root is its own parent
+		for (uint32_t node = leaf; !refit_flags[node]; node = parents[node])
+		{
+			refit_flags[node] = 1;
+			refit_nodes.push_back(node);
+		}
+	}
+
+	// Children before their parents. Sorting a few nodes is cheaper than going over the flags of
+	// all of them, going over the flags is cheaper than sorting many.
+	if (refit_nodes.size() * 32 < nodes.size())
+	{
+		std::sort(refit_nodes.begin(), refit_nodes.end(), std::greater<uint32_t>());
+		for (uint32_t node : refit_nodes)
+		{
+			refitNode(node);
+			refit_flags[node] = 0;
+		}
+		return;
+	}
+	for (size_t node = nodes.size(); node-- > 0;)
+	{
+		if (refit_flags[node])
+		{
+			refitNode((uint32_t)node);
+			refit_flags[node] = 0;
+		}
+	}
+}
+
+void Bvh::refitNode(uint32_t node_index)
+{
+	Node& node = nodes[node_index];
+	BvhBox box = emptyBox();
+	if (node.count > 0)
+	{
+		for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++)
+		{
+			growBox(box, slot_boxes[slot]);
+		}
+	}
+	else
+	{
+		const Node& left = nodes[node_index + 1];
+		const Node& right = nodes[node.offset];
+		box.box_min = glm::min(left.box_min, right.box_min);
+		box.box_max = glm::max(left.box_max, right.box_max);
+	}
+	node.box_min = box.box_min;
+	node.box_max = box.box_max;
+}
+
+void Bvh::refitSubtree(uint32_t node_index)
+{
+	const Node& node = nodes[node_index];
+	if (node.count == 0)
+	{
+		const BvhRange& range = subtree_ranges[node_index];
+		if (range.end - range.begin >= PARALLEL_THRESHOLD)
+		{
+			JobCounter left_refit;
+			uint32_t left = node_index + 1;
+			jobs->run("Bvh::refit subtree", [this, left]() { refitSubtree(left); }, &left_refit);
+			refitSubtree(node.offset);
+			jobs->wait(left_refit);
+		}
+		else
+		{
+			refitSubtree(node_index + 1);
+			refitSubtree(node.offset);
+		}
+	}
+	refitNode(node_index);
+}
+
+template <typename Emit>
+void Bvh::traverseFrustum(const Frustum& frustum, Emit&& emit) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// right children waiting for their left sibling's subtree, with the planes their parent intersects
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t planes;
+	};
+	Entry stack[STACK_SIZE];
+	size_t stack_size = 0;
+	uint32_t node_index = 0;
+	uint32_t planes = ALL_PLANES;
+	for (;;)
+	{
+		const Node& node = nodes[node_index];
+		uint32_t remaining = classifyBox(frustum, node.box_min, node.box_max, planes);
+		if (remaining == 0)
+		{
+			emit(subtree_ranges[node_index].begin, subtree_ranges[node_index].end);
+		}
+		else if (remaining != OUTSIDE && node.count > 0)
+		{
+			for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++)
+			{
+				const BvhBox& box = slot_boxes[slot];
+				if (classifyBox(frustum, box.box_min, box.box_max, remaining) != OUTSIDE)
+				{
+					emit(slot, slot + 1);
+				}
+			}
+		}
+		else if (remaining != OUTSIDE)
+		{
+			stack[stack_size++] = { node.offset, remaining };
+			node_index++;
+			planes = remaining;
+			continue;
+		}
+
+		if (stack_size == 0)
+		{
+			break;
+		}
+		stack_size--;
+		node_index = stack[stack_size].node;
+		planes = stack[stack_size].planes;
+	}
+}
+
+void Bvh::cullRanges(const Frustum& frustum, std::vector<BvhRange>& ranges) const
+{
+	TRACE_SCOPE("Bvh::cullRanges");
+	ranges.clear();
+	traverseFrustum(frustum, [&ranges](uint32_t begin, uint32_t end)
+	{
+		if (!ranges.empty() && ranges.back().end == begin)
+		{
+			ranges.back().end = end;
+		}
+		else
+		{
+			ranges.push_back({ begin, end });
+		}
+	});
+}
+
+void Bvh::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+	TRACE_SCOPE("Bvh::cull");
+	visible.clear();
+	const uint32_t* slot_objects = objects.data();
+	traverseFrustum(frustum, [&visible, slot_objects](uint32_t begin, uint32_t end)
+	{
+		visible.insert(visible.end(), slot_objects + begin, slot_objects + end);
+	});
+}
+
+template <typename Test>
+bool Bvh::traverseRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance
+	, Test&& test, BvhRayHit& hit) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	// children are visited nearest first, and skipped once a closer hit is known
+	glm::vec3 inverse_direction = 1.0f / direction;
+	float nearest = max_distance;
+	uint32_t nearest_slot = ~0u;
+	struct Entry
+	{
+		uint32_t node;
+		float distance;
+	};
+	Entry stack[STACK_SIZE];
+	size_t stack_size = 0;
+	float root_distance = intersectBox(origin, inverse_direction, nodes[0].box_min, nodes[0].box_max, nearest);
+	if (root_distance != INFINITE_DISTANCE)
+	{
+		stack[stack_size++] = { 0, root_distance };
+	}
+	while (stack_size > 0)
+	{
+		Entry entry = stack[--stack_size];
+		if (entry.distance > nearest)
+		{
+			continue;
+		}
+		const Node& node = nodes[entry.node];
+		if (node.count > 0)
+		{
+			for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++)
+			{
+				float distance = test(slot, nearest);
+				if (distance != INFINITE_DISTANCE && distance <= nearest)
+				{
+					nearest = distance;
+					nearest_slot = slot;
+				}
+			}
+			continue;
+		}
+
+		Entry near_child = { entry.node + 1, 0.0f };
+		Entry far_child = { node.offset, 0.0f };
+		near_child.distance = intersectBox(origin, inverse_direction
+			, nodes[near_child.node].box_min, nodes[near_child.node].box_max, nearest);
+		far_child.distance = intersectBox(origin, inverse_direction
+			, nodes[far_child.node].box_min, nodes[far_child.node].box_max, nearest);
+		if (far_child.distance < near_child.distance)
+		{
+			std::swap(near_child, far_child);
+		}
+		if (far_child.distance != INFINITE_DISTANCE)
+		{
+			stack[stack_size++] = far_child;
+		}
+		if (near_child.distance != INFINITE_DISTANCE)
+		{
+			stack[stack_size++] = near_child;
+		}
+	}
+
+	if (nearest_slot == ~0u)
+	{
+		return false;
+	}
+	hit.object = objects[nearest_slot];
+	hit.distance = nearest;
+	return true;
+}
+
+bool Bvh::intersectRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, BvhRayHit& hit) const
+{
+	glm::vec3 inverse_direction = 1.0f / direction;
+	const BvhBox* boxes = slot_boxes.data();
+	return traverseRay(origin, direction, max_distance, [&](uint32_t slot, float nearest)
+	{
+		return intersectBox(origin, inverse_direction, boxes[slot].box_min, boxes[slot].box_max, nearest);
+	}, hit);
+}
+
+bool Bvh::intersectRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance
+	, const SphereBoundsSoA& spheres, BvhRayHit& hit) const
+{
+	float a = glm::dot(direction, direction);
+	const uint32_t* slot_objects = objects.data();
+	return traverseRay(origin, direction, max_distance, [&](uint32_t slot, float nearest)
+	{
+		uint32_t object = slot_objects[slot];
+		glm::vec3 center = { spheres.center_x[object], spheres.center_y[object], spheres.center_z[object] };
+		float radius = spheres.radius[object];
+		// |origin + t * direction - center| = radius, the smaller root unless the origin is inside
+		glm::vec3 offset = origin - center;
+		float b = glm::dot(offset, direction);
+		float c = glm::dot(offset, offset) - radius * radius;
+		if (c <= 0.0f)
+		{
+			return 0.0f;
+		}
+		float discriminant = b * b - a * c;
+		if (b > 0.0f || discriminant < 0.0f)
+		{
+			return INFINITE_DISTANCE; // behind the origin or missed
+		}
+		float distance = (-b - std::sqrt(discriminant)) / a;
+		return distance <= nearest ? distance : INFINITE_DISTANCE;
+	}, hit);
+}
+
+float Bvh::getSahCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+	// the chance of a random ray hitting a node is its area relative to the root's
+	float root_area = surfaceArea({ nodes[0].box_min, nodes[0].box_max });
+	if (root_area <= 0.0f)
+	{
+		return (float)size();
+	}
+	double cost = 0.0;
+	for (const Node& node : nodes)
+	{
+		float area = surfaceArea({ node.box_min, node.box_max });
+		cost += area / root_area * (node.count > 0 ? (double)node.count : TRAVERSAL_COST);
+	}
+	return (float)cost;
+}
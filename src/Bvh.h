@@ -0,0 +1,130 @@
+#pragma once
+
+#include "CpuCulling.h"
+#include "Frustum.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class JobSystem;
+
+// Bounding volume hierarchy over the bounds of the scene objects, so that frustum culling and
+// picking touch the objects near the frustum or the ray rather than all of them.
+// Built top down with binned SAH splits (Wald, "On fast Construction of SAH-based Bounding
+// Volume Hierarchies", 2007), the subtrees of large nodes by jobs, then flattened depth first:
+// a left child follows its parent and the objects of every subtree are one range of getObjects().
+// Moving objects refit the boxes in place. The splits stay the ones of the last build, so the
+// tree gets slower the more the objects are shuffled around, build it again then.
+
+// [begin, end) of Bvh::getObjects()
+struct BvhRange
+{
+	uint32_t begin;
+	uint32_t end;
+};
+
+struct BvhBox
+{
+	glm::vec3 box_min;
+	glm::vec3 box_max;
+};
+
+struct BvhRayHit
+{
+	uint32_t object;
+	float distance; // in lengths of the ray direction
+};
+
+class Bvh
+{
+public:
+	// two per cache line
+	struct Node
+	{
+		glm::vec3 box_min;
+		uint32_t offset; // leaves: first slot of getObjects(), inner nodes: index of the right child
+		glm::vec3 box_max;
+		uint32_t count; // leaves: objects in it, inner nodes: 0
+	};
+
+	// without jobs everything runs on the calling thread
+	explicit Bvh(JobSystem* jobs = nullptr);
+
+	// object i has the bounds at index i, refits take them in the same order
+	void build(const SphereBoundsSoA& bounds);
+	void build(const BoxBoundsSoA& bounds);
+	// every object may have moved
+	void refit(const SphereBoundsSoA& bounds);
+	void refit(const BoxBoundsSoA& bounds);
+	// only changed_objects moved, refits the whole tree when they are many
+	void refit(const SphereBoundsSoA& bounds, const std::vector<uint32_t>& changed_objects);
+	void refit(const BoxBoundsSoA& bounds, const std::vector<uint32_t>& changed_objects);
+
+	// Replaces the content of ranges with the ranges of getObjects() whose boxes intersect the
+	// frustum, ascending and with adjacent ones merged. Subtrees inside the frustum are one range.
+	void cullRanges(const Frustum& frustum, std::vector<BvhRange>& ranges) const;
+	// Replaces the content of visible with the indices of the objects whose boxes intersect
+	// the frustum, in the order of getObjects()
+	void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+	// Nearest object whose box the ray enters before max_distance, false when there is none.
+	// The direction doesn't have to be normalized, distances are in its lengths.
+	bool intersectRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, BvhRayHit& hit) const;
+	// the same against the spheres the tree was built or last refit from
+	bool intersectRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance
+		, const SphereBoundsSoA& spheres, BvhRayHit& hit) const;
+
+	const std::vector<Node>& getNodes() const { return nodes; }
+	// object index of every slot, leaves and subtrees are ranges of it
+	const std::vector<uint32_t>& getObjects() const { return objects; }
+	size_t size() const { return objects.size(); }
+	// levels of nodes, 1 for a single leaf
+	uint32_t getDepth() const { return depth; }
+	// expected cost of a random ray against the tree in object tests, to compare builds
+	float getSahCost() const;
+	unsigned getThreadCount() const;
+
+	// a node of more objects is always split
+	static const uint32_t MAX_LEAF_SIZE = 8;
+	// split candidates per axis
+	static const uint32_t BIN_COUNT = 16;
+	// nodes of fewer objects are binned and their subtrees built on the calling thread
+	static const size_t PARALLEL_THRESHOLD = 1 << 14;
+
+private:
+	JobSystem* jobs;
+
+	std::vector<Node> nodes; // depth first, the root first
+	std::vector<uint32_t> objects;
+	std::vector<BvhBox> slot_boxes; // of the objects in the order of getObjects(), what leaves test
+	uint32_t depth = 0;
+
+	// only read by refits and by nodes inside the frustum
+	std::vector<uint32_t> parents; // of every node, the root's is its own index
+	std::vector<BvhRange> subtree_ranges; // slots of every node's subtree
+	std::vector<uint32_t> object_leaves; // leaf node of every object
+	std::vector<uint8_t> refit_flags; // scratch of partial refits, by node
+	std::vector<uint32_t> refit_nodes;
+
+	template <typename Bounds>
+	void buildFrom(const Bounds& bounds);
+	template <typename Bounds>
+	void refitFrom(const Bounds& bounds);
+	template <typename Bounds>
+	void refitFrom(const Bounds& bounds, const std::vector<uint32_t>& changed_objects);
+
+	// the node's box from its objects or children, whose boxes are up to date
+	void refitNode(uint32_t node);
+	void refitSubtree(uint32_t node);
+
+	// calls emit(begin, end) for the slots intersecting the frustum, in ascending order
+	template <typename Emit>
+	void traverseFrustum(const Frustum& frustum, Emit&& emit) const;
+	// test(slot, max_distance) gives the distance the ray hits the object at, or a larger one
+	template <typename Test>
+	bool traverseRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance
+		, Test&& test, BvhRayHit& hit) const;
+};
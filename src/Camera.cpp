@@ -0,0 +1,47 @@
+#include "Camera.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+
+UniformBufferObject computeCameraMatrices(const CameraSetup& setup, float time)
+{
+	UniformBufferObject ubo = {};
+	glm::vec3 up = { 0.0f, 0.0f, 1.0f };
+	// at the middle of the models' height, so that nearer models hide farther ones
+	float eye_height = setup.model_bounding_sphere.z;
+	float view_distance = 3.0f * setup.scene_half_extent;
+
+	switch (setup.path)
+	{
+	case CameraPath::GRAZING:
+	{
+		// from a corner across the whole grid, swaying over the diagonal
+		glm::vec3 eye = { -setup.scene_half_extent, -setup.scene_half_extent, eye_height };
+		float angle = glm::radians(45.0f) + 0.3f * std::sin(time * 0.5f);
+		ubo.model = glm::mat4();
+		ubo.view = glm::lookAt(eye, eye + glm::vec3(std::cos(angle), std::sin(angle), 0.0f), up);
+		ubo.proj = glm::perspective(glm::radians(60.0f), setup.aspect, 0.1f, view_distance);
+		break;
+	}
+	case CameraPath::FLYTHROUGH:
+	{
+		// along the rows from one end of the grid to the other, then again
+		float travel = std::fmod(time * setup.object_spacing, 2.0f * setup.scene_half_extent);
+		glm::vec3 eye = { -setup.scene_half_extent + travel, 0.25f * setup.object_spacing, eye_height };
+		ubo.model = glm::mat4();
+		ubo.view = glm::lookAt(eye, eye + glm::vec3(1.0f, 0.0f, 0.0f), up);
+		ubo.proj = glm::perspective(glm::radians(60.0f), setup.aspect, 0.1f, view_distance);
+		break;
+	}
+	case CameraPath::ORBIT:
+	default:
+		ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.view = glm::lookAt(glm::vec3(1.5f, 1.5f, 1.5f), glm::vec3(0.0f, 0.0f, 0.0f), up);
+		ubo.proj = glm::perspective(glm::radians(45.0f), setup.aspect, 0.1f, 10.0f);
+		break;
+	}
+
+	ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
+	return ubo;
+}
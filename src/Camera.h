@@ -0,0 +1,31 @@
+#pragma once
+
+#include "AppOptions.h"
+
+#ifndef GLM_FORCE_RADIANS
+#define GLM_FORCE_RADIANS
+#endif
+#ifndef GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#endif
+#include <glm/glm.hpp>
+
+struct UniformBufferObject
+{
+	glm::mat4 model;
+	glm::mat4 view;
+	glm::mat4 proj;
+};
+
+// what the camera paths are fitted to
+struct CameraSetup
+{
+	CameraPath path = CameraPath::ORBIT;
+	float aspect = 1.0f; // width / height
+	glm::vec4 model_bounding_sphere; // of the model in model space
+	float object_spacing = 1.0f; // between neighbours on the object grid
+	float scene_half_extent = 0.0f; // of the object grid, including the models' bounds
+};
+
+// matrices of the camera at time seconds along its path, with proj flipped for Vulkan's y axis
+UniformBufferObject computeCameraMatrices(const CameraSetup& setup, float time);
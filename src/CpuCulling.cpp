@@ -0,0 +1,408 @@
+#include "CpuCulling.h"
+#include "JobSystem.h"
+#include "TraceProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CULLING_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics of any level without flags, gcc and clang need the
+// target attribute so that only the AVX2 kernels are built with AVX2 enabled
+#if defined(CULLING_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+const char* simdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::SCALAR: return "scalar";
+	case SimdLevel::SSE: return "sse";
+	case SimdLevel::AVX2: return "avx2";
+	}
+	return "unknown";
+}
+
+bool isSimdLevelSupported(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::SCALAR:
+		return true;
+#ifdef CULLING_X86
+	case SimdLevel::SSE:
+		return true; // SSE2 is part of x86-64 and assumed on 32 bits
+	case SimdLevel::AVX2:
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+	{
+		int info[4];
+		__cpuid(info, 1);
+		bool os_saves_ymm = (info[2] & (1 << 27)) != 0 // OSXSAVE
+			&& (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(info, 7, 0);
+		return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+	}
+#else
+		return false;
+#endif
+#endif
+	default:
+		return false;
+	}
+}
+
+SimdLevel parseSimdLevel(const std::string& name)
+{
+	for (auto level : { SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2 })
+	{
+		if (name == simdLevelName(level))
+		{
+			return level;
+		}
+	}
+	throw std::runtime_error("Unknown SIMD level " + name);
+}
+
+SimdLevel detectSimdLevel()
+{
+	if (isSimdLevelSupported(SimdLevel::AVX2)) return SimdLevel::AVX2;
+	if (isSimdLevelSupported(SimdLevel::SSE)) return SimdLevel::SSE;
+	return SimdLevel::SCALAR;
+}
+
+void SphereBoundsSoA::resize(size_t count)
+{
+	center_x.resize(count);
+	center_y.resize(count);
+	center_z.resize(count);
+	radius.resize(count);
+}
+
+void SphereBoundsSoA::set(size_t index, const glm::vec4& sphere)
+{
+	center_x[index] = sphere.x;
+	center_y[index] = sphere.y;
+	center_z[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+void BoxBoundsSoA::resize(size_t count)
+{
+	min_x.resize(count);
+	min_y.resize(count);
+	min_z.resize(count);
+	max_x.resize(count);
+	max_y.resize(count);
+	max_z.resize(count);
+}
+
+void BoxBoundsSoA::set(size_t index, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	min_x[index] = box_min.x;
+	min_y[index] = box_min.y;
+	min_z[index] = box_min.z;
+	max_x[index] = box_max.x;
+	max_y[index] = box_max.y;
+	max_z[index] = box_max.z;
+}
+
+namespace
+{
+	// the box corner furthest along a plane normal only depends on the signs of the normal,
+	// which are the same for every box, so each plane picks its arrays once
+	struct BoxPlaneInputs
+	{
+		const float* x;
+		const float* y;
+		const float* z;
+	};
+
+	BoxPlaneInputs positiveVertexArrays(const glm::vec4& plane, const BoxBoundsSoA& boxes)
+	{
+		return {
+			plane.x >= 0.0f ? boxes.max_x.data() : boxes.min_x.data(),
+			plane.y >= 0.0f ? boxes.max_y.data() : boxes.min_y.data(),
+			plane.z >= 0.0f ? boxes.max_z.data() : boxes.min_z.data()
+		};
+	}
+
+	// appends base + lane for every set bit of mask, without branching on the mask
+	inline size_t appendLanes(unsigned mask, unsigned lane_count, uint32_t base, uint32_t* out, size_t written)
+	{
+		for (unsigned lane = 0; lane < lane_count; lane++)
+		{
+			out[written] = base + lane;
+			written += (mask >> lane) & 1;
+		}
+		return written;
+	}
+
+	size_t cullSpheresScalar(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& spheres = *static_cast<const SphereBoundsSoA*>(bounds);
+		size_t written = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (const auto& plane : frustum.planes)
+			{
+				float distance = plane.x * spheres.center_x[i] + plane.y * spheres.center_y[i]
+					+ plane.z * spheres.center_z[i] + plane.w;
+				inside &= distance >= -spheres.radius[i];
+			}
+			out[written] = (uint32_t)i;
+			written += inside ? 1 : 0;
+		}
+		return written;
+	}
+
+	size_t cullBoxesScalar(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& boxes = *static_cast<const BoxBoundsSoA*>(bounds);
+		BoxPlaneInputs inputs[Frustum::PLANE_COUNT];
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			inputs[p] = positiveVertexArrays(frustum.planes[p], boxes);
+		}
+
+		size_t written = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+			{
+				const auto& plane = frustum.planes[p];
+				float distance = plane.x * inputs[p].x[i] + plane.y * inputs[p].y[i] + plane.z * inputs[p].z[i] + plane.w;
+				inside &= distance >= 0.0f;
+			}
+			out[written] = (uint32_t)i;
+			written += inside ? 1 : 0;
+		}
+		return written;
+	}
+
+#ifdef CULLING_X86
+	// 4 spheres starting at i, returns a 4 bit mask of the ones inside
+	inline unsigned testSpheresSSE(const Frustum& frustum, const SphereBoundsSoA& spheres, size_t i)
+	{
+		__m128 x = _mm_loadu_ps(&spheres.center_x[i]);
+		__m128 y = _mm_loadu_ps(&spheres.center_y[i]);
+		__m128 z = _mm_loadu_ps(&spheres.center_z[i]);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (const auto& plane : frustum.planes)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+		}
+		return (unsigned)_mm_movemask_ps(inside);
+	}
+
+	size_t cullSpheresSSE(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& spheres = *static_cast<const SphereBoundsSoA*>(bounds);
+		size_t written = 0;
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			unsigned mask = testSpheresSSE(frustum, spheres, i) | (testSpheresSSE(frustum, spheres, i + 4) << 4);
+			written = appendLanes(mask, 8, (uint32_t)i, out, written);
+		}
+		return written + cullSpheresScalar(frustum, bounds, i, end, out + written);
+	}
+
+	inline unsigned testBoxesSSE(const Frustum& frustum, const BoxPlaneInputs* inputs, size_t i)
+	{
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			const auto& plane = frustum.planes[p];
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(inputs[p].x + i), _mm_set1_ps(plane.x))
+					, _mm_mul_ps(_mm_loadu_ps(inputs[p].y + i), _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(inputs[p].z + i), _mm_set1_ps(plane.z))
+					, _mm_set1_ps(plane.w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+		}
+		return (unsigned)_mm_movemask_ps(inside);
+	}
+
+	size_t cullBoxesSSE(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& boxes = *static_cast<const BoxBoundsSoA*>(bounds);
+		BoxPlaneInputs inputs[Frustum::PLANE_COUNT];
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			inputs[p] = positiveVertexArrays(frustum.planes[p], boxes);
+		}
+
+		size_t written = 0;
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			unsigned mask = testBoxesSSE(frustum, inputs, i) | (testBoxesSSE(frustum, inputs, i + 4) << 4);
+			written = appendLanes(mask, 8, (uint32_t)i, out, written);
+		}
+		return written + cullBoxesScalar(frustum, bounds, i, end, out + written);
+	}
+
+	TARGET_AVX2 size_t cullSpheresAVX2(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& spheres = *static_cast<const SphereBoundsSoA*>(bounds);
+
+		__m256 plane_x[Frustum::PLANE_COUNT], plane_y[Frustum::PLANE_COUNT];
+		__m256 plane_z[Frustum::PLANE_COUNT], plane_w[Frustum::PLANE_COUNT];
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			plane_x[p] = _mm256_set1_ps(frustum.planes[p].x);
+			plane_y[p] = _mm256_set1_ps(frustum.planes[p].y);
+			plane_z[p] = _mm256_set1_ps(frustum.planes[p].z);
+			plane_w[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+
+		size_t written = 0;
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&spheres.center_x[i]);
+			__m256 y = _mm256_loadu_ps(&spheres.center_y[i]);
+			__m256 z = _mm256_loadu_ps(&spheres.center_z[i]);
+			__m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+			{
+				__m256 distance = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(x, plane_x[p]), _mm256_mul_ps(y, plane_y[p])),
+					_mm256_add_ps(_mm256_mul_ps(z, plane_z[p]), plane_w[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+			}
+			written = appendLanes((unsigned)_mm256_movemask_ps(inside), 8, (uint32_t)i, out, written);
+		}
+		return written + cullSpheresScalar(frustum, bounds, i, end, out + written);
+	}
+
+	TARGET_AVX2 size_t cullBoxesAVX2(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out)
+	{
+		const auto& boxes = *static_cast<const BoxBoundsSoA*>(bounds);
+		BoxPlaneInputs inputs[Frustum::PLANE_COUNT];
+		for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			inputs[p] = positiveVertexArrays(frustum.planes[p], boxes);
+		}
+
+		size_t written = 0;
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+			{
+				const auto& plane = frustum.planes[p];
+				__m256 distance = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(inputs[p].x + i), _mm256_set1_ps(plane.x))
+						, _mm256_mul_ps(_mm256_loadu_ps(inputs[p].y + i), _mm256_set1_ps(plane.y))),
+					_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(inputs[p].z + i), _mm256_set1_ps(plane.z))
+						, _mm256_set1_ps(plane.w)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			written = appendLanes((unsigned)_mm256_movemask_ps(inside), 8, (uint32_t)i, out, written);
+		}
+		return written + cullBoxesScalar(frustum, bounds, i, end, out + written);
+	}
+#endif
+}
+
+CpuCuller::CpuCuller(SimdLevel level, JobSystem* jobs)
+	: simd_level(level)
+	, jobs(jobs)
+{
+	if (!isSimdLevelSupported(level))
+	{
+		throw std::runtime_error(std::string("SIMD level not supported on this machine: ") + simdLevelName(level));
+	}
+}
+
+unsigned CpuCuller::getThreadCount() const
+{
+	return jobs ? jobs->getThreadCount() : 1;
+}
+
+void CpuCuller::cullSpheres(const Frustum& frustum, const SphereBoundsSoA& bounds, std::vector<uint32_t>& visible) const
+{
+	CullRangeFunction cull_range = cullSpheresScalar;
+#ifdef CULLING_X86
+	if (simd_level == SimdLevel::SSE) cull_range = cullSpheresSSE;
+	if (simd_level == SimdLevel::AVX2) cull_range = cullSpheresAVX2;
+#endif
+	cull(cull_range, frustum, &bounds, bounds.size(), visible);
+}
+
+void CpuCuller::cullBoxes(const Frustum& frustum, const BoxBoundsSoA& bounds, std::vector<uint32_t>& visible) const
+{
+	CullRangeFunction cull_range = cullBoxesScalar;
+#ifdef CULLING_X86
+	if (simd_level == SimdLevel::SSE) cull_range = cullBoxesSSE;
+	if (simd_level == SimdLevel::AVX2) cull_range = cullBoxesAVX2;
+#endif
+	cull(cull_range, frustum, &bounds, bounds.size(), visible);
+}
+
+void CpuCuller::cull(CullRangeFunction cull_range, const Frustum& frustum, const void* bounds, size_t count
+	, std::vector<uint32_t>& visible) const
+{
+	TRACE_SCOPE("CpuCuller::cull");
+	// every index may survive
+	visible.resize(count);
+
+	unsigned thread_count = getThreadCount();
+	if (count < PARALLEL_THRESHOLD || thread_count <= 1)
+	{
+		visible.resize(cull_range(frustum, bounds, 0, count, visible.data()));
+		return;
+	}
+
+	// each thread culls a contiguous chunk into its own part of visible,
+	// chunks are multiples of 8 so only the last one has a scalar tail
+	size_t chunk_size = ((count + thread_count - 1) / thread_count + 7) / 8 * 8;
+	size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+	std::vector<size_t> written(chunk_count);
+	uint32_t* out = visible.data();
+	JobCounter chunks;
+	for (size_t chunk = 1; chunk < chunk_count; chunk++)
+	{
+		size_t begin = chunk * chunk_size;
+		size_t end = std::min(count, begin + chunk_size);
+		jobs->run("CpuCuller::cull chunk", [cull_range, &frustum, bounds, begin, end, out, &written, chunk]()
+		{
+			written[chunk] = cull_range(frustum, bounds, begin, end, out + begin);
+		}, &chunks);
+	}
+	written[0] = cull_range(frustum, bounds, 0, std::min(count, chunk_size), out);
+	jobs->wait(chunks);
+
+	// close the gaps between chunks
+	size_t total = written[0];
+	for (size_t chunk = 1; chunk < chunk_count; chunk++)
+	{
+		memmove(visible.data() + total, visible.data() + chunk * chunk_size, written[chunk] * sizeof(uint32_t));
+		total += written[chunk];
+	}
+	visible.resize(total);
+}
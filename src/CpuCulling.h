@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Frustum.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+class JobSystem;
+
+// Frustum culling on the CPU over structure-of-arrays bounds,
+// used when the GPU culling path is not wanted.
+
+enum class SimdLevel
+{
+	SCALAR,
+	SSE, // SSE2, 2 x 4 lanes per iteration
+	AVX2, // 8 lanes per iteration
+};
+
+const char* simdLevelName(SimdLevel level);
+// best level supported by both the build and the running CPU
+SimdLevel detectSimdLevel();
+bool isSimdLevelSupported(SimdLevel level);
+// from the name returned by simdLevelName, throws on unknown names
+SimdLevel parseSimdLevel(const std::string& name);
+
+struct SphereBoundsSoA
+{
+	std::vector<float> center_x;
+	std::vector<float> center_y;
+	std::vector<float> center_z;
+	std::vector<float> radius;
+
+	size_t size() const { return radius.size(); }
+	void resize(size_t count);
+	// xyz: center, w: radius
+	void set(size_t index, const glm::vec4& sphere);
+};
+
+struct BoxBoundsSoA
+{
+	std::vector<float> min_x;
+	std::vector<float> min_y;
+	std::vector<float> min_z;
+	std::vector<float> max_x;
+	std::vector<float> max_y;
+	std::vector<float> max_z;
+
+	size_t size() const { return min_x.size(); }
+	void resize(size_t count);
+	void set(size_t index, const glm::vec3& box_min, const glm::vec3& box_max);
+};
+
+class CpuCuller
+{
+public:
+	// large inputs are split across the threads of jobs, without it everything runs on the calling thread
+	explicit CpuCuller(SimdLevel level = detectSimdLevel(), JobSystem* jobs = nullptr);
+
+	// Replaces the content of visible with the indices of the bounds
+	// intersecting the frustum, in ascending order
+	void cullSpheres(const Frustum& frustum, const SphereBoundsSoA& bounds, std::vector<uint32_t>& visible) const;
+	void cullBoxes(const Frustum& frustum, const BoxBoundsSoA& bounds, std::vector<uint32_t>& visible) const;
+
+	SimdLevel getSimdLevel() const { return simd_level; }
+	unsigned getThreadCount() const;
+
+	// below this many objects splitting the work costs more than it saves
+	static const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+private:
+	SimdLevel simd_level;
+	JobSystem* jobs;
+
+	// culls [begin, end) into out, which has room for end - begin indices, returns the number written
+	typedef size_t(*CullRangeFunction)(const Frustum& frustum, const void* bounds, size_t begin, size_t end, uint32_t* out);
+
+	void cull(CullRangeFunction cull_range, const Frustum& frustum, const void* bounds, size_t count
+		, std::vector<uint32_t>& visible) const;
+};
@@ -0,0 +1,151 @@
+#include "DeferredDestruction.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+DeferredDestruction::DeferredDestruction(const VDevice& device, VkQueue queue)
+	: device(device)
+	, queue(queue)
+{
+}
+
+DeferredDestruction::~DeferredDestruction()
+{
+	drain();
+}
+
+void DeferredDestruction::retire(VkCommandPool pool, std::vector<VkCommandBuffer>& command_buffers)
+{
+	for (VkCommandBuffer command_buffer : command_buffers)
+	{
+		if (command_buffer != VK_NULL_HANDLE)
+		{
+			push(handleBits(command_buffer), handleBits(pool), &freeCommandBuffer);
+		}
+	}
+	command_buffers.clear();
+}
+
+void DeferredDestruction::retire(VkDescriptorPool pool, std::vector<VkDescriptorSet>& descriptor_sets)
+{
+	for (VkDescriptorSet descriptor_set : descriptor_sets)
+	{
+		if (descriptor_set != VK_NULL_HANDLE)
+		{
+			push(handleBits(descriptor_set), handleBits(pool), &freeDescriptorSet);
+		}
+	}
+	descriptor_sets.clear();
+}
+
+void DeferredDestruction::endFrame()
+{
+	auto first_later = std::upper_bound(retired.begin(), retired.end(), current_frame
+		, [](uint64_t frame, const Retired& object) { return frame < object.frame; });
+	if (first_later != retired.begin() && std::prev(first_later)->frame == current_frame)
+	{
+		uint32_t fence;
+		if (!free_fences.empty())
+		{
+			fence = free_fences.back();
+			free_fences.pop_back();
+		}
+		else
+		{
+			VkFenceCreateInfo fence_info = {};
+			fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			fences.emplace_back(device);
+			if (vkCreateFence(device, &fence_info, nullptr, &fences.back()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create deferred destruction fence!");
+			}
+			fence = (uint32_t)fences.size() - 1;
+		}
+
+		// no command buffers, the fence signals once everything submitted before it completes
+		if (vkQueueSubmit(queue, 0, nullptr, fences[fence]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit deferred destruction fence!");
+		}
+		fenced_frames.push_back({ current_frame, fence });
+		stats.fenced_frames++;
+	}
+	current_frame++;
+}
+
+void DeferredDestruction::collect()
+{
+	while (!fenced_frames.empty())
+	{
+		FencedFrame fenced = fenced_frames.front();
+		VkFence fence = fences[fenced.fence];
+		if (vkGetFenceStatus(device, fence) != VK_SUCCESS)
+		{
+			break; // the queue completes frames in order
+		}
+		vkResetFences(device, 1, &fence);
+		free_fences.push_back(fenced.fence);
+		fenced_frames.pop_front();
+		destroyUpTo(fenced.frame);
+	}
+}
+
+void DeferredDestruction::drain()
+{
+	endFrame();
+	// the caller is done with the objects retired for later frames too, they go with the last fence
+	if (!retired.empty() && retired.back().frame >= current_frame)
+	{
+		for (auto& object : retired)
+		{
+			object.frame = std::min(object.frame, current_frame);
+		}
+		endFrame();
+	}
+	if (!fenced_frames.empty())
+	{
+		// the last one signals after all the others
+		VkFence fence = fences[fenced_frames.back().fence];
+		vkWaitForFences(device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	collect();
+}
+
+void DeferredDestruction::push(uint64_t object, uint64_t parent, void (*destroy)(VkDevice, uint64_t, uint64_t)
+	, uint32_t later_frames)
+{
+	// after the objects of the same frame, keeping the frames ascending
+	uint64_t frame = current_frame + later_frames;
+	auto position = std::upper_bound(retired.begin(), retired.end(), frame
+		, [](uint64_t frame, const Retired& object) { return frame < object.frame; });
+	retired.insert(position, { frame, object, parent, destroy });
+	stats.retired++;
+	stats.pending = retired.size();
+	stats.max_pending = std::max(stats.max_pending, stats.pending);
+}
+
+void DeferredDestruction::destroyUpTo(uint64_t frame)
+{
+	while (!retired.empty() && retired.front().frame <= frame)
+	{
+		const Retired& object = retired.front();
+		object.destroy(device, object.object, object.parent);
+		retired.pop_front();
+		stats.destroyed++;
+	}
+	stats.pending = retired.size();
+}
+
+void DeferredDestruction::freeCommandBuffer(VkDevice device, uint64_t command_buffer, uint64_t pool)
+{
+	VkCommandBuffer buffer = handleOf<VkCommandBuffer>(command_buffer);
+	vkFreeCommandBuffers(device, handleOf<VkCommandPool>(pool), 1, &buffer);
+}
+
+void DeferredDestruction::freeDescriptorSet(VkDevice device, uint64_t descriptor_set, uint64_t pool)
+{
+	VkDescriptorSet set = handleOf<VkDescriptorSet>(descriptor_set);
+	vkFreeDescriptorSets(device, handleOf<VkDescriptorPool>(pool), 1, &set);
+}
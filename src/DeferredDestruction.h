@@ -0,0 +1,132 @@
+#pragma once
+
+#include "VHandle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Destroys device objects once the GPU is done with them, instead of idling the device first.
+// Retired objects are queued with the frame that last used them. Frames that retired something
+// end with an empty submit signaling a fence, so an object is destroyed after every command
+// buffer submitted to the queue up to the end of its frame has completed.
+// Holders are left empty by retire, so creating a new object into them destroys nothing.
+class DeferredDestruction
+{
+public:
+	struct Stats
+	{
+		uint64_t retired = 0;
+		uint64_t destroyed = 0;
+		size_t pending = 0; // retired and not destroyed yet
+		size_t max_pending = 0;
+		uint64_t fenced_frames = 0; // frames that retired objects and got a fence
+	};
+
+	// The fences only cover work submitted to this queue. Objects another queue uses, like a swap chain
+	// and the semaphores presenting waits on, are retired with later_frames to outlive that use.
+	DeferredDestruction(const VDevice& device, VkQueue queue);
+	// drains
+	~DeferredDestruction();
+
+	DeferredDestruction(const DeferredDestruction&) = delete;
+	DeferredDestruction& operator=(const DeferredDestruction&) = delete;
+
+	// The object may still be used by work submitted in the current frame,
+	// it is destroyed with the frame later_frames after it instead.
+	template <typename T, void (VKAPI_PTR* Destroy)(VkDevice, T, const VkAllocationCallbacks*)>
+	void retire(VHandle<VkDevice, T, Destroy>& handle, uint32_t later_frames = 0)
+	{
+		T object = handle.release();
+		if (object != VK_NULL_HANDLE)
+		{
+			push(handleBits(object), 0, &destroyObject<T, Destroy>, later_frames);
+		}
+	}
+	// retires every holder and clears the vector
+	template <typename T, void (VKAPI_PTR* Destroy)(VkDevice, T, const VkAllocationCallbacks*)>
+	void retire(std::vector<VHandle<VkDevice, T, Destroy>>& handles, uint32_t later_frames = 0)
+	{
+		for (auto& handle : handles)
+		{
+			retire(handle, later_frames);
+		}
+		handles.clear();
+	}
+	// frees the command buffers back to pool, which has to outlive them, and clears the vector
+	void retire(VkCommandPool pool, std::vector<VkCommandBuffer>& command_buffers);
+	// frees the sets back to pool, created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, and clears the vector
+	void retire(VkDescriptorPool pool, std::vector<VkDescriptorSet>& descriptor_sets);
+
+	// After the last submit of a frame, signals a fence for the objects retired in it.
+	// Objects retired before the next endFrame belong to the next frame.
+	void endFrame();
+	// destroys the objects of frames the GPU completed, never waits
+	void collect();
+	// ends the current frame, waits for every frame and destroys everything retired
+	void drain();
+
+	// frames ended so far, the one objects retired now belong to
+	uint64_t getCurrentFrame() const { return current_frame; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	// a handle of any type, the destroy function knows which
+	struct Retired
+	{
+		uint64_t frame;
+		uint64_t object;
+		uint64_t parent; // the pool of command buffers and descriptor sets
+		void (*destroy)(VkDevice device, uint64_t object, uint64_t parent);
+	};
+
+	struct FencedFrame
+	{
+		uint64_t frame;
+		uint32_t fence; // index in fences
+	};
+
+	const VDevice& device;
+	VkQueue queue;
+	uint64_t current_frame = 0;
+
+	std::deque<Retired> retired; // ascending frames, some may be later than the current one
+	std::deque<FencedFrame> fenced_frames; // ascending frames
+	std::vector<VFence> fences;
+	std::vector<uint32_t> free_fences;
+	Stats stats;
+
+	void push(uint64_t object, uint64_t parent, void (*destroy)(VkDevice, uint64_t, uint64_t), uint32_t later_frames = 0);
+	// destroys the objects of frames up to frame
+	void destroyUpTo(uint64_t frame);
+
+	// non-dispatchable handles are pointers on 64 bit platforms and uint64_t on 32 bit ones
+	template <typename T>
+	static uint64_t handleBits(T object)
+	{
+		uint64_t bits = 0;
+		memcpy(&bits, &object, sizeof(object));
+		return bits;
+	}
+
+	template <typename T>
+	static T handleOf(uint64_t bits)
+	{
+		T object;
+		memcpy(&object, &bits, sizeof(object));
+		return object;
+	}
+
+	template <typename T, void (VKAPI_PTR* Destroy)(VkDevice, T, const VkAllocationCallbacks*)>
+	static void destroyObject(VkDevice device, uint64_t object, uint64_t)
+	{
+		Destroy(device, handleOf<T>(object), nullptr);
+	}
+
+	static void freeCommandBuffer(VkDevice device, uint64_t command_buffer, uint64_t pool);
+	static void freeDescriptorSet(VkDevice device, uint64_t descriptor_set, uint64_t pool);
+};
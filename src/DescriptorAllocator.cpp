@@ -0,0 +1,356 @@
+#include "DescriptorAllocator.h"
+#include "DeferredDestruction.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+	bool isImageDescriptor(VkDescriptorType type)
+	{
+		return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			|| type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+			|| type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	}
+
+	bool isBufferDescriptor(VkDescriptorType type)
+	{
+		return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+			|| type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	}
+}
+
+const uint32_t DescriptorAllocator::FIRST_POOL_SETS;
+const uint32_t DescriptorAllocator::MAX_POOL_SETS;
+
+DescriptorAllocator::DescriptorAllocator(const VDevice& device, bool update_templates)
+	: device(device)
+	, update_templates(false)
+{
+#ifdef VK_KHR_descriptor_update_template
+	if (update_templates)
+	{
+		create_update_template = (PFN_vkCreateDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(device
+			, "vkCreateDescriptorUpdateTemplateKHR");
+		destroy_update_template = (PFN_vkDestroyDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(device
+			, "vkDestroyDescriptorUpdateTemplateKHR");
+		update_with_template = (PFN_vkUpdateDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(device
+			, "vkUpdateDescriptorSetWithTemplateKHR");
+		this->update_templates = create_update_template && destroy_update_template && update_with_template;
+	}
+#else
+	(void)update_templates;
+#endif
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+#ifdef VK_KHR_descriptor_update_template
+	for (const Layout& layout : layouts)
+	{
+		if (layout.update_template != VK_NULL_HANDLE)
+		{
+			destroy_update_template(device, layout.update_template, nullptr);
+		}
+	}
+#endif
+}
+
+uint32_t DescriptorAllocator::addLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	Layout added;
+	added.layout = layout;
+	added.bindings = bindings;
+	added.descriptor_count = 0;
+
+#ifdef VK_KHR_descriptor_update_template
+	std::vector<VkDescriptorUpdateTemplateEntryKHR> entries;
+#endif
+	std::map<VkDescriptorType, uint32_t> type_counts;
+	for (const auto& binding : bindings)
+	{
+		if (!isImageDescriptor(binding.descriptorType) && !isBufferDescriptor(binding.descriptorType))
+		{
+			throw std::runtime_error("Texel buffer descriptors are not supported!");
+		}
+#ifdef VK_KHR_descriptor_update_template
+		VkDescriptorUpdateTemplateEntryKHR entry = {};
+		entry.dstBinding = binding.binding;
+		entry.dstArrayElement = 0;
+		entry.descriptorCount = binding.descriptorCount;
+		entry.descriptorType = binding.descriptorType;
+		entry.offset = added.descriptor_count * sizeof(DescriptorResource);
+		entry.stride = sizeof(DescriptorResource);
+		entries.push_back(entry);
+#endif
+		added.descriptor_count += binding.descriptorCount;
+		type_counts[binding.descriptorType] += binding.descriptorCount;
+	}
+
+	// pools created from now on fit any set of this layout too
+	for (const auto& type_count : type_counts)
+	{
+		auto size = std::find_if(set_pool_sizes.begin(), set_pool_sizes.end()
+			, [&](const VkDescriptorPoolSize& size) { return size.type == type_count.first; });
+		if (size == set_pool_sizes.end())
+		{
+			set_pool_sizes.push_back({ type_count.first, type_count.second });
+		}
+		else
+		{
+			size->descriptorCount = std::max(size->descriptorCount, type_count.second);
+		}
+	}
+
+#ifdef VK_KHR_descriptor_update_template
+	added.update_template = VK_NULL_HANDLE;
+	if (update_templates)
+	{
+		VkDescriptorUpdateTemplateCreateInfoKHR template_info = {};
+		template_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+		template_info.descriptorUpdateEntryCount = (uint32_t)entries.size();
+		template_info.pDescriptorUpdateEntries = entries.data();
+		template_info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+		template_info.descriptorSetLayout = layout;
+
+		if (create_update_template(device, &template_info, nullptr, &added.update_template) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create descriptor update template!");
+		}
+	}
+#endif
+
+	layouts.push_back(std::move(added));
+	return (uint32_t)layouts.size() - 1;
+}
+
+VkDescriptorSet DescriptorAllocator::getSet(uint32_t layout, const std::vector<DescriptorResource>& resources)
+{
+	bool found;
+	VkDescriptorSet set = findOrCreate(cache, layout, resources, found);
+	if (found)
+	{
+		stats.cache_hits++;
+	}
+	else
+	{
+		stats.cache_misses++;
+	}
+	return set;
+}
+
+void DescriptorAllocator::beginFrame()
+{
+	// what came before the first frame is not counted as one
+	if (stats.frames > 0)
+	{
+		if (frame_allocations > 0 || frame_update_ns > 0)
+		{
+			stats.busy_frames++;
+		}
+		stats.max_frame_allocations = std::max(stats.max_frame_allocations, frame_allocations);
+		stats.max_frame_update_ns = std::max(stats.max_frame_update_ns, frame_update_ns);
+	}
+	stats.frames++;
+	frame_allocations = 0;
+	frame_update_ns = 0;
+}
+
+void DescriptorAllocator::beginRebuild()
+{
+	rebuild++;
+}
+
+void DescriptorAllocator::endRebuild(DeferredDestruction& deferred_destruction)
+{
+	std::map<VkDescriptorPool, std::vector<VkDescriptorSet>> unused;
+	for (auto cached = cache.sets.begin(); cached != cache.sets.end();)
+	{
+		if (cached->second.rebuild != rebuild)
+		{
+			unused[cached->second.pool].push_back(cached->second.set);
+			cached = cache.sets.erase(cached);
+			stats.freed++;
+		}
+		else
+		{
+			++cached;
+		}
+	}
+	for (auto& pool_sets : unused)
+	{
+		deferred_destruction.retire(pool_sets.first, pool_sets.second);
+	}
+}
+
+DescriptorAllocator::Stats DescriptorAllocator::getStats() const
+{
+	Stats current = stats;
+	current.pools = (uint32_t)cache.pools.size();
+	current.cached_sets = cache.sets.size();
+	return current;
+}
+
+VkDescriptorSet DescriptorAllocator::findOrCreate(PoolChain& chain, uint32_t layout
+	, const std::vector<DescriptorResource>& resources, bool& found)
+{
+	if (resources.size() != layouts[layout].descriptor_count)
+	{
+		throw std::runtime_error("Descriptor set resources do not match the layout!");
+	}
+
+	uint64_t hash = hashSet(layout, resources);
+	auto range = chain.sets.equal_range(hash);
+	for (auto candidate = range.first; candidate != range.second; ++candidate)
+	{
+		CachedSet& existing = candidate->second;
+		if (existing.layout == layout
+			&& memcmp(existing.resources.data(), resources.data(), resources.size() * sizeof(DescriptorResource)) == 0)
+		{
+			existing.rebuild = rebuild;
+			found = true;
+			return existing.set;
+		}
+	}
+
+	found = false;
+	CachedSet created;
+	created.layout = layout;
+	created.resources = resources;
+	created.set = allocate(chain, layouts[layout].layout, created.pool);
+	created.rebuild = rebuild;
+	write(created.set, layouts[layout], resources);
+	VkDescriptorSet set = created.set;
+	chain.sets.emplace(hash, std::move(created));
+	return set;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(PoolChain& chain, VkDescriptorSetLayout layout, VkDescriptorPool& pool)
+{
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &layout;
+
+	VkDescriptorSet set;
+	// a full or fragmented pool fails with an error that depends on the driver and its version,
+	// so any failure moves on to the next pool, starting with the last one allocated from
+	for (size_t tried = 0; tried < chain.pools.size(); tried++)
+	{
+		size_t index = (chain.current + tried) % chain.pools.size();
+		alloc_info.descriptorPool = chain.pools[index];
+		if (vkAllocateDescriptorSets(device, &alloc_info, &set) == VK_SUCCESS)
+		{
+			chain.current = index;
+			pool = chain.pools[index];
+			stats.allocations++;
+			frame_allocations++;
+			return set;
+		}
+	}
+
+	createPool(chain);
+	chain.current = chain.pools.size() - 1;
+	alloc_info.descriptorPool = chain.pools.back();
+	if (vkAllocateDescriptorSets(device, &alloc_info, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor set!");
+	}
+	pool = chain.pools.back();
+	stats.allocations++;
+	frame_allocations++;
+	return set;
+}
+
+void DescriptorAllocator::createPool(PoolChain& chain)
+{
+	// every pool twice the sets of the one before, up to MAX_POOL_SETS
+	uint32_t set_count = MAX_POOL_SETS;
+	if (chain.pools.size() < 8 && (FIRST_POOL_SETS << chain.pools.size()) < MAX_POOL_SETS)
+	{
+		set_count = FIRST_POOL_SETS << chain.pools.size();
+	}
+
+	std::vector<VkDescriptorPoolSize> pool_sizes = set_pool_sizes;
+	for (auto& size : pool_sizes)
+	{
+		size.descriptorCount *= set_count;
+	}
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = (uint32_t)pool_sizes.size();
+	pool_info.pPoolSizes = pool_sizes.data();
+	pool_info.maxSets = set_count;
+	// sets not asked for in a rebuild are freed one by one
+	pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+
+	chain.pools.emplace_back(device);
+	if (vkCreateDescriptorPool(device, &pool_info, nullptr, &chain.pools.back()) != VK_SUCCESS)
+	{
+		chain.pools.pop_back();
+		throw std::runtime_error("Failed to create descriptor pool!");
+	}
+}
+
+void DescriptorAllocator::write(VkDescriptorSet set, const Layout& layout, const std::vector<DescriptorResource>& resources)
+{
+	auto start = std::chrono::steady_clock::now();
+#ifdef VK_KHR_descriptor_update_template
+	if (layout.update_template != VK_NULL_HANDLE)
+	{
+		update_with_template(device, set, layout.update_template, resources.data());
+	}
+	else
+#endif
+	{
+		std::vector<VkWriteDescriptorSet> descriptor_writes(layout.bindings.size());
+		uint32_t first = 0;
+		for (size_t i = 0; i < layout.bindings.size(); i++)
+		{
+			const auto& binding = layout.bindings[i];
+			VkWriteDescriptorSet& descriptor_write = descriptor_writes[i];
+			descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptor_write.dstSet = set;
+			descriptor_write.dstBinding = binding.binding;
+			descriptor_write.dstArrayElement = 0;
+			descriptor_write.descriptorType = binding.descriptorType;
+			descriptor_write.descriptorCount = binding.descriptorCount;
+			// the resources of a binding are consecutive, so the infos are too
+			if (isImageDescriptor(binding.descriptorType))
+			{
+				descriptor_write.pImageInfo = &resources[first].image_info;
+			}
+			else
+			{
+				descriptor_write.pBufferInfo = &resources[first].buffer_info;
+			}
+			first += binding.descriptorCount;
+		}
+		vkUpdateDescriptorSets(device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+	}
+	uint64_t update_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	stats.descriptors_written += layout.descriptor_count;
+	stats.update_ns += update_ns;
+	frame_update_ns += update_ns;
+}
+
+uint64_t DescriptorAllocator::hashSet(uint32_t layout, const std::vector<DescriptorResource>& resources)
+{
+	// FNV-1a over the layout and the bytes of the resources
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+	add(&layout, sizeof(layout));
+	add(resources.data(), resources.size() * sizeof(DescriptorResource));
+	return hash;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "VHandle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+class DeferredDestruction;
+
+// What a descriptor refers to, zeroed first so the bytes of equal resources hash and compare equal.
+// The layout of an update template entry, which reads a descriptor from every sizeof(DescriptorResource) bytes.
+union DescriptorResource
+{
+	VkDescriptorBufferInfo buffer_info;
+	VkDescriptorImageInfo image_info;
+
+	static DescriptorResource buffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+	{
+		DescriptorResource resource;
+		memset(&resource, 0, sizeof(resource));
+		resource.buffer_info.buffer = buffer;
+		resource.buffer_info.offset = offset;
+		resource.buffer_info.range = range;
+		return resource;
+	}
+
+	static DescriptorResource image(VkSampler sampler, VkImageView view, VkImageLayout layout)
+	{
+		DescriptorResource resource;
+		memset(&resource, 0, sizeof(resource));
+		resource.image_info.sampler = sampler;
+		resource.image_info.imageView = view;
+		resource.image_info.imageLayout = layout;
+		return resource;
+	}
+};
+
+// Allocates and writes descriptor sets out of pools it grows on demand.
+// Long-lived sets are cached by their layout and the resources they bind, so asking again for
+// the same bindings returns the same set without writing it. Between beginRebuild and endRebuild
+// the sets asked for are kept and the others freed once the frames using them complete.
+// Sets are written with VK_KHR_descriptor_update_template when the device has it enabled.
+class DescriptorAllocator
+{
+public:
+	struct Stats
+	{
+		uint64_t allocations = 0;
+		uint64_t cache_hits = 0;
+		uint64_t cache_misses = 0;
+		uint64_t freed = 0; // cached sets not asked for in a rebuild
+		uint64_t descriptors_written = 0;
+		uint64_t update_ns = 0; // in writing sets
+		uint32_t pools = 0;
+		size_t cached_sets = 0;
+		// over the frames begun so far
+		uint64_t frames = 0;
+		uint64_t busy_frames = 0; // frames that allocated or wrote a set
+		uint64_t max_frame_allocations = 0;
+		uint64_t max_frame_update_ns = 0;
+	};
+
+	// update_templates when the device was created with VK_KHR_descriptor_update_template
+	DescriptorAllocator(const VDevice& device, bool update_templates);
+	~DescriptorAllocator();
+
+	DescriptorAllocator(const DescriptorAllocator&) = delete;
+	DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+	// Sets of the layout bind resources to these bindings in order, a resource per descriptor,
+	// which may leave bindings of the layout out. Returns the index to allocate sets with.
+	uint32_t addLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+	// a set of the layout binding resources, cached until a rebuild does not ask for it
+	VkDescriptorSet getSet(uint32_t layout, const std::vector<DescriptorResource>& resources);
+
+	// ends the stats of the last frame, what is allocated and written from now on counts for the next
+	void beginFrame();
+
+	// cached sets are asked for again after this, when the resources some of them bind are replaced
+	void beginRebuild();
+	// frees the cached sets not asked for since beginRebuild through deferred_destruction
+	void endRebuild(DeferredDestruction& deferred_destruction);
+
+	bool usesUpdateTemplates() const { return update_templates; }
+	Stats getStats() const;
+
+private:
+	struct Layout
+	{
+		VkDescriptorSetLayout layout;
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		uint32_t descriptor_count; // the resources a set binds
+#ifdef VK_KHR_descriptor_update_template
+		VkDescriptorUpdateTemplateKHR update_template;
+#endif
+	};
+
+	struct CachedSet
+	{
+		uint32_t layout;
+		std::vector<DescriptorResource> resources;
+		VkDescriptorSet set;
+		VkDescriptorPool pool;
+		uint64_t rebuild; // the last one that asked for it
+	};
+
+	// pools that grow on demand and the sets allocated from them
+	struct PoolChain
+	{
+		std::vector<VDescriptorPool> pools;
+		size_t current = 0; // the pool allocated from last
+		std::unordered_multimap<uint64_t, CachedSet> sets; // by hashSet
+	};
+
+	const VDevice& device;
+	std::vector<Layout> layouts;
+	// the most descriptors of each type a set of any layout has, a pool has this times its sets
+	std::vector<VkDescriptorPoolSize> set_pool_sizes;
+
+	PoolChain cache;
+	uint64_t rebuild = 0;
+
+	Stats stats;
+	uint64_t frame_allocations = 0;
+	uint64_t frame_update_ns = 0;
+
+	// without the extension in the headers sets are always written with vkUpdateDescriptorSets
+	bool update_templates;
+#ifdef VK_KHR_descriptor_update_template
+	PFN_vkCreateDescriptorUpdateTemplateKHR create_update_template = nullptr;
+	PFN_vkDestroyDescriptorUpdateTemplateKHR destroy_update_template = nullptr;
+	PFN_vkUpdateDescriptorSetWithTemplateKHR update_with_template = nullptr;
+#endif
+
+	static const uint32_t FIRST_POOL_SETS = 16;
+	static const uint32_t MAX_POOL_SETS = 1024;
+
+	VkDescriptorSet findOrCreate(PoolChain& chain, uint32_t layout
+		, const std::vector<DescriptorResource>& resources, bool& found);
+	VkDescriptorSet allocate(PoolChain& chain, VkDescriptorSetLayout layout, VkDescriptorPool& pool);
+	void createPool(PoolChain& chain);
+	void write(VkDescriptorSet set, const Layout& layout, const std::vector<DescriptorResource>& resources);
+
+	static uint64_t hashSet(uint32_t layout, const std::vector<DescriptorResource>& resources);
+};
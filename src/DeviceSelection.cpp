@@ -0,0 +1,181 @@
+#include "DeviceSelection.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <vector>
+
+const char* deviceTypeName(VkPhysicalDeviceType type)
+{
+	switch (type)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+	default: return "other";
+	}
+}
+
+static std::string formatUuid(const uint8_t* uuid)
+{
+	std::string text;
+	for (int i = 0; i < VK_UUID_SIZE; i++)
+	{
+		char digits[3];
+		snprintf(digits, sizeof(digits), "%02x", uuid[i]);
+		text += digits;
+		if (i == 3 || i == 5 || i == 7 || i == 9)
+		{
+			text += '-';
+		}
+	}
+	return text;
+}
+
+DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice device)
+{
+	DeviceCapabilities capabilities;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+	capabilities.name = properties.deviceName;
+	capabilities.type = properties.deviceType;
+	std::copy(properties.pipelineCacheUUID, properties.pipelineCacheUUID + VK_UUID_SIZE, capabilities.uuid);
+	capabilities.limits = properties.limits;
+	capabilities.timestamps = properties.limits.timestampComputeAndGraphics == VK_TRUE;
+
+	vkGetPhysicalDeviceFeatures(device, &capabilities.supported);
+
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(device, &memory_properties);
+	for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++)
+	{
+		const auto& heap = memory_properties.memoryHeaps[i];
+		if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			capabilities.device_local_bytes = std::max(capabilities.device_local_bytes, heap.size);
+		}
+	}
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, families.data());
+	for (uint32_t i = 0; i < family_count; i++)
+	{
+		VkQueueFlags flags = families[i].queueFlags;
+		if (families[i].queueCount == 0 || (flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			continue;
+		}
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && capabilities.dedicated_compute_family < 0)
+		{
+			capabilities.dedicated_compute_family = i;
+		}
+		else if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT) && capabilities.dedicated_transfer_family < 0)
+		{
+			capabilities.dedicated_transfer_family = i;
+		}
+	}
+
+	return capabilities;
+}
+
+uint64_t scoreDevice(const DeviceCapabilities& capabilities)
+{
+	uint64_t score = 0;
+	switch (capabilities.type)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 100000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 50000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 20000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: break; // a software rasterizer only when nothing else renders
+	default: score += 10000; break;
+	}
+
+	// a point per 16 MiB up to 16 GiB, integrated GPUs report a share of system memory here
+	const VkDeviceSize MIB = 1024 * 1024;
+	score += std::min<VkDeviceSize>(capabilities.device_local_bytes, 16 * 1024 * MIB) / (16 * MIB);
+
+	if (capabilities.dedicated_transfer_family >= 0)
+	{
+		score += 200;
+	}
+	if (capabilities.dedicated_compute_family >= 0)
+	{
+		score += 100;
+	}
+
+	if (capabilities.supported.samplerAnisotropy)
+	{
+		score += 100;
+	}
+	if (capabilities.timestamps)
+	{
+		score += 50;
+	}
+	if (capabilities.supported.pipelineStatisticsQuery)
+	{
+		score += 20;
+	}
+	score += capabilities.limits.maxImageDimension2D / 1024;
+	return score;
+}
+
+std::string describeDevice(const DeviceCapabilities& capabilities)
+{
+	char memory[32];
+	snprintf(memory, sizeof(memory), "%.1f GiB", capabilities.device_local_bytes / (1024.0 * 1024.0 * 1024.0));
+	std::string text = capabilities.name + " (" + deviceTypeName(capabilities.type) + ", " + memory;
+	if (capabilities.dedicated_transfer_family >= 0)
+	{
+		text += ", transfer queue";
+	}
+	if (capabilities.dedicated_compute_family >= 0)
+	{
+		text += ", compute queue";
+	}
+	return text + ") " + formatUuid(capabilities.uuid);
+}
+
+bool matchesDeviceSelector(const DeviceCapabilities& capabilities, uint32_t index, const std::string& selector)
+{
+	std::string lower_selector;
+	for (char c : selector)
+	{
+		lower_selector += (char)std::tolower((unsigned char)c);
+	}
+
+	if (!lower_selector.empty() && std::all_of(lower_selector.begin(), lower_selector.end(), [](char c) { return c >= '0' && c <= '9'; }) && lower_selector.size() < 4)
+	{
+		return std::stoul(lower_selector) == index;
+	}
+
+	std::string hex = lower_selector;
+	hex.erase(std::remove(hex.begin(), hex.end(), '-'), hex.end());
+	if (hex.size() == 2 * VK_UUID_SIZE && std::all_of(hex.begin(), hex.end(), [](char c) { return std::isxdigit((unsigned char)c) != 0; }))
+	{
+		std::string uuid = formatUuid(capabilities.uuid);
+		uuid.erase(std::remove(uuid.begin(), uuid.end(), '-'), uuid.end());
+		return hex == uuid;
+	}
+
+	std::string lower_name;
+	for (char c : capabilities.name)
+	{
+		lower_name += (char)std::tolower((unsigned char)c);
+	}
+	return lower_name.find(lower_selector) != std::string::npos;
+}
+
+VkPhysicalDeviceFeatures selectDeviceFeatures(const DeviceCapabilities& capabilities, bool pipeline_statistics)
+{
+	VkPhysicalDeviceFeatures features = {}; // Everything is by default VK_FALSE
+	features.samplerAnisotropy = capabilities.supported.samplerAnisotropy;
+	if (pipeline_statistics)
+	{
+		features.pipelineStatisticsQuery = capabilities.supported.pipelineStatisticsQuery;
+	}
+	return features;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+// What a physical device offers the renderer. The optional paths check enabled, which only
+// holds the features createLogicalDevice turned on, never supported directly.
+struct DeviceCapabilities
+{
+	std::string name;
+	VkPhysicalDeviceType type = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+	// pipelineCacheUUID, the only UUID Vulkan 1.0 reports; it changes with the driver version
+	// and identical cards share it, those are told apart by index
+	uint8_t uuid[VK_UUID_SIZE] = {};
+	VkDeviceSize device_local_bytes = 0; // of the largest device local heap
+	int dedicated_transfer_family = -1; // transfer without graphics or compute, a DMA engine
+	int dedicated_compute_family = -1; // compute without graphics
+	bool timestamps = false; // every graphics and compute queue can write timestamps
+	VkPhysicalDeviceLimits limits = {};
+	VkPhysicalDeviceFeatures supported = {};
+	VkPhysicalDeviceFeatures enabled = {};
+};
+
+const char* deviceTypeName(VkPhysicalDeviceType type);
+
+DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice device);
+
+// Higher is better. The device type dominates, so a discrete GPU wins over an integrated one
+// whatever their memory; within a type memory, queue topology, features and limits decide.
+uint64_t scoreDevice(const DeviceCapabilities& capabilities);
+
+// One line: name, type, memory, extra queues and UUID
+std::string describeDevice(const DeviceCapabilities& capabilities);
+
+// selector is the UUID as 32 hex digits (dashes ignored), the index in enumeration order
+// or a case insensitive part of the name
+bool matchesDeviceSelector(const DeviceCapabilities& capabilities, uint32_t index, const std::string& selector);
+
+// The features the renderer has a use for, where supported: anisotropic filtering for the
+// texture sampler and, when asked for, pipeline statistics queries
+VkPhysicalDeviceFeatures selectDeviceFeatures(const DeviceCapabilities& capabilities, bool pipeline_statistics);
@@ -0,0 +1,83 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+constexpr float DynamicResolution::LOWER_BAND;
+constexpr uint32_t DynamicResolution::OVER_FRAMES;
+constexpr uint32_t DynamicResolution::UNDER_FRAMES;
+constexpr float DynamicResolution::SMOOTHING;
+constexpr float DynamicResolution::SCALE_STEP;
+
+DynamicResolution::DynamicResolution(float target_ms, float min_scale, float max_scale, size_t history_size)
+	: target_ms(target_ms)
+	, min_scale(min_scale)
+	, max_scale(max_scale)
+	, scale(max_scale)
+	, history_size(std::max<size_t>(history_size, 1))
+{
+	if (target_ms <= 0.0f)
+	{
+		throw std::runtime_error("GPU frame time target must be positive");
+	}
+	if (min_scale <= 0.0f || min_scale > max_scale)
+	{
+		throw std::runtime_error("Resolution scale range must satisfy 0 < min <= max");
+	}
+	history.reserve(this->history_size);
+}
+
+float DynamicResolution::update(float gpu_time_ms)
+{
+	Sample sample = { frame++, gpu_time_ms, scale };
+	if (history.size() < history_size)
+	{
+		history.push_back(sample);
+	}
+	else
+	{
+		history[history_next] = sample;
+	}
+	history_next = (history_next + 1) % history_size;
+
+	smoothed_ms = smoothed_ms == 0.0f ? gpu_time_ms
+		: smoothed_ms + SMOOTHING * (gpu_time_ms - smoothed_ms);
+
+	over_count = smoothed_ms > target_ms ? over_count + 1 : 0;
+	under_count = smoothed_ms < LOWER_BAND * target_ms ? under_count + 1 : 0;
+	bool can_grow = scale < max_scale;
+	bool can_shrink = scale > min_scale;
+	if (!(over_count >= OVER_FRAMES && can_shrink) && !(under_count >= UNDER_FRAMES && can_grow))
+	{
+		return scale;
+	}
+
+	// time goes with the pixel count, aim at the middle of the band
+	float aim_ms = 0.5f * (1.0f + LOWER_BAND) * target_ms;
+	float new_scale = scale * std::sqrt(aim_ms / smoothed_ms);
+	new_scale = std::round(new_scale / SCALE_STEP) * SCALE_STEP;
+	new_scale = std::min(std::max(new_scale, min_scale), max_scale);
+
+	over_count = 0;
+	under_count = 0;
+	if (new_scale != scale)
+	{
+		// expect the new time until measurements catch up
+		smoothed_ms *= (new_scale * new_scale) / (scale * scale);
+		scale = new_scale;
+		change_count++;
+	}
+	return scale;
+}
+
+std::vector<DynamicResolution::Sample> DynamicResolution::getHistory() const
+{
+	if (history.size() < history_size)
+	{
+		return history;
+	}
+	std::vector<Sample> ordered(history.begin() + history_next, history.end());
+	ordered.insert(ordered.end(), history.begin(), history.begin() + history_next);
+	return ordered;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Picks the render resolution scale from measured GPU frame times.
+// The scale applies to both axes, so the pixel count and roughly the
+// GPU time go with its square.
+class DynamicResolution
+{
+public:
+	struct Sample
+	{
+		uint64_t frame;
+		float gpu_time_ms; // as measured
+		float scale; // used for the frame
+	};
+
+	DynamicResolution(float target_ms, float min_scale = 0.5f, float max_scale = 1.0f
+		, size_t history_size = 600);
+
+	// Feeds the GPU time of the last completed frame, rendered at getScale(),
+	// and returns the scale for the next frame
+	float update(float gpu_time_ms);
+
+	float getScale() const { return scale; }
+	float getTargetMs() const { return target_ms; }
+	uint32_t getChangeCount() const { return change_count; }
+	// the last history_size samples, oldest first
+	std::vector<Sample> getHistory() const;
+
+	// Hysteresis: nothing changes while the smoothed time stays between
+	// LOWER_BAND * target and the target. Going over has to last OVER_FRAMES
+	// frames and staying under UNDER_FRAMES frames before the scale moves,
+	// then it aims at the middle of the band.
+	static constexpr float LOWER_BAND = 0.85f;
+	static constexpr uint32_t OVER_FRAMES = 3;
+	static constexpr uint32_t UNDER_FRAMES = 30;
+	static constexpr float SMOOTHING = 0.2f; // weight of a new sample in the moving average
+	static constexpr float SCALE_STEP = 1.0f / 32.0f; // scales are rounded to this
+
+private:
+	float target_ms;
+	float min_scale;
+	float max_scale;
+	float scale;
+
+	float smoothed_ms = 0.0f;
+	uint32_t over_count = 0;
+	uint32_t under_count = 0;
+	uint32_t change_count = 0;
+
+	// ring buffer
+	std::vector<Sample> history;
+	size_t history_size;
+	size_t history_next = 0;
+	uint64_t frame = 0;
+};
@@ -0,0 +1,336 @@
+#include "FrameCapture.h"
+#include "TraceProfiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+const char* captureFormatName(CaptureFormat format)
+{
+	switch (format)
+	{
+	case CaptureFormat::PNG: return "png";
+	case CaptureFormat::RAW: return "raw";
+	default: return "ppm";
+	}
+}
+
+CaptureFormat parseCaptureFormat(const std::string& name)
+{
+	for (auto format : { CaptureFormat::PPM, CaptureFormat::PNG, CaptureFormat::RAW })
+	{
+		if (name == captureFormatName(format))
+		{
+			return format;
+		}
+	}
+	throw std::runtime_error("Unknown capture format " + name);
+}
+
+// rows of RGB, the alpha of a presented image means nothing
+static std::vector<uint8_t> toRgb(const CapturedFrame& frame)
+{
+	size_t pixel_count = (size_t)frame.width * frame.height;
+	std::vector<uint8_t> rgb(pixel_count * 3);
+	int red = frame.bgra ? 2 : 0;
+	int blue = frame.bgra ? 0 : 2;
+	for (size_t i = 0; i < pixel_count; i++)
+	{
+		rgb[i * 3 + 0] = frame.pixels[i * 4 + red];
+		rgb[i * 3 + 1] = frame.pixels[i * 4 + 1];
+		rgb[i * 3 + 2] = frame.pixels[i * 4 + blue];
+	}
+	return rgb;
+}
+
+static std::ofstream openOutput(const std::string& path)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+	return file;
+}
+
+void writePpm(const std::string& path, const CapturedFrame& frame)
+{
+	auto rgb = toRgb(frame);
+	auto file = openOutput(path);
+	file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+	file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+}
+
+static const std::array<uint32_t, 256>& crcTable()
+{
+	static const std::array<uint32_t, 256> table = []()
+	{
+		std::array<uint32_t, 256> result;
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			result[n] = c;
+		}
+		return result;
+	}();
+	return table;
+}
+
+static uint32_t updateCrc(uint32_t crc, const uint8_t* data, size_t size)
+{
+	const auto& table = crcTable();
+	for (size_t i = 0; i < size; i++)
+	{
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back((uint8_t)(value >> 24));
+	out.push_back((uint8_t)(value >> 16));
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)value);
+}
+
+static void writeChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> header;
+	appendBigEndian(header, (uint32_t)data.size());
+	header.insert(header.end(), type, type + 4);
+	uint32_t crc = updateCrc(0xffffffffu, header.data() + 4, 4);
+	crc = updateCrc(crc, data.data(), data.size()) ^ 0xffffffffu;
+	std::vector<uint8_t> footer;
+	appendBigEndian(footer, crc);
+
+	file.write(reinterpret_cast<const char*>(header.data()), header.size());
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+}
+
+void writePng(const std::string& path, const CapturedFrame& frame)
+{
+	// every row starts with filter type 0
+	auto rgb = toRgb(frame);
+	size_t row_size = (size_t)frame.width * 3;
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve((row_size + 1) * frame.height);
+	for (uint32_t y = 0; y < frame.height; y++)
+	{
+		scanlines.push_back(0);
+		scanlines.insert(scanlines.end(), rgb.begin() + y * row_size, rgb.begin() + (y + 1) * row_size);
+	}
+
+	// zlib stream of stored deflate blocks: bigger files, but no time spent compressing
+	const size_t MAX_BLOCK = 65535;
+	std::vector<uint8_t> idat;
+	idat.reserve(scanlines.size() + scanlines.size() / MAX_BLOCK * 5 + 16);
+	idat.push_back(0x78);
+	idat.push_back(0x01);
+	uint32_t adler_a = 1, adler_b = 0;
+	size_t offset = 0;
+	do
+	{
+		size_t block_size = std::min(MAX_BLOCK, scanlines.size() - offset);
+		bool last = offset + block_size == scanlines.size();
+		idat.push_back(last ? 1 : 0);
+		idat.push_back((uint8_t)block_size);
+		idat.push_back((uint8_t)(block_size >> 8));
+		idat.push_back((uint8_t)~block_size);
+		idat.push_back((uint8_t)(~block_size >> 8));
+		idat.insert(idat.end(), scanlines.begin() + offset, scanlines.begin() + offset + block_size);
+		for (size_t i = offset; i < offset + block_size; i++)
+		{
+			adler_a = (adler_a + scanlines[i]) % 65521;
+			adler_b = (adler_b + adler_a) % 65521;
+		}
+		offset += block_size;
+	} while (offset < scanlines.size());
+	appendBigEndian(idat, (adler_b << 16) | adler_a);
+
+	std::vector<uint8_t> ihdr;
+	appendBigEndian(ihdr, frame.width);
+	appendBigEndian(ihdr, frame.height);
+	ihdr.push_back(8); // bit depth
+	ihdr.push_back(2); // truecolor
+	ihdr.push_back(0); // deflate
+	ihdr.push_back(0); // adaptive filtering
+	ihdr.push_back(0); // no interlace
+
+	auto file = openOutput(path);
+	const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+	writeChunk(file, "IHDR", ihdr);
+	writeChunk(file, "IDAT", idat);
+	writeChunk(file, "IEND", {});
+}
+
+FrameEncoder::FrameEncoder(CaptureFormat format, const std::string& path, unsigned worker_count, size_t max_queue_depth)
+	: format(format)
+	, path(path)
+	, max_queue_depth(std::max<size_t>(max_queue_depth, 1))
+{
+	if (format == CaptureFormat::RAW)
+	{
+		raw_stream = openOutput(path);
+		worker_count = 1;
+	}
+	worker_count = std::max(worker_count, 1u);
+	for (unsigned i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back(&FrameEncoder::work, this);
+	}
+}
+
+FrameEncoder::~FrameEncoder()
+{
+	finish();
+}
+
+void FrameEncoder::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	queue_condition.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+bool FrameEncoder::submit(CapturedFrame&& frame)
+{
+	{
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		if (stopping || queue.size() >= max_queue_depth)
+		{
+			stats.dropped_frames++;
+			lock.unlock();
+			if (frame.release)
+			{
+				frame.release();
+			}
+			return false;
+		}
+		queue.push_back(std::move(frame));
+		stats.max_queue_depth = std::max(stats.max_queue_depth, queue.size());
+	}
+	queue_condition.notify_one();
+	return true;
+}
+
+void FrameEncoder::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	idle_condition.wait(lock, [this]() { return queue.empty() && encoding_frames == 0; });
+}
+
+CaptureStats FrameEncoder::getStats() const
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	return stats;
+}
+
+size_t FrameEncoder::getQueueDepth() const
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	return queue.size();
+}
+
+void FrameEncoder::work()
+{
+	TraceProfiler::setThreadName("capture encoder");
+	while (true)
+	{
+		CapturedFrame frame;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty())
+			{
+				return; // stopping and drained
+			}
+			frame = std::move(queue.front());
+			queue.pop_front();
+			encoding_frames++;
+		}
+
+		bool encoded = true;
+		try
+		{
+			encode(frame);
+		}
+		catch (const std::runtime_error& e)
+		{
+			// an exception would end the program from this thread
+			std::cerr << "Capture of frame " << frame.frame << " failed: " << e.what() << std::endl;
+			encoded = false;
+		}
+		if (frame.release)
+		{
+			frame.release();
+		}
+
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (encoded)
+		{
+			stats.encoded_frames++;
+		}
+		else
+		{
+			stats.dropped_frames++;
+		}
+		encoding_frames--;
+		if (queue.empty() && encoding_frames == 0)
+		{
+			idle_condition.notify_all();
+		}
+	}
+}
+
+void FrameEncoder::encode(const CapturedFrame& frame)
+{
+	TRACE_SCOPE("FrameEncoder::encode");
+	if (format == CaptureFormat::RAW)
+	{
+		// only one worker, so frames stay in order
+		size_t size = (size_t)frame.width * frame.height * 4;
+		if (frame.bgra)
+		{
+			std::vector<uint8_t> rgba(frame.pixels, frame.pixels + size);
+			for (size_t i = 0; i < rgba.size(); i += 4)
+			{
+				std::swap(rgba[i], rgba[i + 2]);
+			}
+			raw_stream.write(reinterpret_cast<const char*>(rgba.data()), rgba.size());
+		}
+		else
+		{
+			raw_stream.write(reinterpret_cast<const char*>(frame.pixels), size);
+		}
+		raw_stream.flush();
+		return;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "frame_%06llu.", (unsigned long long)frame.frame);
+	std::string file_path = path + "/" + name + captureFormatName(format);
+	if (format == CaptureFormat::PNG)
+	{
+		writePng(file_path, frame);
+	}
+	else
+	{
+		writePpm(file_path, frame);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Encodes frames read back from the GPU on worker threads, so that the
+// render loop only hands over mapped memory.
+
+enum class CaptureFormat
+{
+	PPM, // one binary P6 file per frame
+	PNG, // one file per frame, uncompressed deflate to keep up with the frame rate
+	RAW, // RGBA8 frames appended to a single file or pipe, for e.g. ffmpeg -f rawvideo
+};
+
+const char* captureFormatName(CaptureFormat format);
+// from the name returned by captureFormatName, throws on unknown names
+CaptureFormat parseCaptureFormat(const std::string& name);
+
+struct CapturedFrame
+{
+	uint64_t frame = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	bool bgra = false; // B8G8R8A8 instead of R8G8B8A8
+	const uint8_t* pixels = nullptr; // tightly packed rows of 4 bytes per pixel, valid until release
+	std::function<void()> release; // called once the pixels are no longer read, also when the frame is dropped
+};
+
+struct CaptureStats
+{
+	uint64_t encoded_frames = 0;
+	uint64_t dropped_frames = 0; // the queue was full
+	size_t max_queue_depth = 0;
+};
+
+void writePpm(const std::string& path, const CapturedFrame& frame);
+void writePng(const std::string& path, const CapturedFrame& frame);
+
+class FrameEncoder
+{
+public:
+	// For PPM and PNG path is a folder that frame_<number> files go to,
+	// for RAW the file or pipe the frames are streamed to. RAW uses a single
+	// worker to keep the frames in order.
+	FrameEncoder(CaptureFormat format, const std::string& path, unsigned worker_count = 2, size_t max_queue_depth = 8);
+	// encodes what is still queued
+	~FrameEncoder();
+	// encodes what is still queued and stops the workers, later frames are dropped
+	void finish();
+
+	FrameEncoder(const FrameEncoder&) = delete;
+	FrameEncoder& operator=(const FrameEncoder&) = delete;
+
+	// false when the queue is full and the frame is dropped, never blocks
+	bool submit(CapturedFrame&& frame);
+	// blocks until every submitted frame is encoded and released
+	void waitIdle();
+
+	CaptureStats getStats() const;
+	size_t getQueueDepth() const;
+	size_t getMaxQueueDepth() const { return max_queue_depth; }
+
+private:
+	CaptureFormat format;
+	std::string path;
+	size_t max_queue_depth;
+	std::ofstream raw_stream;
+
+	mutable std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	std::deque<CapturedFrame> queue;
+	std::condition_variable idle_condition;
+	size_t encoding_frames = 0; // taken from the queue by a worker
+	bool stopping = false;
+	CaptureStats stats;
+
+	std::vector<std::thread> workers;
+
+	void work();
+	void encode(const CapturedFrame& frame);
+};
@@ -0,0 +1,242 @@
+#include "FramePacing.h"
+#include "Benchmark.h"
+#include "TraceProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+const char* pacingPresetName(PacingPreset preset)
+{
+	switch (preset)
+	{
+	case PacingPreset::LOW_LATENCY: return "low-latency";
+	case PacingPreset::MAX_THROUGHPUT: return "throughput";
+	default: return "default";
+	}
+}
+
+PacingPreset parsePacingPreset(const std::string& name)
+{
+	for (auto preset : { PacingPreset::DEFAULT, PacingPreset::LOW_LATENCY, PacingPreset::MAX_THROUGHPUT })
+	{
+		if (name == pacingPresetName(preset))
+		{
+			return preset;
+		}
+	}
+	throw std::runtime_error("Unknown pacing preset " + name);
+}
+
+const char* presentModeName(VkPresentModeKHR mode)
+{
+	switch (mode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+	default: return "unknown";
+	}
+}
+
+VkPresentModeKHR parsePresentMode(const std::string& name)
+{
+	for (auto mode : { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR
+		, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR })
+	{
+		if (name == presentModeName(mode))
+		{
+			return mode;
+		}
+	}
+	throw std::runtime_error("Unknown present mode " + name);
+}
+
+PresentPolicy presentPolicyFor(PacingPreset preset)
+{
+	switch (preset)
+	{
+	case PacingPreset::LOW_LATENCY:
+		// mailbox replaces the queued frame instead of waiting behind it,
+		// tearing is preferred over the latency of vsync
+		return { { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR }, 0 };
+	case PacingPreset::MAX_THROUGHPUT:
+		return { { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR }, 2 };
+	default:
+		return { { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR }, 1 };
+	}
+}
+
+constexpr std::chrono::microseconds FrameLimiter::SPIN_MARGIN;
+
+FrameLimiter::FrameLimiter(double target_fps)
+{
+	setTargetFps(target_fps);
+}
+
+void FrameLimiter::setTargetFps(double target_fps)
+{
+	if (target_fps < 0.0)
+	{
+		throw std::runtime_error("FPS limit can't be negative");
+	}
+	this->target_fps = target_fps;
+	period = target_fps > 0.0
+		? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / target_fps))
+		: Clock::duration::zero();
+	started = false;
+}
+
+void FrameLimiter::wait()
+{
+	TRACE_SCOPE("FrameLimiter::wait");
+	if (period == Clock::duration::zero())
+	{
+		return;
+	}
+
+	auto now = Clock::now();
+	if (!started)
+	{
+		started = true;
+		next_frame = now + period;
+		return;
+	}
+
+	if (next_frame - now > SPIN_MARGIN)
+	{
+		std::this_thread::sleep_for(next_frame - now - SPIN_MARGIN);
+	}
+	while (Clock::now() < next_frame)
+	{
+		// spin out the rest
+	}
+
+	// keep a steady cadence, but don't try to catch up on frames that ran long
+	next_frame += period;
+	now = Clock::now();
+	if (next_frame < now)
+	{
+		next_frame = now + period;
+	}
+}
+
+double processCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+	{
+		return 0.0;
+	}
+	// in 100 ns units
+	auto to_seconds = [](const FILETIME& time)
+	{
+		return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) * 1e-7;
+	};
+	return to_seconds(kernel_time) + to_seconds(user_time);
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0.0;
+	}
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+		+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+void FramePacingStats::begin()
+{
+	frame_times_ms.clear();
+	latencies_ms.clear();
+	begin_time = std::chrono::steady_clock::now();
+	begin_cpu_seconds = processCpuSeconds();
+}
+
+void FramePacingStats::addFrame(double frame_time_ms, double input_to_present_ms)
+{
+	frame_times_ms.push_back(frame_time_ms);
+	latencies_ms.push_back(input_to_present_ms);
+}
+
+static double mean(const std::vector<double>& values)
+{
+	return values.empty() ? 0.0 : std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+}
+
+FramePacingSummary FramePacingStats::summarize() const
+{
+	FramePacingSummary summary;
+	summary.frame_count = frame_times_ms.size();
+	summary.frame_time_mean_ms = mean(frame_times_ms);
+	double square_sum = 0.0;
+	for (double frame_time : frame_times_ms)
+	{
+		square_sum += (frame_time - summary.frame_time_mean_ms) * (frame_time - summary.frame_time_mean_ms);
+	}
+	summary.frame_time_stddev_ms = frame_times_ms.empty() ? 0.0 : std::sqrt(square_sum / frame_times_ms.size());
+	summary.frame_time_p99_ms = percentile(frame_times_ms, 0.99);
+	summary.frame_time_max_ms = frame_times_ms.empty() ? 0.0 : *std::max_element(frame_times_ms.begin(), frame_times_ms.end());
+	summary.latency_mean_ms = mean(latencies_ms);
+	summary.latency_p99_ms = percentile(latencies_ms, 0.99);
+
+	double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_time).count();
+	if (wall_seconds > 0.0)
+	{
+		summary.cpu_utilization = (processCpuSeconds() - begin_cpu_seconds) / wall_seconds;
+	}
+	return summary;
+}
+
+constexpr std::chrono::milliseconds ResizeCoalescer::DEFAULT_SETTLE_TIME;
+constexpr std::chrono::milliseconds ResizeCoalescer::DEFAULT_MAX_INTERVAL;
+
+ResizeCoalescer::ResizeCoalescer(std::chrono::milliseconds settle_time, std::chrono::milliseconds max_interval)
+	: settle_time(settle_time)
+	, max_interval(max_interval)
+{
+}
+
+void ResizeCoalescer::onResize(Clock::time_point now)
+{
+	if (!pending)
+	{
+		pending = true;
+		first_event = now;
+	}
+	last_event = now;
+	event_count++;
+}
+
+void ResizeCoalescer::onSuboptimal(Clock::time_point now)
+{
+	// only the first report is an event, the size didn't change again
+	if (!pending)
+	{
+		onResize(now);
+	}
+}
+
+bool ResizeCoalescer::isDue(Clock::time_point now) const
+{
+	return pending && (now - last_event >= settle_time || now - first_event >= max_interval);
+}
+
+void ResizeCoalescer::onRecreated()
+{
+	pending = false;
+	recreation_count++;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Present mode and swap chain length choices, an FPS limiter and the
+// measurements to compare them.
+
+enum class PacingPreset
+{
+	DEFAULT, // mailbox if available, one image more than the minimum
+	LOW_LATENCY, // mailbox or immediate, the fewest images so frames don't queue up
+	MAX_THROUGHPUT, // immediate if available, two spare images so the CPU never waits for one
+};
+
+const char* pacingPresetName(PacingPreset preset);
+// from the name returned by pacingPresetName, throws on unknown names
+PacingPreset parsePacingPreset(const std::string& name);
+
+const char* presentModeName(VkPresentModeKHR mode);
+// fifo, fifo-relaxed, mailbox or immediate, throws on unknown names
+VkPresentModeKHR parsePresentMode(const std::string& name);
+
+struct PresentPolicy
+{
+	std::vector<VkPresentModeKHR> present_modes; // in order of preference, FIFO is always available
+	uint32_t extra_images; // on top of minImageCount
+};
+
+PresentPolicy presentPolicyFor(PacingPreset preset);
+
+// Caps the frame rate. Sleeping is only accurate to a millisecond or so,
+// so it sleeps until SPIN_MARGIN before the frame is due and spins the rest.
+class FrameLimiter
+{
+public:
+	// 0 disables limiting
+	explicit FrameLimiter(double target_fps = 0.0);
+
+	void setTargetFps(double target_fps);
+	double getTargetFps() const { return target_fps; }
+
+	// blocks until the next frame is due
+	void wait();
+
+	static constexpr std::chrono::microseconds SPIN_MARGIN{ 1500 };
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	double target_fps = 0.0;
+	Clock::duration period = Clock::duration::zero();
+	Clock::time_point next_frame;
+	bool started = false;
+};
+
+// CPU time used by the whole process so far, in seconds
+double processCpuSeconds();
+
+struct FramePacingSummary
+{
+	size_t frame_count = 0;
+	double frame_time_mean_ms = 0.0;
+	double frame_time_stddev_ms = 0.0;
+	double frame_time_p99_ms = 0.0;
+	double frame_time_max_ms = 0.0;
+	double latency_mean_ms = 0.0;
+	double latency_p99_ms = 0.0;
+	double cpu_utilization = 0.0; // process CPU time over wall time, 1 is one busy core
+};
+
+// Collects per frame timings between begin() and summarize()
+class FramePacingStats
+{
+public:
+	void begin();
+	// time since the previous present, and from sampling input to the present call returning
+	void addFrame(double frame_time_ms, double input_to_present_ms);
+	FramePacingSummary summarize() const;
+
+private:
+	std::vector<double> frame_times_ms;
+	std::vector<double> latencies_ms;
+	std::chrono::steady_clock::time_point begin_time;
+	double begin_cpu_seconds = 0.0;
+};
+
+// Turns the resize events of a window drag, one per pixel it moves, into a few swap chain
+// recreations. One is due once no event came for settle_time, or max_interval after the first
+// event since the last recreation while they keep coming. Zero for both recreates on every event.
+class ResizeCoalescer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ResizeCoalescer(std::chrono::milliseconds settle_time, std::chrono::milliseconds max_interval);
+
+	// the window changed size
+	void onResize(Clock::time_point now = Clock::now());
+	// presenting reported a suboptimal swap chain, which it keeps doing until it is recreated
+	void onSuboptimal(Clock::time_point now = Clock::now());
+	bool isDue(Clock::time_point now = Clock::now()) const;
+	// recreated, due or because the swap chain went out of date
+	void onRecreated();
+
+	bool isPending() const { return pending; }
+	uint64_t getEventCount() const { return event_count; }
+	uint64_t getRecreationCount() const { return recreation_count; }
+
+	static constexpr std::chrono::milliseconds DEFAULT_SETTLE_TIME{ 50 };
+	// a drag still follows the window a few times a second
+	static constexpr std::chrono::milliseconds DEFAULT_MAX_INTERVAL{ 200 };
+
+private:
+	Clock::duration settle_time;
+	Clock::duration max_interval;
+	bool pending = false;
+	Clock::time_point first_event; // since the last recreation
+	Clock::time_point last_event;
+	uint64_t event_count = 0;
+	uint64_t recreation_count = 0;
+};
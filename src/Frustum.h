@@ -0,0 +1,77 @@
+#pragma once
+
+#ifndef GLM_FORCE_RADIANS
+#define GLM_FORCE_RADIANS
+#endif
+#ifndef GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#endif
+#include <glm/glm.hpp>
+
+#include <array>
+
+// Six clipping planes stored as (normal, distance) with normals pointing into the frustum,
+// so a point p is inside a plane when dot(normal, p) + distance >= 0
+struct Frustum
+{
+	enum Plane { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+
+	std::array<glm::vec4, PLANE_COUNT> planes;
+
+	// Extracts the planes from a (projection * view * model) matrix (Gribb & Hartmann).
+	// The planes end up in the space the matrix transforms from.
+	// Expects Vulkan's 0 to 1 clip space depth range.
+	static Frustum fromMatrix(const glm::mat4& m)
+	{
+		// glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 row0 = { m[0][0], m[1][0], m[2][0], m[3][0] };
+		glm::vec4 row1 = { m[0][1], m[1][1], m[2][1], m[3][1] };
+		glm::vec4 row2 = { m[0][2], m[1][2], m[2][2], m[3][2] };
+		glm::vec4 row3 = { m[0][3], m[1][3], m[2][3], m[3][3] };
+
+		Frustum frustum;
+		frustum.planes[LEFT] = row3 + row0;
+		frustum.planes[RIGHT] = row3 - row0;
+		frustum.planes[BOTTOM] = row3 + row1;
+		frustum.planes[TOP] = row3 - row1;
+		frustum.planes[NEAR_PLANE] = row2; // depth starts at 0 instead of -w
+		frustum.planes[FAR_PLANE] = row3 - row2;
+
+		for (auto& plane : frustum.planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+
+	bool intersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const auto& plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// conservative test, may keep boxes that are outside near the frustum corners
+	bool intersectsAABB(const glm::vec3& box_min, const glm::vec3& box_max) const
+	{
+		for (const auto& plane : planes)
+		{
+			// the box corner furthest along the plane normal
+			glm::vec3 positive_vertex = {
+				plane.x >= 0.0f ? box_max.x : box_min.x,
+				plane.y >= 0.0f ? box_max.y : box_min.y,
+				plane.z >= 0.0f ? box_max.z : box_min.z
+			};
+			if (glm::dot(glm::vec3(plane), positive_vertex) + plane.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
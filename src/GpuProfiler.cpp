@@ -0,0 +1,195 @@
+#include "GpuProfiler.h"
+#include "DeferredDestruction.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+constexpr VkQueryPipelineStatisticFlags GpuProfiler::STATISTICS;
+
+GpuProfiler::GpuProfiler(const VDevice& device, float timestamp_period, uint64_t timestamp_mask
+	, bool pipeline_statistics, size_t history_size)
+	: device(device)
+	, timestamp_period(timestamp_period)
+	, timestamp_mask(timestamp_mask)
+	, pipeline_statistics(pipeline_statistics)
+	, history_size(std::max<size_t>(history_size, 1))
+{
+}
+
+uint32_t GpuProfiler::addPass(const std::string& name)
+{
+	if (!timestamp_pools.empty())
+	{
+		throw std::runtime_error("GPU profiler passes have to be added before the query pools are created");
+	}
+	pass_names.push_back(name);
+	return (uint32_t)pass_names.size() - 1;
+}
+
+void GpuProfiler::createPools(uint32_t pool_count, DeferredDestruction* deferred_destruction)
+{
+	if (deferred_destruction)
+	{
+		deferred_destruction->retire(timestamp_pools);
+		deferred_destruction->retire(statistics_pools);
+	}
+	timestamp_pools.clear();
+	statistics_pools.clear();
+	recorded_passes.assign(pool_count, std::vector<bool>(pass_names.size(), false));
+
+	for (uint32_t i = 0; i < pool_count; i++)
+	{
+		VkQueryPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		pool_info.queryCount = 2 * (uint32_t)pass_names.size();
+		timestamp_pools.emplace_back(device);
+		if (vkCreateQueryPool(device, &pool_info, nullptr, &timestamp_pools.back()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create GPU profiler timestamp query pool!");
+		}
+
+		if (pipeline_statistics)
+		{
+			pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			pool_info.queryCount = (uint32_t)pass_names.size();
+			pool_info.pipelineStatistics = STATISTICS;
+			statistics_pools.emplace_back(device);
+			if (vkCreateQueryPool(device, &pool_info, nullptr, &statistics_pools.back()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create GPU profiler pipeline statistics query pool!");
+			}
+		}
+	}
+}
+
+void GpuProfiler::recordReset(VkCommandBuffer command_buffer, uint32_t pool)
+{
+	vkCmdResetQueryPool(command_buffer, timestamp_pools[pool], 0, 2 * (uint32_t)pass_names.size());
+	if (pipeline_statistics)
+	{
+		vkCmdResetQueryPool(command_buffer, statistics_pools[pool], 0, (uint32_t)pass_names.size());
+	}
+	std::fill(recorded_passes[pool].begin(), recorded_passes[pool].end(), false);
+}
+
+void GpuProfiler::recordBegin(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass)
+{
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_pools[pool], 2 * pass);
+	if (pipeline_statistics)
+	{
+		vkCmdBeginQuery(command_buffer, statistics_pools[pool], pass, 0);
+	}
+}
+
+void GpuProfiler::recordEnd(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass)
+{
+	if (pipeline_statistics)
+	{
+		vkCmdEndQuery(command_buffer, statistics_pools[pool], pass);
+	}
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pools[pool], 2 * pass + 1);
+	recorded_passes[pool][pass] = true;
+}
+
+bool GpuProfiler::collect(uint32_t pool, uint64_t frame)
+{
+	std::vector<PassResult> results(pass_names.size());
+	for (uint32_t pass = 0; pass < pass_names.size(); pass++)
+	{
+		if (!recorded_passes[pool][pass])
+		{
+			continue;
+		}
+
+		uint64_t timestamps[2];
+		auto result = vkGetQueryPoolResults(device, timestamp_pools[pool], 2 * pass, 2
+			, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS)
+		{
+			return false; // VK_NOT_READY
+		}
+		results[pass].gpu_time_ms = (float)(((timestamps[1] - timestamps[0]) & timestamp_mask) * timestamp_period / 1e6);
+
+		if (pipeline_statistics)
+		{
+			// in the order of the STATISTICS bits
+			uint64_t counts[4];
+			result = vkGetQueryPoolResults(device, statistics_pools[pool], pass, 1
+				, sizeof(counts), counts, sizeof(counts), VK_QUERY_RESULT_64_BIT);
+			if (result != VK_SUCCESS)
+			{
+				return false;
+			}
+			results[pass].statistics.vertex_invocations = counts[0];
+			results[pass].statistics.clipping_primitives = counts[1];
+			results[pass].statistics.fragment_invocations = counts[2];
+			results[pass].statistics.compute_invocations = counts[3];
+		}
+		results[pass].valid = true;
+	}
+
+	auto& sample = sampleOf(frame);
+	for (size_t pass = 0; pass < results.size(); pass++)
+	{
+		if (results[pass].valid)
+		{
+			sample.passes[pass] = results[pass];
+		}
+	}
+	return true;
+}
+
+GpuProfiler::FrameSample& GpuProfiler::sampleOf(uint64_t frame)
+{
+	// pools of the same frame are collected close together, look from the newest sample
+	for (auto it = history.rbegin(); it != history.rend(); ++it)
+	{
+		if (it->frame == frame)
+		{
+			return *it;
+		}
+	}
+	if (history.size() >= history_size)
+	{
+		history.pop_front();
+	}
+	history.push_back({ frame, std::vector<PassResult>(pass_names.size()) });
+	return history.back();
+}
+
+std::vector<GpuPassSummary> GpuProfiler::summarize(uint64_t first_frame) const
+{
+	std::vector<GpuPassSummary> summaries;
+	for (size_t pass = 0; pass < pass_names.size(); pass++)
+	{
+		std::vector<double> times_ms;
+		GpuPassSummary summary;
+		summary.name = pass_names[pass];
+		summary.has_statistics = pipeline_statistics;
+		for (const auto& sample : history)
+		{
+			const auto& result = sample.passes[pass];
+			if (sample.frame < first_frame || !result.valid)
+			{
+				continue;
+			}
+			times_ms.push_back(result.gpu_time_ms);
+			summary.vertex_invocations += (double)result.statistics.vertex_invocations;
+			summary.clipping_primitives += (double)result.statistics.clipping_primitives;
+			summary.fragment_invocations += (double)result.statistics.fragment_invocations;
+			summary.compute_invocations += (double)result.statistics.compute_invocations;
+		}
+		if (times_ms.empty())
+		{
+			continue;
+		}
+		summary.time = summarizeTimings(times_ms);
+		summary.vertex_invocations /= times_ms.size();
+		summary.clipping_primitives /= times_ms.size();
+		summary.fragment_invocations /= times_ms.size();
+		summary.compute_invocations /= times_ms.size();
+		summaries.push_back(summary);
+	}
+	return summaries;
+}
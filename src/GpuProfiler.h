@@ -0,0 +1,94 @@
+#pragma once
+
+#include "VHandle.h"
+#include "Benchmark.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+class DeferredDestruction;
+
+// Measures the GPU time of named passes with timestamp queries, and optionally
+// counts their shader invocations with pipeline statistics queries.
+// Every command buffer gets a pool of its own, since pre-recorded command
+// buffers can't change which queries they write. Results are read without
+// waiting and kept for the last history_size frames.
+class GpuProfiler
+{
+public:
+	struct PipelineStatistics
+	{
+		uint64_t vertex_invocations = 0;
+		uint64_t clipping_primitives = 0;
+		uint64_t fragment_invocations = 0;
+		uint64_t compute_invocations = 0;
+	};
+
+	struct PassResult
+	{
+		bool valid = false; // the pass ran in this frame and its queries were available
+		float gpu_time_ms = 0.0f;
+		PipelineStatistics statistics;
+	};
+
+	struct FrameSample
+	{
+		uint64_t frame;
+		std::vector<PassResult> passes; // indexed like getPassNames()
+	};
+
+	// timestamp_period and timestamp_mask from the device limits and the queue family,
+	// pipeline_statistics needs the pipelineStatisticsQuery feature to be enabled
+	GpuProfiler(const VDevice& device, float timestamp_period, uint64_t timestamp_mask
+		, bool pipeline_statistics, size_t history_size = 600);
+
+	// passes are added before createPools, returns the index to record it with
+	uint32_t addPass(const std::string& name);
+	// One pool per command buffer that records passes, recreating drops what was not collected.
+	// The old pools are retired through deferred_destruction when given, destroyed right away otherwise.
+	void createPools(uint32_t pool_count, DeferredDestruction* deferred_destruction = nullptr);
+
+	// has to be recorded before the first pass of the pool, outside of a render pass
+	void recordReset(VkCommandBuffer command_buffer, uint32_t pool);
+	// passes of a pool must not overlap, and not begin inside a render pass they end outside of
+	void recordBegin(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass);
+	void recordEnd(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass);
+
+	// Reads the passes the pool's command buffer recorded into the sample of frame,
+	// false while the GPU has not finished them. Never waits.
+	bool collect(uint32_t pool, uint64_t frame);
+
+	const std::vector<std::string>& getPassNames() const { return pass_names; }
+	bool hasPipelineStatistics() const { return pipeline_statistics; }
+	// oldest first
+	const std::deque<FrameSample>& getHistory() const { return history; }
+	// over the samples from first_frame on, passes that never ran are left out
+	std::vector<GpuPassSummary> summarize(uint64_t first_frame = 0) const;
+
+	static constexpr VkQueryPipelineStatisticFlags STATISTICS =
+		VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+		| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+		| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+		| VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+private:
+	const VDevice& device;
+	float timestamp_period; // nanoseconds per tick
+	uint64_t timestamp_mask;
+	bool pipeline_statistics;
+	size_t history_size;
+
+	std::vector<std::string> pass_names;
+	std::vector<VQueryPool> timestamp_pools; // a begin and an end timestamp per pass
+	std::vector<VQueryPool> statistics_pools; // a query per pass
+	std::vector<std::vector<bool>> recorded_passes; // per pool, queries never written would never become available
+
+	std::deque<FrameSample> history;
+
+	FrameSample& sampleOf(uint64_t frame);
+};
@@ -0,0 +1,447 @@
+#include "JobSystem.h"
+#include "TraceProfiler.h"
+
+#include <stdexcept>
+#include <string>
+
+// the job system the current thread belongs to, and its state in there
+static thread_local JobSystem* current_system = nullptr;
+static thread_local void* current_state = nullptr;
+
+// for counters with a single writer, a locked add costs more than the job it counts
+static void addRelaxed(std::atomic<uint64_t>& counter, uint64_t amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+bool JobDeque::push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= (int64_t)CAPACITY)
+	{
+		return false;
+	}
+	jobs[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	// publishes the job to thieves, a release store rather than the paper's fence so that
+	// thread sanitizer follows it
+	bottom.store(b + 1, std::memory_order_release);
+	return true;
+}
+
+Job* JobDeque::pop()
+{
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+	if (t > b)
+	{
+		// empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	Job* job = jobs[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// the last job, thieves may be after it too
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			job = nullptr;
+		}
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* JobDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+	{
+		return nullptr;
+	}
+	Job* job = jobs[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+	return job;
+}
+
+JobSystem::JobSystem(unsigned worker_count)
+{
+	if (current_system)
+	{
+		throw std::runtime_error("The thread creating a job system already belongs to one");
+	}
+	if (worker_count == ~0u)
+	{
+		worker_count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		worker_count = std::max(1u, worker_count);
+	}
+	for (unsigned i = 0; i <= worker_count; i++)
+	{
+		threads.emplace_back(new ThreadState());
+		threads.back()->steal_seed = i * 2654435761u + 1;
+	}
+	current_system = this;
+	current_state = threads[0].get();
+	stats_start_ns = TraceProfiler::now();
+
+	for (unsigned i = 1; i <= worker_count; i++)
+	{
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	// what is queued still runs, the workers stop once they find nothing more
+	ThreadState& main_thread = *threads[0];
+	while (Job* job = findJob(main_thread))
+	{
+		execute(job, main_thread);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_condition.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	Job* job = main_thread_jobs.exchange(nullptr, std::memory_order_acquire);
+	while (job)
+	{
+		Job* next = job->next;
+		job->invoke(job, false);
+		if (job->allocated)
+		{
+			delete job;
+		}
+		job = next;
+	}
+	current_system = nullptr;
+	current_state = nullptr;
+}
+
+bool JobSystem::isMainThread() const
+{
+	return current_system == this && current_state == threads[0].get();
+}
+
+JobSystem::ThreadState& JobSystem::currentThread()
+{
+	if (current_system != this)
+	{
+		throw std::runtime_error("Jobs can only be queued and waited for by the main thread of the job system and by its jobs");
+	}
+	return *static_cast<ThreadState*>(current_state);
+}
+
+Job* JobSystem::allocateJob()
+{
+	ThreadState& thread = currentThread();
+	// jobs finish out of order, so busy slots are skipped, up to a point
+	for (size_t attempt = 0; attempt < 64; attempt++)
+	{
+		Job* job = &thread.jobs[thread.next_job++ % JOB_POOL_SIZE];
+		if (!job->in_use.load(std::memory_order_acquire))
+		{
+			job->in_use.store(true, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	// Waiting for a slot could deadlock: the jobs holding them may be the ones this thread is
+	// running nested in waits, each of them queuing a job of its own.
+	addRelaxed(thread.allocated_count, 1);
+	Job* job = new Job();
+	job->allocated = true;
+	return job;
+}
+
+void JobSystem::submit(Job* job)
+{
+	if (job->affinity == JobAffinity::MAIN_THREAD)
+	{
+		Job* head = main_thread_jobs.load(std::memory_order_relaxed);
+		do
+		{
+			job->next = head;
+		} while (!main_thread_jobs.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+		return;
+	}
+
+	ThreadState& thread = currentThread();
+	if (!thread.deque.push(job))
+	{
+		execute(job, thread); // the deque is full, so there is enough to do for everyone else
+		return;
+	}
+	// a worker about to sleep either sees the new signal or is counted as sleeping here
+	work_signal.fetch_add(1, std::memory_order_seq_cst);
+	if (sleeping_workers.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		sleep_condition.notify_one();
+	}
+}
+
+void JobSystem::addContinuation(JobCounter& dependency, Job* job)
+{
+	Job* head = dependency.continuations.load(std::memory_order_relaxed);
+	do
+	{
+		job->next = head;
+	} while (!dependency.continuations.compare_exchange_weak(head, job, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+	// when the last job finished before the push, nobody else will release the list
+	if (dependency.pending.load(std::memory_order_seq_cst) == 0)
+	{
+		releaseContinuations(dependency);
+	}
+}
+
+void JobSystem::releaseContinuations(JobCounter& counter)
+{
+	Job* job = counter.continuations.exchange(nullptr, std::memory_order_seq_cst);
+	while (job)
+	{
+		Job* next = job->next;
+		submit(job);
+		job = next;
+	}
+}
+
+void JobSystem::execute(Job* job, ThreadState& thread)
+{
+	// the busy time and the trace event share their timestamps, reading the clock is a good
+	// part of what an empty job costs
+	const char* name = job->name;
+	uint64_t start_ns = TraceProfiler::now();
+	thread.execute_depth++;
+	try
+	{
+		job->invoke(job, true);
+	}
+	catch (...)
+	{
+		thread.execute_depth--;
+		finish(job);
+		throw;
+	}
+	thread.execute_depth--;
+	uint64_t end_ns = TraceProfiler::now();
+	if (TraceProfiler::isEnabled())
+	{
+		TraceProfiler::addEvent(name, start_ns, end_ns);
+	}
+	// nested jobs are part of the outer one's time already
+	if (thread.execute_depth == 0)
+	{
+		addRelaxed(thread.busy_ns, end_ns - start_ns);
+	}
+	addRelaxed(thread.job_count, 1);
+	finish(job);
+}
+
+void JobSystem::finish(Job* job)
+{
+	JobCounter* counter = job->counter;
+	if (job->allocated)
+	{
+		delete job;
+	}
+	else
+	{
+		job->in_use.store(false, std::memory_order_release);
+	}
+	if (!counter)
+	{
+		return;
+	}
+	// a waiter may destroy the counter as soon as it is done, finishing holds it off until
+	// the continuations are out
+	counter->finishing.fetch_add(1, std::memory_order_seq_cst);
+	if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		releaseContinuations(*counter);
+	}
+	counter->finishing.fetch_sub(1, std::memory_order_release);
+}
+
+Job* JobSystem::findJob(ThreadState& thread)
+{
+	if (Job* job = thread.deque.pop())
+	{
+		return job;
+	}
+
+	// xorshift, so that thieves spread over the victims
+	uint32_t x = thread.steal_seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	thread.steal_seed = x;
+	size_t count = threads.size();
+	for (size_t i = 0; i < count; i++)
+	{
+		ThreadState& victim = *threads[(x + i) % count];
+		if (&victim == &thread)
+		{
+			continue;
+		}
+		if (Job* job = victim.deque.steal())
+		{
+			addRelaxed(thread.stolen_count, 1);
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::wait(const JobCounter& counter)
+{
+	ThreadState& thread = currentThread();
+	bool run_main_thread_jobs = isMainThread() && main_thread_job_depth == 0;
+	while (!counter.isDone())
+	{
+		if (run_main_thread_jobs && main_thread_jobs.load(std::memory_order_relaxed))
+		{
+			runMainThreadJobs();
+		}
+		else if (Job* job = findJob(thread))
+		{
+			execute(job, thread);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::runMainThreadJobs()
+{
+	if (!isMainThread())
+	{
+		throw std::runtime_error("Main thread jobs can only run on the main thread");
+	}
+	Job* stack = main_thread_jobs.exchange(nullptr, std::memory_order_acquire);
+	// oldest first
+	Job* queue = nullptr;
+	while (stack)
+	{
+		Job* next = stack->next;
+		stack->next = queue;
+		queue = stack;
+		stack = next;
+	}
+
+	main_thread_job_depth++;
+	while (queue)
+	{
+		Job* job = queue;
+		queue = queue->next;
+		try
+		{
+			execute(job, *threads[0]);
+		}
+		catch (...)
+		{
+			main_thread_job_depth--;
+			// the jobs after it are queued again, in their order
+			while (queue)
+			{
+				Job* requeued = queue;
+				queue = queue->next;
+				submit(requeued);
+			}
+			throw;
+		}
+	}
+	main_thread_job_depth--;
+}
+
+void JobSystem::workerLoop(unsigned index)
+{
+	current_system = this;
+	current_state = threads[index].get();
+	if (TraceProfiler::isEnabled())
+	{
+		TraceProfiler::setThreadName("job worker " + std::to_string(index));
+	}
+
+	ThreadState& thread = *threads[index];
+	while (true)
+	{
+		uint64_t signal = work_signal.load(std::memory_order_seq_cst);
+		if (Job* job = findJob(thread))
+		{
+			execute(job, thread);
+			continue;
+		}
+		if (stopping.load(std::memory_order_acquire))
+		{
+			break;
+		}
+
+		// jobs of a frame come in bursts, look a little longer before sleeping
+		Job* job = nullptr;
+		for (int spin = 0; spin < 64 && !job; spin++)
+		{
+			std::this_thread::yield();
+			job = findJob(thread);
+		}
+		if (job)
+		{
+			execute(job, thread);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleeping_workers.fetch_add(1, std::memory_order_seq_cst);
+		sleep_condition.wait(lock, [&]()
+		{
+			return stopping.load(std::memory_order_acquire) || work_signal.load(std::memory_order_seq_cst) != signal;
+		});
+		sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+std::vector<JobThreadStats> JobSystem::getStats() const
+{
+	std::vector<JobThreadStats> stats(threads.size());
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		const ThreadState& thread = *threads[i];
+		stats[i].jobs = thread.job_count.load(std::memory_order_relaxed) - thread.reset_stats.jobs;
+		stats[i].stolen = thread.stolen_count.load(std::memory_order_relaxed) - thread.reset_stats.stolen;
+		stats[i].allocated = thread.allocated_count.load(std::memory_order_relaxed) - thread.reset_stats.allocated;
+		stats[i].busy_ns = thread.busy_ns.load(std::memory_order_relaxed) - thread.reset_stats.busy_ns;
+	}
+	return stats;
+}
+
+uint64_t JobSystem::getStatsElapsedNs() const
+{
+	return TraceProfiler::now() - stats_start_ns.load(std::memory_order_relaxed);
+}
+
+void JobSystem::resetStats()
+{
+	for (auto& thread : threads)
+	{
+		thread->reset_stats.jobs = thread->job_count.load(std::memory_order_relaxed);
+		thread->reset_stats.stolen = thread->stolen_count.load(std::memory_order_relaxed);
+		thread->reset_stats.allocated = thread->allocated_count.load(std::memory_order_relaxed);
+		thread->reset_stats.busy_ns = thread->busy_ns.load(std::memory_order_relaxed);
+	}
+	stats_start_ns = TraceProfiler::now();
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Work-stealing job system. Every thread of it, the workers and the main thread that created
+// it, owns a lock-free deque it pushes to and pops from at one end while idle threads steal
+// from the other, and a ring of preallocated jobs, so that running a job doesn't allocate
+// unless a thread has more jobs in flight than the ring holds.
+// Counters track groups of jobs: wait helps running jobs until one drops to zero, and jobs
+// queued with runAfter start once it does. Jobs with MAIN_THREAD affinity only run on the
+// main thread, where GLFW, presenting and queue submissions live, when it pumps them.
+
+class JobSystem;
+struct Job;
+
+// Jobs still to finish, shared by the jobs of a group. It has to outlive them, wait for it
+// before destroying it, and is only reused once it is zero again.
+class JobCounter
+{
+public:
+	JobCounter() = default;
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	// also waits for the thread that finished the last job to let go of the counter
+	bool isDone() const
+	{
+		return pending.load(std::memory_order_acquire) == 0 && finishing.load(std::memory_order_acquire) == 0;
+	}
+
+private:
+	friend class JobSystem;
+	std::atomic<uint32_t> pending{ 0 };
+	std::atomic<uint32_t> finishing{ 0 }; // threads between decrementing pending and releasing continuations
+	std::atomic<Job*> continuations{ nullptr }; // queued by runAfter
+};
+
+enum class JobAffinity
+{
+	ANY_THREAD,
+	MAIN_THREAD, // run by runMainThreadJobs, or by wait on the main thread
+};
+
+// Two cache lines, holding the callable in place
+struct Job
+{
+	static const size_t STORAGE_SIZE = 80;
+
+	void(*invoke)(Job* job, bool call) = nullptr; // calls the callable, unless dropped, and destroys it
+	const char* name = nullptr; // literal, for the trace
+	JobCounter* counter = nullptr; // decremented once the job returned
+	Job* next = nullptr; // in a continuation list or the main thread queue
+	std::atomic<bool> in_use{ false }; // the slot of the ring is taken until the job returned
+	bool allocated = false; // on the heap, the ring was full
+	JobAffinity affinity = JobAffinity::ANY_THREAD;
+	alignas(16) unsigned char storage[STORAGE_SIZE];
+};
+
+// Chase-Lev deque of a fixed size: the owner pushes and pops at the bottom, thieves take from
+// the top. Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models", 2013.
+class JobDeque
+{
+public:
+	static const size_t CAPACITY = 4096;
+
+	// owner only, false when full
+	bool push(Job* job);
+	// owner only, nullptr when empty
+	Job* pop();
+	// any thread, nullptr when empty or another thread won the race for the top job
+	Job* steal();
+
+private:
+	// on cache lines of their own, thieves only touch bottom to read it
+	std::atomic<int64_t> top{ 0 };
+	char top_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> bottom{ 0 };
+	char bottom_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<Job*> jobs[CAPACITY];
+};
+
+struct JobThreadStats
+{
+	uint64_t jobs = 0; // run by the thread
+	uint64_t stolen = 0; // of those, taken from another thread's deque
+	uint64_t allocated = 0; // queued by the thread with its ring full
+	uint64_t busy_ns = 0; // in jobs
+};
+
+class JobSystem
+{
+public:
+	// Jobs can be queued from the creating thread, which becomes the main thread, and from jobs.
+	// worker_count of ~0u starts one worker per hardware thread but the main one, at least one.
+	explicit JobSystem(unsigned worker_count = ~0u);
+	// runs the jobs still queued, then stops the workers; main thread jobs still queued are
+	// dropped, what they would upload or present may be gone by then
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// counter, when given, is incremented now and decremented once function returned. The
+	// captures of function have to fit into Job::STORAGE_SIZE. Jobs on workers must not throw,
+	// exceptions of main thread jobs leave runMainThreadJobs or wait, the other jobs stay queued.
+	template <typename Function>
+	void run(const char* name, Function&& function, JobCounter* counter = nullptr
+		, JobAffinity affinity = JobAffinity::ANY_THREAD)
+	{
+		submit(makeJob(name, std::forward<Function>(function), counter, affinity));
+	}
+
+	// queued once dependency is zero, right away when it is already
+	template <typename Function>
+	void runAfter(JobCounter& dependency, const char* name, Function&& function, JobCounter* counter = nullptr
+		, JobAffinity affinity = JobAffinity::ANY_THREAD)
+	{
+		addContinuation(dependency, makeJob(name, std::forward<Function>(function), counter, affinity));
+	}
+
+	// Runs jobs until counter is zero. On the main thread that includes the main thread jobs,
+	// unless it is inside one of them.
+	void wait(const JobCounter& counter);
+	// the main thread jobs queued so far, main thread only
+	void runMainThreadJobs();
+
+	// Splits [begin, end) into batches of at least min_batch items, calls body(batch_begin,
+	// batch_end) on them in parallel, the calling thread included, and returns when all did
+	template <typename Body>
+	void parallelFor(const char* name, size_t begin, size_t end, size_t min_batch, const Body& body)
+	{
+		size_t count = end > begin ? end - begin : 0;
+		size_t batch_count = std::min((count + min_batch - 1) / std::max<size_t>(min_batch, 1), (size_t)getThreadCount() * 4);
+		if (batch_count <= 1)
+		{
+			if (count > 0)
+			{
+				body(begin, end);
+			}
+			return;
+		}
+		size_t batch_size = (count + batch_count - 1) / batch_count;
+		JobCounter batches;
+		for (size_t batch_begin = begin + batch_size; batch_begin < end; batch_begin += batch_size)
+		{
+			size_t batch_end = std::min(end, batch_begin + batch_size);
+			run(name, [&body, batch_begin, batch_end]() { body(batch_begin, batch_end); }, &batches);
+		}
+		body(begin, std::min(end, begin + batch_size));
+		wait(batches);
+	}
+
+	// workers and the main thread
+	unsigned getThreadCount() const { return (unsigned)threads.size(); }
+	bool isMainThread() const;
+	// per thread, the main thread first, since the system started or the last reset; the
+	// stats are read and reset by the main thread
+	std::vector<JobThreadStats> getStats() const;
+	uint64_t getStatsElapsedNs() const;
+	void resetStats();
+
+	// jobs per thread in flight at once without allocating
+	static const size_t JOB_POOL_SIZE = 4096;
+
+private:
+	struct ThreadState
+	{
+		JobDeque deque;
+		Job jobs[JOB_POOL_SIZE]; // ring, handed out in order
+		size_t next_job = 0;
+		uint32_t steal_seed = 0;
+		uint32_t execute_depth = 0; // jobs run while waiting inside a job are nested
+		// only written by the thread itself, without read-modify-writes
+		std::atomic<uint64_t> job_count{ 0 };
+		std::atomic<uint64_t> stolen_count{ 0 };
+		std::atomic<uint64_t> allocated_count{ 0 };
+		std::atomic<uint64_t> busy_ns{ 0 };
+		JobThreadStats reset_stats; // the counts as of the last reset
+	};
+
+	std::vector<std::unique_ptr<ThreadState>> threads; // the main thread's first
+	std::vector<std::thread> workers;
+	std::atomic<Job*> main_thread_jobs{ nullptr }; // a stack, newest first
+	uint32_t main_thread_job_depth = 0; // main thread jobs running on the main thread
+	std::atomic<uint64_t> stats_start_ns{ 0 };
+
+	// sleeping workers wake up when work_signal changes
+	std::atomic<uint64_t> work_signal{ 0 };
+	std::atomic<uint32_t> sleeping_workers{ 0 };
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_condition;
+	std::atomic<bool> stopping{ false };
+
+	ThreadState& currentThread();
+	Job* allocateJob();
+	void submit(Job* job);
+	void addContinuation(JobCounter& dependency, Job* job);
+	void releaseContinuations(JobCounter& counter);
+	void execute(Job* job, ThreadState& thread);
+	void finish(Job* job);
+	// from the thread's own deque, or stolen from another
+	Job* findJob(ThreadState& thread);
+	void workerLoop(unsigned index);
+
+	template <typename Function>
+	Job* makeJob(const char* name, Function&& function, JobCounter* counter, JobAffinity affinity)
+	{
+		typedef typename std::decay<Function>::type Callable;
+		static_assert(sizeof(Callable) <= Job::STORAGE_SIZE, "The captures of a job have to fit into Job::STORAGE_SIZE");
+		static_assert(alignof(Callable) <= 16, "Jobs keep their callable 16 byte aligned");
+		Job* job = allocateJob();
+		new (job->storage) Callable(std::forward<Function>(function));
+		job->invoke = [](Job* job, bool call)
+		{
+			// destroyed even when a main thread job throws
+			struct Destroy
+			{
+				Callable* callable;
+				~Destroy() { callable->~Callable(); }
+			} destroy{ reinterpret_cast<Callable*>(job->storage) };
+			if (call)
+			{
+				(*destroy.callable)();
+			}
+		};
+		job->name = name;
+		job->counter = counter;
+		job->next = nullptr;
+		job->affinity = affinity;
+		if (counter)
+		{
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+};
@@ -0,0 +1,195 @@
+#include "RenderPassBuilder.h"
+
+#include <stdexcept>
+
+namespace
+{
+	// where and how the subpass touches an attachment
+	const VkPipelineStageFlags COLOR_STAGES = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	const VkPipelineStageFlags DEPTH_STAGES = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	// the last depth writes happen in the late tests
+	const VkPipelineStageFlags DEPTH_WRITE_STAGES = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	const char* loadOpName(VkAttachmentLoadOp op)
+	{
+		return op == VK_ATTACHMENT_LOAD_OP_LOAD ? "load" : op == VK_ATTACHMENT_LOAD_OP_CLEAR ? "clear" : "discard";
+	}
+}
+
+uint32_t RenderPassBuilder::addColor(VkFormat format, Contents contents, const AttachmentUse& previous, const AttachmentUse& next)
+{
+	uint32_t attachment = add(format, false, contents, previous, next);
+	color_references.push_back({ attachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+	return attachment;
+}
+
+uint32_t RenderPassBuilder::addDepth(VkFormat format, Contents contents, const AttachmentUse& previous, const AttachmentUse& next)
+{
+	if (depth_reference.attachment != VK_ATTACHMENT_UNUSED)
+	{
+		throw std::runtime_error("A subpass has one depth attachment!");
+	}
+	uint32_t attachment = add(format, true, contents, previous, next);
+	depth_reference = { attachment, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	return attachment;
+}
+
+uint32_t RenderPassBuilder::add(VkFormat format, bool depth, Contents contents, const AttachmentUse& previous, const AttachmentUse& next)
+{
+	VkImageLayout subpass_layout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription description = {};
+	description.format = format;
+	description.samples = VK_SAMPLE_COUNT_1_BIT;
+	description.loadOp = contents == Contents::LOAD ? VK_ATTACHMENT_LOAD_OP_LOAD
+		: contents == Contents::CLEAR ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	description.storeOp = next.stages != 0 ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// nothing reads the stencil of the depth formats
+	description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	description.initialLayout = contents == Contents::LOAD ? previous.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	description.finalLayout = next.stages != 0 ? next.layout : subpass_layout;
+
+	attachments.push_back(description);
+	uses.push_back({ depth, previous, next });
+	return (uint32_t)attachments.size() - 1;
+}
+
+void RenderPassBuilder::build(VkDevice device, VkRenderPass* render_pass) const
+{
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = (uint32_t)color_references.size();
+	subpass.pColorAttachments = color_references.data();
+	subpass.pDepthStencilAttachment = depth_reference.attachment != VK_ATTACHMENT_UNUSED ? &depth_reference : nullptr;
+
+	auto dependencies = getDependencies();
+
+	VkRenderPassCreateInfo render_pass_info = {};
+	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	render_pass_info.attachmentCount = (uint32_t)attachments.size();
+	render_pass_info.pAttachments = attachments.data();
+	render_pass_info.subpassCount = 1;
+	render_pass_info.pSubpasses = &subpass;
+	render_pass_info.dependencyCount = (uint32_t)dependencies.size();
+	render_pass_info.pDependencies = dependencies.data();
+
+	if (vkCreateRenderPass(device, &render_pass_info, nullptr, render_pass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create render pass!");
+	}
+}
+
+bool RenderPassBuilder::isTransient(uint32_t attachment) const
+{
+	return attachments[attachment].loadOp != VK_ATTACHMENT_LOAD_OP_LOAD
+		&& attachments[attachment].storeOp != VK_ATTACHMENT_STORE_OP_STORE;
+}
+
+std::vector<VkSubpassDependency> RenderPassBuilder::getDependencies() const
+{
+	// the uses before the pass against the subpass, which also orders the transitions out of the
+	// initial layouts, and the subpass against the uses after it, which orders the final transitions
+	VkSubpassDependency in = {};
+	in.srcSubpass = VK_SUBPASS_EXTERNAL;
+	in.dstSubpass = 0;
+	VkSubpassDependency out = {};
+	out.srcSubpass = 0;
+	out.dstSubpass = VK_SUBPASS_EXTERNAL;
+
+	for (size_t i = 0; i < attachments.size(); i++)
+	{
+		const Attachment& use = uses[i];
+		bool load = attachments[i].loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+		if (use.previous.stages != 0)
+		{
+			in.srcStageMask |= use.previous.stages;
+			in.srcAccessMask |= use.previous.access;
+			if (use.depth)
+			{
+				// the tests read depth whatever the load op
+				in.dstStageMask |= DEPTH_STAGES;
+				in.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			}
+			else
+			{
+				in.dstStageMask |= COLOR_STAGES;
+				in.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (load ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
+			}
+		}
+		if (use.next.stages != 0)
+		{
+			out.srcStageMask |= use.depth ? DEPTH_WRITE_STAGES : COLOR_STAGES;
+			out.srcAccessMask |= use.depth ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			out.dstStageMask |= use.next.stages;
+			out.dstAccessMask |= use.next.access;
+		}
+	}
+
+	// without one the implicit dependency applies, which waits for nothing
+	std::vector<VkSubpassDependency> dependencies;
+	if (in.srcStageMask != 0)
+	{
+		dependencies.push_back(in);
+	}
+	if (out.srcStageMask != 0)
+	{
+		dependencies.push_back(out);
+	}
+	return dependencies;
+}
+
+RenderPassBuilder::Traffic RenderPassBuilder::estimateTraffic(VkExtent2D extent) const
+{
+	Traffic traffic;
+	for (const auto& attachment : attachments)
+	{
+		VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * formatSize(attachment.format);
+		if (attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		{
+			traffic.load_bytes += size;
+		}
+		if (attachment.storeOp == VK_ATTACHMENT_STORE_OP_STORE)
+		{
+			traffic.store_bytes += size;
+		}
+		traffic.naive_bytes += 2 * size;
+	}
+	return traffic;
+}
+
+std::string RenderPassBuilder::describe() const
+{
+	std::string description;
+	for (size_t i = 0; i < attachments.size(); i++)
+	{
+		if (i > 0)
+		{
+			description += ", ";
+		}
+		description += uses[i].depth ? "depth " : "color ";
+		description += loadOpName(attachments[i].loadOp);
+		description += attachments[i].storeOp == VK_ATTACHMENT_STORE_OP_STORE ? "/store" : "/discard";
+		if (isTransient((uint32_t)i))
+		{
+			description += " transient";
+		}
+	}
+	return description;
+}
+
+VkDeviceSize RenderPassBuilder::formatSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_D16_UNORM:
+		return 2;
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return 5;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8;
+	default:
+		// the 8 bit per channel color formats, D32_SFLOAT and D24_UNORM_S8_UINT
+		return 4;
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How an attachment is used right before or right after a render pass: the layout it is in or
+// wanted in, and the stages and accesses the pass has to be ordered after or before.
+struct AttachmentUse
+{
+	VkImageLayout layout;
+	VkPipelineStageFlags stages; // 0 for no use
+	VkAccessFlags access;
+};
+
+// Builds a render pass of one subpass from how each attachment is used around it, instead of
+// writing the ops, layouts and dependencies by hand:
+// - contents not loaded start in VK_IMAGE_LAYOUT_UNDEFINED, cleared or not
+// - contents without a next use are not stored and end in the subpass layout
+// - an attachment neither loaded nor stored is transient, it can live in tile memory only
+// - the layout transitions happen in the pass, ordered by an external dependency in each direction
+//   covering only the stages and accesses of the uses around it
+class RenderPassBuilder
+{
+public:
+	enum class Contents
+	{
+		DISCARD, // written all over, the old contents don't matter
+		CLEAR,
+		LOAD
+	};
+
+	// Previous is the last use of the attachment before the pass, of the previous frame when
+	// nothing uses it earlier in this one; its layout only matters when the contents are loaded.
+	// Next is the first use after the pass, stages 0 when the contents are not needed anymore.
+	uint32_t addColor(VkFormat format, Contents contents, const AttachmentUse& previous, const AttachmentUse& next);
+	uint32_t addDepth(VkFormat format, Contents contents, const AttachmentUse& previous, const AttachmentUse& next);
+
+	void build(VkDevice device, VkRenderPass* render_pass) const;
+
+	bool isTransient(uint32_t attachment) const;
+	const std::vector<VkAttachmentDescription>& getAttachments() const { return attachments; }
+	std::vector<VkSubpassDependency> getDependencies() const;
+
+	// What the load and store ops cost in memory traffic, as on a tiler that keeps the attachments
+	// on chip during the pass; naive_bytes is what loading and storing every attachment would.
+	struct Traffic
+	{
+		VkDeviceSize load_bytes = 0;
+		VkDeviceSize store_bytes = 0;
+		VkDeviceSize naive_bytes = 0;
+	};
+	Traffic estimateTraffic(VkExtent2D extent) const;
+	// the ops of every attachment, like "color clear/store, depth clear/discard transient"
+	std::string describe() const;
+
+	// bytes per pixel of the color and depth formats the renderer picks from, 4 for others
+	static VkDeviceSize formatSize(VkFormat format);
+
+private:
+	struct Attachment
+	{
+		bool depth;
+		AttachmentUse previous;
+		AttachmentUse next;
+	};
+
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<Attachment> uses;
+	std::vector<VkAttachmentReference> color_references;
+	VkAttachmentReference depth_reference = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+
+	uint32_t add(VkFormat format, bool depth, Contents contents, const AttachmentUse& previous, const AttachmentUse& next);
+};
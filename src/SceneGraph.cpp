@@ -0,0 +1,338 @@
+#include "SceneGraph.h"
+#include "JobSystem.h"
+#include "TraceProfiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCENE_X86 1
+#include <immintrin.h>
+#endif
+
+// as in CpuCulling.cpp, only the AVX2 kernel is built with AVX2 enabled
+#if defined(SCENE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	// Matrices are column major like glm's, every kernel sums the products in glm's order so
+	// that all of them give the same results.
+
+	void updateRangeScalar(const uint32_t* indices, size_t count, const uint32_t* parent
+		, const glm::mat4* local, glm::mat4* world)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t index = indices[i];
+			world[index] = world[parent[index]] * local[index];
+		}
+	}
+
+#ifdef SCENE_X86
+	// sparse updates miss the cache on every matrix, so the ones a few nodes ahead are requested early
+	const size_t PREFETCH_DISTANCE = 8;
+
+	inline void prefetchNode(const uint32_t* indices, size_t count, size_t i, const uint32_t* parent
+		, const glm::mat4* local, glm::mat4* world)
+	{
+		if (i < count)
+		{
+			uint32_t index = indices[i];
+			_mm_prefetch((const char*)&local[index], _MM_HINT_T0);
+			_mm_prefetch((const char*)&world[index], _MM_HINT_T0);
+			_mm_prefetch((const char*)&world[parent[index]], _MM_HINT_T0);
+		}
+	}
+
+	// a column of the result per iteration: the parent's columns weighted by a column of local
+	inline void multiplySSE(const float* a, const float* b, float* out)
+	{
+		__m128 a0 = _mm_loadu_ps(a);
+		__m128 a1 = _mm_loadu_ps(a + 4);
+		__m128 a2 = _mm_loadu_ps(a + 8);
+		__m128 a3 = _mm_loadu_ps(a + 12);
+		for (int column = 0; column < 4; column++)
+		{
+			const float* b_column = b + 4 * column;
+			__m128 result = _mm_mul_ps(a0, _mm_set1_ps(b_column[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(b_column[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(b_column[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(b_column[3])));
+			_mm_storeu_ps(out + 4 * column, result);
+		}
+	}
+
+	void updateRangeSSE(const uint32_t* indices, size_t count, const uint32_t* parent
+		, const glm::mat4* local, glm::mat4* world)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			prefetchNode(indices, count, i + PREFETCH_DISTANCE, parent, local, world);
+			uint32_t index = indices[i];
+			multiplySSE(&world[parent[index]][0][0], &local[index][0][0], &world[index][0][0]);
+		}
+	}
+
+	// two columns of the result per iteration, the parent's columns repeated in both halves
+	TARGET_AVX2 inline void multiplyAVX2(const float* a, const float* b, float* out)
+	{
+		__m128 a_columns[4] = { _mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12) };
+		__m256 a0 = _mm256_insertf128_ps(_mm256_castps128_ps256(a_columns[0]), a_columns[0], 1);
+		__m256 a1 = _mm256_insertf128_ps(_mm256_castps128_ps256(a_columns[1]), a_columns[1], 1);
+		__m256 a2 = _mm256_insertf128_ps(_mm256_castps128_ps256(a_columns[2]), a_columns[2], 1);
+		__m256 a3 = _mm256_insertf128_ps(_mm256_castps128_ps256(a_columns[3]), a_columns[3], 1);
+		for (int column = 0; column < 4; column += 2)
+		{
+			__m256 b_columns = _mm256_loadu_ps(b + 4 * column);
+			__m256 result = _mm256_mul_ps(a0, _mm256_permute_ps(b_columns, 0x00));
+			result = _mm256_add_ps(result, _mm256_mul_ps(a1, _mm256_permute_ps(b_columns, 0x55)));
+			result = _mm256_add_ps(result, _mm256_mul_ps(a2, _mm256_permute_ps(b_columns, 0xAA)));
+			result = _mm256_add_ps(result, _mm256_mul_ps(a3, _mm256_permute_ps(b_columns, 0xFF)));
+			_mm256_storeu_ps(out + 4 * column, result);
+		}
+	}
+
+	TARGET_AVX2 void updateRangeAVX2(const uint32_t* indices, size_t count, const uint32_t* parent
+		, const glm::mat4* local, glm::mat4* world)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			prefetchNode(indices, count, i + PREFETCH_DISTANCE, parent, local, world);
+			uint32_t index = indices[i];
+			multiplyAVX2(&world[parent[index]][0][0], &local[index][0][0], &world[index][0][0]);
+		}
+	}
+#endif
+}
+
+SceneGraph::SceneGraph(SimdLevel level, JobSystem* jobs)
+	: simd_level(level)
+	, jobs(jobs)
+	, level_begin{ 0 }
+{
+	if (!isSimdLevelSupported(level))
+	{
+		throw std::runtime_error(std::string("SIMD level not supported on this machine: ") + simdLevelName(level));
+	}
+}
+
+unsigned SceneGraph::getThreadCount() const
+{
+	return jobs ? jobs->getThreadCount() : 1;
+}
+
+void SceneGraph::reserve(size_t node_count)
+{
+	node_index.reserve(node_count);
+	parent.reserve(node_count);
+	depth.reserve(node_count);
+	node_id.reserve(node_count);
+	dirty.reserve(node_count);
+	local.reserve(node_count);
+	world.reserve(node_count);
+}
+
+SceneGraph::NodeId SceneGraph::addNode(NodeId parent_node, const glm::mat4& local_transform)
+{
+	uint32_t parent_index = NO_PARENT;
+	uint32_t node_depth = 0;
+	if (parent_node != NO_PARENT)
+	{
+		if (parent_node >= node_index.size())
+		{
+			throw std::runtime_error("Scene graph parent node " + std::to_string(parent_node) + " doesn't exist");
+		}
+		parent_index = node_index[parent_node];
+		node_depth = depth[parent_index] + 1;
+	}
+
+	NodeId id = (NodeId)node_index.size();
+	uint32_t index = (uint32_t)parent.size();
+	if (sorted && !depth.empty() && node_depth < depth.back())
+	{
+		sorted = false;
+	}
+	else if (sorted)
+	{
+		// the node extends the deepest level or starts a new one below it
+		if (node_depth == getDepthCount())
+		{
+			level_begin.push_back(index + 1);
+		}
+		else
+		{
+			level_begin.back() = index + 1;
+		}
+	}
+
+	node_index.push_back(index);
+	parent.push_back(parent_index);
+	depth.push_back(node_depth);
+	node_id.push_back(id);
+	dirty.push_back(1);
+	shallowest_dirty_depth = std::min(shallowest_dirty_depth, node_depth);
+	local.push_back(local_transform);
+	world.push_back(local_transform);
+	return id;
+}
+
+void SceneGraph::setLocalTransform(NodeId node, const glm::mat4& local_transform)
+{
+	uint32_t index = node_index[node];
+	local[index] = local_transform;
+	dirty[index] = 1;
+	shallowest_dirty_depth = std::min(shallowest_dirty_depth, depth[index]);
+}
+
+const glm::mat4& SceneGraph::getLocalTransform(NodeId node) const
+{
+	return local[node_index[node]];
+}
+
+const glm::mat4& SceneGraph::getWorldTransform(NodeId node) const
+{
+	return world[node_index[node]];
+}
+
+void SceneGraph::sortByDepth()
+{
+	TRACE_SCOPE("SceneGraph::sortByDepth");
+	// counting sort, stable so that siblings keep the order they were added in
+	uint32_t depth_count = *std::max_element(depth.begin(), depth.end()) + 1;
+	level_begin.assign(depth_count + 1, 0);
+	for (uint32_t node_depth : depth)
+	{
+		level_begin[node_depth + 1]++;
+	}
+	for (uint32_t d = 0; d < depth_count; d++)
+	{
+		level_begin[d + 1] += level_begin[d];
+	}
+
+	std::vector<uint32_t> cursor(level_begin.begin(), level_begin.end() - 1);
+	std::vector<uint32_t> new_index(size());
+	for (size_t i = 0; i < size(); i++)
+	{
+		new_index[i] = cursor[depth[i]]++;
+	}
+
+	auto permute = [&](auto& values)
+	{
+		typename std::remove_reference<decltype(values)>::type sorted_values(values.size());
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			sorted_values[new_index[i]] = values[i];
+		}
+		values.swap(sorted_values);
+	};
+	for (auto& parent_index : parent)
+	{
+		if (parent_index != NO_PARENT)
+		{
+			parent_index = new_index[parent_index];
+		}
+	}
+	permute(parent);
+	permute(depth);
+	permute(node_id);
+	permute(dirty);
+	permute(local);
+	permute(world);
+	for (size_t i = 0; i < size(); i++)
+	{
+		node_index[node_id[i]] = (uint32_t)i;
+	}
+	sorted = true;
+}
+
+const std::vector<SceneGraph::NodeId>& SceneGraph::update()
+{
+	TRACE_SCOPE("SceneGraph::update");
+	if (!sorted)
+	{
+		sortByDepth();
+	}
+
+	UpdateRangeFunction update_range = updateRangeScalar;
+#ifdef SCENE_X86
+	if (simd_level == SimdLevel::SSE) update_range = updateRangeSSE;
+	if (simd_level == SimdLevel::AVX2) update_range = updateRangeAVX2;
+#endif
+
+	updated_nodes.clear();
+	if (shallowest_dirty_depth == CLEAN)
+	{
+		return updated_nodes;
+	}
+
+	// Every node may be dirty. The flags are read through local pointers, stores to them
+	// would make the compiler reload the members on every node otherwise.
+	dirty_indices.resize(size());
+	uint32_t* out = dirty_indices.data();
+	uint8_t* flags = dirty.data();
+	const uint32_t* parents = parent.data();
+	size_t written = 0;
+	// the levels above the shallowest dirty node are clean
+	for (size_t level = shallowest_dirty_depth; level < getDepthCount(); level++)
+	{
+		uint32_t begin = level_begin[level];
+		uint32_t end = level_begin[level + 1];
+		size_t level_start = written;
+		if (level == 0)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				out[written] = i;
+				written += flags[i];
+			}
+			for (size_t i = level_start; i < written; i++)
+			{
+				world[out[i]] = local[out[i]];
+			}
+			continue;
+		}
+
+		// a node is dirty when it or its parent is, parents were settled by the level above
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint8_t node_dirty = flags[i] | flags[parents[i]];
+			flags[i] = node_dirty;
+			out[written] = i;
+			written += node_dirty;
+		}
+		updateLevel(update_range, out + level_start, written - level_start);
+	}
+	shallowest_dirty_depth = CLEAN;
+
+	updated_nodes.resize(written);
+	for (size_t i = 0; i < written; i++)
+	{
+		dirty[dirty_indices[i]] = 0;
+		updated_nodes[i] = node_id[dirty_indices[i]];
+	}
+	return updated_nodes;
+}
+
+void SceneGraph::updateLevel(UpdateRangeFunction update_range, const uint32_t* indices, size_t count)
+{
+	const uint32_t* parents = parent.data();
+	const glm::mat4* locals = local.data();
+	glm::mat4* worlds = world.data();
+	if (count < PARALLEL_THRESHOLD || getThreadCount() <= 1)
+	{
+		update_range(indices, count, parents, locals, worlds);
+		return;
+	}
+
+	// the nodes of a level only read the level above, so any split of them is independent
+	jobs->parallelFor("SceneGraph::updateLevel batch", 0, count, PARALLEL_THRESHOLD / 4, [=](size_t begin, size_t end)
+	{
+		update_range(indices + begin, end - begin, parents, locals, worlds);
+	});
+}
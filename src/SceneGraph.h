@@ -0,0 +1,79 @@
+#pragma once
+
+#include "CpuCulling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class JobSystem;
+
+// Node hierarchy with world transforms recomputed only below the nodes that changed.
+// Nodes are stored as parallel arrays sorted by depth, so that a level only reads the one
+// above it: its nodes are independent of each other and are updated in SIMD batches,
+// split across the threads of a job system when a level has enough dirty nodes.
+class SceneGraph
+{
+public:
+	typedef uint32_t NodeId;
+	static const NodeId NO_PARENT = ~0u;
+
+	// without jobs every update runs on the calling thread
+	explicit SceneGraph(SimdLevel level = detectSimdLevel(), JobSystem* jobs = nullptr);
+
+	void reserve(size_t node_count);
+	// parent must exist already, NO_PARENT makes a root; the node starts dirty
+	NodeId addNode(NodeId parent, const glm::mat4& local_transform);
+	// marks the node dirty, its world transform and the ones below it change on the next update
+	void setLocalTransform(NodeId node, const glm::mat4& local_transform);
+	const glm::mat4& getLocalTransform(NodeId node) const;
+	// as of the last update
+	const glm::mat4& getWorldTransform(NodeId node) const;
+
+	// Recomputes the world transform of every dirty node and of everything below them.
+	// Returns the nodes whose world transform was recomputed, valid until the next update.
+	const std::vector<NodeId>& update();
+
+	size_t size() const { return parent.size(); }
+	size_t getDepthCount() const { return level_begin.size() - 1; }
+	SimdLevel getSimdLevel() const { return simd_level; }
+	unsigned getThreadCount() const;
+
+	// dirty nodes of a level below this count are updated on the calling thread
+	static const size_t PARALLEL_THRESHOLD = 1 << 14;
+
+private:
+	SimdLevel simd_level;
+	JobSystem* jobs;
+
+	std::vector<uint32_t> node_index; // storage index of every node id
+
+	// storage, parents before their children
+	std::vector<uint32_t> parent; // storage index, NO_PARENT for roots
+	std::vector<uint32_t> depth;
+	std::vector<NodeId> node_id;
+	std::vector<uint8_t> dirty;
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+
+	// level d is [level_begin[d], level_begin[d + 1]). Kept up to date while nodes are added
+	// at the deepest level or below it, otherwise sortByDepth rebuilds it on the next update.
+	std::vector<uint32_t> level_begin;
+	bool sorted = true;
+
+	// no node is dirty, update has nothing to do
+	static const uint32_t CLEAN = ~0u;
+	uint32_t shallowest_dirty_depth = CLEAN;
+
+	std::vector<uint32_t> dirty_indices; // scratch of update, storage indices by level
+	std::vector<NodeId> updated_nodes;
+
+	// world[i] = world[parent[i]] * local[i] for the count storage indices
+	typedef void(*UpdateRangeFunction)(const uint32_t* indices, size_t count, const uint32_t* parent
+		, const glm::mat4* local, glm::mat4* world);
+
+	void sortByDepth();
+	void updateLevel(UpdateRangeFunction update_range, const uint32_t* indices, size_t count);
+};
@@ -0,0 +1,30 @@
+#include "StartupTiming.h"
+
+#include <cstdio>
+
+StartupTimeline::StartupTimeline()
+	: start(std::chrono::steady_clock::now())
+{}
+
+void StartupTimeline::mark(const std::string& name)
+{
+	double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(mutex);
+	milestones.emplace_back(name, elapsed_ms);
+}
+
+std::vector<std::pair<std::string, double>> StartupTimeline::getMilestones() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return milestones;
+}
+
+void StartupTimeline::print(std::ostream& out) const
+{
+	for (const auto& milestone : getMilestones())
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "  %-18s %9.1f ms", milestone.first.c_str(), milestone.second);
+		out << line << std::endl;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Named milestones of the application start, in milliseconds since the timeline
+// was created. Marks may come from any thread, e.g. the asset loading tasks.
+class StartupTimeline
+{
+public:
+	StartupTimeline();
+
+	void mark(const std::string& name);
+	// in the order they were marked
+	std::vector<std::pair<std::string, double>> getMilestones() const;
+	// a line per milestone
+	void print(std::ostream& out) const;
+
+private:
+	std::chrono::steady_clock::time_point start;
+	mutable std::mutex mutex;
+	std::vector<std::pair<std::string, double>> milestones;
+};
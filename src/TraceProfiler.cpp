@@ -0,0 +1,161 @@
+#include "TraceProfiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+
+std::atomic<bool> TraceProfiler::enabled(false);
+
+struct TraceEvent
+{
+	const char* name;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+};
+
+// only contended while exporting
+struct ThreadTrace
+{
+	std::mutex mutex;
+	uint32_t thread_id = 0;
+	std::string thread_name;
+	std::vector<TraceEvent> events;
+	uint64_t dropped_events = 0;
+};
+
+static const auto trace_epoch = std::chrono::steady_clock::now();
+
+static std::mutex registry_mutex;
+// kept after their threads end, so their events still get exported
+static std::vector<std::shared_ptr<ThreadTrace>> thread_traces;
+
+static ThreadTrace& currentThreadTrace()
+{
+	thread_local std::shared_ptr<ThreadTrace> trace;
+	if (!trace)
+	{
+		trace = std::make_shared<ThreadTrace>();
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		trace->thread_id = (uint32_t)thread_traces.size() + 1;
+		thread_traces.push_back(trace);
+	}
+	return *trace;
+}
+
+// event names are function names and literals, quotes and backslashes are all that needs escaping
+static std::string jsonString(const std::string& value)
+{
+	std::string escaped = "\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped + "\"";
+}
+
+void TraceProfiler::setEnabled(bool enabled)
+{
+	TraceProfiler::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void TraceProfiler::setThreadName(const std::string& name)
+{
+	auto& trace = currentThreadTrace();
+	std::lock_guard<std::mutex> lock(trace.mutex);
+	trace.thread_name = name;
+}
+
+uint64_t TraceProfiler::now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+void TraceProfiler::addEvent(const char* name, uint64_t start_ns, uint64_t end_ns)
+{
+	auto& trace = currentThreadTrace();
+	std::lock_guard<std::mutex> lock(trace.mutex);
+	if (trace.events.size() >= MAX_THREAD_EVENTS)
+	{
+		trace.dropped_events++;
+		return;
+	}
+	trace.events.push_back({ name, start_ns, end_ns - start_ns });
+}
+
+void TraceProfiler::writeChromeTrace(std::ostream& out)
+{
+	std::vector<std::shared_ptr<ThreadTrace>> traces;
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		traces = thread_traces;
+	}
+
+	// timestamps and durations are in microseconds
+	auto precision = out.precision(3);
+	auto flags = out.setf(std::ios::fixed, std::ios::floatfield);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	for (const auto& trace : traces)
+	{
+		std::lock_guard<std::mutex> lock(trace->mutex);
+		if (!trace->thread_name.empty())
+		{
+			out << (first ? "" : ",") << std::endl
+				<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << trace->thread_id
+				<< ", \"args\": {\"name\": " << jsonString(trace->thread_name) << "}}";
+			first = false;
+		}
+		for (const auto& event : trace->events)
+		{
+			out << (first ? "" : ",") << std::endl
+				<< "{\"name\": " << jsonString(event.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace->thread_id
+				<< ", \"ts\": " << event.start_ns / 1e3 << ", \"dur\": " << event.duration_ns / 1e3 << "}";
+			first = false;
+		}
+	}
+	out << std::endl << "]}" << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void TraceProfiler::writeChromeTrace(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open " + path + " for the trace!");
+	}
+	writeChromeTrace(file);
+}
+
+size_t TraceProfiler::getEventCount()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	size_t count = 0;
+	for (const auto& trace : thread_traces)
+	{
+		std::lock_guard<std::mutex> trace_lock(trace->mutex);
+		count += trace->events.size();
+	}
+	return count;
+}
+
+uint64_t TraceProfiler::getDroppedEventCount()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	uint64_t count = 0;
+	for (const auto& trace : thread_traces)
+	{
+		std::lock_guard<std::mutex> trace_lock(trace->mutex);
+		count += trace->dropped_events;
+	}
+	return count;
+}
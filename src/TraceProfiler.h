@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+// Scoped CPU markers recorded into a buffer per thread and exported as Chrome
+// trace JSON, which chrome://tracing and ui.perfetto.dev open. While tracing is
+// disabled a marker costs a relaxed atomic load, defining DISABLE_TRACING
+// compiles them out altogether.
+class TraceProfiler
+{
+public:
+	static void setEnabled(bool enabled);
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// names the calling thread in the trace
+	static void setThreadName(const std::string& name);
+
+	// nanoseconds since the program started
+	static uint64_t now();
+	// a complete event on the calling thread, name has to outlive the export:
+	// string literals or __func__
+	static void addEvent(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+	// everything recorded so far by every thread, recording goes on
+	static void writeChromeTrace(std::ostream& out);
+	static void writeChromeTrace(const std::string& path);
+	static size_t getEventCount();
+	static uint64_t getDroppedEventCount();
+
+	// per thread, events past it are dropped and counted
+	static const size_t MAX_THREAD_EVENTS = 1 << 20;
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+// records its lifetime as an event, when tracing was enabled at construction
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+		: name(TraceProfiler::isEnabled() ? name : nullptr)
+		, start_ns(this->name ? TraceProfiler::now() : 0)
+	{}
+
+	~TraceScope()
+	{
+		if (name)
+		{
+			TraceProfiler::addEvent(name, start_ns, TraceProfiler::now());
+		}
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t start_ns;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef DISABLE_TRACING
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
+
+// named after the enclosing function
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
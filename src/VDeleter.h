@@ -5,6 +5,7 @@
 
 // This RAII class is used to hold Vulkan handles.
 // It will call deletef upon destruction or & operator
+// Superseded by VHandle.h, kept as what cpu_benchmark measures the holders against.
 template <typename T>
 class VDeleter
 {
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <type_traits>
+
+// RAII holders of Vulkan handles with the destroy function fixed at compile time, replacing VDeleter.
+// A holder is the handle, plus a pointer to the handle of its parent for the objects of an instance
+// or a device: no std::function to store, copy or call through, moves only copy the two and never throw.
+// & destroys the held object and gives the address to create a new one into, like VDeleter's did.
+
+// the instance and the device, destroyed without a parent
+template <typename T, void (VKAPI_PTR* Destroy)(T, const VkAllocationCallbacks*)>
+class VRootHandle
+{
+public:
+	VRootHandle() noexcept
+		: object(VK_NULL_HANDLE)
+	{}
+
+	~VRootHandle()
+	{
+		cleanup();
+	}
+
+	VRootHandle(VRootHandle&& other) noexcept
+		: object(other.object)
+	{
+		other.object = VK_NULL_HANDLE;
+	}
+	VRootHandle& operator=(VRootHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			cleanup();
+			object = other.object;
+			other.object = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	VRootHandle(const VRootHandle&) = delete;
+	VRootHandle& operator=(const VRootHandle&) = delete;
+
+	T* operator &()
+	{
+		cleanup();
+		return &object;
+	}
+
+	operator T() const
+	{
+		return object;
+	}
+
+	// children keep the address, the handle may be created after them
+	const T& get() const
+	{
+		return object;
+	}
+
+private:
+	T object;
+
+	void cleanup()
+	{
+		if (object != VK_NULL_HANDLE)
+		{
+			Destroy(object, nullptr);
+		}
+		object = VK_NULL_HANDLE;
+	}
+};
+
+// an object of an instance or a device, the parent has to outlive it
+template <typename Parent, typename T, void (VKAPI_PTR* Destroy)(Parent, T, const VkAllocationCallbacks*)>
+class VHandle
+{
+public:
+	template <void (VKAPI_PTR* ParentDestroy)(Parent, const VkAllocationCallbacks*)>
+	explicit VHandle(const VRootHandle<Parent, ParentDestroy>& parent) noexcept
+		: object(VK_NULL_HANDLE)
+		, parent(&parent.get())
+	{}
+
+	~VHandle()
+	{
+		cleanup();
+	}
+
+	VHandle(VHandle&& other) noexcept
+		: object(other.object)
+		, parent(other.parent)
+	{
+		other.object = VK_NULL_HANDLE;
+	}
+	VHandle& operator=(VHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			cleanup();
+			object = other.object;
+			parent = other.parent;
+			other.object = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	VHandle(const VHandle&) = delete;
+	VHandle& operator=(const VHandle&) = delete;
+
+	T* operator &()
+	{
+		cleanup();
+		return &object;
+	}
+
+	operator T() const
+	{
+		return object;
+	}
+
+	const T& get() const
+	{
+		return object;
+	}
+
+	// gives up the object without destroying it
+	T release() noexcept
+	{
+		T released = object;
+		object = VK_NULL_HANDLE;
+		return released;
+	}
+
+private:
+	T object;
+	const Parent* parent;
+
+	void cleanup()
+	{
+		if (object != VK_NULL_HANDLE)
+		{
+			Destroy(*parent, object, nullptr);
+		}
+		object = VK_NULL_HANDLE;
+	}
+};
+
+using VInstance = VRootHandle<VkInstance, vkDestroyInstance>;
+using VDevice = VRootHandle<VkDevice, vkDestroyDevice>;
+
+using VSurface = VHandle<VkInstance, VkSurfaceKHR, vkDestroySurfaceKHR>;
+
+using VBuffer = VHandle<VkDevice, VkBuffer, vkDestroyBuffer>;
+using VCommandPool = VHandle<VkDevice, VkCommandPool, vkDestroyCommandPool>;
+using VDescriptorPool = VHandle<VkDevice, VkDescriptorPool, vkDestroyDescriptorPool>;
+using VDescriptorSetLayout = VHandle<VkDevice, VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+using VDeviceMemory = VHandle<VkDevice, VkDeviceMemory, vkFreeMemory>;
+using VFence = VHandle<VkDevice, VkFence, vkDestroyFence>;
+using VFramebuffer = VHandle<VkDevice, VkFramebuffer, vkDestroyFramebuffer>;
+using VImage = VHandle<VkDevice, VkImage, vkDestroyImage>;
+using VImageView = VHandle<VkDevice, VkImageView, vkDestroyImageView>;
+using VPipeline = VHandle<VkDevice, VkPipeline, vkDestroyPipeline>;
+using VPipelineLayout = VHandle<VkDevice, VkPipelineLayout, vkDestroyPipelineLayout>;
+using VQueryPool = VHandle<VkDevice, VkQueryPool, vkDestroyQueryPool>;
+using VRenderPass = VHandle<VkDevice, VkRenderPass, vkDestroyRenderPass>;
+using VSampler = VHandle<VkDevice, VkSampler, vkDestroySampler>;
+using VSemaphore = VHandle<VkDevice, VkSemaphore, vkDestroySemaphore>;
+using VShaderModule = VHandle<VkDevice, VkShaderModule, vkDestroyShaderModule>;
+using VSwapchain = VHandle<VkDevice, VkSwapchainKHR, vkDestroySwapchainKHR>;
+
+static_assert(sizeof(VDevice) == sizeof(VkDevice), "a root holder is only its handle");
+// the handle and the parent pointer plus any padding between them: on 32 bit the 64 bit non-dispatchable
+// handles make a holder 16 bytes where they align to 8 in structs, and 12 bytes on i386 System V, where they align to 4
+static_assert(sizeof(VBuffer) <= sizeof(VkBuffer) + sizeof(void*) + alignof(VkBuffer), "a holder is only its handle and its parent");
+static_assert(std::is_nothrow_move_constructible<VBuffer>::value && std::is_nothrow_move_assignable<VBuffer>::value
+	, "vectors of holders move them when they grow");
@@ -2,12 +2,6 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-
 #include <iostream>
 #include <functional>
 #include <vector>
@@ -19,26 +13,7 @@
 #include <fstream>
 #include <chrono>
 #include <unordered_map>
-
-static std::vector<char> readFile(const std::string& filename) 
-{
-	std::ifstream file_stream(filename, std::ios::ate | std::ios::binary);
-
-	if (!file_stream.is_open()) 
-	{
-		throw std::runtime_error("failed to open file!");
-	}
-
-	// starts reading at the end of file to determine file size (ate)
-	size_t file_size = (size_t)file_stream.tellg();
-	std::vector<char> buffer(file_size);
-
-	file_stream.seekg(0);
-	file_stream.read(buffer.data(), file_size);
-
-	file_stream.close();
-	return buffer;
-}
+#include <cmath>
 
 struct SwapChainSupportDetails 
 {
@@ -86,21 +61,26 @@ QueueFamilyIndices QueueFamilyIndices::findQueueFamilies(VkPhysicalDevice device
 	int i = 0;
 	for (const auto& queuefamily : queuefamilies)
 	{
-		if (queuefamily.queueCount > 0 && queuefamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		// the culling pass runs on the graphics queue, Vulkan guarantees a family doing both
+		if (queuefamily.queueCount > 0 && queuefamily.queueFlags & VK_QUEUE_GRAPHICS_BIT
+			&& queuefamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
 		{
 			// Graphics queue_family
 			indices.graphicsFamily = i;
 		}
 
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if (surface != VK_NULL_HANDLE)
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		}
 		if (queuefamily.queueCount > 0 && presentSupport)
 		{
 			// Graphics queue_family
 			indices.presentFamily = i;
 		}
 
-		if (indices.isComplete()) {
+		if (indices.isComplete(surface != VK_NULL_HANDLE)) {
 			break;
 		}
 
@@ -111,17 +91,56 @@ QueueFamilyIndices QueueFamilyIndices::findQueueFamilies(VkPhysicalDevice device
 	return indices;
 }
 
-VulkanShowBase::VulkanShowBase()
+VulkanShowBase::VulkanShowBase(const AppOptions& options)
+	: options(options)
+	, depth_prepass_enabled(options.depth_prepass)
+	, present_policy(presentPolicyFor(parsePacingPreset(options.pacing_preset)))
+	, frame_limiter(options.fps_limit)
+	, resize_coalescer(std::chrono::milliseconds(options.resize_settle_ms), options.resize_settle_ms > 0
+		? std::max(ResizeCoalescer::DEFAULT_MAX_INTERVAL, std::chrono::milliseconds(options.resize_settle_ms))
+		: std::chrono::milliseconds(0))
 {
+	if (!options.present_mode.empty())
+	{
+		present_policy.present_modes = { parsePresentMode(options.present_mode), VK_PRESENT_MODE_FIFO_KHR };
+	}
 }
 
 
 
 void VulkanShowBase::run()
 {
-	initWindow();
+	if (!options.trace_path.empty())
+	{
+		TraceProfiler::setEnabled(true);
+		TraceProfiler::setThreadName("main");
+	}
+	job_system.reset(new JobSystem(options.job_workers < 0 ? ~0u : (unsigned)options.job_workers));
+	std::cout << "Jobs: " << job_system->getThreadCount() - 1 << " workers" << std::endl;
+	openAssetArchive();
+	startAssetLoading();
+	if (!options.headless)
+	{
+		initWindow();
+		startup_timeline.mark("window");
+	}
 	initVulkan();
 	mainLoop();
+	if (!options.trace_path.empty())
+	{
+		writeTrace();
+	}
+}
+
+void VulkanShowBase::writeTrace() const
+{
+	TraceProfiler::writeChromeTrace(options.trace_path);
+	std::cout << "Trace of " << TraceProfiler::getEventCount() << " events written to " << options.trace_path;
+	if (TraceProfiler::getDroppedEventCount() > 0)
+	{
+		std::cout << ", " << TraceProfiler::getDroppedEventCount() << " dropped";
+	}
+	std::cout << std::endl;
 }
 
 VkResult VulkanShowBase::CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback)
@@ -137,7 +156,7 @@ VkResult VulkanShowBase::CreateDebugReportCallbackEXT(VkInstance instance, const
 	}
 }
 
-void VulkanShowBase::DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* pAllocator)
+void VKAPI_CALL VulkanShowBase::DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* pAllocator)
 {
 	auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
 	if (func != nullptr) {
@@ -164,6 +183,7 @@ VkBool32 debugCallback(
 
 void VulkanShowBase::initWindow()
 {
+	TRACE_FUNCTION();
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // no OpenGL context
@@ -181,6 +201,8 @@ void VulkanShowBase::initWindow()
 
 	glfwSetWindowUserPointer(window, this);
 	glfwSetWindowSizeCallback(window, VulkanShowBase::onWindowResized);
+	glfwSetKeyCallback(window, VulkanShowBase::onKeyPressed);
+	glfwSetMouseButtonCallback(window, VulkanShowBase::onMouseButton);
 }
 
 void VulkanShowBase::onWindowResized(GLFWwindow * window, int width, int height)
@@ -188,41 +210,339 @@ void VulkanShowBase::onWindowResized(GLFWwindow * window, int width, int height)
 	if (width == 0 || height == 0) return;
 
 	VulkanShowBase* app = reinterpret_cast<VulkanShowBase*>(glfwGetWindowUserPointer(window));
-	app->recreateSwapChain();
+	// events are polled between acquiring and presenting, so wait until the image is presented,
+	// and for the size to settle
+	app->resize_coalescer.onResize();
+}
+
+void VulkanShowBase::onKeyPressed(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	VulkanShowBase* app = reinterpret_cast<VulkanShowBase*>(glfwGetWindowUserPointer(window));
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+	{
+		app->depth_prepass_enabled = !app->depth_prepass_enabled;
+		if (app->depth_prepass_enabled && !app->depth_prepass_pipeline)
+		{
+			// made again along with the pre-pass pipelines, the frames in flight keep the old ones
+			app->deferred_destruction->retire(app->pipeline_layout);
+			app->deferred_destruction->retire(app->graphics_pipeline);
+			try
+			{
+				app->createGraphicsPipeline();
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Depth pre-pass unavailable: " << e.what() << std::endl;
+				app->depth_prepass_enabled = false;
+			}
+		}
+		std::cout << "Depth pre-pass: " << (app->depth_prepass_enabled ? "on" : "off") << std::endl;
+		app->retireCommandBuffers();
+		app->createCommandBuffers();
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS && app->options.occlusion_culling)
+	{
+		// cycle through the depth pyramid levels and back to the scene
+		app->debug_pyramid_level++;
+		if (app->debug_pyramid_level >= (int)app->depth_pyramid_level_count)
+		{
+			app->debug_pyramid_level = -1;
+		}
+		app->retireCommandBuffers();
+		app->createCommandBuffers();
+	}
+	if (key == GLFW_KEY_T && action == GLFW_PRESS && !app->options.trace_path.empty())
+	{
+		app->writeTrace();
+	}
+}
+
+void VulkanShowBase::onMouseButton(GLFWwindow* window, int button, int action, int mods)
+{
+	VulkanShowBase* app = reinterpret_cast<VulkanShowBase*>(glfwGetWindowUserPointer(window));
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+	{
+		app->pickObject();
+	}
+}
+
+void VulkanShowBase::openAssetArchive()
+{
+	TRACE_FUNCTION();
+	// a missing archive isn't an error, content may just not have been packed
+	if (!options.asset_archive.empty() && std::ifstream(options.asset_archive).good())
+	{
+		asset_archive.reset(new AssetArchive(options.asset_archive));
+		std::cout << "Assets: " << options.asset_archive << ", " << asset_archive->getEntryCount() << " entries" << std::endl;
+	}
+	else
+	{
+		std::cout << "Assets: loose files" << std::endl;
+	}
+}
+
+AssetBytes VulkanShowBase::readAsset(const std::string& path) const
+{
+	TRACE_FUNCTION();
+	if (asset_archive && asset_archive->contains(path))
+	{
+		return asset_archive->read(path);
+	}
+	return AssetBytes(readFile(path));
+}
+
+std::vector<std::future<AssetBytes>> VulkanShowBase::readAssetsAsync(const std::vector<std::string>& paths)
+{
+	TRACE_FUNCTION();
+	struct LooseFile
+	{
+		std::string path;
+		std::promise<AssetBytes> bytes;
+		std::vector<char> buffer;
+	};
+	auto loose_files = std::make_shared<std::vector<LooseFile>>();
+	std::vector<std::future<AssetBytes>> results;
+	for (const auto& path : paths)
+	{
+		if (asset_archive && asset_archive->contains(path))
+		{
+			// checked against its checksum by whichever thread gets it
+			results.push_back(std::async(std::launch::deferred, [this, path]() { return asset_archive->read(path); }));
+			continue;
+		}
+		loose_files->emplace_back();
+		loose_files->back().path = path;
+		results.push_back(loose_files->back().bytes.get_future());
+	}
+	if (loose_files->empty())
+	{
+		return results;
+	}
+
+	// one batch on a thread of its own, every file is handed over as soon as it is in
+	asset_reads = std::async(std::launch::async, [loose_files]()
+	{
+		if (TraceProfiler::isEnabled())
+		{
+			TraceProfiler::setThreadName("asset reads");
+		}
+		TRACE_SCOPE("readAssetsAsync batch");
+		AsyncFileReader reader;
+		for (auto& file : *loose_files)
+		{
+			try
+			{
+				file.buffer.resize((size_t)AsyncFileReader::getFileSize(file.path));
+			}
+			catch (const std::runtime_error&)
+			{
+				file.bytes.set_exception(std::current_exception());
+				continue;
+			}
+			reader.read(file.path, file.buffer.data(), file.buffer.size(), [&file](const FileReadResult& result)
+			{
+				if (result.error.empty())
+				{
+					file.bytes.set_value(AssetBytes(std::move(file.buffer)));
+				}
+				else
+				{
+					file.bytes.set_exception(std::make_exception_ptr(
+						std::runtime_error("Failed to read " + result.path + ": " + result.error)));
+				}
+			});
+		}
+		reader.wait();
+	});
+	return results;
+}
+
+void VulkanShowBase::startAssetLoading()
+{
+	TRACE_FUNCTION();
+	// in parallel the files are read in one batch up front, serially each job reads its own
+	std::future<AssetBytes> texture_bytes;
+	std::future<AssetBytes> model_bytes;
+	if (!options.serial_init)
+	{
+		auto reads = readAssetsAsync({ TEXTURE_PATH, MODEL_PATH });
+		texture_bytes = std::move(reads[0]);
+		model_bytes = std::move(reads[1]);
+	}
+	auto load_affinity = options.serial_init ? JobAffinity::MAIN_THREAD : JobAffinity::ANY_THREAD;
+
+	// jobs on workers must not throw, errors wait for the uploads on the main thread
+	job_system->run("loadImage", [this, read = std::move(texture_bytes)]() mutable
+	{
+		try
+		{
+			auto bytes = read.valid() ? read.get() : readAsset(TEXTURE_PATH);
+			loaded_texture = decodeImage(bytes.data(), bytes.size());
+			startup_timeline.mark("texture_decoded");
+		}
+		catch (...)
+		{
+			texture_error = std::current_exception();
+		}
+	}, &texture_load, load_affinity);
+	job_system->run("loadObjModel", [this, read = std::move(model_bytes)]() mutable
+	{
+		try
+		{
+			auto bytes = read.valid() ? read.get() : readAsset(MODEL_PATH);
+			loaded_model = loadObjModel(bytes.data(), bytes.size());
+			startup_timeline.mark("model_parsed");
+		}
+		catch (...)
+		{
+			model_error = std::current_exception();
+		}
+	}, &model_load, load_affinity);
+
+	job_system->runAfter(texture_load, "upload texture", [this]()
+	{
+		createTextureImage();
+		createTextureImageView();
+		startup_timeline.mark("texture_uploaded");
+	}, &asset_uploads, JobAffinity::MAIN_THREAD);
+	job_system->runAfter(model_load, "upload model", [this]()
+	{
+		loadModel();
+		createSceneObjects();
+		createVertexBuffer();
+		createIndexBuffer();
+		startup_timeline.mark("model_uploaded");
+	}, &asset_uploads, JobAffinity::MAIN_THREAD);
 }
 
 void VulkanShowBase::initVulkan()
 {
+	TRACE_FUNCTION();
 	createInstance();
 	setupDebugCallback();
-	createWindowSurface();
+	if (!options.headless)
+	{
+		createWindowSurface();
+	}
 	pickPhysicalDevice();
 	createLogicalDevice();
-	createSwapChain();
+	descriptor_allocator.reset(new DescriptorAllocator(graphics_device, descriptor_update_templates));
+	deferred_destruction.reset(new DeferredDestruction(graphics_device, graphics_queue));
+	if (options.gpu_time_target_ms > 0.0f)
+	{
+		dynamic_resolution.reset(new DynamicResolution(options.gpu_time_target_ms, options.min_resolution_scale));
+	}
+	// uploads need nothing more than this, assets that are loaded by now go up between the
+	// following steps, the rest is waited for after the frame buffers; nothing else runs
+	// main thread jobs before
+	createCommandPool();
+	startup_timeline.mark("device");
+	uploadLoadedAssets(false);
+	if (options.headless)
+	{
+		createOffscreenTargets();
+	}
+	else
+	{
+		createSwapChain();
+	}
 	createSwapChainImageViews();
+	updateRenderExtent();
+	startup_timeline.mark("swapchain");
+	uploadLoadedAssets(false);
 	createRenderPass();
 	createDescriptorSetLayout();
 	createGraphicsPipeline();
-	createCommandPool();
+	startup_timeline.mark("pipelines");
+	uploadLoadedAssets(false);
 	createDepthResources();
+	if (dynamic_resolution)
+	{
+		createSceneColorResources();
+		createFrameTimestampPool();
+	}
 	createFrameBuffers();
-	createTextureImage();
-	createTextureImageView();
 	createTextureSampler();
-	loadModel();
+	uploadLoadedAssets(true);
 	// TODO: better to use a single memory allocation for multiple buffers
-	createVertexBuffer();
-	createIndexBuffer();
 	createUniformBuffer();
-	createDescriptorPool();
+	createFrameUniformBuffers();
+	createObjectBuffers();
+	if (options.gpu_culling)
+	{
+		createCullingResources();
+		if (options.occlusion_culling)
+		{
+			createOcclusionCullingResources();
+		}
+		createCullingPipeline();
+	}
+	if (options.occlusion_culling)
+	{
+		createDepthPyramid();
+		createDepthPyramidDebugPipeline();
+	}
 	createDescriptorSet();
+	if (options.gpu_culling)
+	{
+		createCullingDescriptorSet();
+	}
+	if (options.gpu_profile)
+	{
+		createGpuProfiler();
+	}
 	createCommandBuffers();
 	createSemaphores();
+	createFrameFences();
+	if (!options.capture_path.empty())
+	{
+		frame_encoder.reset(new FrameEncoder(parseCaptureFormat(options.capture_format), options.capture_path
+			, options.capture_workers));
+		createReadbackRing();
+	}
+	startup_timeline.mark("initialized");
+}
+
+void VulkanShowBase::uploadLoadedAssets(bool wait)
+{
+	TRACE_FUNCTION();
+	// the uploads were queued once their loading finished, with serial_init the loading as well
+	if (wait)
+	{
+		job_system->wait(asset_uploads);
+	}
+	else
+	{
+		job_system->runMainThreadJobs();
+	}
+}
+
+void VulkanShowBase::printJobStats() const
+{
+	auto stats = job_system->getStats();
+	double elapsed_ns = (double)job_system->getStatsElapsedNs();
+	std::cout << "Job threads busy since the first frame:";
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		std::cout << (i == 0 ? " main " : ", ") << (elapsed_ns > 0.0 ? stats[i].busy_ns * 100.0 / elapsed_ns : 0.0) << " %";
+	}
+	uint64_t jobs = 0;
+	uint64_t stolen = 0;
+	uint64_t allocated = 0;
+	for (const auto& thread : stats)
+	{
+		jobs += thread.jobs;
+		stolen += thread.stolen;
+		allocated += thread.allocated;
+	}
+	std::cout << std::endl << "Jobs: " << jobs << " run, " << stolen << " stolen, "
+		<< allocated << " allocated past a full ring" << std::endl;
 }
 
 // Needs to be called right after instance creation because it may influence device selection
 void VulkanShowBase::createWindowSurface()
 {
+	TRACE_FUNCTION();
 	auto result = glfwCreateWindowSurface(instance, window, nullptr, &window_surface);
 
 	if (result != VK_SUCCESS)
@@ -231,115 +551,447 @@ void VulkanShowBase::createWindowSurface()
 	}
 }
 
+static uint64_t nanosecondsBetween(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
 void VulkanShowBase::mainLoop()
 {
-	auto start_time = std::chrono::high_resolution_clock::now();
-	while (!glfwWindowShouldClose(window))
+	auto start_time = std::chrono::steady_clock::now();
+	animation_start_time = start_time;
+	pacing_stats.begin();
+	std::unique_ptr<BenchmarkRecorder> benchmark;
+	uint32_t frame_limit = options.frame_count;
+	if (options.benchmark)
 	{
-		glfwPollEvents();
+		benchmark.reset(new BenchmarkRecorder(options.warmup_frames, options.frame_count));
+		frame_limit += options.warmup_frames;
+	}
+
+	auto last_present_time = std::chrono::steady_clock::now();
+	while (options.headless || !glfwWindowShouldClose(window))
+	{
+		TRACE_SCOPE("frame");
+		// whatever jobs left for the main thread, GLFW and presenting stay on it
+		job_system->runMainThreadJobs();
+		frame_limiter.wait();
+		auto frame_start = std::chrono::steady_clock::now();
+		frame_timings = FrameTimings();
+		bool resize_sweep_frame = stepResizeSweep();
+
+		// with FIFO this is where the CPU waits for the display
+		uint32_t image_index;
+		if (!acquireFrame(&image_index))
+		{
+			glfwPollEvents();
+			continue;
+		}
+		auto input_time = std::chrono::steady_clock::now();
+		frame_timings.present_wait_ns = nanosecondsBetween(frame_start, input_time);
+
+		// sample input as late as possible, right before it goes into the uniform buffer
+		if (!options.headless)
+		{
+			glfwPollEvents();
+		}
+		updateUniformBuffer(image_index);
+		frame_timings.update_ns = nanosecondsBetween(input_time, std::chrono::steady_clock::now());
+		drawFrame(image_index);
 
-		updateUniformBuffer();
-		drawFrame();
+		auto present_time = std::chrono::steady_clock::now();
+		frame_timings.total_ns = nanosecondsBetween(frame_start, present_time);
+		if (benchmark)
+		{
+			benchmark->addFrame(frame_timings);
+		}
+		if (total_frames > 0)
+		{
+			pacing_stats.addFrame(std::chrono::duration<double, std::milli>(present_time - last_present_time).count()
+				, std::chrono::duration<double, std::milli>(present_time - input_time).count());
+		}
+		if (resize_sweep_frame)
+		{
+			resize_sweep_stats.addFrame(std::chrono::duration<double, std::milli>(present_time - last_present_time).count()
+				, std::chrono::duration<double, std::milli>(present_time - input_time).count());
+		}
+		last_present_time = present_time;
+		if (total_frames == 0)
+		{
+			startup_timeline.mark("first_frame");
+			std::cout << "Startup, " << (options.serial_init ? "serial" : "parallel") << " asset loading:" << std::endl;
+			startup_timeline.print(std::cout);
+			job_system->resetStats();
+		}
 		total_frames++;
+
+		if (frame_limit > 0 && total_frames >= (int)frame_limit)
+		{
+			break;
+		}
 	}
-	auto end_time = std::chrono::high_resolution_clock::now();
-	total_time_past = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() / 1000.0f;
+	auto end_time = std::chrono::steady_clock::now();
+	total_time_past = std::chrono::duration<float>(end_time - start_time).count();
 	if (total_time_past > 0)
 	{
 	    std::cout << "FPS: " << total_frames / total_time_past << std::endl;
 	}
 
-	vkDeviceWaitIdle(graphics_device);
-}
+	auto pacing = pacing_stats.summarize();
+	std::cout << "Frame pacing: " << options.pacing_preset << ", " << (options.headless ? "offscreen" : presentModeName(present_mode))
+		<< ", " << swap_chain_images.size() << " images";
+	if (frame_limiter.getTargetFps() > 0.0)
+	{
+		std::cout << ", limited to " << frame_limiter.getTargetFps() << " fps";
+	}
+	std::cout << std::endl
+		<< "Frame time: mean " << pacing.frame_time_mean_ms << " ms, stddev " << pacing.frame_time_stddev_ms
+		<< " ms, p99 " << pacing.frame_time_p99_ms << " ms" << std::endl
+		<< "Input to present: mean " << pacing.latency_mean_ms << " ms, p99 " << pacing.latency_p99_ms << " ms" << std::endl
+		<< "CPU utilization: " << pacing.cpu_utilization * 100.0 << " %" << std::endl;
+	if (options.resize_sweep_frames > 0)
+	{
+		auto sweep = resize_sweep_stats.summarize();
+		std::cout << "Resize sweep: " << sweep.frame_count << " frames, " << resize_coalescer.getEventCount()
+			<< " resize events, " << resize_coalescer.getRecreationCount() << " swap chain recreations, frame time mean "
+			<< sweep.frame_time_mean_ms << " ms, p99 " << sweep.frame_time_p99_ms << " ms, worst "
+			<< sweep.frame_time_max_ms << " ms" << std::endl;
+	}
+	printJobStats();
+	printAttachmentReport();
 
-void VulkanShowBase::recreateSwapChain()
-{
 	vkDeviceWaitIdle(graphics_device);
-
-	createSwapChain();
-	createSwapChainImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
-	createDepthResources();
-	createFrameBuffers();
-	createCommandBuffers();
-}
-
-void VulkanShowBase::createInstance()
-{
-	if (ENABLE_VALIDATION_LAYERS && !checkValidationLayerSupport())
+	// the frames still in flight when the loop ended
+	for (uint32_t i = 0; i < profiled_frames.size(); i++)
 	{
-		throw std::runtime_error("validation layers requested, but not available!");
+		collectProfiledFrame(i);
 	}
-
-
-	VkApplicationInfo app_info = {}; // optional
-	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-	app_info.pApplicationName = "Vulkan Hello World";
-	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-	app_info.pEngineName = "No Engine";
-	app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	app_info.apiVersion = VK_API_VERSION_1_0;
-
-	VkInstanceCreateInfo instance_info = {}; // not optional
-	instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-	instance_info.pApplicationInfo = &app_info;
-
-	// Getting Vulkan instance extensions required by GLFW
-	auto glfwExtensions = getRequiredExtensions();
-
-	// Getting Vulkan supported extensions
-	uint32_t extensionCount = 0;
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-	std::vector<VkExtensionProperties> extensions(extensionCount);
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-	std::unordered_set<std::string> supportedExtensionNames;
-	for (const auto& extension : extensions)
+	deferred_destruction->drain();
+	auto retired = deferred_destruction->getStats();
+	if (retired.retired > 0)
 	{
-		supportedExtensionNames.insert(std::string(extension.extensionName));
+		std::cout << "Deferred destruction: " << retired.destroyed << " objects over " << retired.fenced_frames
+			<< " frames, at most " << retired.max_pending << " pending" << std::endl;
 	}
-
-	// Print Vulkan supported extensions
-	std::cout << "available extensions:" << std::endl;
-	for (const auto& name : supportedExtensionNames) {
-		std::cout << "\t" << name << std::endl;
+	auto descriptors = descriptor_allocator->getStats();
+	std::cout << "Descriptors: " << descriptors.allocations << " sets allocated from " << descriptors.pools
+		<< " pools, " << descriptors.cache_hits << " cache hits, " << descriptors.cache_misses << " misses, "
+		<< descriptors.freed << " freed, " << descriptors.descriptors_written << " descriptors written in "
+		<< descriptors.update_ns / 1000.0 << " us with "
+		<< (descriptor_allocator->usesUpdateTemplates() ? "update templates" : "vkUpdateDescriptorSets")
+		<< ", " << descriptors.busy_frames << " of " << descriptors.frames << " frames allocating, at most "
+		<< descriptors.max_frame_allocations << " sets and " << descriptors.max_frame_update_ns / 1000.0
+		<< " us in one" << std::endl;
+
+	if (frame_encoder)
+	{
+		collectCaptures();
+		frame_encoder->finish();
+		auto capture_stats = frame_encoder->getStats();
+		std::cout << "Capture: " << capture_stats.encoded_frames << " frames written, "
+			<< readback_dropped_frames + capture_stats.dropped_frames << " dropped ("
+			<< readback_dropped_frames << " with the readback ring full, "
+			<< capture_stats.dropped_frames << " by the encoder), max queue depth "
+			<< capture_stats.max_queue_depth << " of " << frame_encoder->getMaxQueueDepth() << std::endl;
 	}
-	// Check for and print any unsupported extension
-	for (const auto& extension_name : glfwExtensions)
+
+	if (options.gpu_culling || options.cpu_culling)
 	{
-		std::string name(extension_name);
-		if (supportedExtensionNames.count(name) <= 0)
+		auto stats = getCullingStats();
+		std::cout << "Drawn objects: " << stats.drawn_objects
+			<< ", culled objects: " << stats.culled_objects;
+		if (options.occlusion_culling)
 		{
-			std::cout << "unsupported extension required by GLFW: " << name << std::endl;
+			std::cout << " (" << stats.occluded_objects << " occluded)";
 		}
+		std::cout << std::endl;
 	}
 
-	// Enable required extensions
-	instance_info.enabledExtensionCount = static_cast<uint32_t>(glfwExtensions.size());
-	instance_info.ppEnabledExtensionNames = glfwExtensions.data();
-
-	if (ENABLE_VALIDATION_LAYERS) {
-		instance_info.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
-		instance_info.ppEnabledLayerNames = VALIDATION_LAYERS.data();
-	}
-	else {
-		instance_info.enabledLayerCount = 0;
+	if (dynamic_resolution)
+	{
+		auto history = getResolutionHistory();
+		float scale_sum = 0.0f;
+		for (const auto& sample : history)
+		{
+			scale_sum += sample.scale;
+		}
+		std::cout << "Resolution scale: " << dynamic_resolution->getScale()
+			<< ", average " << (history.empty() ? 0.0f : scale_sum / history.size())
+			<< " over the last " << history.size() << " frames, "
+			<< dynamic_resolution->getChangeCount() << " changes" << std::endl;
 	}
 
-	VkResult result = vkCreateInstance(&instance_info, nullptr, &instance);
-	if (result != VK_SUCCESS)
+	if (gpu_profiler)
 	{
-		throw std::runtime_error("failed to create instance!");
+		auto passes = gpu_profiler->summarize();
+		std::cout << "GPU passes over the last " << gpu_profiler->getHistory().size() << " frames:" << std::endl;
+		for (const auto& pass : passes)
+		{
+			std::cout << "\t" << pass.name << ": mean " << pass.time.mean_ms << " ms, p99 " << pass.time.p99_ms << " ms";
+			if (pass.has_statistics)
+			{
+				// fragment against vertex invocations tells fragment bound passes from vertex bound ones
+				std::cout << ", " << pass.vertex_invocations << " vertex, " << pass.clipping_primitives << " primitives, "
+					<< pass.fragment_invocations << " fragment, " << pass.compute_invocations << " compute invocations";
+			}
+			std::cout << std::endl;
+		}
 	}
 
+	if (benchmark)
+	{
+		writeBenchmarkResults(*benchmark);
+	}
 }
 
-bool VulkanShowBase::checkValidationLayerSupport()
+void VulkanShowBase::writeBenchmarkResults(const BenchmarkRecorder& benchmark) const
 {
-	uint32_t layerCount;
-	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+	TRACE_FUNCTION();
+	BenchmarkInfo info;
+	info.device_name = device_capabilities.name;
+	info.headless = options.headless;
+	info.width = swap_chain_extent.width;
+	info.height = swap_chain_extent.height;
+	info.object_count = options.object_count;
+	info.timestep_ms = options.timestep_ms;
+	info.warmup_frames = options.warmup_frames;
+	info.settings = {
+		{ "culling", options.occlusion_culling ? "occlusion" : options.gpu_culling ? "gpu" : options.cpu_culling ? "cpu" : "none" },
+		{ "depth_prepass", depth_prepass_enabled ? "on" : "off" },
+		{ "camera", cameraPathName(options.camera_path) },
+		{ "present_mode", options.headless ? "offscreen" : presentModeName(present_mode) },
+		{ "swapchain_images", std::to_string(swap_chain_images.size()) },
+		{ "dynamic_resolution_ms", std::to_string(options.gpu_time_target_ms) },
+		{ "asset_loading", options.serial_init ? "serial" : "parallel" },
+	};
+	info.startup_ms = startup_timeline.getMilestones();
+	if (gpu_profiler)
+	{
+		// frames count from 0, the measured ones start after the warm-up
+		info.gpu_passes = gpu_profiler->summarize(options.warmup_frames);
+	}
 
-	std::vector<VkLayerProperties> availableLayers(layerCount);
+	auto format = parseBenchmarkFormat(options.benchmark_format);
+	if (options.benchmark_output.empty())
+	{
+		benchmark.write(std::cout, format, info);
+		return;
+	}
+	std::ofstream file(options.benchmark_output);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open " + options.benchmark_output + " for the benchmark results!");
+	}
+	benchmark.write(file, format, info);
+	std::cout << "Benchmark results written to " << options.benchmark_output << std::endl;
+}
+
+std::vector<DynamicResolution::Sample> VulkanShowBase::getResolutionHistory() const
+{
+	if (!dynamic_resolution)
+	{
+		return {};
+	}
+	return dynamic_resolution->getHistory();
+}
+
+CullingStats VulkanShowBase::getCullingStats() const
+{
+	CullingStats stats;
+	if (mapped_culling_stats)
+	{
+		// read after mainLoop has idled the device, every frame writes it
+		stats.drawn_objects = mapped_culling_stats->draw.instanceCount;
+		if (options.occlusion_culling)
+		{
+			stats.drawn_objects += mapped_culling_stats->late_draw.instanceCount;
+			stats.occluded_objects = mapped_culling_stats->occluded_objects;
+		}
+		stats.culled_objects = (uint32_t)scene_objects.size() - stats.drawn_objects;
+	}
+	else if (options.cpu_culling)
+	{
+		stats.drawn_objects = (uint32_t)visible_objects.size();
+		stats.culled_objects = (uint32_t)scene_objects.size() - stats.drawn_objects;
+	}
+	else
+	{
+		stats.drawn_objects = (uint32_t)scene_objects.size();
+	}
+	return stats;
+}
+
+void VulkanShowBase::recreateSwapChain()
+{
+	TRACE_FUNCTION();
+	// the frames in flight keep their objects until they complete, the old swap chain is passed on
+	VkFormat old_format = swap_chain_image_format;
+	createSwapChain();
+	bool format_changed = swap_chain_image_format != old_format;
+	retireSwapChainResources(format_changed);
+
+	createSwapChainImageViews();
+	updateRenderExtent();
+	if (format_changed)
+	{
+		createRenderPass();
+		createGraphicsPipeline();
+	}
+	createDepthResources();
+	if (dynamic_resolution)
+	{
+		createSceneColorResources();
+		createFrameTimestampPool();
+	}
+	// the sets of the old depth pyramid are the ones not asked for again
+	descriptor_allocator->beginRebuild();
+	if (options.occlusion_culling)
+	{
+		createDepthPyramid();
+		if (format_changed)
+		{
+			createDepthPyramidDebugPipeline();
+		}
+	}
+	createDescriptorSet();
+	if (options.gpu_culling)
+	{
+		createCullingDescriptorSet();
+	}
+	descriptor_allocator->endRebuild(*deferred_destruction);
+	createFrameBuffers();
+	if (gpu_profiler)
+	{
+		// the swap chain length may have changed
+		gpu_profiler->createPools((uint32_t)swap_chain_images.size(), deferred_destruction.get());
+		profiled_frames.assign(swap_chain_images.size(), -1);
+	}
+	// so may have the frames in flight, the ones of the old swap chain keep their objects
+	createFrameUniformBuffers();
+	createCommandBuffers();
+	createSemaphores();
+	createFrameFences();
+	if (frame_encoder)
+	{
+		createReadbackRing(); // for the new extent
+	}
+	resize_coalescer.onRecreated();
+}
+
+void VulkanShowBase::retireSwapChainResources(bool format_changed)
+{
+	// the frames in flight may still use all of it, so nothing is destroyed before they complete;
+	// only what is created again is retired, holders of objects not in use here are empty anyway
+	DeferredDestruction& retired = *deferred_destruction;
+	retired.retire(swap_chain_imageviews);
+	if (format_changed)
+	{
+		retired.retire(render_pass);
+		retired.retire(late_render_pass);
+		retired.retire(pipeline_layout);
+		retired.retire(graphics_pipeline);
+		retired.retire(depth_prepass_pipeline);
+		retired.retire(depth_equal_pipeline);
+		retired.retire(depth_pyramid_debug_pipeline);
+	}
+	retired.retire(depth_image);
+	retired.retire(depth_image_memory);
+	retired.retire(depth_image_view);
+	retired.retire(scene_color_image);
+	retired.retire(scene_color_image_memory);
+	retired.retire(scene_color_image_view);
+	retired.retire(depth_pyramid);
+	retired.retire(depth_pyramid_memory);
+	retired.retire(depth_pyramid_view);
+	retired.retire(depth_pyramid_level_views);
+	retired.retire(swap_chain_framebuffers);
+	retireCommandBuffers();
+}
+
+void VulkanShowBase::retireCommandBuffers()
+{
+	// recorded again into new ones, the secondary ones go with their pools
+	deferred_destruction->retire(command_pool, command_buffers);
+	deferred_destruction->retire(draw_command_pools);
+	draw_command_buffers.clear();
+}
+
+void VulkanShowBase::createInstance()
+{
+	TRACE_FUNCTION();
+	if (ENABLE_VALIDATION_LAYERS && !checkValidationLayerSupport())
+	{
+		throw std::runtime_error("validation layers requested, but not available!");
+	}
+
+
+	VkApplicationInfo app_info = {}; // optional
+	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	app_info.pApplicationName = "Vulkan Hello World";
+	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+	app_info.pEngineName = "No Engine";
+	app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+	app_info.apiVersion = VK_API_VERSION_1_0;
+
+	VkInstanceCreateInfo instance_info = {}; // not optional
+	instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instance_info.pApplicationInfo = &app_info;
+
+	// Getting Vulkan instance extensions required by GLFW
+	auto glfwExtensions = getRequiredExtensions();
+
+	// Getting Vulkan supported extensions
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+	std::unordered_set<std::string> supportedExtensionNames;
+	for (const auto& extension : extensions)
+	{
+		supportedExtensionNames.insert(std::string(extension.extensionName));
+	}
+
+	// Print Vulkan supported extensions
+	std::cout << "available extensions:" << std::endl;
+	for (const auto& name : supportedExtensionNames) {
+		std::cout << "\t" << name << std::endl;
+	}
+	// Check for and print any unsupported extension
+	for (const auto& extension_name : glfwExtensions)
+	{
+		std::string name(extension_name);
+		if (supportedExtensionNames.count(name) <= 0)
+		{
+			std::cout << "unsupported extension required by GLFW: " << name << std::endl;
+		}
+	}
+
+	// Enable required extensions
+	instance_info.enabledExtensionCount = static_cast<uint32_t>(glfwExtensions.size());
+	instance_info.ppEnabledExtensionNames = glfwExtensions.data();
+
+	if (ENABLE_VALIDATION_LAYERS) {
+		instance_info.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
+		instance_info.ppEnabledLayerNames = VALIDATION_LAYERS.data();
+	}
+	else {
+		instance_info.enabledLayerCount = 0;
+	}
+
+	VkResult result = vkCreateInstance(&instance_info, nullptr, &instance);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create instance!");
+	}
+
+}
+
+bool VulkanShowBase::checkValidationLayerSupport()
+{
+	uint32_t layerCount;
+	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+	std::vector<VkLayerProperties> availableLayers(layerCount);
 	vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
 
 	for (const char* layerName : VALIDATION_LAYERS)
@@ -367,9 +1019,13 @@ std::vector<const char*> VulkanShowBase::getRequiredExtensions()
 {
 	std::vector<const char*> extensions;
 
+	// headless mode has no surface, so GLFW isn't even initialized
 	unsigned int glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	const char** glfwExtensions = nullptr;
+	if (!options.headless)
+	{
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	}
 
 	for (unsigned int i = 0; i < glfwExtensionCount; i++)
 	{
@@ -387,6 +1043,7 @@ std::vector<const char*> VulkanShowBase::getRequiredExtensions()
 
 void VulkanShowBase::setupDebugCallback()
 {
+	TRACE_FUNCTION();
 	if (!ENABLE_VALIDATION_LAYERS) return;
 
 	VkDebugReportCallbackCreateInfoEXT createInfo = {};
@@ -406,8 +1063,7 @@ void VulkanShowBase::setupDebugCallback()
 // Pick up a graphics card to use
 void VulkanShowBase::pickPhysicalDevice()
 {
-	// This object will be implicitly destroyed when the VkInstance is destroyed, so we don't need to add a delete wrapper.
-	VkPhysicalDevice physial_device = VK_NULL_HANDLE;
+	TRACE_FUNCTION();
 	uint32_t device_count = 0;
 	vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
 
@@ -418,29 +1074,50 @@ void VulkanShowBase::pickPhysicalDevice()
 
 	std::vector<VkPhysicalDevice> devices(device_count);
 	vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
-	//TODO: continue here
 
-	for (const auto& device : devices)
+	// The highest scoring device that can render, among the ones matching --device if given.
+	// Physical devices are implicitly destroyed with the VkInstance, so there's no delete wrapper.
+	VkPhysicalDevice best_device = VK_NULL_HANDLE;
+	DeviceCapabilities best_capabilities;
+	uint64_t best_score = 0;
+	bool selector_matched = false;
+	for (uint32_t i = 0; i < device_count; i++)
 	{
-		if (isDeviceSuitable(device))
+		DeviceCapabilities capabilities = queryDeviceCapabilities(devices[i]);
+		uint64_t score = scoreDevice(capabilities);
+		bool suitable = isDeviceSuitable(devices[i]);
+		std::cout << "GPU " << i << ": " << describeDevice(capabilities) << ", score " << score
+			<< (suitable ? "" : ", can't render") << std::endl;
+
+		if (!options.device.empty())
 		{
-			physial_device = device;
-			break;
+			if (!matchesDeviceSelector(capabilities, i, options.device))
+			{
+				continue;
+			}
+			selector_matched = true;
+		}
+		if (suitable && (best_device == VK_NULL_HANDLE || score > best_score))
+		{
+			best_device = devices[i];
+			best_capabilities = capabilities;
+			best_score = score;
 		}
 	}
 
-	if (physial_device == VK_NULL_HANDLE)
-	{
-		throw std::runtime_error("Failed to find a suitable GPU!");
-	}
-	else
+	if (best_device == VK_NULL_HANDLE)
 	{
-		VkPhysicalDeviceProperties properties;
-		vkGetPhysicalDeviceProperties(physial_device, &properties);
-		std::cout << "Current Device: " << properties.deviceName << std::endl;
+		if (options.device.empty())
+		{
+			throw std::runtime_error("Failed to find a suitable GPU!");
+		}
+		throw std::runtime_error(selector_matched ? "No GPU matching --device " + options.device + " can render!"
+			: "No GPU matches --device " + options.device);
 	}
 
-	this->physical_device = physial_device;
+	std::cout << "Current Device: " << best_capabilities.name << std::endl;
+	physical_device = best_device;
+	device_capabilities = best_capabilities;
 }
 
 bool VulkanShowBase::isDeviceSuitable(VkPhysicalDevice device)
@@ -458,14 +1135,14 @@ bool VulkanShowBase::isDeviceSuitable(VkPhysicalDevice device)
 
 	bool extensions_supported = checkDeviceExtensionSupport(device);
 
-	bool swap_chain_adequate = false;
-	if (extensions_supported)
+	bool swap_chain_adequate = options.headless; // nothing to present to
+	if (extensions_supported && !options.headless)
 	{
 		auto swap_chain_support = SwapChainSupportDetails::querySwapChainSupport(device, static_cast<VkSurfaceKHR>(window_surface));
 		swap_chain_adequate = !swap_chain_support.formats.empty() && !swap_chain_support.present_modes.empty();
 	}
 
-	return indices.isComplete() && extensions_supported && swap_chain_adequate;
+	return indices.isComplete(!options.headless) && extensions_supported && swap_chain_adequate;
 }
 
 bool VulkanShowBase::checkDeviceExtensionSupport(VkPhysicalDevice device)
@@ -476,7 +1153,8 @@ bool VulkanShowBase::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	std::vector<VkExtensionProperties> available_extensions(extension_count);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
 
-	std::set<std::string> required_extensions(DEVICE_EXTENSIONS.begin(), DEVICE_EXTENSIONS.end());
+	auto device_extensions = getDeviceExtensions();
+	std::set<std::string> required_extensions(device_extensions.begin(), device_extensions.end());
 
 	for (const auto& extension : available_extensions) 
 	{
@@ -488,10 +1166,15 @@ bool VulkanShowBase::checkDeviceExtensionSupport(VkPhysicalDevice device)
 
 void VulkanShowBase::createLogicalDevice()
 {
+	TRACE_FUNCTION();
 	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physical_device, static_cast<VkSurfaceKHR>(window_surface));
 
 	std::vector <VkDeviceQueueCreateInfo> queue_create_infos;
-	std::set<int> queue_families = { indices.graphicsFamily, indices.presentFamily };
+	std::set<int> queue_families = { indices.graphicsFamily };
+	if (!options.headless)
+	{
+		queue_families.insert(indices.presentFamily);
+	}
 
 	float queue_priority = 1.0f;
 	for (int family : queue_families)
@@ -499,15 +1182,24 @@ void VulkanShowBase::createLogicalDevice()
 		// Create a graphics queue
 		VkDeviceQueueCreateInfo queue_create_info = {};
 		queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_create_info.queueFamilyIndex = indices.graphicsFamily;
+		queue_create_info.queueFamilyIndex = family;
 		queue_create_info.queueCount = 1;
 
 		queue_create_info.pQueuePriorities = &queue_priority;
 		queue_create_infos.push_back(queue_create_info);
 	}
 
-	// Specify used device features
-	VkPhysicalDeviceFeatures device_features = {}; // Everything is by default VK_FALSE
+	// Specify used device features, only the ones some path checks for
+	VkPhysicalDeviceFeatures device_features = selectDeviceFeatures(device_capabilities, options.pipeline_statistics);
+	device_capabilities.enabled = device_features;
+	if (options.pipeline_statistics && !device_features.pipelineStatisticsQuery)
+	{
+		std::cout << "Pipeline statistics queries are not supported, profiling GPU times only" << std::endl;
+	}
+	if (!device_features.samplerAnisotropy)
+	{
+		std::cout << "Anisotropic filtering is not supported, the texture is sampled bilinearly" << std::endl;
+	}
 
 												   // Create the logical device
 	VkDeviceCreateInfo device_create_info = {};
@@ -527,8 +1219,24 @@ void VulkanShowBase::createLogicalDevice()
 		device_create_info.enabledLayerCount = 0;
 	}
 
-	device_create_info.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-	device_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	auto device_extensions = getDeviceExtensions();
+#ifdef VK_KHR_descriptor_update_template
+	// optional, descriptor sets are written with vkUpdateDescriptorSets without it
+	uint32_t extension_count;
+	vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr);
+	std::vector<VkExtensionProperties> available_extensions(extension_count);
+	vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, available_extensions.data());
+	for (const auto& extension : available_extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME) == 0)
+		{
+			device_extensions.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+			descriptor_update_templates = true;
+		}
+	}
+#endif
+	device_create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+	device_create_info.ppEnabledExtensionNames = device_extensions.data();
 
 	auto result = vkCreateDevice(physical_device, &device_create_info, nullptr, &graphics_device);
 
@@ -538,18 +1246,44 @@ void VulkanShowBase::createLogicalDevice()
 	}
 
 	vkGetDeviceQueue(graphics_device, indices.graphicsFamily, 0, &graphics_queue);
-	vkGetDeviceQueue(graphics_device, indices.presentFamily, 0, &present_queue);
+	if (options.headless)
+	{
+		present_queue = graphics_queue; // never presented to
+	}
+	else
+	{
+		vkGetDeviceQueue(graphics_device, indices.presentFamily, 0, &present_queue);
+	}
+}
+
+std::vector<const char*> VulkanShowBase::getDeviceExtensions() const
+{
+	if (options.headless)
+	{
+		return {};
+	}
+	return DEVICE_EXTENSIONS;
+}
+
+VkImageLayout VulkanShowBase::getPresentLayout() const
+{
+	// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR needs the swap chain extension
+	return options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 }
 
 void VulkanShowBase::createSwapChain()
 {
+	TRACE_FUNCTION();
 	auto support_details = SwapChainSupportDetails::querySwapChainSupport(physical_device, window_surface);
 
 	VkSurfaceFormatKHR surface_format = chooseSwapSurfaceFormat(support_details.formats);
-	VkPresentModeKHR present_mode = chooseSwapPresentMode(support_details.present_modes);
+	present_mode = chooseSwapPresentMode(support_details.present_modes);
 	VkExtent2D extent = chooseSwapExtent(support_details.capabilities);
 
-	uint32_t queue_length = support_details.capabilities.minImageCount + 1;
+	// fewer images queue fewer frames ahead of the display, more let the CPU run ahead
+	uint32_t queue_length = options.swapchain_images > 0
+		? std::max(options.swapchain_images, support_details.capabilities.minImageCount)
+		: support_details.capabilities.minImageCount + present_policy.extra_images;
 	if (support_details.capabilities.maxImageCount > 0 && queue_length > support_details.capabilities.maxImageCount) 
 	{
 		// 0 for maxImageCount means no limit
@@ -566,6 +1300,24 @@ void VulkanShowBase::createSwapChain()
 	create_info.imageArrayLayers = 1; // >1 when developing stereoscopic application
 	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // render directly
 	// VK_IMAGE_USAGE_TRANSFER_DST_BIT and memory operation to enable post processing
+	if (dynamic_resolution)
+	{
+		// the scaled scene is blitted in
+		if (!(support_details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+		{
+			throw std::runtime_error("Dynamic resolution needs swap chain images that can be blitted to!");
+		}
+		create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+	if (!options.capture_path.empty())
+	{
+		// copied to the readback buffers
+		if (!(support_details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+		{
+			throw std::runtime_error("Capture needs swap chain images that can be copied from!");
+		}
+		create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 
 	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physical_device, window_surface);
 	uint32_t queueFamilyIndices[] = { (uint32_t)indices.graphicsFamily, (uint32_t)indices.presentFamily };
@@ -589,10 +1341,14 @@ void VulkanShowBase::createSwapChain()
 	create_info.presentMode = present_mode;
 	create_info.clipped = VK_TRUE; // ignore pixels obscured
 
-	auto old_swap_chain = std::move(swap_chain); //which will be destroyed when out of scope
+	auto old_swap_chain = std::move(swap_chain);
 	create_info.oldSwapchain = old_swap_chain; // required when recreating a swap chain (like resizing windows)
 
 	auto result = vkCreateSwapchainKHR(graphics_device, &create_info, nullptr, &swap_chain);
+	// Frames in flight may still render to or present its images. Its last presents are on present_queue,
+	// which the fences don't cover; every present waited for a frame's submit, and the frames are paced
+	// by as many fences as it had images, so they are done once as many frames more have completed.
+	deferred_destruction->retire(old_swap_chain, (uint32_t)swap_chain_images.size());
 
 	if (result != VK_SUCCESS) 
 	{
@@ -608,82 +1364,93 @@ void VulkanShowBase::createSwapChain()
 	swap_chain_extent = extent;
 }
 
+void VulkanShowBase::createOffscreenTargets()
+{
+	TRACE_FUNCTION();
+	// stand-ins for the swap chain images at the window size, blittable for
+	// dynamic resolution and copyable for reading frames back
+	swap_chain_image_format = findSupportedFormat({ VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM }
+		, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT);
+	swap_chain_extent = { (uint32_t)WINDOW_WIDTH, (uint32_t)WINDOW_HEIGHT };
+
+	offscreen_images.clear();
+	offscreen_image_memory.clear();
+	swap_chain_images.clear();
+	for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++)
+	{
+		offscreen_images.emplace_back(graphics_device);
+		offscreen_image_memory.emplace_back(graphics_device);
+		createImage(swap_chain_extent.width, swap_chain_extent.height
+			, swap_chain_image_format
+			, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			, &offscreen_images[i]
+			, &offscreen_image_memory[i]);
+		swap_chain_images.push_back(offscreen_images[i]);
+	}
+}
+
 void VulkanShowBase::createSwapChainImageViews()
 {
-	swap_chain_imageviews.clear(); // VDeleter will delete old objects
+	TRACE_FUNCTION();
+	swap_chain_imageviews.clear(); // the holders destroy the old objects
 	swap_chain_imageviews.reserve(swap_chain_images.size());
 
 	for (uint32_t i = 0; i < swap_chain_images.size(); i++) 
 	{
-		swap_chain_imageviews.emplace_back( graphics_device, vkDestroyImageView);
+		swap_chain_imageviews.emplace_back(graphics_device);
 		createImageView(swap_chain_images[i], swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, &swap_chain_imageviews[i]);
 	}
 }
 
 void VulkanShowBase::createRenderPass()
 {
-	VkAttachmentDescription color_attachment = {};
-	color_attachment.format = swap_chain_image_format;
-	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // before rendering
-	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // after rendering
-	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // no stencil
-	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // to be directly used in swap chain
-
-	VkAttachmentDescription depth_attachment = {};
-	depth_attachment.format = findDepthFormat();
-	depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depth_attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference color_attachment_ref = {};
-	color_attachment_ref.attachment = 0;
-	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depth_attachment_ref = {};
-	depth_attachment_ref.attachment = 1;
-	depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &color_attachment_ref;
-	subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-	// overwrite subpass dependency to make it wait until VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0; // 0  refers to the subpass
-	dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	std::array<VkAttachmentDescription, 2> attachments = { color_attachment, depth_attachment };
-
-	VkRenderPassCreateInfo render_pass_info = {};
-	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_info.attachmentCount = (uint32_t)attachments.size();
-	render_pass_info.pAttachments = attachments.data();
-	render_pass_info.subpassCount = 1;
-	render_pass_info.pSubpasses = &subpass;
-	render_pass_info.dependencyCount = 1;
-	render_pass_info.pDependencies = &dependency;
-
-	if (vkCreateRenderPass(graphics_device, &render_pass_info, nullptr, &render_pass) != VK_SUCCESS) 
-	{
-		throw std::runtime_error("failed to create render pass!");
+	TRACE_FUNCTION();
+	VkFormat depth_format = findDepthFormat();
+	// before the pass the acquire semaphore is waited for, or the last frame's blit reads the offscreen target
+	AttachmentUse color_previous = dynamic_resolution
+		? AttachmentUse{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT, 0 }
+		: AttachmentUse{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0 };
+	// after the last pass the scene is presented, read back in headless mode, or blitted to the swap chain image
+	AttachmentUse color_next = dynamic_resolution
+		? AttachmentUse{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT }
+		: AttachmentUse{ getPresentLayout(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+	// the depth tests of the last frame, nothing after the last pass
+	AttachmentUse depth_previous = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+		, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT };
+	AttachmentUse unused = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 };
+
+	render_pass_builder = RenderPassBuilder();
+	late_render_pass_builder = RenderPassBuilder();
+	if (!options.occlusion_culling)
+	{
+		render_pass_builder.addColor(swap_chain_image_format, RenderPassBuilder::Contents::CLEAR, color_previous, color_next);
+		render_pass_builder.addDepth(depth_format, RenderPassBuilder::Contents::CLEAR, depth_previous, unused);
+		render_pass_builder.build(graphics_device, &render_pass);
+		return;
 	}
+
+	// the depth pyramid is built from the depth render_pass leaves, then late_render_pass keeps drawing
+	// into both attachments; compatible with render_pass, so the framebuffers are shared
+	AttachmentUse color_between = { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+	AttachmentUse depth_reduction = { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, VK_ACCESS_SHADER_READ_BIT };
+	render_pass_builder.addColor(swap_chain_image_format, RenderPassBuilder::Contents::CLEAR, color_previous, color_between);
+	render_pass_builder.addDepth(depth_format, RenderPassBuilder::Contents::CLEAR, depth_previous, depth_reduction);
+	render_pass_builder.build(graphics_device, &render_pass);
+
+	color_between.access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	depth_reduction.access = 0; // only read
+	late_render_pass_builder.addColor(swap_chain_image_format, RenderPassBuilder::Contents::LOAD, color_between, color_next);
+	late_render_pass_builder.addDepth(depth_format, RenderPassBuilder::Contents::LOAD, depth_reduction, unused);
+	late_render_pass_builder.build(graphics_device, &late_render_pass);
 }
 
 void VulkanShowBase::createDescriptorSetLayout()
 {
+	TRACE_FUNCTION();
 	// create descriptor for uniform buffer objects
 	VkDescriptorSetLayoutBinding ubo_layout_binding = {};
 	ubo_layout_binding.binding = 0;
@@ -701,7 +1468,18 @@ void VulkanShowBase::createDescriptorSetLayout()
 	sampler_layout_binding.pImmutableSamplers = nullptr;
 	sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { ubo_layout_binding, sampler_layout_binding };
+	// per-object transforms and the instance to object mapping
+	VkDescriptorSetLayoutBinding object_layout_binding = {};
+	object_layout_binding.binding = 2;
+	object_layout_binding.descriptorCount = 1;
+	object_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	object_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutBinding visible_object_layout_binding = object_layout_binding;
+	visible_object_layout_binding.binding = 3;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { ubo_layout_binding, sampler_layout_binding
+		, object_layout_binding, visible_object_layout_binding };
 	VkDescriptorSetLayoutCreateInfo layout_info = {};
 	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layout_info.bindingCount = (uint32_t)bindings.size();
@@ -712,16 +1490,17 @@ void VulkanShowBase::createDescriptorSetLayout()
 	{
 		throw std::runtime_error("Failed to create descriptor set layout!");
 	}
-
+	scene_layout_index = descriptor_allocator->addLayout(descriptor_set_layout, bindings);
 }
 
 void VulkanShowBase::createGraphicsPipeline()
 {
-	auto vert_shader_code = readFile("content/helloworld_vert.spv");
-	auto frag_shader_code = readFile("content/helloworld_frag.spv");
+	TRACE_FUNCTION();
+	auto vert_shader_code = readAsset("content/helloworld_vert.spv");
+	auto frag_shader_code = readAsset("content/helloworld_frag.spv");
 
-	VDeleter<VkShaderModule> vert_shader_module{ graphics_device, vkDestroyShaderModule };
-	VDeleter<VkShaderModule> frag_shader_module{ graphics_device, vkDestroyShaderModule };
+	VShaderModule vert_shader_module{ graphics_device };
+	VShaderModule frag_shader_module{ graphics_device };
 	createShaderModule(vert_shader_code, &vert_shader_module);
 	createShaderModule(frag_shader_code, &frag_shader_module);
 
@@ -831,12 +1610,14 @@ void VulkanShowBase::createGraphicsPipeline()
 	color_blending_info.blendConstants[3] = 0.0f; // Optional
 
 	// parameters allowed to be changed without recreating a pipeline
+	// the viewport follows render_extent, which changes with dynamic resolution
 	VkDynamicState dynamicStates[] = 
 	{
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 	VkPipelineDynamicStateCreateInfo dynamic_state_info = {};
+	dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 	dynamic_state_info.dynamicStateCount = 2;
 	dynamic_state_info.pDynamicStates = dynamicStates;
 
@@ -869,7 +1650,7 @@ void VulkanShowBase::createGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depth_stencil; 
 	pipelineInfo.pColorBlendState = &color_blending_info;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamic_state_info;
 	pipelineInfo.layout = pipeline_layout;
 	pipelineInfo.renderPass = render_pass;
 	pipelineInfo.subpass = 0;
@@ -883,18 +1664,69 @@ void VulkanShowBase::createGraphicsPipeline()
 	{
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+
+	// the pre-pass pipelines are made when it is first turned on, a launch without it never reads its shader
+	if (!depth_prepass_enabled)
+	{
+		return;
+	}
+
+	// after a depth pre-pass only the nearest fragment of each pixel gets shaded
+	depth_stencil.depthWriteEnable = VK_FALSE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+	if (vkCreateGraphicsPipelines(graphics_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depth_equal_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth equal pipeline!");
+	}
+
+	// the pre-pass itself reads tightly packed positions and has no fragment shader
+	auto prepass_shader_code = readAsset("content/depth_prepass_vert.spv");
+	VShaderModule prepass_shader_module{ graphics_device };
+	createShaderModule(prepass_shader_code, &prepass_shader_module);
+
+	VkPipelineShaderStageCreateInfo prepass_stage_info = vert_shader_stage_info;
+	prepass_stage_info.module = prepass_shader_module;
+
+	VkVertexInputBindingDescription position_binding = {};
+	position_binding.binding = 0;
+	position_binding.stride = sizeof(glm::vec3);
+	position_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	VkVertexInputAttributeDescription position_attribute = {};
+	position_attribute.binding = 0;
+	position_attribute.location = 0;
+	position_attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	position_attribute.offset = 0;
+	vertex_input_info.pVertexBindingDescriptions = &position_binding;
+	vertex_input_info.vertexAttributeDescriptionCount = 1;
+	vertex_input_info.pVertexAttributeDescriptions = &position_attribute;
+
+	depth_stencil.depthWriteEnable = VK_TRUE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	color_blend_attachment.blendEnable = VK_FALSE;
+	color_blend_attachment.colorWriteMask = 0;
+
+	pipelineInfo.stageCount = 1;
+	pipelineInfo.pStages = &prepass_stage_info;
+
+	if (vkCreateGraphicsPipelines(graphics_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depth_prepass_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pre-pass pipeline!");
+	}
 }
 
 void VulkanShowBase::createFrameBuffers()
 {
-	swap_chain_framebuffers.clear(); // VDeleter will delete old objects
+	TRACE_FUNCTION();
+	swap_chain_framebuffers.clear(); // the holders destroy the old objects
 	swap_chain_framebuffers.reserve(swap_chain_imageviews.size());
 
 	for (size_t i = 0; i < swap_chain_imageviews.size(); i++)
 	{
-		//swap_chain_framebuffers.push_back(VDeleter<VkFramebuffer>{ graphics_device, vkDestroyFramebuffer });
-		swap_chain_framebuffers.emplace_back(graphics_device, vkDestroyFramebuffer);
-		std::array<VkImageView, 2> attachments = { swap_chain_imageviews[i], depth_image_view};
+		swap_chain_framebuffers.emplace_back(graphics_device);
+		// with dynamic resolution every framebuffer renders into the same offscreen target
+		VkImageView color_view = dynamic_resolution ? scene_color_image_view : swap_chain_imageviews[i];
+		std::array<VkImageView, 2> attachments = { color_view, depth_image_view};
 
 		VkFramebufferCreateInfo framebuffer_info = {};
 		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -915,6 +1747,7 @@ void VulkanShowBase::createFrameBuffers()
 
 void VulkanShowBase::createCommandPool()
 {
+	TRACE_FUNCTION();
 	auto indices = QueueFamilyIndices::findQueueFamilies(physical_device, window_surface);
 
 	VkCommandPoolCreateInfo pool_info = {};
@@ -923,6 +1756,12 @@ void VulkanShowBase::createCommandPool()
 	pool_info.flags = 0; // Optional
 	// hint the command pool will rerecord buffers by VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
 	// allow buffers to be rerecorded individually by VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+	if (options.cpu_culling || dynamic_resolution || !options.capture_path.empty())
+	{
+		// draws are recorded again every frame for the visible objects,
+		// or whenever the resolution scale changes, and readback copies for every capture
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	}
 
 	auto result = vkCreateCommandPool(graphics_device, &pool_info, nullptr, &command_pool);
 	if (result != VK_SUCCESS) 
@@ -934,39 +1773,168 @@ void VulkanShowBase::createCommandPool()
 
 void VulkanShowBase::createDepthResources()
 {
+	TRACE_FUNCTION();
 	VkFormat depth_format = findDepthFormat();
-	createImage(swap_chain_extent.width, swap_chain_extent.height
-		, depth_format
-		, VK_IMAGE_TILING_OPTIMAL
-		, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-		, &depth_image
-		, &depth_image_memory);
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (options.occlusion_culling)
+	{
+		usage |= VK_IMAGE_USAGE_SAMPLED_BIT; // read by the first depth pyramid reduction
+	}
+	// the render passes move it out of the initial layout, nothing has to be submitted for it
+	depth_image_lazily_allocated = createAttachmentImage(DEPTH_ATTACHMENT, depth_format, usage
+		, &depth_image, &depth_image_memory);
 	createImageView(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, &depth_image_view);
-	transitImageLayout(depth_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
+
+bool VulkanShowBase::createAttachmentImage(uint32_t attachment, VkFormat format, VkImageUsageFlags usage
+	, VkImage* p_vkimage, VkDeviceMemory* p_image_memory)
+{
+	bool transient = render_pass_builder.isTransient(attachment)
+		&& (!late_render_pass || late_render_pass_builder.isTransient(attachment));
+	VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	if (transient)
+	{
+		// never leaves tile memory on tilers, which back it with memory only if it has to
+		usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		memory_properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	}
+	memory_properties = createImage(swap_chain_extent.width, swap_chain_extent.height
+		, format
+		, VK_IMAGE_TILING_OPTIMAL
+		, usage
+		, memory_properties
+		, p_vkimage
+		, p_image_memory);
+	return (memory_properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+}
+
+void VulkanShowBase::printAttachmentReport()
+{
+	std::cout << "Render passes at " << swap_chain_extent.width << "x" << swap_chain_extent.height << ":" << std::endl;
+	std::vector<std::pair<const char*, const RenderPassBuilder*>> passes = { { "scene", &render_pass_builder } };
+	if (late_render_pass)
+	{
+		passes.push_back({ "late scene", &late_render_pass_builder });
+	}
+	for (const auto& pass : passes)
+	{
+		// bytes the load and store ops move per frame, against loading and storing everything
+		auto traffic = pass.second->estimateTraffic(swap_chain_extent);
+		std::cout << "  " << pass.first << ": " << pass.second->describe() << ", "
+			<< (traffic.load_bytes + traffic.store_bytes) / 1e6 << " MB loaded and stored per frame, "
+			<< traffic.naive_bytes / 1e6 << " MB with every attachment loaded and stored" << std::endl;
+	}
+
+	VkMemoryRequirements depth_requirements;
+	vkGetImageMemoryRequirements(graphics_device, depth_image, &depth_requirements);
+	std::cout << "  depth attachment: " << depth_requirements.size / 1e6 << " MB";
+	if (depth_image_lazily_allocated)
+	{
+		VkDeviceSize committed = 0;
+		vkGetDeviceMemoryCommitment(graphics_device, depth_image_memory, &committed);
+		std::cout << " lazily allocated, " << committed / 1e6 << " MB committed";
+	}
+	else if (render_pass_builder.isTransient(DEPTH_ATTACHMENT))
+	{
+		std::cout << " transient, no lazily allocated memory";
+	}
+	std::cout << std::endl;
+	if (dynamic_resolution)
+	{
+		VkMemoryRequirements color_requirements;
+		vkGetImageMemoryRequirements(graphics_device, scene_color_image, &color_requirements);
+		std::cout << "  scene color target: " << color_requirements.size / 1e6 << " MB" << std::endl;
+	}
+}
+
+void VulkanShowBase::createSceneColorResources()
+{
+	TRACE_FUNCTION();
+	// allocated once at the largest size, render_extent picks the part in use
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(physical_device, swap_chain_image_format, &format_properties);
+	auto features = format_properties.optimalTilingFeatures;
+	if (!(features & VK_FORMAT_FEATURE_BLIT_SRC_BIT) || !(features & VK_FORMAT_FEATURE_BLIT_DST_BIT))
+	{
+		throw std::runtime_error("Dynamic resolution needs a swap chain format that supports blits!");
+	}
+	upscale_filter = (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+	createAttachmentImage(COLOR_ATTACHMENT, swap_chain_image_format
+		, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+		, &scene_color_image, &scene_color_image_memory);
+	createImageView(scene_color_image, swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, &scene_color_image_view);
+}
+
+void VulkanShowBase::queryTimestampProperties()
+{
+	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physical_device, window_surface);
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+	uint32_t valid_bits = families[indices.graphicsFamily].timestampValidBits;
+	if (valid_bits == 0)
+	{
+		throw std::runtime_error("Timestamp queries are not supported on the graphics queue!");
+	}
+	timestamp_mask = valid_bits >= 64 ? ~0ull : ((1ull << valid_bits) - 1);
+	timestamp_period = device_capabilities.limits.timestampPeriod;
+}
+
+void VulkanShowBase::createFrameTimestampPool()
+{
+	TRACE_FUNCTION();
+	queryTimestampProperties();
+	// the frames in flight may still write the old one
+	deferred_destruction->retire(frame_timestamp_pool);
+
+	VkQueryPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	pool_info.queryCount = 2 * (uint32_t)swap_chain_images.size();
+	if (vkCreateQueryPool(graphics_device, &pool_info, nullptr, &frame_timestamp_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create frame timestamp query pool!");
+	}
+	frame_timestamps_written.assign(swap_chain_images.size(), false);
+}
+
+void VulkanShowBase::createGpuProfiler()
+{
+	TRACE_FUNCTION();
+	queryTimestampProperties();
+	// a benchmark summarizes all of its measured frames
+	size_t history_size = options.benchmark ? std::max<size_t>(600, options.frame_count + options.warmup_frames) : 600;
+	gpu_profiler.reset(new GpuProfiler(graphics_device, timestamp_period, timestamp_mask
+		, device_capabilities.enabled.pipelineStatisticsQuery == VK_TRUE, history_size));
+	profiled_passes.upload = gpu_profiler->addPass("upload");
+	profiled_passes.culling = gpu_profiler->addPass("culling");
+	profiled_passes.scene = gpu_profiler->addPass("scene");
+	profiled_passes.depth_pyramid = gpu_profiler->addPass("depth_pyramid");
+	profiled_passes.late_culling = gpu_profiler->addPass("late_culling");
+	profiled_passes.late_scene = gpu_profiler->addPass("late_scene");
+	profiled_passes.blit = gpu_profiler->addPass("blit");
+	gpu_profiler->createPools((uint32_t)swap_chain_images.size());
+	profiled_frames.assign(swap_chain_images.size(), -1);
 }
 
 void VulkanShowBase::createTextureImage()
 {
-	// load image file
-	int tex_width, tex_height, tex_channels;
-	//stbi_uc * pixels = stbi_load("content/jumpin_windy.png"
-	//	, &tex_width, &tex_height
-	//	, &tex_channels
-	//	, STBI_rgb_alpha);
-	stbi_uc * pixels = stbi_load(TEXTURE_PATH.c_str()
-		, &tex_width, &tex_height
-		, &tex_channels
-		, STBI_rgb_alpha);
-	VkDeviceSize image_size = tex_width * tex_height * 4;
-	if (!pixels)
+	TRACE_FUNCTION();
+	// decoded by the texture loading job
+	if (texture_error)
 	{
-		throw std::runtime_error("Failed to load texture image");
+		std::rethrow_exception(texture_error);
 	}
+	auto image = std::move(loaded_texture);
+	uint32_t tex_width = image.width;
+	uint32_t tex_height = image.height;
+	VkDeviceSize image_size = image.getSize();
 
 	// create staging image memory
-	VDeleter<VkImage> staging_image{ graphics_device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> staging_image_memory{ graphics_device, vkFreeMemory };
+	VImage staging_image{ graphics_device };
+	VDeviceMemory staging_image_memory{ graphics_device };
 	createImage(tex_width, tex_height
 		, VK_FORMAT_R8G8B8A8_UNORM
 		, VK_IMAGE_TILING_LINEAR
@@ -977,11 +1945,11 @@ void VulkanShowBase::createTextureImage()
 	// copy image to staging memory
 	void* data;
 	vkMapMemory(graphics_device, staging_image_memory, 0, image_size, 0, &data);
-	memcpy(data, pixels, (size_t)image_size);
+	memcpy(data, image.pixels.get(), (size_t)image_size);
 	vkUnmapMemory(graphics_device, staging_image_memory);
 
 	// free image in memory
-	stbi_image_free(pixels);
+	image.pixels.reset();
 
 	// create texture image
 	createImage(tex_width, tex_height
@@ -1006,11 +1974,13 @@ void VulkanShowBase::createTextureImage()
 
 void VulkanShowBase::createTextureImageView()
 {
+	TRACE_FUNCTION();
 	createImageView(texture_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, &texture_image_view);
 }
 
 void VulkanShowBase::createTextureSampler()
 {
+	TRACE_FUNCTION();
 	VkSamplerCreateInfo sampler_info = {};
 	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	sampler_info.magFilter = VK_FILTER_LINEAR;
@@ -1020,8 +1990,9 @@ void VulkanShowBase::createTextureSampler()
 	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 
-	sampler_info.anisotropyEnable = VK_TRUE;
-	sampler_info.maxAnisotropy = 16;
+	// an optional feature, enabled by createLogicalDevice where the device has it
+	sampler_info.anisotropyEnable = device_capabilities.enabled.samplerAnisotropy;
+	sampler_info.maxAnisotropy = sampler_info.anisotropyEnable ? std::min(16.0f, device_capabilities.limits.maxSamplerAnisotropy) : 1.0f;
 	
 	sampler_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 	sampler_info.unnormalizedCoordinates = VK_FALSE;
@@ -1043,44 +2014,135 @@ void VulkanShowBase::createTextureSampler()
 
 void VulkanShowBase::loadModel()
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str())) 
+	TRACE_FUNCTION();
+	if (model_error)
 	{
-		throw std::runtime_error(err);
+		std::rethrow_exception(model_error);
 	}
+	auto model = std::move(loaded_model);
+	vertices = std::move(model.vertices);
+	vertex_indices = std::move(model.indices);
+	model_bounding_sphere = model.bounding_sphere;
+}
+
+void VulkanShowBase::createSceneObjects()
+{
+	TRACE_FUNCTION();
+	// lay out instances of the model on a square grid around the origin
+	uint32_t object_count = options.object_count;
+	uint32_t grid_size = (uint32_t)std::ceil(std::sqrt((double)object_count));
+	float spacing = OBJECT_SPACING * model_bounding_sphere.w;
+	float grid_offset = (grid_size - 1) * 0.5f;
+	scene_half_extent = grid_offset * spacing + model_bounding_sphere.w;
+
+	scene_graph.reset(new SceneGraph(detectSimdLevel(), job_system.get()));
+	scene_graph->reserve(object_count + 1);
+	SceneGraph::NodeId grid_node = scene_graph->addNode(SceneGraph::NO_PARENT, glm::mat4());
+	object_nodes.resize(object_count);
+	for (uint32_t i = 0; i < object_count; i++)
+	{
+		glm::vec3 position = {
+			((i % grid_size) - grid_offset) * spacing,
+			((i / grid_size) - grid_offset) * spacing,
+			0.0f
+		};
+		object_nodes[i] = scene_graph->addNode(grid_node, glm::translate(glm::mat4(), position));
+	}
+
+	scene_objects.resize(object_count);
+	object_bounds.resize(object_count);
+	writeObjectData(scene_graph->update());
 
-	std::unordered_map<Vertex, size_t> unique_vertices = {};
-	for (const auto& shape : shapes) 
+	object_bvh.reset(new Bvh(job_system.get()));
+	object_bvh->build(object_bounds);
+	std::cout << "BVH: " << object_bvh->getNodes().size() << " nodes, " << object_bvh->getDepth() << " levels" << std::endl;
+
+	if (options.bvh_culling)
+	{
+		std::cout << "CPU culling: BVH, " << job_system->getThreadCount() << " threads" << std::endl;
+	}
+	else if (options.cpu_culling)
 	{
-		for (const auto& index : shape.mesh.indices) 
+		SimdLevel simd_level = options.simd_level.empty() ? detectSimdLevel() : parseSimdLevel(options.simd_level);
+		cpu_culler.reset(new CpuCuller(simd_level, job_system.get()));
+		std::cout << "CPU culling: " << simdLevelName(simd_level)
+			<< ", " << cpu_culler->getThreadCount() << " threads" << std::endl;
+	}
+}
+
+void VulkanShowBase::writeObjectData(const std::vector<SceneGraph::NodeId>& updated_nodes)
+{
+	TRACE_FUNCTION();
+	// the object nodes were added one after the other, right after the grid's root
+	moved_objects.clear();
+	for (SceneGraph::NodeId node : updated_nodes)
+	{
+		if (object_nodes.empty() || node < object_nodes[0])
 		{
-			Vertex vertex = {};
+			continue;
+		}
+		uint32_t object = node - object_nodes[0];
+		const glm::mat4& world = scene_graph->getWorldTransform(node);
+		float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+		scene_objects[object].model = world;
+		scene_objects[object].bounding_sphere = glm::vec4(glm::vec3(world * glm::vec4(glm::vec3(model_bounding_sphere), 1.0f))
+			, model_bounding_sphere.w * scale);
+		object_bounds.set(object, scene_objects[object].bounding_sphere);
+		moved_objects.push_back(object);
+	}
+	if (object_bvh)
+	{
+		object_bvh->refit(object_bounds, moved_objects);
+	}
+}
+
+void VulkanShowBase::pickObject()
+{
+	TRACE_FUNCTION();
+	double cursor_x, cursor_y;
+	int width, height;
+	glfwGetCursorPos(window, &cursor_x, &cursor_y);
+	glfwGetWindowSize(window, &width, &height);
+	if (!object_bvh || width == 0 || height == 0)
+	{
+		return;
+	}
 
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+	// from the near to the far plane through the cursor, the y axes of the window and of Vulkan NDC both point down
+	glm::vec2 ndc = { 2.0f * (float)cursor_x / width - 1.0f, 2.0f * (float)cursor_y / height - 1.0f };
+	glm::mat4 inverse_view_proj = glm::inverse(view_proj);
+	glm::vec4 near_point = inverse_view_proj * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec4 far_point = inverse_view_proj * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+	glm::vec3 direction = glm::vec3(far_point) / far_point.w - origin;
 
-			// since the y axis of obj's texture coordinate points up
-			vertex.tex_coord = { 
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
+	BvhRayHit hit;
+	if (object_bvh->intersectRay(origin, direction, 1.0f, object_bounds, hit))
+	{
+		glm::vec3 position = origin + direction * hit.distance;
+		std::cout << "Picked object " << hit.object << " at (" << position.x << ", " << position.y << ", " << position.z << ")" << std::endl;
+	}
+	else
+	{
+		std::cout << "Picked nothing" << std::endl;
+	}
+}
 
-			if (unique_vertices.count(vertex) == 0)
-			{
-				unique_vertices[vertex] = vertices.size(); // auto incrementing size
-				vertices.push_back(vertex);
-			}
+bool hasMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
 
-			vertex_indices.push_back((uint32_t)unique_vertices[vertex]);
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		bool type_supported = (type_filter & (1 << i)) != 0;
+		bool properties_supported = ((memory_properties.memoryTypes[i].propertyFlags & properties) == properties);
+		if (type_supported && properties_supported)
+		{
+			return true;
 		}
 	}
+	return false;
 }
 
 uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device)
@@ -1103,301 +2165,1348 @@ uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties,
 
 void VulkanShowBase::createVertexBuffer()
 {
+	TRACE_FUNCTION();
 	VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
 
-	// create staging buffer
-	VDeleter<VkBuffer> staging_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> staging_buffer_memory{ graphics_device, vkFreeMemory };
-	createBuffer(buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		, &staging_buffer
-		, &staging_buffer_memory);
-
-	// copy data to staging buffer
-	void* data;
-	vkMapMemory(graphics_device, staging_buffer_memory, 0, buffer_size, 0, &data); // access the graphics memory using mapping
-		memcpy(data, vertices.data(), (size_t)buffer_size); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-	vkUnmapMemory(graphics_device, staging_buffer_memory);
-
-	// create vertex buffer at optimized local memory which may not be directly accessable by memory mapping
-	// as copy destination of staging buffer
-	createBuffer(buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	createDeviceLocalBuffer(vertices.data(), buffer_size
+		, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
 		, &vertex_buffer
 		, &vertex_buffer_memory);
 
-	// copy content of staging buffer to vertex buffer
-	copyBuffer(staging_buffer, vertex_buffer, buffer_size);
+	// 12 bytes per vertex instead of 32 for the depth pre-pass
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		positions[i] = vertices[i].pos;
+	}
+	createDeviceLocalBuffer(positions.data(), sizeof(positions[0]) * positions.size()
+		, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+		, &position_buffer
+		, &position_buffer_memory);
 }
 
 void VulkanShowBase::createIndexBuffer()
 {
+	TRACE_FUNCTION();
 	VkDeviceSize buffer_size = sizeof(vertex_indices[0]) * vertex_indices.size();
 
-	// create staging buffer
-	VDeleter<VkBuffer> staging_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> staging_buffer_memory{ graphics_device, vkFreeMemory };
-	createBuffer(buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
+	createDeviceLocalBuffer(vertex_indices.data(), buffer_size
+		, VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+		, &index_buffer
+		, &index_buffer_memory);
+}
+
+void VulkanShowBase::createUniformBuffer()
+{
+	TRACE_FUNCTION();
+	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+
+	createBuffer(bufferSize
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, &uniform_buffer
+		, &uniform_buffer_memory);
+}
+
+void VulkanShowBase::createFrameUniformBuffers()
+{
+	TRACE_FUNCTION();
+	// the frames in flight may still copy from the old ones
+	deferred_destruction->retire(frame_uniform_buffers);
+	deferred_destruction->retire(frame_uniform_memory);
+	mapped_frame_uniforms.clear();
+
+	for (size_t i = 0; i < swap_chain_images.size(); i++)
+	{
+		frame_uniform_buffers.emplace_back(graphics_device);
+		frame_uniform_memory.emplace_back(graphics_device);
+		createBuffer(sizeof(FrameUniforms)
+			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			, &frame_uniform_buffers.back()
+			, &frame_uniform_memory.back());
+		// stays mapped, freeing the memory unmaps it
+		void* data;
+		vkMapMemory(graphics_device, frame_uniform_memory.back(), 0, sizeof(FrameUniforms), 0, &data);
+		mapped_frame_uniforms.push_back(static_cast<FrameUniforms*>(data));
+		*mapped_frame_uniforms.back() = {};
+	}
+}
+
+void VulkanShowBase::createObjectBuffers()
+{
+	TRACE_FUNCTION();
+	createDeviceLocalBuffer(scene_objects.data(), sizeof(ObjectData) * scene_objects.size()
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, &object_buffer
+		, &object_buffer_memory);
+
+	// identity mapping so that drawing object i with firstInstance = i just works,
+	// the culling pass overwrites it with the survivors
+	std::vector<uint32_t> visible_objects(scene_objects.size());
+	for (uint32_t i = 0; i < visible_objects.size(); i++)
+	{
+		visible_objects[i] = i;
+	}
+	createDeviceLocalBuffer(visible_objects.data(), sizeof(uint32_t) * visible_objects.size()
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, &visible_object_buffer
+		, &visible_object_buffer_memory);
+}
+
+void VulkanShowBase::createCullingResources()
+{
+	TRACE_FUNCTION();
+	// a single instanced draw of the model, the culling pass fills in instanceCount
+	VkDrawIndexedIndirectCommand draw_command = {};
+	draw_command.indexCount = (uint32_t)vertex_indices.size();
+	draw_command.instanceCount = 0;
+	draw_command.firstIndex = 0;
+	draw_command.vertexOffset = 0;
+	draw_command.firstInstance = 0;
+	CullingDrawCommands draw_commands = {};
+	draw_commands.draw = draw_command;
+	draw_commands.late_draw = draw_command;
+	createDeviceLocalBuffer(&draw_commands, sizeof(draw_commands)
+		, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		, &draw_command_buffer
+		, &draw_command_buffer_memory);
+
+	// written by every frame before its culling passes
+	createBuffer(sizeof(CullingUniform)
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, &culling_uniform_buffer
+		, &culling_uniform_buffer_memory);
+
+	createBuffer(sizeof(CullingDrawCommands)
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT
 		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		, &staging_buffer
-		, &staging_buffer_memory);
+		, &culling_stats_buffer
+		, &culling_stats_buffer_memory);
+	vkMapMemory(graphics_device, culling_stats_buffer_memory, 0, sizeof(CullingDrawCommands), 0
+		, reinterpret_cast<void**>(&mapped_culling_stats));
+	*mapped_culling_stats = draw_commands;
+	mapped_culling_stats->draw.instanceCount = (uint32_t)scene_objects.size();
+}
 
-	void* data;
-	vkMapMemory(graphics_device, staging_buffer_memory, 0, buffer_size, 0, &data); // access the graphics memory using mapping
-	memcpy(data, vertex_indices.data(), (size_t)buffer_size); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-	vkUnmapMemory(graphics_device, staging_buffer_memory);
+void VulkanShowBase::createOcclusionCullingResources()
+{
+	TRACE_FUNCTION();
+	// nothing was visible before the first frame, so it draws everything in the late phase
+	std::vector<uint32_t> zeros(scene_objects.size(), 0);
+	createDeviceLocalBuffer(zeros.data(), sizeof(uint32_t) * zeros.size()
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, &late_visible_object_buffer
+		, &late_visible_object_buffer_memory);
+	createDeviceLocalBuffer(zeros.data(), sizeof(uint32_t) * zeros.size()
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, &object_visibility_buffer
+		, &object_visibility_buffer_memory);
+
+	// only read with texelFetch, the filter does not matter
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_NEAREST;
+	sampler_info.minFilter = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.anisotropyEnable = VK_FALSE;
+	sampler_info.maxAnisotropy = 1;
+	sampler_info.compareEnable = VK_FALSE;
+	sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
+	sampler_info.minLod = 0.0f;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+	sampler_info.unnormalizedCoordinates = VK_FALSE;
+
+	if (vkCreateSampler(graphics_device, &sampler_info, nullptr, &depth_pyramid_sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid sampler!");
+	}
+
+	// every level of the pyramid, for the late culling phase and the debug view
+	VkDescriptorSetLayoutBinding pyramid_binding = {};
+	pyramid_binding.binding = 0;
+	pyramid_binding.descriptorCount = 1;
+	pyramid_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pyramid_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	createBuffer(buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = 1;
+	layout_info.pBindings = &pyramid_binding;
+
+	if (vkCreateDescriptorSetLayout(graphics_device, &layout_info, nullptr, &depth_pyramid_descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid descriptor set layout!");
+	}
+	depth_pyramid_layout_index = descriptor_allocator->addLayout(depth_pyramid_descriptor_set_layout, { pyramid_binding });
+
+	// the level below and the level to write
+	std::vector<VkDescriptorSetLayoutBinding> reduce_bindings(2);
+	reduce_bindings[0].binding = 0;
+	reduce_bindings[0].descriptorCount = 1;
+	reduce_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	reduce_bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	reduce_bindings[1].binding = 1;
+	reduce_bindings[1].descriptorCount = 1;
+	reduce_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	reduce_bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	layout_info.bindingCount = (uint32_t)reduce_bindings.size();
+	layout_info.pBindings = reduce_bindings.data();
+
+	if (vkCreateDescriptorSetLayout(graphics_device, &layout_info, nullptr, &depth_reduce_descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce descriptor set layout!");
+	}
+	depth_reduce_layout_index = descriptor_allocator->addLayout(depth_reduce_descriptor_set_layout, reduce_bindings);
+
+	// the size of the source holding depth, smaller than the level with dynamic resolution
+	VkPushConstantRange source_size_range = {};
+	source_size_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	source_size_range.offset = 0;
+	source_size_range.size = 2 * sizeof(int32_t);
+
+	VkDescriptorSetLayout reduce_set_layouts[] = { depth_reduce_descriptor_set_layout };
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = reduce_set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &source_size_range;
+
+	if (vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &depth_reduce_pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce pipeline layout!");
+	}
+
+	auto shader_code = readAsset("content/depth_reduce_comp.spv");
+	VShaderModule shader_module{ graphics_device };
+	createShaderModule(shader_code, &shader_module);
+
+	VkComputePipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module = shader_module;
+	pipeline_info.stage.pName = "main";
+	pipeline_info.layout = depth_reduce_pipeline_layout;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_info.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &depth_reduce_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth reduce pipeline!");
+	}
+
+	// the debug view takes the level to show as a push constant
+	VkPushConstantRange level_range = {};
+	level_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	level_range.offset = 0;
+	level_range.size = 3 * sizeof(int32_t);
+
+	VkDescriptorSetLayout debug_set_layouts[] = { depth_pyramid_descriptor_set_layout };
+	pipeline_layout_info.pSetLayouts = debug_set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &level_range;
+
+	if (vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &depth_pyramid_debug_pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid debug pipeline layout!");
+	}
+}
+
+void VulkanShowBase::createDepthPyramid()
+{
+	TRACE_FUNCTION();
+	// level 0 is half the depth attachment, every level halves again down to 1x1
+	depth_pyramid_extent.width = std::max(1u, swap_chain_extent.width / 2);
+	depth_pyramid_extent.height = std::max(1u, swap_chain_extent.height / 2);
+	depth_pyramid_level_count = (uint32_t)std::floor(std::log2(
+		(double)std::max(depth_pyramid_extent.width, depth_pyramid_extent.height))) + 1;
+	if (debug_pyramid_level >= (int)depth_pyramid_level_count)
+	{
+		debug_pyramid_level = -1;
+	}
+
+	depth_pyramid_level_views.clear(); // the holders destroy the old objects
+	createImage(depth_pyramid_extent.width, depth_pyramid_extent.height
+		, VK_FORMAT_R32_SFLOAT
+		, VK_IMAGE_TILING_OPTIMAL
+		, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-		, &index_buffer
-		, &index_buffer_memory);
+		, &depth_pyramid
+		, &depth_pyramid_memory
+		, depth_pyramid_level_count);
+	createImageView(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &depth_pyramid_view
+		, 0, depth_pyramid_level_count);
+	depth_pyramid_level_views.reserve(depth_pyramid_level_count);
+	for (uint32_t level = 0; level < depth_pyramid_level_count; level++)
+	{
+		depth_pyramid_level_views.emplace_back(graphics_device);
+		createImageView(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &depth_pyramid_level_views[level]
+			, level, 1);
+	}
+
+	// no layout transition here, recordDepthPyramid takes it to GENERAL at the start of every frame
+
+	// level 0 reads the depth attachment, every other level the one below it
+	depth_reduce_descriptor_sets.resize(depth_pyramid_level_count);
+	for (uint32_t level = 0; level < depth_pyramid_level_count; level++)
+	{
+		depth_reduce_descriptor_sets[level] = descriptor_allocator->getSet(depth_reduce_layout_index, {
+			level == 0
+				? DescriptorResource::image(depth_pyramid_sampler, depth_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+				: DescriptorResource::image(depth_pyramid_sampler, depth_pyramid_level_views[level - 1], VK_IMAGE_LAYOUT_GENERAL),
+			DescriptorResource::image(VK_NULL_HANDLE, depth_pyramid_level_views[level], VK_IMAGE_LAYOUT_GENERAL) });
+	}
+	// every level, for the late culling phase and the debug view
+	depth_pyramid_descriptor_set = descriptor_allocator->getSet(depth_pyramid_layout_index, {
+		DescriptorResource::image(depth_pyramid_sampler, depth_pyramid_view, VK_IMAGE_LAYOUT_GENERAL) });
+}
+
+void VulkanShowBase::createDepthPyramidDebugPipeline()
+{
+	TRACE_FUNCTION();
+	auto vert_shader_code = readAsset("content/depth_pyramid_debug_vert.spv");
+	auto frag_shader_code = readAsset("content/depth_pyramid_debug_frag.spv");
+
+	VShaderModule vert_shader_module{ graphics_device };
+	VShaderModule frag_shader_module{ graphics_device };
+	createShaderModule(vert_shader_code, &vert_shader_module);
+	createShaderModule(frag_shader_code, &frag_shader_module);
+
+	std::array<VkPipelineShaderStageCreateInfo, 2> shader_stages = {};
+	shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shader_stages[0].module = vert_shader_module;
+	shader_stages[0].pName = "main";
+	shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shader_stages[1].module = frag_shader_module;
+	shader_stages[1].pName = "main";
+
+	// a full screen triangle generated in the vertex shader
+	VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {};
+	input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	input_assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	// set by recordScenePass
+	VkPipelineViewportStateCreateInfo viewport_state_info = {};
+	viewport_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport_state_info.viewportCount = 1;
+	viewport_state_info.scissorCount = 1;
+	VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamic_state_info = {};
+	dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state_info.dynamicStateCount = 2;
+	dynamic_state_info.pDynamicStates = dynamic_states;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	// drawn over the scene
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_FALSE;
+	depth_stencil.depthWriteEnable = VK_FALSE;
+	depth_stencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+	VkPipelineColorBlendAttachmentState color_blend_attachment = {};
+	color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	color_blend_attachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo color_blending_info = {};
+	color_blending_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	color_blending_info.attachmentCount = 1;
+	color_blending_info.pAttachments = &color_blend_attachment;
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.stageCount = (uint32_t)shader_stages.size();
+	pipeline_info.pStages = shader_stages.data();
+	pipeline_info.pVertexInputState = &vertex_input_info;
+	pipeline_info.pInputAssemblyState = &input_assembly_info;
+	pipeline_info.pViewportState = &viewport_state_info;
+	pipeline_info.pRasterizationState = &rasterizer;
+	pipeline_info.pMultisampleState = &multisampling;
+	pipeline_info.pDepthStencilState = &depth_stencil;
+	pipeline_info.pColorBlendState = &color_blending_info;
+	pipeline_info.pDynamicState = &dynamic_state_info;
+	pipeline_info.layout = depth_pyramid_debug_pipeline_layout;
+	pipeline_info.renderPass = late_render_pass;
+	pipeline_info.subpass = 0;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_info.basePipelineIndex = -1;
+
+	if (vkCreateGraphicsPipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &depth_pyramid_debug_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid debug pipeline!");
+	}
+}
+
+void VulkanShowBase::createCullingPipeline()
+{
+	TRACE_FUNCTION();
+	// objects, visible objects, the draw commands and the parameters,
+	// then the late visible objects and the object visibility for occlusion culling
+	std::vector<VkDescriptorSetLayoutBinding> bindings(options.occlusion_culling ? 6 : 4);
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorType = i == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = (uint32_t)bindings.size();
+	layout_info.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(graphics_device, &layout_info, nullptr, &culling_descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling descriptor set layout!");
+	}
+	culling_layout_index = descriptor_allocator->addLayout(culling_descriptor_set_layout, bindings);
+
+	// occlusion culling also reads the depth pyramid and is told which phase it runs
+	VkDescriptorSetLayout set_layouts[] = { culling_descriptor_set_layout, depth_pyramid_descriptor_set_layout };
+	VkPushConstantRange phase_range = {};
+	phase_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	phase_range.offset = 0;
+	phase_range.size = sizeof(uint32_t);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = options.occlusion_culling ? 2 : 1;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = options.occlusion_culling ? 1 : 0;
+	pipeline_layout_info.pPushConstantRanges = &phase_range;
+
+	if (vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &culling_pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling pipeline layout!");
+	}
+
+	auto shader_code = readAsset(options.occlusion_culling ? "content/occlusion_cull_comp.spv" : "content/cull_comp.spv");
+	VShaderModule shader_module{ graphics_device };
+	createShaderModule(shader_code, &shader_module);
+
+	VkComputePipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module = shader_module;
+	pipeline_info.stage.pName = "main";
+	pipeline_info.layout = culling_pipeline_layout;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_info.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &culling_pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling pipeline!");
+	}
+}
+
+void VulkanShowBase::createDescriptorSet()
+{
+	TRACE_FUNCTION();
+	descriptor_set = getSceneDescriptorSet(visible_object_buffer);
+	if (options.occlusion_culling)
+	{
+		// the late pass draws the objects listed by the late culling phase
+		late_descriptor_set = getSceneDescriptorSet(late_visible_object_buffer);
+	}
+}
+
+VkDescriptorSet VulkanShowBase::getSceneDescriptorSet(VkBuffer visible_objects)
+{
+	// the transforms, the texture, the per-object data and the instance to object mapping
+	return descriptor_allocator->getSet(scene_layout_index, {
+		DescriptorResource::buffer(uniform_buffer, 0, sizeof(UniformBufferObject)),
+		DescriptorResource::image(texture_sampler, texture_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+		DescriptorResource::buffer(object_buffer),
+		DescriptorResource::buffer(visible_objects) });
+}
+
+void VulkanShowBase::createCullingDescriptorSet()
+{
+	TRACE_FUNCTION();
+	std::vector<DescriptorResource> resources = {
+		DescriptorResource::buffer(object_buffer),
+		DescriptorResource::buffer(visible_object_buffer),
+		DescriptorResource::buffer(draw_command_buffer),
+		DescriptorResource::buffer(culling_uniform_buffer) };
+	if (options.occlusion_culling)
+	{
+		resources.push_back(DescriptorResource::buffer(late_visible_object_buffer));
+		resources.push_back(DescriptorResource::buffer(object_visibility_buffer));
+	}
+	culling_descriptor_set = descriptor_allocator->getSet(culling_layout_index, resources);
+}
+
+void VulkanShowBase::createCommandBuffers()
+{
+	TRACE_FUNCTION();
+	// Free old command buffers, if any, the frames in flight need them retired first
+	if (command_buffers.size() > 0)
+	{
+		vkFreeCommandBuffers(graphics_device, command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+	}
+
+	command_buffers.resize(swap_chain_framebuffers.size());
+
+	VkCommandBufferAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandPool = command_pool;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; 
+	// primary: can be submitted to a queue but cannot be called from other command buffers
+	// secondary: can be called by others but cannot be submitted to a queue
+	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+
+	auto alloc_result = vkAllocateCommandBuffers(graphics_device, &alloc_info, command_buffers.data());
+	if (alloc_result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate command buffers!");
+	}
+
+	// per object draws are split across the job system's threads when there are enough of them,
+	// with gpu culling there is a single indirect draw
+	uint32_t draw_chunks = job_system->getThreadCount();
+	if (options.gpu_culling || draw_chunks <= 1 || scene_objects.size() < PARALLEL_DRAW_THRESHOLD)
+	{
+		draw_chunks = 0;
+	}
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex = QueueFamilyIndices::findQueueFamilies(physical_device, window_surface).graphicsFamily;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // recorded again with their primary
+	draw_command_buffers.clear();
+	draw_command_pools.clear();
+	for (uint32_t chunk = 0; chunk < draw_chunks; chunk++)
+	{
+		draw_command_pools.emplace_back(graphics_device);
+		if (vkCreateCommandPool(graphics_device, &pool_info, nullptr, &draw_command_pools.back()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create command pool!");
+		}
+	}
+	if (draw_chunks > 0)
+	{
+		draw_command_buffers.resize(command_buffers.size() * 2 * draw_chunks);
+		std::vector<VkCommandBuffer> chunk_buffers(command_buffers.size() * 2);
+		VkCommandBufferAllocateInfo secondary_alloc_info = {};
+		secondary_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		secondary_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		secondary_alloc_info.commandBufferCount = (uint32_t)chunk_buffers.size();
+		for (uint32_t chunk = 0; chunk < draw_chunks; chunk++)
+		{
+			secondary_alloc_info.commandPool = draw_command_pools[chunk];
+			if (vkAllocateCommandBuffers(graphics_device, &secondary_alloc_info, chunk_buffers.data()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+			for (size_t i = 0; i < chunk_buffers.size(); i++)
+			{
+				draw_command_buffers[i * draw_chunks + chunk] = chunk_buffers[i];
+			}
+		}
+	}
+
+	// record command buffers
+	outdated_command_buffers.assign(command_buffers.size(), false);
+	for (uint32_t i = 0; i < command_buffers.size(); i++) 
+	{
+		recordCommandBuffer(i);
+	}
+}
+
+void VulkanShowBase::recordCommandBuffer(uint32_t image_index)
+{
+	TRACE_FUNCTION();
+	VkCommandBuffer command_buffer = command_buffers[image_index];
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	begin_info.pInheritanceInfo = nullptr; // Optional
+
+	vkBeginCommandBuffer(command_buffer, &begin_info);
+
+	if (dynamic_resolution)
+	{
+		vkCmdResetQueryPool(command_buffer, frame_timestamp_pool, 2 * image_index, 2);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame_timestamp_pool, 2 * image_index);
+	}
+	if (gpu_profiler)
+	{
+		gpu_profiler->recordReset(command_buffer, image_index);
+	}
+
+	// The frames in flight share the uniform, object and culling buffers, the depth attachment and the
+	// pyramid, so this one starts after the frame submitted before it is done with them.
+	VkMemoryBarrier frame_barrier = {};
+	frame_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	frame_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	frame_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0
+		, 1, &frame_barrier, 0, nullptr, 0, nullptr);
+
+	// the host wrote the image's FrameUniforms before submitting
+	recordProfilerBegin(command_buffer, image_index, profiled_passes.upload);
+	VkBufferCopy ubo_region = { offsetof(FrameUniforms, ubo), 0, sizeof(UniformBufferObject) };
+	vkCmdCopyBuffer(command_buffer, frame_uniform_buffers[image_index], uniform_buffer, 1, &ubo_region);
+	recordBufferBarrier(command_buffer, uniform_buffer
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT);
+	if (options.gpu_culling)
+	{
+		VkBufferCopy culling_region = { offsetof(FrameUniforms, culling), 0, sizeof(CullingUniform) };
+		vkCmdCopyBuffer(command_buffer, frame_uniform_buffers[image_index], culling_uniform_buffer, 1, &culling_region);
+		recordBufferBarrier(command_buffer, culling_uniform_buffer
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT);
+	}
+	recordProfilerEnd(command_buffer, image_index, profiled_passes.upload);
+
+	if (options.occlusion_culling)
+	{
+		// draw what was visible last frame, build the depth pyramid from it,
+		// then draw what it does not hide and was not drawn yet
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.culling);
+		recordOcclusionCulling(command_buffer, 0);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.culling);
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.scene);
+		recordScenePass(command_buffer, image_index, render_pass, descriptor_set, 0);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.scene);
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.depth_pyramid);
+		recordDepthPyramid(command_buffer);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.depth_pyramid);
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.late_culling);
+		recordOcclusionCulling(command_buffer, 1);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.late_culling);
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.late_scene);
+		recordScenePass(command_buffer, image_index, late_render_pass, late_descriptor_set
+			, offsetof(CullingDrawCommands, late_draw));
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.late_scene);
+	}
+	else
+	{
+		if (options.gpu_culling)
+		{
+			// has to happen outside of the render pass
+			recordProfilerBegin(command_buffer, image_index, profiled_passes.culling);
+			recordCulling(command_buffer);
+			recordProfilerEnd(command_buffer, image_index, profiled_passes.culling);
+		}
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.scene);
+		recordScenePass(command_buffer, image_index, render_pass, descriptor_set, 0);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.scene);
+	}
+
+	if (options.gpu_culling)
+	{
+		recordCullingStatsCopy(command_buffer);
+	}
+
+	if (dynamic_resolution)
+	{
+		recordProfilerBegin(command_buffer, image_index, profiled_passes.blit);
+		recordBlitToSwapChain(command_buffer, image_index);
+		recordProfilerEnd(command_buffer, image_index, profiled_passes.blit);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame_timestamp_pool, 2 * image_index + 1);
+	}
+
+	auto record_result = vkEndCommandBuffer(command_buffer);
+	if (record_result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer!");
+	}
+	outdated_command_buffers[image_index] = false;
+}
+
+void VulkanShowBase::recordScenePass(VkCommandBuffer command_buffer, uint32_t image_index, VkRenderPass pass
+	, VkDescriptorSet scene_descriptor_set, VkDeviceSize draw_command_offset)
+{
+	VkRenderPassBeginInfo render_pass_info = {};
+	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_info.renderPass = pass;
+	render_pass_info.framebuffer = swap_chain_framebuffers[image_index];
+	render_pass_info.renderArea.offset = { 0, 0 };
+	render_pass_info.renderArea.extent = render_extent;
+
+	std::array<VkClearValue, 2> clear_values = {};
+	clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clear_values[1].depthStencil = { 1.0f, 0 }; // 1.0 is far view plane
+	render_pass_info.clearValueCount = (uint32_t)clear_values.size();
+	render_pass_info.pClearValues = clear_values.data();
+
+	if (!draw_command_pools.empty())
+	{
+		// only per object draws are split, the debug view below needs gpu culling
+		vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		recordParallelSceneDraws(command_buffer, image_index, pass, scene_descriptor_set);
+		vkCmdEndRenderPass(command_buffer);
+		return;
+	}
+	
+	vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+	bindSceneState(command_buffer, scene_descriptor_set);
+
+	if (depth_prepass_enabled)
+	{
+		// the same draws once more, depth only
+		bindScenePipeline(command_buffer, true);
+		recordSceneDraws(command_buffer, draw_command_offset);
+	}
+
+	bindScenePipeline(command_buffer, false);
+	//vkCmdDraw(command_buffer, VERTICES.size(), 1, 0, 0);
+	recordSceneDraws(command_buffer, draw_command_offset);
+
+	if (pass == late_render_pass && debug_pyramid_level >= 0)
+	{
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pyramid_debug_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS
+			, depth_pyramid_debug_pipeline_layout, 0, 1, &depth_pyramid_descriptor_set, 0, nullptr);
+		// matches DebugView in depth_pyramid_debug.frag
+		struct
+		{
+			int32_t depth_size[2];
+			int32_t level;
+		} debug_view = { { (int32_t)render_extent.width, (int32_t)render_extent.height }, debug_pyramid_level };
+		vkCmdPushConstants(command_buffer, depth_pyramid_debug_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT
+			, 0, sizeof(debug_view), &debug_view);
+		vkCmdDraw(command_buffer, 3, 1, 0, 0);
+	}
+
+	vkCmdEndRenderPass(command_buffer);
+}
+
+void VulkanShowBase::bindSceneState(VkCommandBuffer command_buffer, VkDescriptorSet scene_descriptor_set)
+{
+	VkViewport viewport = {};
+	viewport.width = (float)render_extent.width;
+	viewport.height = (float)render_extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, render_extent };
+	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+	//vkCmdBindIndexBuffer(command_buffer, index_buffer, 0, VK_INDEX_TYPE_UINT16);
+	vkCmdBindIndexBuffer(command_buffer, index_buffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS
+		, pipeline_layout, 0, 1, &scene_descriptor_set, 0, nullptr);
+}
+
+void VulkanShowBase::bindScenePipeline(VkCommandBuffer command_buffer, bool depth_only)
+{
+	// TODO: better to store vertex buffer and index buffer in a single VkBuffer
+	VkDeviceSize offsets[] = { 0 };
+	if (depth_only)
+	{
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass_pipeline);
+		VkBuffer position_buffers[] = { position_buffer };
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, position_buffers, offsets);
+		return;
+	}
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS
+		, depth_prepass_enabled ? depth_equal_pipeline : graphics_pipeline);
+	// bind vertex buffer
+	VkBuffer vertex_buffers[] = { vertex_buffer };
+	vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+}
+
+void VulkanShowBase::recordSceneDraws(VkCommandBuffer command_buffer, VkDeviceSize draw_command_offset)
+{
+	if (options.gpu_culling)
+	{
+		// the same single draw no matter how many objects there are
+		vkCmdDrawIndexedIndirect(command_buffer, draw_command_buffer, draw_command_offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		recordObjectDraws(command_buffer, 0, getObjectDrawCount());
+	}
+}
+
+size_t VulkanShowBase::getObjectDrawCount() const
+{
+	return options.cpu_culling ? visible_objects.size() : scene_objects.size();
+}
+
+void VulkanShowBase::recordObjectDraws(VkCommandBuffer command_buffer, size_t begin, size_t end)
+{
+	uint32_t index_count = (uint32_t)vertex_indices.size();
+	for (size_t i = begin; i < end; i++)
+	{
+		// firstInstance selects the object in the vertex shader
+		uint32_t object_index = options.cpu_culling ? visible_objects[i] : (uint32_t)i;
+		vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, object_index);
+	}
+}
+
+void VulkanShowBase::recordParallelSceneDraws(VkCommandBuffer command_buffer, uint32_t image_index, VkRenderPass pass
+	, VkDescriptorSet scene_descriptor_set)
+{
+	TRACE_FUNCTION();
+	size_t chunk_count = draw_command_pools.size();
+	size_t draw_count = getObjectDrawCount();
+	size_t chunk_size = (draw_count + chunk_count - 1) / chunk_count;
+	VkCommandBuffer* pass_buffers = &draw_command_buffers[image_index * 2 * chunk_count];
+	bool prepass = depth_prepass_enabled;
+
+	VkCommandBufferInheritanceInfo inheritance_info = {};
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance_info.renderPass = pass;
+	inheritance_info.subpass = 0;
+	inheritance_info.framebuffer = swap_chain_framebuffers[image_index];
+
+	// a chunk per job, each on a pool of its own, the job records both passes of its chunk one
+	// after the other since they share the pool; empty chunks are recorded all the same, they
+	// are executed with the others
+	std::vector<VkResult> results(2 * chunk_count, VK_SUCCESS);
+	VkResult* chunk_results = results.data();
+	const VkCommandBufferInheritanceInfo* inheritance = &inheritance_info;
+	JobCounter chunks;
+	for (size_t chunk = 0; chunk < chunk_count; chunk++)
+	{
+		job_system->run("record draws", [this, pass_buffers, chunk_results, inheritance, scene_descriptor_set, chunk_count, chunk_size, draw_count, prepass, chunk]()
+		{
+			size_t begin = std::min(draw_count, chunk * chunk_size);
+			size_t end = std::min(draw_count, begin + chunk_size);
+			for (size_t i = prepass ? chunk : chunk_count + chunk; i < 2 * chunk_count; i += chunk_count)
+			{
+				VkCommandBuffer secondary = pass_buffers[i];
+				VkCommandBufferBeginInfo begin_info = {};
+				begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+				begin_info.pInheritanceInfo = inheritance;
+				chunk_results[i] = vkBeginCommandBuffer(secondary, &begin_info);
+				if (chunk_results[i] != VK_SUCCESS)
+				{
+					return;
+				}
+				bindSceneState(secondary, scene_descriptor_set);
+				bindScenePipeline(secondary, i < chunk_count);
+				recordObjectDraws(secondary, begin, end);
+				chunk_results[i] = vkEndCommandBuffer(secondary);
+			}
+		}, &chunks);
+	}
+	job_system->wait(chunks);
+
+	for (VkResult result : results)
+	{
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to record command buffer!");
+		}
+	}
+	// the depth pre-pass chunks first, then the shading ones
+	size_t first = prepass ? 0 : chunk_count;
+	vkCmdExecuteCommands(command_buffer, (uint32_t)(2 * chunk_count - first), pass_buffers + first);
+}
+
+void VulkanShowBase::createSemaphores()
+{
+	TRACE_FUNCTION();
+	// the frames in flight may still wait on or signal the old ones, presenting waits on the
+	// render finished ones on present_queue, so they are kept as long as the old swap chain
+	deferred_destruction->retire(acquire_semaphores);
+	deferred_destruction->retire(render_finished_semaphores, (uint32_t)render_finished_semaphores.size());
+	free_acquire_semaphores.clear();
+	image_acquire_semaphores.assign(swap_chain_images.size(), VK_NULL_HANDLE);
+
+	VkSemaphoreCreateInfo semaphore_info = {};
+	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	// copy content of staging buffer to index buffer
-	copyBuffer(staging_buffer, index_buffer, buffer_size);
+	for (size_t i = 0; i <= swap_chain_images.size(); i++)
+	{
+		acquire_semaphores.emplace_back(graphics_device);
+		if (vkCreateSemaphore(graphics_device, &semaphore_info, nullptr, &acquire_semaphores.back()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create semaphores!");
+		}
+		free_acquire_semaphores.push_back(acquire_semaphores.back());
+	}
+	for (size_t i = 0; i < swap_chain_images.size(); i++)
+	{
+		render_finished_semaphores.emplace_back(graphics_device);
+		if (vkCreateSemaphore(graphics_device, &semaphore_info, nullptr, &render_finished_semaphores.back()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create semaphores!");
+		}
+	}
 }
 
-void VulkanShowBase::createUniformBuffer()
+void VulkanShowBase::createFrameFences()
 {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-	createBuffer(bufferSize
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		, &uniform_staging_buffer
-		, &uniform_staging_buffer_memory);
-	createBuffer(bufferSize
-		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-		, &uniform_buffer
-		, &uniform_buffer_memory);
+	TRACE_FUNCTION();
+	VkFenceCreateInfo fence_info = {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT; // no frame is pending at first
+
+	// the frames in flight still signal the old ones
+	deferred_destruction->retire(frame_fences);
+	for (uint32_t i = 0; i < swap_chain_images.size(); i++)
+	{
+		frame_fences.emplace_back(graphics_device);
+		if (vkCreateFence(graphics_device, &fence_info, nullptr, &frame_fences[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create frame fences!");
+		}
+	}
 }
 
-void VulkanShowBase::createDescriptorPool()
+void VulkanShowBase::createReadbackRing()
 {
-	// Create descriptor pool for uniform buffer
-	std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[0].descriptorCount = 1;
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = 1;
+	TRACE_FUNCTION();
+	if (swap_chain_image_format != VK_FORMAT_B8G8R8A8_UNORM && swap_chain_image_format != VK_FORMAT_B8G8R8A8_SRGB
+		&& swap_chain_image_format != VK_FORMAT_R8G8B8A8_UNORM && swap_chain_image_format != VK_FORMAT_R8G8B8A8_SRGB)
+	{
+		throw std::runtime_error("Capture needs an 8 bit RGBA or BGRA swap chain format!");
+	}
+
+	// the copies in flight still write to the old buffers, wait for them so that no frame is lost
+	for (auto& slot : readback_ring)
+	{
+		if (slot.pending)
+		{
+			VkFence fence = slot.fence;
+			vkWaitForFences(graphics_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		}
+	}
+	collectCaptures();
+	frame_encoder->waitIdle(); // the workers read the mapped memory
+	for (auto& slot : readback_ring)
+	{
+		vkFreeCommandBuffers(graphics_device, command_pool, 1, &slot.command_buffer);
+	}
+	readback_ring.clear();
+	readback_next = 0;
+
+	// cached memory makes reading it on the CPU fast, coherent is only the fallback
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+	VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	VkMemoryPropertyFlags memory_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	readback_coherent = true;
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		auto flags = memory_properties.memoryTypes[i].propertyFlags;
+		if ((flags & cached) == cached)
+		{
+			memory_flags = cached;
+			readback_coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+			break;
+		}
+	}
 
-	VkDescriptorPoolCreateInfo pool_info = {};
-	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool_info.poolSizeCount = (uint32_t)pool_sizes.size();
-	pool_info.pPoolSizes = pool_sizes.data();
-	pool_info.maxSets = 1;
-	pool_info.flags = 0;
-	//poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	VkFenceCreateInfo fence_info = {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-	if (vkCreateDescriptorPool(graphics_device, &pool_info, nullptr, &descriptor_pool) != VK_SUCCESS) 
+	VkDeviceSize size = (VkDeviceSize)swap_chain_extent.width * swap_chain_extent.height * 4;
+	readback_ring.reserve(READBACK_RING_SIZE);
+	for (uint32_t i = 0; i < READBACK_RING_SIZE; i++)
 	{
-		throw std::runtime_error("Failed to create descriptor pool!");
+		readback_ring.emplace_back(graphics_device);
+		auto& slot = readback_ring.back();
+		createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, memory_flags, &slot.buffer, &slot.memory);
+		vkMapMemory(graphics_device, slot.memory, 0, size, 0, &slot.mapped);
+		if (vkCreateFence(graphics_device, &fence_info, nullptr, &slot.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create readback fence!");
+		}
+
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(graphics_device, &alloc_info, &slot.command_buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate readback command buffer!");
+		}
 	}
 }
 
-void VulkanShowBase::createDescriptorSet()
+int VulkanShowBase::beginCapture(uint32_t image_index)
 {
-	VkDescriptorSetLayout layouts[] = { descriptor_set_layout };
-	VkDescriptorSetAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	alloc_info.descriptorPool = descriptor_pool;
-	alloc_info.descriptorSetCount = 1;
-	alloc_info.pSetLayouts = layouts;
+	TRACE_FUNCTION();
+	collectCaptures();
 
-	if (vkAllocateDescriptorSets(graphics_device, &alloc_info, &descriptor_set) != VK_SUCCESS) 
+	auto& slot = readback_ring[readback_next];
+	if (slot.pending || *slot.encoding)
 	{
-		throw std::runtime_error("Failed to allocate descriptor set!");
+		// the CPU is behind, rather drop the frame than wait for it
+		readback_dropped_frames++;
+		return -1;
 	}
 
-	// refer to the uniform object buffer
-	VkDescriptorBufferInfo buffer_info = {};
-	buffer_info.buffer = uniform_buffer;
-	buffer_info.offset = 0;
-	buffer_info.range = sizeof(UniformBufferObject);
-
-	VkDescriptorImageInfo image_info = {};
-	image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	image_info.imageView = texture_image_view;
-	image_info.sampler = texture_sampler;
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(slot.command_buffer, &begin_info);
+
+	// submitted after the frame's command buffer, so the barrier waits for all of it
+	VkImage image = swap_chain_images[image_index];
+	recordImageBarrier(slot.command_buffer, image, VK_IMAGE_ASPECT_COLOR_BIT
+		, getPresentLayout(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+		, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+		, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { swap_chain_extent.width, swap_chain_extent.height, 1 };
+	vkCmdCopyImageToBuffer(slot.command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+	recordImageBarrier(slot.command_buffer, image, VK_IMAGE_ASPECT_COLOR_BIT
+		, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, getPresentLayout()
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, 0
+		, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+	recordBufferBarrier(slot.command_buffer, slot.buffer
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+	if (vkEndCommandBuffer(slot.command_buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record readback command buffer!");
+	}
 
-	std::array<VkWriteDescriptorSet, 2> descriptor_writes = {};
-	descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptor_writes[0].dstSet = descriptor_set;
-	descriptor_writes[0].dstBinding = 0;
-	descriptor_writes[0].dstArrayElement = 0;
-	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptor_writes[0].descriptorCount = 1;
-	descriptor_writes[0].pBufferInfo = &buffer_info;
-	descriptor_writes[0].pImageInfo = nullptr; // Optional
-	descriptor_writes[0].pTexelBufferView = nullptr; // Optional
+	slot.pending = true;
+	slot.frame = (uint64_t)total_frames;
+	slot.extent = swap_chain_extent;
+	int slot_index = (int)readback_next;
+	readback_next = (readback_next + 1) % (uint32_t)readback_ring.size();
+	return slot_index;
+}
 
-	descriptor_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptor_writes[1].dstSet = descriptor_set;
-	descriptor_writes[1].dstBinding = 1;
-	descriptor_writes[1].dstArrayElement = 0;
-	descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptor_writes[1].descriptorCount = 1;
-	descriptor_writes[1].pImageInfo = &image_info;
+void VulkanShowBase::collectCaptures()
+{
+	TRACE_FUNCTION();
+	// oldest first, stopping at the first one still in flight keeps the frames in order
+	for (size_t i = 0; i < readback_ring.size(); i++)
+	{
+		auto& slot = readback_ring[(readback_next + i) % readback_ring.size()];
+		if (!slot.pending)
+		{
+			continue;
+		}
+		if (vkGetFenceStatus(graphics_device, slot.fence) != VK_SUCCESS)
+		{
+			break;
+		}
 
+		if (!readback_coherent)
+		{
+			VkMappedMemoryRange range = {};
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = slot.memory;
+			range.offset = 0;
+			range.size = VK_WHOLE_SIZE;
+			vkInvalidateMappedMemoryRanges(graphics_device, 1, &range);
+		}
 
-	vkUpdateDescriptorSets(graphics_device, (uint32_t)descriptor_writes.size()
-		, descriptor_writes.data(), 0, nullptr);
+		CapturedFrame frame;
+		frame.frame = slot.frame;
+		frame.width = slot.extent.width;
+		frame.height = slot.extent.height;
+		frame.bgra = swap_chain_image_format == VK_FORMAT_B8G8R8A8_UNORM || swap_chain_image_format == VK_FORMAT_B8G8R8A8_SRGB;
+		// the worker reads the mapped memory, the slot is reused once it is done
+		frame.pixels = static_cast<const uint8_t*>(slot.mapped);
+		auto encoding = slot.encoding.get();
+		*encoding = true;
+		frame.release = [encoding]() { *encoding = false; };
+
+		vkResetFences(graphics_device, 1, &slot.fence);
+		slot.pending = false;
+		frame_encoder->submit(std::move(frame)); // counts the frames it drops
+	}
 }
 
-void VulkanShowBase::createCommandBuffers()
+void VulkanShowBase::updateUniformBuffer(uint32_t image_index)
 {
-	// Free old command buffers, if any
-	if (command_buffers.size() > 0)
+	TRACE_FUNCTION();
+	// a fixed timestep renders the same frames on every benchmark run
+	float time = options.benchmark
+		? total_frames * options.timestep_ms / 1000.0f
+		: std::chrono::duration<float>(std::chrono::steady_clock::now() - animation_start_time).count();
+	CameraSetup camera_setup;
+	camera_setup.path = options.camera_path;
+	camera_setup.aspect = swap_chain_extent.width / (float)swap_chain_extent.height;
+	camera_setup.model_bounding_sphere = model_bounding_sphere;
+	camera_setup.object_spacing = OBJECT_SPACING * model_bounding_sphere.w;
+	camera_setup.scene_half_extent = scene_half_extent;
+	UniformBufferObject ubo = computeCameraMatrices(camera_setup, time);
+
+	// the image's fence has signaled, so its last frame is done with its FrameUniforms and queries
+	FrameUniforms& uniforms = *mapped_frame_uniforms[image_index];
+	uniforms.ubo = ubo;
+	collectProfiledFrame(image_index);
+	if (dynamic_resolution)
 	{
-		vkFreeCommandBuffers(graphics_device, command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+		updateRenderScale(image_index);
 	}
 
-	command_buffers.resize(swap_chain_framebuffers.size());
+	//TODO: use push constants
 
-	VkCommandBufferAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.commandPool = command_pool;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; 
-	// primary: can be submitted to a queue but cannot be called from other command buffers
-	// secondary: can be called by others but cannot be submitted to a queue
-	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+	// objects are laid out before ubo.model is applied, so cull and pick in that space
+	view_proj = ubo.proj * ubo.view * ubo.model;
+	view_frustum = Frustum::fromMatrix(view_proj);
 
-	auto alloc_result = vkAllocateCommandBuffers(graphics_device, &alloc_info, command_buffers.data());
-	if (alloc_result != VK_SUCCESS)
+	if (options.gpu_culling)
 	{
-		throw std::runtime_error("failed to allocate command buffers!");
-	}
-
-	// record command buffers
-	for (size_t i = 0; i < command_buffers.size(); i++) 
-	{
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		begin_info.pInheritanceInfo = nullptr; // Optional
-
-		vkBeginCommandBuffer(command_buffers[i], &begin_info);
-
-		VkRenderPassBeginInfo render_pass_info = {};
-		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_info.renderPass = render_pass;
-		render_pass_info.framebuffer = swap_chain_framebuffers[i];
-		render_pass_info.renderArea.offset = { 0, 0 };
-		render_pass_info.renderArea.extent = swap_chain_extent;
-
-		std::array<VkClearValue, 2> clear_values = {};
-		clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clear_values[1].depthStencil = { 1.0f, 0 }; // 1.0 is far view plane
-		render_pass_info.clearValueCount = (uint32_t)clear_values.size();
-		render_pass_info.pClearValues = clear_values.data();
-		
-		vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-		vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
-
-		// bind vertex buffer
-		VkBuffer vertex_buffers[] = { vertex_buffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-		//vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT16);
-		vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-			, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
-		// TODO: better to store vertex buffer and index buffer in a single VkBuffer
-
-		//vkCmdDraw(command_buffers[i], VERTICES.size(), 1, 0, 0);
-		vkCmdDrawIndexed(command_buffers[i], (uint32_t)vertex_indices.size(), 1, 0, 0, 0);
-
-		vkCmdEndRenderPass(command_buffers[i]);
-
-		auto record_result = vkEndCommandBuffer(command_buffers[i]);
-		if (record_result != VK_SUCCESS)
+		for (size_t i = 0; i < view_frustum.planes.size(); i++)
 		{
-			throw std::runtime_error("Failed to record command buffer!");
+			uniforms.culling.frustum_planes[i] = view_frustum.planes[i];
 		}
+		uniforms.culling.view_proj = view_proj;
+		uniforms.culling.depth_size = glm::vec2(render_extent.width, render_extent.height);
+		uniforms.culling.pyramid_level_count = depth_pyramid_level_count;
+		uniforms.culling.object_count = (uint32_t)scene_objects.size();
 	}
 }
 
-void VulkanShowBase::createSemaphores()
+void VulkanShowBase::collectProfiledFrame(uint32_t image_index)
 {
-	VkSemaphoreCreateInfo semaphore_info = {};
-	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-	auto result1 = vkCreateSemaphore(graphics_device, &semaphore_info, nullptr, &image_available_semaphore);
-	auto result2 = vkCreateSemaphore(graphics_device, &semaphore_info, nullptr, &render_finished_semaphore);
-
-	if (result1 != VK_SUCCESS || result2 != VK_SUCCESS) 
+	if (gpu_profiler && profiled_frames[image_index] >= 0)
 	{
-		throw std::runtime_error("failed to create semaphores!");
+		gpu_profiler->collect(image_index, (uint64_t)profiled_frames[image_index]);
+		profiled_frames[image_index] = -1;
 	}
 }
 
-void VulkanShowBase::updateUniformBuffer()
+const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max() };
+void VulkanShowBase::updateRenderExtent()
 {
-	static auto start_time = std::chrono::high_resolution_clock::now();
+	render_extent = swap_chain_extent;
+	if (dynamic_resolution)
+	{
+		float scale = dynamic_resolution->getScale();
+		render_extent.width = std::max(1u, (uint32_t)std::lround(swap_chain_extent.width * scale));
+		render_extent.height = std::max(1u, (uint32_t)std::lround(swap_chain_extent.height * scale));
+	}
+}
 
-	auto current_time = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
-	UniformBufferObject ubo = {};
-	ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.view = glm::lookAt(glm::vec3(1.5f, 1.5f, 1.5f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.1f, 10.0f);
-	ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
+void VulkanShowBase::updateRenderScale(uint32_t image_index)
+{
+	TRACE_FUNCTION();
+	if (!frame_timestamps_written[image_index])
+	{
+		return;
+	}
+	uint64_t timestamps[2];
+	auto result = vkGetQueryPoolResults(graphics_device, frame_timestamp_pool, 2 * image_index, 2
+		, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS)
+	{
+		return; // VK_NOT_READY, try again next frame
+	}
+	float gpu_time_ms = (float)(((timestamps[1] - timestamps[0]) & timestamp_mask) * timestamp_period / 1e6);
 
-	void* data;
-	vkMapMemory(graphics_device, uniform_staging_buffer_memory, 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(graphics_device, uniform_staging_buffer_memory);
+	float old_scale = dynamic_resolution->getScale();
+	if (dynamic_resolution->update(gpu_time_ms) != old_scale)
+	{
+		updateRenderExtent();
+		// the frames in flight keep theirs, each image's viewports and blits are recorded again
+		// once its fence has signaled
+		outdated_command_buffers.assign(command_buffers.size(), true);
+	}
+}
 
-	copyBuffer(uniform_staging_buffer, uniform_buffer, sizeof(ubo)); 
-	// TODO: maybe I shouldn't use single time buffer
+bool VulkanShowBase::stepResizeSweep()
+{
+	int frame = total_frames - RESIZE_SWEEP_START;
+	if (options.resize_sweep_frames == 0 || frame < 0 || frame > (int)options.resize_sweep_frames)
+	{
+		return false;
+	}
+	if (frame == (int)options.resize_sweep_frames)
+	{
+		glfwSetWindowSize(window, WINDOW_WIDTH, WINDOW_HEIGHT);
+		return false;
+	}
+	if (frame == 0)
+	{
+		resize_sweep_stats.begin();
+	}
 
-	//TODO: use push constants
+	// like a drag, shrinking the window a step every frame and growing it back
+	int steps = RESIZE_SWEEP_RANGE / RESIZE_SWEEP_STEP;
+	int phase = frame % (2 * steps);
+	int shrink = (phase < steps ? phase + 1 : 2 * steps - phase) * RESIZE_SWEEP_STEP;
+	glfwSetWindowSize(window, WINDOW_WIDTH - shrink, WINDOW_HEIGHT - shrink * WINDOW_HEIGHT / WINDOW_WIDTH);
+	return true;
 }
 
-const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max() };
-void VulkanShowBase::drawFrame()
+bool VulkanShowBase::acquireFrame(uint32_t* p_image_index)
 {
+	TRACE_FUNCTION();
+	if (options.headless)
+	{
+		// no presentation engine hands out images, take turns and wait for the frame that last used this one
+		*p_image_index = next_offscreen_image;
+		next_offscreen_image = (next_offscreen_image + 1) % (uint32_t)swap_chain_images.size();
+		VkFence fence = frame_fences[*p_image_index];
+		vkWaitForFences(graphics_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		vkResetFences(graphics_device, 1, &fence);
+		return true;
+	}
+
 	// 1. Acquiring an image from the swap chain
-	uint32_t image_index;
+	VkSemaphore acquire_semaphore = free_acquire_semaphores.back();
 	auto aquiring_result = vkAcquireNextImageKHR(graphics_device, swap_chain
-		, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphore, VK_NULL_HANDLE, &image_index);
+		, ACQUIRE_NEXT_IMAGE_TIMEOUT, acquire_semaphore, VK_NULL_HANDLE, p_image_index);
 
 	if (aquiring_result == VK_ERROR_OUT_OF_DATE_KHR) 
 	{
-		// when swap chain needs recreation
+		// can't render to it anymore, whether the size settled or not; nothing signals the semaphore
 		recreateSwapChain();
-		return;
+		return false;
+	}
+	else if (aquiring_result == VK_SUBOPTIMAL_KHR)
+	{
+		resize_coalescer.onSuboptimal(); // still presents, stretched
 	}
 	else if (aquiring_result != VK_SUCCESS && aquiring_result != VK_SUBOPTIMAL_KHR) 
 	{
 		throw std::runtime_error("Failed to acquire swap chain image!");
 	}
 
+	// the presentation engine may hand out the image before the frame that last rendered to it completes
+	VkFence fence = frame_fences[*p_image_index];
+	vkWaitForFences(graphics_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	vkResetFences(graphics_device, 1, &fence);
+	// which also waited on the semaphore of its acquire
+	free_acquire_semaphores.pop_back();
+	VkSemaphore& image_semaphore = image_acquire_semaphores[*p_image_index];
+	if (image_semaphore != VK_NULL_HANDLE)
+	{
+		free_acquire_semaphores.push_back(image_semaphore);
+	}
+	image_semaphore = acquire_semaphore;
+	return true;
+}
+
+void VulkanShowBase::drawFrame(uint32_t image_index)
+{
+	TRACE_FUNCTION();
+	deferred_destruction->collect();
+	// sets allocated or written from here on count for this frame
+	descriptor_allocator->beginFrame();
+	auto record_start = std::chrono::steady_clock::now();
+	if (options.cpu_culling)
+	{
+		// the image's command buffer is not pending anymore, it can be recorded again
+		if (options.bvh_culling)
+		{
+			// tests boxes around the spheres, may keep a few more objects than cullSpheres
+			object_bvh->cull(view_frustum, visible_objects);
+		}
+		else
+		{
+			cpu_culler->cullSpheres(view_frustum, object_bounds, visible_objects);
+		}
+		recordCommandBuffer(image_index);
+	}
+	else if (outdated_command_buffers[image_index])
+	{
+		recordCommandBuffer(image_index);
+	}
+	int capture_slot = frame_encoder ? beginCapture(image_index) : -1;
+	auto submit_start = std::chrono::steady_clock::now();
+	frame_timings.record_ns = nanosecondsBetween(record_start, submit_start);
+
 	// 2. Submitting the command buffer
 	VkSubmitInfo submit_info = {};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	VkSemaphore wait_semaphores[] = { image_available_semaphore }; // which semaphore to wait
-	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }; // which stage to execute
+	VkSemaphore wait_semaphores[] = { image_acquire_semaphores[image_index] }; // which semaphore to wait
+	// which stage to execute, with dynamic resolution the swap chain image is first touched by the blit
+	VkPipelineStageFlags wait_stages[] = { dynamic_resolution ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 	submit_info.waitSemaphoreCount = 1;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &command_buffers[image_index];
-	VkSemaphore signal_semaphores[] = { render_finished_semaphore };
+	VkSemaphore signal_semaphores[] = { render_finished_semaphores[image_index] };
 	submit_info.signalSemaphoreCount = 1;
 	submit_info.pSignalSemaphores = signal_semaphores;
 
-	auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+	// paces the frames, the next one rendering to the image waits for it
+	VkFence fence = frame_fences[image_index];
+	if (options.headless)
+	{
+		// nothing to acquire or present
+		submit_info.waitSemaphoreCount = 0;
+		submit_info.signalSemaphoreCount = 0;
+	}
+
+	if (capture_slot >= 0)
+	{
+		// presenting waits for the copy instead
+		submit_info.signalSemaphoreCount = 0;
+	}
+
+	auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, fence);
 	if (submit_result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to submit draw command buffer!");
 	}
+	if (dynamic_resolution)
+	{
+		frame_timestamps_written[image_index] = true;
+	}
+	if (gpu_profiler)
+	{
+		profiled_frames[image_index] = total_frames;
+	}
+
+	if (capture_slot >= 0)
+	{
+		auto& slot = readback_ring[capture_slot];
+		VkSubmitInfo capture_submit_info = {};
+		capture_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		capture_submit_info.commandBufferCount = 1;
+		capture_submit_info.pCommandBuffers = &slot.command_buffer;
+		if (!options.headless)
+		{
+			capture_submit_info.signalSemaphoreCount = 1;
+			capture_submit_info.pSignalSemaphores = signal_semaphores;
+		}
+		if (vkQueueSubmit(graphics_queue, 1, &capture_submit_info, slot.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit readback command buffer!");
+		}
+	}
+	// everything this frame uses has been submitted
+	deferred_destruction->endFrame();
+	auto present_start = std::chrono::steady_clock::now();
+	frame_timings.submit_ns = nanosecondsBetween(submit_start, present_start);
 
-	// TODO: when limiting fps I'll consider breaking the function HERE
+	if (options.headless)
+	{
+		return;
+	}
 
 	// 3. Submitting the result back to the swap chain to show it on screen
 	VkPresentInfoKHR present_info = {};
@@ -1410,24 +3519,35 @@ void VulkanShowBase::drawFrame()
 	present_info.pImageIndices = &image_index;
 	present_info.pResults = nullptr; // Optional, check for if every single chains is successful
 
-	auto present_result = vkQueuePresentKHR(present_queue, &present_info);
+	VkResult present_result;
+	{
+		TRACE_SCOPE("vkQueuePresentKHR");
+		present_result = vkQueuePresentKHR(present_queue, &present_info);
+	}
+	frame_timings.present_wait_ns += nanosecondsBetween(present_start, std::chrono::steady_clock::now());
 
-	if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR) 
+	if (present_result == VK_SUBOPTIMAL_KHR)
 	{
-		recreateSwapChain();
+		resize_coalescer.onSuboptimal();
 	}
-	else if (present_result != VK_SUCCESS) 
+	else if (present_result != VK_SUCCESS && present_result != VK_ERROR_OUT_OF_DATE_KHR)
 	{
 		throw std::runtime_error("Failed to present swap chain image!");
 	}
+	// during a drag only every few resizes recreate it, frames in between are stretched
+	if (present_result == VK_ERROR_OUT_OF_DATE_KHR || resize_coalescer.isDue())
+	{
+		recreateSwapChain();
+	}
 }
 
-void VulkanShowBase::createShaderModule(const std::vector<char>& code, VkShaderModule* p_shader_module)
+void VulkanShowBase::createShaderModule(const AssetBytes& code, VkShaderModule* p_shader_module)
 {
+	TRACE_FUNCTION();
 	VkShaderModuleCreateInfo create_info = {};
 	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	create_info.codeSize = code.size();
-	create_info.pCode = (uint32_t*)code.data();
+	create_info.pCode = (const uint32_t*)code.data();
 
 	auto result = vkCreateShaderModule(graphics_device, &create_info, nullptr, p_shader_module);
 	if (result != VK_SUCCESS)
@@ -1460,15 +3580,16 @@ VkSurfaceFormatKHR VulkanShowBase::chooseSwapSurfaceFormat(const std::vector<VkS
 
 VkPresentModeKHR VulkanShowBase::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& available_present_modes)
 {
-	for (const auto& available_present_mode : available_present_modes)
+	for (auto preferred_mode : present_policy.present_modes)
 	{
-		if (available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) 
+		if (std::find(available_present_modes.begin(), available_present_modes.end(), preferred_mode)
+			!= available_present_modes.end())
 		{
-			return available_present_mode;
+			return preferred_mode;
 		}
 	}
 
-	return VK_PRESENT_MODE_FIFO_KHR;
+	return VK_PRESENT_MODE_FIFO_KHR; // always supported
 }
 
 VkExtent2D VulkanShowBase::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
@@ -1480,7 +3601,10 @@ VkExtent2D VulkanShowBase::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capa
 	}
 	else
 	{
-		VkExtent2D actual_extent = { (uint32_t)WINDOW_WIDTH, (uint32_t)WINDOW_HEIGHT };
+		// the surface takes the size of the swap chain, which follows the window's
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		VkExtent2D actual_extent = { (uint32_t)width, (uint32_t)height };
 
 		actual_extent.width = std::max(capabilities.minImageExtent.width
 			, std::min(capabilities.maxImageExtent.width, actual_extent.width));
@@ -1555,8 +3679,40 @@ void VulkanShowBase::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, V
 	}
 }
 
+void VulkanShowBase::createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage
+	, VkBuffer* p_buffer, VkDeviceMemory* p_buffer_memory)
+{
+	TRACE_FUNCTION();
+	// create staging buffer
+	VBuffer staging_buffer{ graphics_device };
+	VDeviceMemory staging_buffer_memory{ graphics_device };
+	createBuffer(size
+		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		, &staging_buffer
+		, &staging_buffer_memory);
+
+	// copy data to staging buffer
+	void* mapped;
+	vkMapMemory(graphics_device, staging_buffer_memory, 0, size, 0, &mapped); // access the graphics memory using mapping
+	memcpy(mapped, data, (size_t)size); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
+	vkUnmapMemory(graphics_device, staging_buffer_memory);
+
+	// create the buffer at optimized local memory which may not be directly accessable by memory mapping
+	// as copy destination of staging buffer
+	createBuffer(size
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, p_buffer
+		, p_buffer_memory);
+
+	// copy content of staging buffer to the buffer
+	copyBuffer(staging_buffer, *p_buffer, size);
+}
+
 void VulkanShowBase::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size)
 {
+	TRACE_FUNCTION();
 	VkCommandBuffer copy_command_buffer = beginSingleTimeCommands();
 
 	recordCopyBuffer(copy_command_buffer, src_buffer, dst_buffer, size);
@@ -1564,10 +3720,11 @@ void VulkanShowBase::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDevi
 	endSingleTimeCommands(copy_command_buffer);
 }
 
-void VulkanShowBase::createImage(uint32_t image_width, uint32_t image_height
+VkMemoryPropertyFlags VulkanShowBase::createImage(uint32_t image_width, uint32_t image_height
 	, VkFormat format, VkImageTiling tiling
 	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties
-	, VkImage* p_vkimage, VkDeviceMemory* p_image_memory)
+	, VkImage* p_vkimage, VkDeviceMemory* p_image_memory
+	, uint32_t mip_levels)
 {
 	VkImageCreateInfo image_info = {};
 	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1575,7 +3732,7 @@ void VulkanShowBase::createImage(uint32_t image_width, uint32_t image_height
 	image_info.extent.width = image_width;
 	image_info.extent.height = image_height;
 	image_info.extent.depth = 1;
-	image_info.mipLevels = 1;
+	image_info.mipLevels = mip_levels;
 	image_info.arrayLayers = 1;
 
 	image_info.format = format; //VK_FORMAT_R8G8B8A8_UNORM;
@@ -1598,6 +3755,13 @@ void VulkanShowBase::createImage(uint32_t image_width, uint32_t image_height
 	VkMemoryRequirements memory_req;
 	vkGetImageMemoryRequirements(graphics_device, vkimage, &memory_req);
 
+	// lazily allocated memory is a preference, desktop GPUs have none
+	if ((memory_properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		&& !hasMemoryType(memory_req.memoryTypeBits, memory_properties, physical_device))
+	{
+		memory_properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	}
+
 	VkMemoryAllocateInfo alloc_info = {};
 	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	alloc_info.allocationSize = memory_req.size;
@@ -1611,10 +3775,12 @@ void VulkanShowBase::createImage(uint32_t image_width, uint32_t image_height
 	}
 
 	vkBindImageMemory(graphics_device, vkimage, *p_image_memory, 0);
+	return memory_properties;
 }
 
 void VulkanShowBase::copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height)
 {
+	TRACE_FUNCTION();
 	VkCommandBuffer command_buffer = beginSingleTimeCommands();
 
 	recordCopyImage(command_buffer, src_image, dst_image, width, height);
@@ -1622,16 +3788,8 @@ void VulkanShowBase::copyImage(VkImage src_image, VkImage dst_image, uint32_t wi
 	endSingleTimeCommands(command_buffer);
 }
 
-void VulkanShowBase::transitImageLayout(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout)
-{
-	VkCommandBuffer command_buffer = beginSingleTimeCommands();
-	
-	recordTransitImageLayout(command_buffer, image, old_layout, new_layout);
-
-	endSingleTimeCommands(command_buffer);
-}
-
-void VulkanShowBase::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view)
+void VulkanShowBase::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view
+	, uint32_t base_mip_level, uint32_t mip_level_count)
 {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1646,8 +3804,8 @@ void VulkanShowBase::createImageView(VkImage image, VkFormat format, VkImageAspe
 	viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 
 	viewInfo.subresourceRange.aspectMask = aspect_mask;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = base_mip_level;
+	viewInfo.subresourceRange.levelCount = mip_level_count;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -1742,14 +3900,7 @@ void VulkanShowBase::recordTransitImageLayout(VkCommandBuffer command_buffer, Vk
 	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.image = image;
 
-	if (new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-	{
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	}
-	else
-	{
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	}
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
 	barrier.subresourceRange.baseMipLevel = 0;
 	barrier.subresourceRange.levelCount = 1;
@@ -1772,12 +3923,6 @@ void VulkanShowBase::recordTransitImageLayout(VkCommandBuffer command_buffer, Vk
 		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	}
-	else if (old_layout == VK_IMAGE_LAYOUT_UNDEFINED && new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
-			| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-	}
 	else
 	{
 		throw std::invalid_argument("unsupported layout transition!");
@@ -1792,3 +3937,236 @@ void VulkanShowBase::recordTransitImageLayout(VkCommandBuffer command_buffer, Vk
 		, 1, &barrier
 		);
 }
+
+void VulkanShowBase::recordCulling(VkCommandBuffer command_buffer)
+{
+	// the previous frame may still read the draw command and visible list
+	recordBufferBarrier(command_buffer, draw_command_buffer
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	recordBufferBarrier(command_buffer, visible_object_buffer
+		, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	// reset the instance count, the culling pass counts survivors into it
+	vkCmdFillBuffer(command_buffer, draw_command_buffer
+		, offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+	recordBufferBarrier(command_buffer, draw_command_buffer
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling_pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE
+		, culling_pipeline_layout, 0, 1, &culling_descriptor_set, 0, nullptr);
+	uint32_t group_count = ((uint32_t)scene_objects.size() + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE;
+	vkCmdDispatch(command_buffer, group_count, 1, 1);
+
+	// results are consumed by the indirect draw and the vertex shader
+	recordBufferBarrier(command_buffer, draw_command_buffer
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	recordBufferBarrier(command_buffer, visible_object_buffer
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+		, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void VulkanShowBase::recordOcclusionCulling(VkCommandBuffer command_buffer, uint32_t late_phase)
+{
+	VkBuffer visible_list = late_phase ? late_visible_object_buffer : visible_object_buffer;
+	if (!late_phase)
+	{
+		// the previous frame may still read the draw commands and visible lists
+		recordBufferBarrier(command_buffer, draw_command_buffer
+			, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		recordBufferBarrier(command_buffer, visible_object_buffer
+			, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		recordBufferBarrier(command_buffer, late_visible_object_buffer
+			, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		// written by the late phase of the previous frame
+		recordBufferBarrier(command_buffer, object_visibility_buffer
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+		// reset both instance counts and the occluded count, the draws themselves stay
+		vkCmdFillBuffer(command_buffer, draw_command_buffer
+			, offsetof(CullingDrawCommands, draw) + offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+		vkCmdFillBuffer(command_buffer, draw_command_buffer
+			, offsetof(CullingDrawCommands, late_draw) + offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+		vkCmdFillBuffer(command_buffer, draw_command_buffer
+			, offsetof(CullingDrawCommands, occluded_objects), sizeof(uint32_t), 0);
+		recordBufferBarrier(command_buffer, draw_command_buffer
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	std::array<VkDescriptorSet, 2> sets = { culling_descriptor_set, depth_pyramid_descriptor_set };
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling_pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE
+		, culling_pipeline_layout, 0, (uint32_t)sets.size(), sets.data(), 0, nullptr);
+	vkCmdPushConstants(command_buffer, culling_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT
+		, 0, sizeof(late_phase), &late_phase);
+	uint32_t group_count = ((uint32_t)scene_objects.size() + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE;
+	vkCmdDispatch(command_buffer, group_count, 1, 1);
+
+	// the early phase's counters are still updated by the late phase
+	recordBufferBarrier(command_buffer, draw_command_buffer
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	recordBufferBarrier(command_buffer, visible_list
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+		, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void VulkanShowBase::recordDepthPyramid(VkCommandBuffer command_buffer)
+{
+	// the first reduction reads what render_pass left in the depth attachment, which it hands over
+	// in SHADER_READ_ONLY_OPTIMAL and late_render_pass takes back
+	// the previous frame may still read the pyramid; nothing reads it before it is rebuilt below,
+	// so its content is discarded, which also takes a new pyramid to the general layout
+	recordImageBarrier(command_buffer, depth_pyramid, VK_IMAGE_ASPECT_COLOR_BIT
+		, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT
+		, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	// only the render_extent part of the depth attachment was rendered to,
+	// the rest of every level is left alone
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_reduce_pipeline);
+	int32_t source_size[2] = { (int32_t)render_extent.width, (int32_t)render_extent.height };
+	VkExtent2D level_extent = { std::max(1u, render_extent.width / 2), std::max(1u, render_extent.height / 2) };
+	for (uint32_t level = 0; level < depth_pyramid_level_count; level++)
+	{
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE
+			, depth_reduce_pipeline_layout, 0, 1, &depth_reduce_descriptor_sets[level], 0, nullptr);
+		vkCmdPushConstants(command_buffer, depth_reduce_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT
+			, 0, sizeof(source_size), source_size);
+		vkCmdDispatch(command_buffer
+			, (level_extent.width + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE
+			, (level_extent.height + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE
+			, 1);
+
+		// read by the next level, the late culling phase and the debug view
+		recordImageBarrier(command_buffer, depth_pyramid, VK_IMAGE_ASPECT_COLOR_BIT
+			, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT
+			, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT
+			, level, 1);
+
+		source_size[0] = (int32_t)level_extent.width;
+		source_size[1] = (int32_t)level_extent.height;
+		level_extent.width = std::max(1u, level_extent.width / 2);
+		level_extent.height = std::max(1u, level_extent.height / 2);
+	}
+}
+
+void VulkanShowBase::recordBlitToSwapChain(VkCommandBuffer command_buffer, uint32_t image_index)
+{
+	// the render pass left the scene in TRANSFER_SRC_OPTIMAL, its dependency makes the writes visible to the blit
+	recordImageBarrier(command_buffer, swap_chain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT
+		, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, 0
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	VkImageBlit blit = {};
+	blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	blit.srcSubresource.layerCount = 1;
+	blit.srcOffsets[1] = { (int32_t)render_extent.width, (int32_t)render_extent.height, 1 };
+	blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	blit.dstSubresource.layerCount = 1;
+	blit.dstOffsets[1] = { (int32_t)swap_chain_extent.width, (int32_t)swap_chain_extent.height, 1 };
+	vkCmdBlitImage(command_buffer
+		, scene_color_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+		, swap_chain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+		, 1, &blit, upscale_filter);
+
+	recordImageBarrier(command_buffer, swap_chain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT
+		, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getPresentLayout()
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+}
+
+void VulkanShowBase::recordCullingStatsCopy(VkCommandBuffer command_buffer)
+{
+	// the occluded count has no reader in between, so wait for the compute writes too
+	recordBufferBarrier(command_buffer, draw_command_buffer
+		, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	recordCopyBuffer(command_buffer, draw_command_buffer, culling_stats_buffer, sizeof(CullingDrawCommands));
+	recordBufferBarrier(command_buffer, culling_stats_buffer
+		, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT
+		, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+}
+
+void VulkanShowBase::recordProfilerBegin(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass)
+{
+	if (gpu_profiler)
+	{
+		gpu_profiler->recordBegin(command_buffer, pool, pass);
+	}
+}
+
+void VulkanShowBase::recordProfilerEnd(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass)
+{
+	if (gpu_profiler)
+	{
+		gpu_profiler->recordEnd(command_buffer, pool, pass);
+	}
+}
+
+void VulkanShowBase::recordBufferBarrier(VkCommandBuffer command_buffer, VkBuffer buffer
+	, VkPipelineStageFlags src_stage, VkAccessFlags src_access
+	, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(command_buffer
+		, src_stage
+		, dst_stage
+		, 0
+		, 0, nullptr
+		, 1, &barrier
+		, 0, nullptr
+		);
+}
+
+void VulkanShowBase::recordImageBarrier(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect_mask
+	, VkImageLayout old_layout, VkImageLayout new_layout
+	, VkPipelineStageFlags src_stage, VkAccessFlags src_access
+	, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access
+	, uint32_t base_mip_level, uint32_t mip_level_count)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspect_mask;
+	barrier.subresourceRange.baseMipLevel = base_mip_level;
+	barrier.subresourceRange.levelCount = mip_level_count;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(command_buffer
+		, src_stage
+		, dst_stage
+		, 0
+		, 0, nullptr
+		, 0, nullptr
+		, 1, &barrier
+		);
+}
@@ -1,6 +1,26 @@
 #pragma once
 
-#include "VDeleter.h"
+#include "VHandle.h"
+#include "AppOptions.h"
+#include "AssetArchive.h"
+#include "AssetLoading.h"
+#include "AsyncFileReader.h"
+#include "Bvh.h"
+#include "Camera.h"
+#include "CpuCulling.h"
+#include "DeferredDestruction.h"
+#include "DescriptorAllocator.h"
+#include "DeviceSelection.h"
+#include "DynamicResolution.h"
+#include "FramePacing.h"
+#include "FrameCapture.h"
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+#include "JobSystem.h"
+#include "RenderPassBuilder.h"
+#include "SceneGraph.h"
+#include "StartupTiming.h"
+#include "TraceProfiler.h"
 
 #include <vulkan/vulkan.h>
 
@@ -14,65 +34,71 @@
 
 #include <vector>
 #include <array>
-
-struct Vertex
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+
+// per-object data, laid out for std430 storage buffers
+struct ObjectData
 {
-	glm::vec3 pos;
-	glm::vec3 color;
-	glm::vec2 tex_coord;
+	glm::mat4 model;
+	glm::vec4 bounding_sphere; // xyz: center in scene space, w: radius
+};
 
-	static VkVertexInputBindingDescription getBindingDesciption()
-	{
-		VkVertexInputBindingDescription binding_description = {};
-		binding_description.binding = 0; // index of the binding, defined in vertex shader
-		binding_description.stride = sizeof(Vertex);
-		binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // move to next data engty after each vertex
-		return binding_description;
-	}
+// parameters of the culling compute passes, laid out for std140
+struct CullingUniform
+{
+	glm::vec4 frustum_planes[6]; // in scene space, normals pointing inside
+	glm::mat4 view_proj; // scene space to clip space, for the occlusion test
+	glm::vec2 depth_size; // of the depth attachment, the depth pyramid starts at half of it
+	uint32_t pyramid_level_count;
+	uint32_t object_count;
+};
 
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
-	{
-		std::array<VkVertexInputAttributeDescription, 3> attr_descriptions = {};
-		attr_descriptions[0].binding = 0; 
-		attr_descriptions[0].location = 0;
-		attr_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attr_descriptions[0].offset = offsetof(Vertex, pos); //bytes of a member since beginning of struct
-		attr_descriptions[1].binding = 0;
-		attr_descriptions[1].location = 1;
-		attr_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attr_descriptions[1].offset = offsetof(Vertex, color); //bytes of a member since beginning of struct
-		attr_descriptions[2].binding = 0;
-		attr_descriptions[2].location = 2;
-		attr_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-		attr_descriptions[2].offset = offsetof(Vertex, tex_coord);
-
-		return attr_descriptions;
-	}
+// content of draw_command_buffer, written by the culling shaders
+struct CullingDrawCommands
+{
+	VkDrawIndexedIndirectCommand draw; // objects visible last frame when occlusion culling
+	VkDrawIndexedIndirectCommand late_draw; // objects that became visible this frame, occlusion culling only
+	uint32_t occluded_objects; // inside the frustum but behind the depth pyramid
+};
 
-	bool operator==(const Vertex& other) const 
-	{
-		return pos == other.pos && color == other.color && tex_coord == other.tex_coord;
-	}
+// what a frame writes from the host, copied into uniform_buffer and culling_uniform_buffer by its command buffer
+struct FrameUniforms
+{
+	UniformBufferObject ubo;
+	CullingUniform culling; // only copied with gpu culling
 };
 
-namespace std {
-	// hash function for Vertex
-	template<> struct hash<Vertex> 
-	{
-		size_t operator()(Vertex const& vertex) const 
-		{
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.tex_coord) << 1);
-		}
-	};
-}
+// a host visible buffer a frame is copied to, waiting for the GPU and then the CPU to read it
+struct ReadbackSlot
+{
+	explicit ReadbackSlot(const VDevice& device)
+		: buffer{ device }
+		, memory{ device }
+		, fence{ device }
+		, encoding(new std::atomic<bool>(false))
+	{}
+
+	VBuffer buffer;
+	VDeviceMemory memory;
+	VFence fence; // signaled when the copy completes
+	void* mapped = nullptr; // persistently
+	VkCommandBuffer command_buffer = VK_NULL_HANDLE; // recorded for the image of each capture
+	bool pending = false; // copy submitted but not handed to the encoder yet
+	std::unique_ptr<std::atomic<bool>> encoding; // an encoder worker still reads mapped, cleared from its thread
+	uint64_t frame = 0;
+	VkExtent2D extent = {};
+};
 
-struct UniformBufferObject
+struct CullingStats
 {
-	glm::mat4 model;
-	glm::mat4 view;
-	glm::mat4 proj;
+	uint32_t drawn_objects = 0;
+	uint32_t culled_objects = 0; // including occluded ones
+	uint32_t occluded_objects = 0;
 };
 
 struct QueueFamilyIndices
@@ -80,23 +106,32 @@ struct QueueFamilyIndices
 	int graphicsFamily = -1;
 	int presentFamily = -1;
 
-	bool isComplete()
+	// without a surface to present to only the graphics family is needed
+	bool isComplete(bool need_present = true)
 	{
-		return graphicsFamily >= 0 && presentFamily >= 0;
+		return graphicsFamily >= 0 && (presentFamily >= 0 || !need_present);
 	}
 
+	// surface may be VK_NULL_HANDLE in headless mode, presentFamily stays -1 then
 	static QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
 };
 
 class VulkanShowBase
 {
 public:
-	VulkanShowBase();
+	VulkanShowBase(const AppOptions& options = AppOptions());
 	void run();
 
+	// culling result of the last completed frame
+	CullingStats getCullingStats() const;
+	// GPU times and resolution scales of recent frames, empty without dynamic resolution
+	std::vector<DynamicResolution::Sample> getResolutionHistory() const;
+
 	static void onWindowResized(GLFWwindow* window, int width, int height);
+	static void onKeyPressed(GLFWwindow* window, int key, int scancode, int action, int mods);
+	static void onMouseButton(GLFWwindow* window, int button, int action, int mods);
 
-	static void DestroyDebugReportCallbackEXT(VkInstance instance
+	static void VKAPI_CALL DestroyDebugReportCallbackEXT(VkInstance instance
 		, VkDebugReportCallbackEXT callback
 		, const VkAllocationCallbacks* pAllocator);
 
@@ -106,76 +141,261 @@ public:
 		, VkDebugReportCallbackEXT* pCallback);
 
 private:
+	AppOptions options;
+
 	GLFWwindow* window;
 
-	VDeleter<VkInstance> instance{ vkDestroyInstance };
-	VDeleter<VkDebugReportCallbackEXT> callback{ instance, DestroyDebugReportCallbackEXT };
+	VInstance instance;
+	VHandle<VkInstance, VkDebugReportCallbackEXT, DestroyDebugReportCallbackEXT> callback{ instance };
 	VkPhysicalDevice physical_device;
+	DeviceCapabilities device_capabilities; // of physical_device, enabled filled by createLogicalDevice
 
-	VDeleter<VkDevice> graphics_device{ vkDestroyDevice }; //logical device
+	VDevice graphics_device; //logical device
 	VkQueue graphics_queue;
 
-	VDeleter<VkSurfaceKHR> window_surface{ instance, vkDestroySurfaceKHR };
+	VSurface window_surface{ instance };
 	VkQueue present_queue;
 
-	VDeleter<VkSwapchainKHR> swap_chain{ graphics_device, vkDestroySwapchainKHR };
+	VSwapchain swap_chain{ graphics_device };
 	std::vector<VkImage> swap_chain_images;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
-	std::vector<VDeleter<VkImageView>> swap_chain_imageviews;
-	std::vector<VDeleter<VkFramebuffer>> swap_chain_framebuffers;
-	VDeleter<VkRenderPass> render_pass{ graphics_device, vkDestroyRenderPass };
-
-	VDeleter<VkDescriptorSetLayout> descriptor_set_layout{ graphics_device, vkDestroyDescriptorSetLayout };
-	VDeleter<VkPipelineLayout> pipeline_layout{ graphics_device, vkDestroyPipelineLayout };
-	VDeleter<VkPipeline> graphics_pipeline{ graphics_device, vkDestroyPipeline };
+	std::vector<VImageView> swap_chain_imageviews;
+	// headless mode renders into these instead, swap_chain_images holds their handles
+	std::vector<VImage> offscreen_images;
+	std::vector<VDeviceMemory> offscreen_image_memory;
+	// signaled when the last frame rendering to the image of the same index completes, every frame waits for
+	// the one of its image before it touches anything of that image: its uniforms, queries and command buffer
+	std::vector<VFence> frame_fences;
+	uint32_t next_offscreen_image = 0;
+	const uint32_t OFFSCREEN_IMAGE_COUNT = 2;
+	std::vector<VFramebuffer> swap_chain_framebuffers;
+	VRenderPass render_pass{ graphics_device };
+	// how render_pass and late_render_pass use their attachments, which are in the framebuffers in this order
+	RenderPassBuilder render_pass_builder;
+	RenderPassBuilder late_render_pass_builder;
+	const uint32_t COLOR_ATTACHMENT = 0;
+	const uint32_t DEPTH_ATTACHMENT = 1;
+
+	VDescriptorSetLayout descriptor_set_layout{ graphics_device };
+	uint32_t scene_layout_index = 0; // of descriptor_set_layout in descriptor_allocator
+	VPipelineLayout pipeline_layout{ graphics_device };
+	VPipeline graphics_pipeline{ graphics_device };
+
+	// depth pre-pass, both pipelines share pipeline_layout
+	VPipeline depth_prepass_pipeline{ graphics_device }; // positions only, no color writes
+	VPipeline depth_equal_pipeline{ graphics_device }; // graphics_pipeline with an EQUAL test and no depth writes
+	bool depth_prepass_enabled = false;
 
 	// Command buffers
-	VDeleter<VkCommandPool> command_pool{ graphics_device, vkDestroyCommandPool };
+	VCommandPool command_pool{ graphics_device };
 	std::vector<VkCommandBuffer> command_buffers; // buffers will be released when pool destroyed
-
-	VDeleter<VkSemaphore> image_available_semaphore{ graphics_device, vkDestroySemaphore };
-	VDeleter<VkSemaphore> render_finished_semaphore{ graphics_device, vkDestroySemaphore };
+	// With enough per object draws they are recorded by jobs into secondary command buffers,
+	// split into a chunk per job system thread with a pool each, since pools aren't thread safe.
+	// Both passes of a chunk come from its pool, so a single job records them one after the other.
+	// draw_command_buffers[(image * 2 + pass) * chunks + chunk], pass 0 is the depth pre-pass.
+	std::vector<VCommandPool> draw_command_pools;
+	std::vector<VkCommandBuffer> draw_command_buffers;
+	const size_t PARALLEL_DRAW_THRESHOLD = 2048;
+
+	// Every descriptor set comes from it, declared before deferred_destruction, which frees the sets
+	// that are not used anymore back to its pools.
+	std::unique_ptr<DescriptorAllocator> descriptor_allocator;
+	bool descriptor_update_templates = false; // VK_KHR_descriptor_update_template is enabled
+
+	// Replaced objects wait in it for the frames that used them. Declared after the device and
+	// command_pool, whose objects it destroys when it drains.
+	std::unique_ptr<DeferredDestruction> deferred_destruction;
+
+	// One more acquire semaphore than images. Acquiring signals a free one, which the submit of that image
+	// waits on, and the one the image's previous submit waited on is free again once its fence has signaled.
+	std::vector<VSemaphore> acquire_semaphores;
+	std::vector<VkSemaphore> free_acquire_semaphores;
+	std::vector<VkSemaphore> image_acquire_semaphores; // per image, waited on by its last submit
+	// per image, presenting waits on it; acquiring the image again means the present is done with it
+	std::vector<VSemaphore> render_finished_semaphores;
 
 	// only one image buffer for depth because only one draw operation happens at one time
-	VDeleter<VkImage> depth_image{ graphics_device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> depth_image_memory{ graphics_device, vkFreeMemory };
-	VDeleter<VkImageView> depth_image_view{ graphics_device, vkDestroyImageView };
+	VImage depth_image{ graphics_device };
+	VDeviceMemory depth_image_memory{ graphics_device };
+	VImageView depth_image_view{ graphics_device };
+	bool depth_image_lazily_allocated = false;
 
 	// texture image
-	VDeleter<VkImage> texture_image{ graphics_device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> texture_image_memory{ graphics_device, vkFreeMemory };
-	VDeleter<VkImageView> texture_image_view{ graphics_device, vkDestroyImageView };
-	VDeleter<VkSampler> texture_sampler{ graphics_device, vkDestroySampler };
+	VImage texture_image{ graphics_device };
+	VDeviceMemory texture_image_memory{ graphics_device };
+	VImageView texture_image_view{ graphics_device };
+	VSampler texture_sampler{ graphics_device };
 
 	// vertex buffer
-	VDeleter<VkBuffer> vertex_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> vertex_buffer_memory{ graphics_device, vkFreeMemory };
-	VDeleter<VkBuffer> index_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> index_buffer_memory{ graphics_device, vkFreeMemory };
+	VBuffer vertex_buffer{ graphics_device };
+	VDeviceMemory vertex_buffer_memory{ graphics_device };
+	VBuffer position_buffer{ graphics_device }; // just the positions of vertices, for the depth pre-pass
+	VDeviceMemory position_buffer_memory{ graphics_device };
+	VBuffer index_buffer{ graphics_device };
+	VDeviceMemory index_buffer_memory{ graphics_device };
 
 	// uniform buffer and descriptor
-	VDeleter<VkBuffer> uniform_staging_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniform_staging_buffer_memory{ graphics_device, vkFreeMemory };
-	VDeleter<VkBuffer> uniform_buffer{ graphics_device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniform_buffer_memory{ graphics_device, vkFreeMemory };
+	VBuffer uniform_buffer{ graphics_device };
+	VDeviceMemory uniform_buffer_memory{ graphics_device };
+	// per image, host visible and mapped, copied into the uniform buffers at the start of its command buffer
+	std::vector<VBuffer> frame_uniform_buffers;
+	std::vector<VDeviceMemory> frame_uniform_memory;
+	std::vector<FrameUniforms*> mapped_frame_uniforms;
 
-	VDeleter<VkDescriptorPool> descriptor_pool{ graphics_device, vkDestroyDescriptorPool };
 	VkDescriptorSet descriptor_set;
 
+	// scene objects
+	VBuffer object_buffer{ graphics_device };
+	VDeviceMemory object_buffer_memory{ graphics_device };
+	VBuffer visible_object_buffer{ graphics_device };
+	VDeviceMemory visible_object_buffer_memory{ graphics_device };
+
+	// gpu culling, only created with options.gpu_culling
+	VBuffer draw_command_buffer{ graphics_device };
+	VDeviceMemory draw_command_buffer_memory{ graphics_device };
+	VBuffer culling_uniform_buffer{ graphics_device }; // copied from the frame's FrameUniforms
+	VDeviceMemory culling_uniform_buffer_memory{ graphics_device };
+	VBuffer culling_stats_buffer{ graphics_device }; // host visible copy of the draw command
+	VDeviceMemory culling_stats_buffer_memory{ graphics_device };
+	CullingDrawCommands* mapped_culling_stats = nullptr;
+	VDescriptorSetLayout culling_descriptor_set_layout{ graphics_device };
+	uint32_t culling_layout_index = 0;
+	VPipelineLayout culling_pipeline_layout{ graphics_device };
+	VPipeline culling_pipeline{ graphics_device }; // occlusion_cull.comp with occlusion culling
+	VkDescriptorSet culling_descriptor_set;
+
+	// occlusion culling, only created with options.occlusion_culling
+	VRenderPass late_render_pass{ graphics_device }; // continues render_pass after the late culling phase
+	VBuffer late_visible_object_buffer{ graphics_device };
+	VDeviceMemory late_visible_object_buffer_memory{ graphics_device };
+	VBuffer object_visibility_buffer{ graphics_device }; // visibility in the previous frame
+	VDeviceMemory object_visibility_buffer_memory{ graphics_device };
+	VkDescriptorSet late_descriptor_set; // like descriptor_set, but with the late visible list
+	VDescriptorSetLayout depth_pyramid_descriptor_set_layout{ graphics_device };
+	VDescriptorSetLayout depth_reduce_descriptor_set_layout{ graphics_device };
+	uint32_t depth_pyramid_layout_index = 0;
+	uint32_t depth_reduce_layout_index = 0;
+	VPipelineLayout depth_reduce_pipeline_layout{ graphics_device };
+	VPipeline depth_reduce_pipeline{ graphics_device };
+	VPipelineLayout depth_pyramid_debug_pipeline_layout{ graphics_device };
+	VPipeline depth_pyramid_debug_pipeline{ graphics_device };
+	VSampler depth_pyramid_sampler{ graphics_device };
+
+	// depth pyramid, sized after the depth attachment and recreated with it
+	VImage depth_pyramid{ graphics_device };
+	VDeviceMemory depth_pyramid_memory{ graphics_device };
+	VImageView depth_pyramid_view{ graphics_device }; // every level, for sampling
+	std::vector<VImageView> depth_pyramid_level_views; // a level each, for writing
+	std::vector<VkDescriptorSet> depth_reduce_descriptor_sets; // one per level
+	VkDescriptorSet depth_pyramid_descriptor_set;
+	VkExtent2D depth_pyramid_extent;
+	uint32_t depth_pyramid_level_count = 0;
+	int debug_pyramid_level = -1; // level shown instead of the scene, -1 for none
+	const uint32_t DEPTH_REDUCE_WORKGROUP_SIZE = 8; // local_size_x and y in depth_reduce.comp
+
+	// dynamic resolution, only with options.gpu_time_target_ms > 0.
+	// The scene renders into the top left render_extent of an offscreen target
+	// of swap chain size, which is then blitted to the swap chain image.
+	std::unique_ptr<DynamicResolution> dynamic_resolution;
+	VImage scene_color_image{ graphics_device };
+	VDeviceMemory scene_color_image_memory{ graphics_device };
+	VImageView scene_color_image_view{ graphics_device };
+	VkFilter upscale_filter = VK_FILTER_LINEAR;
+	VQueryPool frame_timestamp_pool{ graphics_device }; // start and end of the frame, a pair per image
+	float timestamp_period = 1.0f; // nanoseconds per tick
+	uint64_t timestamp_mask = ~0ull; // of the valid bits
+	std::vector<bool> frame_timestamps_written; // per image, a frame has been submitted since the pool was created
+	// per image, recorded at the old render extent, recorded again when the image is rendered to next
+	std::vector<bool> outdated_command_buffers;
+	VkExtent2D render_extent; // swap_chain_extent without dynamic resolution
+
+	// per pass GPU timings, only with options.gpu_profile. Profiler pool i belongs to command_buffers[i].
+	std::unique_ptr<GpuProfiler> gpu_profiler;
+	struct ProfiledPasses
+	{
+		uint32_t upload, culling, scene, depth_pyramid, late_culling, late_scene, blit;
+	} profiled_passes;
+	std::vector<int64_t> profiled_frames; // per image, the frame its pool was last submitted in, -1 for none
+
+	// frame pacing
+	PresentPolicy present_policy;
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR; // picked from present_policy
+	FrameLimiter frame_limiter;
+	FramePacingStats pacing_stats;
+	ResizeCoalescer resize_coalescer; // the swap chain is recreated after a frame is presented, when it is due
+	FramePacingStats resize_sweep_stats; // frames of options.resize_sweep_frames
+
+	// frame capture, only with options.capture_path. Frames are copied into
+	// the ring and the slot's memory is handed to frame_encoder once its fence
+	// is signaled, a frame is dropped when the next slot is still pending or encoding.
+	std::vector<ReadbackSlot> readback_ring;
+	std::unique_ptr<FrameEncoder> frame_encoder; // after the ring, so it finishes reading before the ring goes
+	uint32_t readback_next = 0; // oldest slot, the next one to be used
+	bool readback_coherent = true; // otherwise HOST_CACHED without HOST_COHERENT, needs invalidating
+	uint64_t readback_dropped_frames = 0;
+	const uint32_t READBACK_RING_SIZE = 3;
+
+	// cpu culling, only used with options.cpu_culling
+	std::unique_ptr<CpuCuller> cpu_culler;
+	SphereBoundsSoA object_bounds; // same spheres as in scene_objects
+	std::vector<uint32_t> visible_objects; // survivors of the current frame
+	Frustum view_frustum; // in scene space, updated with the uniform buffer
+	glm::mat4 view_proj; // from scene space, updated with the uniform buffer
+
+	// over object_bounds and refit with them, picking goes through it and CPU culling with options.bvh_culling
+	std::unique_ptr<Bvh> object_bvh;
+	std::vector<uint32_t> moved_objects; // scratch of writeObjectData
+
 
 	const int WINDOW_WIDTH = 1920;
 	const int WINDOW_HEIGHT = 1080;
 	const bool WINDOW_RESIZABLE = true;
+	// the resize sweep shrinks the window by up to RESIZE_SWEEP_RANGE pixels and back, a step a frame
+	const int RESIZE_SWEEP_START = 60;
+	const int RESIZE_SWEEP_STEP = 8;
+	const int RESIZE_SWEEP_RANGE = 640;
 
 	const std::string MODEL_PATH = "content/chalet.obj";
 	const std::string TEXTURE_PATH = "content/chalet.jpg";
 
+	// from construction to the first frame, printed once it is presented
+	StartupTimeline startup_timeline;
+	// options.asset_archive mapped, assets it doesn't have are read from loose files
+	std::unique_ptr<AssetArchive> asset_archive;
+	// loose files being read for the loading jobs
+	std::future<void> asset_reads;
+	// Decoded and parsed by jobs from the start of run(). Their uploads are main thread jobs
+	// queued after them, which initVulkan runs between its steps once the device exists.
+	JobCounter texture_load;
+	JobCounter model_load;
+	JobCounter asset_uploads;
+	LoadedImage loaded_texture;
+	LoadedModel loaded_model;
+	std::exception_ptr texture_error; // rethrown by the upload
+	std::exception_ptr model_error;
+
+	// loading, culling, scene updates and draw recording, created first thing in run();
+	// declared after what its jobs use, so that they finish before it is destroyed
+	std::unique_ptr<JobSystem> job_system;
+
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> vertex_indices;
+	glm::vec4 model_bounding_sphere; // of the loaded model in model space
+
+	// a root for the grid with a node per object below it, its world transforms are the
+	// model matrices of scene_objects
+	std::unique_ptr<SceneGraph> scene_graph;
+	std::vector<SceneGraph::NodeId> object_nodes;
+	std::vector<ObjectData> scene_objects;
+	const float OBJECT_SPACING = 2.5f; // in bounding sphere radii
+	float scene_half_extent = 0.0f; // of the object grid, including the models' bounds
+	const uint32_t CULLING_WORKGROUP_SIZE = 64; // local_size_x in cull.comp
 
 	float total_time_past = 0.0f;
 	int total_frames = 0;
+	std::chrono::steady_clock::time_point animation_start_time; // animation runs on wall clock time outside benchmarks
+	FrameTimings frame_timings; // of the frame in flight, filled by mainLoop and drawFrame
 
 	//const std::vector<Vertex> vertices = {
 	//	{ { -0.5f, -0.5f, 0.0f }, { 1.0f, 0.0f, 0.0f }, {0.0f, 0.0f} },
@@ -209,10 +429,33 @@ private:
 	};
 
 	void initWindow();
+	void openAssetArchive();
+	// from the archive when it has the path, otherwise the loose file
+	AssetBytes readAsset(const std::string& path) const;
+	// the archive's entries are read by the thread getting them, loose files in a batch of
+	// asynchronous reads on a thread of its own
+	std::vector<std::future<AssetBytes>> readAssetsAsync(const std::vector<std::string>& paths);
+	// queues the texture and model loading jobs and their uploads, with options.serial_init
+	// everything runs on the main thread once initVulkan gets to the uploads
+	void startAssetLoading();
 	void initVulkan();
+	// uploads the assets whose loading is done, waits for all of them with wait
+	void uploadLoadedAssets(bool wait);
+	// busy share of every job system thread since the first frame, and how many jobs ran
+	void printJobStats() const;
 	void mainLoop();
+	void writeBenchmarkResults(const BenchmarkRecorder& benchmark) const;
+	// to options.trace_path, everything recorded so far
+	void writeTrace() const;
 
 	void recreateSwapChain();
+	// What recreateSwapChain creates again goes to deferred_destruction. The pipelines take the
+	// viewport dynamically, so they and the render passes only follow a change of the format.
+	void retireSwapChainResources(bool format_changed);
+	// the primary command buffers and the pools of the secondary ones, before they are created again
+	void retireCommandBuffers();
+	// resizes the window for a frame of options.resize_sweep_frames, false outside of the sweep
+	bool stepResizeSweep();
 
 	void createInstance();
 	void setupDebugCallback();
@@ -220,60 +463,136 @@ private:
 	void pickPhysicalDevice();
 	void createLogicalDevice();
 	void createSwapChain();
+	void createOffscreenTargets();
+	void createFrameFences();
+	void createReadbackRing();
 	void createSwapChainImageViews();
 	void createRenderPass();
 	void createDescriptorSetLayout();
 	void createGraphicsPipeline();
 	void createCommandPool();
 	void createDepthResources();
+	void createSceneColorResources();
+	// An image for an attachment of the scene passes, transient and in lazily allocated memory
+	// where there is some when no pass loads or stores it. Returns whether the memory is lazily allocated.
+	bool createAttachmentImage(uint32_t attachment, VkFormat format, VkImageUsageFlags usage
+		, VkImage* p_vkimage, VkDeviceMemory* p_image_memory);
+	// attachment memory and the load/store traffic of the scene passes, at the current extent
+	void printAttachmentReport();
+	// timestamp_period and timestamp_mask, throws without timestamps on the graphics queue
+	void queryTimestampProperties();
+	void createFrameTimestampPool();
+	void createGpuProfiler();
 	void createFrameBuffers();
 	void createTextureImage();
 	void createTextureImageView();
 	void createTextureSampler();
 	void loadModel();
+	void createSceneObjects();
+	// world transforms and bounds of the objects the last scene graph update changed
+	void writeObjectData(const std::vector<SceneGraph::NodeId>& updated_nodes);
+	// prints the object whose bounding sphere is under the cursor
+	void pickObject();
 	void createVertexBuffer();
 	void createIndexBuffer();
 	void createUniformBuffer();
-	void createDescriptorPool();
+	// FrameUniforms of each image
+	void createFrameUniformBuffers();
+	void createObjectBuffers();
+	void createCullingResources();
+	void createCullingPipeline();
+	void createOcclusionCullingResources();
+	void createDepthPyramid();
+	void createDepthPyramidDebugPipeline();
+	// the sets are cached by descriptor_allocator, asking again after a rebuild keeps them
 	void createDescriptorSet();
+	VkDescriptorSet getSceneDescriptorSet(VkBuffer visible_objects);
+	void createCullingDescriptorSet();
 	void createCommandBuffers();
+	void recordCommandBuffer(uint32_t image_index);
+	void recordScenePass(VkCommandBuffer command_buffer, uint32_t image_index, VkRenderPass pass
+		, VkDescriptorSet scene_descriptor_set, VkDeviceSize draw_command_offset);
+	// viewport, scissor, index buffer and descriptor set of the scene passes
+	void bindSceneState(VkCommandBuffer command_buffer, VkDescriptorSet scene_descriptor_set);
+	// the depth pre-pass or the shading pipeline and its vertex buffer
+	void bindScenePipeline(VkCommandBuffer command_buffer, bool depth_only);
+	void recordSceneDraws(VkCommandBuffer command_buffer, VkDeviceSize draw_command_offset);
+	// per object draws, of the visible objects with cpu culling
+	size_t getObjectDrawCount() const;
+	void recordObjectDraws(VkCommandBuffer command_buffer, size_t begin, size_t end);
+	// records the object draws of the scene pass into the image's secondary command buffers
+	// in parallel and executes them, inside a render pass begun with secondary contents
+	void recordParallelSceneDraws(VkCommandBuffer command_buffer, uint32_t image_index, VkRenderPass pass
+		, VkDescriptorSet scene_descriptor_set);
 	void createSemaphores();
 
-	void updateUniformBuffer();
-	void drawFrame();
-
-	void createShaderModule(const std::vector<char>& code, VkShaderModule* p_shader_module);
+	// into the image's FrameUniforms, after its fence has signaled
+	void updateUniformBuffer(uint32_t image_index);
+	// from the timestamps of the image's last frame
+	void updateRenderScale(uint32_t image_index);
+	// the profiler queries of the image's last frame, after its fence has signaled
+	void collectProfiledFrame(uint32_t image_index);
+	void updateRenderExtent();
+	// waits for the image's fence, false when the swap chain had to be recreated instead
+	bool acquireFrame(uint32_t* p_image_index);
+	void drawFrame(uint32_t image_index);
+	// records a copy of the image into the next readback slot, -1 when it is still pending
+	int beginCapture(uint32_t image_index);
+	// hands the completed slots to frame_encoder in frame order, without waiting
+	void collectCaptures();
+
+	void createShaderModule(const AssetBytes& code, VkShaderModule* p_shader_module);
 	
 	bool checkValidationLayerSupport();
 	std::vector<const char*> getRequiredExtensions();
 	bool isDeviceSuitable(VkPhysicalDevice device);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+	// DEVICE_EXTENSIONS, or none in headless mode
+	std::vector<const char*> getDeviceExtensions() const;
+	// what the scene is left in for presenting, or for reading back in headless mode
+	VkImageLayout getPresentLayout() const;
 	
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& available_formats);
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& available_present_modes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
+	inline static bool hasStencilComponent(VkFormat format)
+	{
+		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+	}
 	inline VkFormat findDepthFormat()
 	{
+		VkFormatFeatureFlags features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		if (options.occlusion_culling)
+		{
+			// the depth pyramid is built from it
+			features |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+		}
 		return findSupportedFormat(
 			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }
 			, VK_IMAGE_TILING_OPTIMAL
-			, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+			, features
 			);
 	}
 
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits
 		, VkBuffer* p_buffer, VkDeviceMemory* p_buffer_memory);
+	// creates a device local buffer and fills it through a staging buffer
+	void createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage
+		, VkBuffer* p_buffer, VkDeviceMemory* p_buffer_memory);
 	void copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
 
-	void createImage(uint32_t image_width, uint32_t image_height
+	// VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT in memory_properties is dropped when no memory type has it,
+	// returns the properties the memory was allocated with
+	VkMemoryPropertyFlags createImage(uint32_t image_width, uint32_t image_height
 		, VkFormat format, VkImageTiling tiling
 		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties
-		, VkImage* p_vkimage, VkDeviceMemory* p_image_memory);
+		, VkImage* p_vkimage, VkDeviceMemory* p_image_memory
+		, uint32_t mip_levels = 1);
 	void copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
-	void transitImageLayout(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView * p_image_view);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView * p_image_view
+		, uint32_t base_mip_level = 0, uint32_t mip_level_count = 1);
 
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
@@ -282,5 +601,21 @@ private:
 	void recordCopyBuffer(VkCommandBuffer command_buffer, VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
 	void recordCopyImage(VkCommandBuffer command_buffer, VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
 	void recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
+	void recordCulling(VkCommandBuffer command_buffer);
+	void recordOcclusionCulling(VkCommandBuffer command_buffer, uint32_t late_phase);
+	void recordBlitToSwapChain(VkCommandBuffer command_buffer, uint32_t image_index);
+	void recordDepthPyramid(VkCommandBuffer command_buffer);
+	void recordImageBarrier(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect_mask
+		, VkImageLayout old_layout, VkImageLayout new_layout
+		, VkPipelineStageFlags src_stage, VkAccessFlags src_access
+		, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access
+		, uint32_t base_mip_level = 0, uint32_t mip_level_count = VK_REMAINING_MIP_LEVELS);
+	void recordCullingStatsCopy(VkCommandBuffer command_buffer);
+	// no-ops without gpu_profiler
+	void recordProfilerBegin(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass);
+	void recordProfilerEnd(VkCommandBuffer command_buffer, uint32_t pool, uint32_t pass);
+	void recordBufferBarrier(VkCommandBuffer command_buffer, VkBuffer buffer
+		, VkPipelineStageFlags src_stage, VkAccessFlags src_access
+		, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
 };
 
@@ -0,0 +1,200 @@
+// Microbenchmark of BVH builds, refits, frustum and ray queries against linear scans, needs no Vulkan device.
+// usage: bvh_benchmark [largest object count]
+
+#include "Bvh.h"
+#include "CpuCulling.h"
+#include "JobSystem.h"
+#include "Measure.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const size_t RAY_COUNT = 1000;
+	// rays checked against every object, up to this many objects
+	const size_t CHECKED_RAY_COUNT = 20;
+	const size_t CHECKED_OBJECT_LIMIT = 1000000;
+
+	// spheres spread through a cube at the same density for every count
+	void randomSpheres(size_t count, float half_extent, std::mt19937& rng, SphereBoundsSoA& spheres)
+	{
+		std::uniform_real_distribution<float> position(-half_extent, half_extent);
+		std::uniform_real_distribution<float> radius(0.5f, 1.5f);
+		spheres.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			spheres.set(i, glm::vec4(position(rng), position(rng), position(rng), radius(rng)));
+		}
+	}
+
+	void boxesOfSpheres(const SphereBoundsSoA& spheres, BoxBoundsSoA& boxes)
+	{
+		boxes.resize(spheres.size());
+		for (size_t i = 0; i < spheres.size(); i++)
+		{
+			glm::vec3 center = { spheres.center_x[i], spheres.center_y[i], spheres.center_z[i] };
+			glm::vec3 radius(spheres.radius[i]);
+			boxes.set(i, center - radius, center + radius);
+		}
+	}
+
+	// brute force nearest sphere hit, the same math as the BVH's
+	bool nearestSphere(const SphereBoundsSoA& spheres, const glm::vec3& origin, const glm::vec3& direction, float max_distance
+		, BvhRayHit& hit)
+	{
+		bool found = false;
+		float a = glm::dot(direction, direction);
+		for (size_t i = 0; i < spheres.size(); i++)
+		{
+			glm::vec3 offset = origin - glm::vec3(spheres.center_x[i], spheres.center_y[i], spheres.center_z[i]);
+			float b = glm::dot(offset, direction);
+			float c = glm::dot(offset, offset) - spheres.radius[i] * spheres.radius[i];
+			float discriminant = b * b - a * c;
+			if (c <= 0.0f || b > 0.0f || discriminant < 0.0f)
+			{
+				continue; // the rays start outside every sphere
+			}
+			float distance = (-b - std::sqrt(discriminant)) / a;
+			if (distance <= max_distance && (!found || distance < hit.distance))
+			{
+				hit = { (uint32_t)i, distance };
+				found = true;
+			}
+		}
+		return found;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_count = argc > 1 ? (size_t)std::stoull(argv[1]) : 10000000;
+
+	unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1 };
+	if (hardware_threads > 1)
+	{
+		thread_counts.push_back(hardware_threads);
+	}
+
+	printf("%-9s %7s %10s %6s %5s %10s %12s %10s %10s %10s %9s\n", "objects", "threads", "build (ms)", "sah", "depth"
+		, "refit (ms)", "refit 1% (us)", "cull (us)", "scan (us)", "visible", "ray (ns)");
+	for (size_t count = 10000; count <= max_count; count *= 10)
+	{
+		std::mt19937 rng(42);
+		float half_extent = 2.0f * std::cbrt((float)count);
+		SphereBoundsSoA spheres;
+		randomSpheres(count, half_extent, rng, spheres);
+		BoxBoundsSoA boxes;
+		boxesOfSpheres(spheres, boxes);
+
+		// from a corner of the cube towards its center, seeing about a tenth of it
+		glm::vec3 eye(-half_extent);
+		glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, half_extent);
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+
+		// a percent of the objects move a little every refit
+		std::vector<uint32_t> moved_objects;
+		for (size_t i = 0; i < count; i += 100)
+		{
+			moved_objects.push_back((uint32_t)i);
+		}
+		SphereBoundsSoA moved_spheres = spheres;
+
+		// rays from outside the cube through random points in it
+		std::uniform_real_distribution<float> position(-half_extent, half_extent);
+		std::vector<glm::vec3> ray_origins(RAY_COUNT);
+		std::vector<glm::vec3> ray_directions(RAY_COUNT);
+		for (size_t i = 0; i < RAY_COUNT; i++)
+		{
+			glm::vec3 target(position(rng), position(rng), position(rng));
+			ray_origins[i] = glm::vec3(position(rng), position(rng), 2.0f * half_extent);
+			ray_directions[i] = target - ray_origins[i];
+		}
+
+		int runs = count >= 1000000 ? 3 : 11;
+		for (unsigned threads : thread_counts)
+		{
+			std::unique_ptr<JobSystem> jobs(threads > 1 ? new JobSystem(threads - 1) : nullptr);
+			Bvh bvh(jobs.get());
+			double build_time = measure([&]() { bvh.build(spheres); }, runs, 1);
+
+			int frame = 0;
+			double refit_time = measure([&]()
+			{
+				moved_spheres.center_z[frame++ % count] += 0.01f;
+				bvh.refit(moved_spheres);
+			}, runs, 1);
+			double partial_refit_time = measure([&]()
+			{
+				for (uint32_t object : moved_objects)
+				{
+					moved_spheres.center_x[object] += 0.01f;
+				}
+				bvh.refit(moved_spheres, moved_objects);
+			}, runs, 1);
+			// back where the other queries expect the objects
+			bvh.refit(spheres);
+
+			std::vector<uint32_t> visible;
+			double cull_time = measure([&]() { bvh.cull(frustum, visible); }, 11, 1);
+			CpuCuller culler(detectSimdLevel(), jobs.get());
+			std::vector<uint32_t> scanned;
+			double scan_time = measure([&]() { culler.cullBoxes(frustum, boxes, scanned); }, 11, 1);
+			// the same box test, the BVH only skips what is outside or inside as a whole
+			std::sort(visible.begin(), visible.end());
+			if (visible != scanned)
+			{
+				printf("%-9zu %7u culling results differ from the scan: %zu against %zu visible\n", count, threads
+					, visible.size(), scanned.size());
+				return 1;
+			}
+
+			std::vector<BvhRayHit> hits(RAY_COUNT);
+			size_t hit_count = 0;
+			double ray_time = measure([&]()
+			{
+				hit_count = 0;
+				for (size_t i = 0; i < RAY_COUNT; i++)
+				{
+					hit_count += bvh.intersectRay(ray_origins[i], ray_directions[i], 1.0f, spheres, hits[i]);
+				}
+			}, 11, 1);
+			if (count <= CHECKED_OBJECT_LIMIT)
+			{
+				for (size_t i = 0; i < CHECKED_RAY_COUNT; i++)
+				{
+					BvhRayHit expected;
+					BvhRayHit hit;
+					bool found = nearestSphere(spheres, ray_origins[i], ray_directions[i], 1.0f, expected);
+					if (bvh.intersectRay(ray_origins[i], ray_directions[i], 1.0f, spheres, hit) != found
+						|| (found && hit.distance != expected.distance))
+					{
+						printf("%-9zu %7u ray %zu differs from the scan\n", count, threads, i);
+						return 1;
+					}
+				}
+			}
+
+			printf("%-9zu %7u %10.1f %6.1f %5u %10.2f %12.1f %10.1f %10.1f %10zu %9.1f\n", count, threads
+				, build_time / 1e6, bvh.getSahCost(), bvh.getDepth(), refit_time / 1e6, partial_refit_time / 1000.0
+				, cull_time / 1000.0, scan_time / 1000.0, visible.size(), ray_time / RAY_COUNT);
+			if (hit_count == 0)
+			{
+				printf("%-9zu %7u no ray hit anything\n", count, threads);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,307 @@
+// Microbenchmarks of the CPU side asset and math hot paths, needs no Vulkan device.
+// usage: cpu_benchmark [--content <folder>] [--runs <n>] [--filter <text>] [--json <file>]
+
+#include "AssetLoading.h"
+#include "Benchmark.h"
+#include "Camera.h"
+#include "VDeleter.h"
+#include "VHandle.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// consumed results, so that the measured work can't be optimized away
+	volatile size_t sink = 0;
+	volatile size_t destroyed_handles = 0;
+
+	// the destroy functions of the handle holders, they count instead of calling into a driver
+	void VKAPI_CALL destroyDevice(VkDevice, const VkAllocationCallbacks*)
+	{
+	}
+
+	void VKAPI_CALL destroySemaphore(VkDevice, VkSemaphore, const VkAllocationCallbacks*)
+	{
+		destroyed_handles = destroyed_handles + 1;
+	}
+
+	using BenchmarkDevice = VRootHandle<VkDevice, destroyDevice>;
+	using BenchmarkSemaphore = VHandle<VkDevice, VkSemaphore, destroySemaphore>;
+
+	// a std::function to a lambda holding another std::function and the parent against the handle and a parent pointer
+	static_assert(sizeof(BenchmarkDevice) < sizeof(VDeleter<VkDevice>), "VRootHandle is larger than VDeleter");
+	static_assert(sizeof(BenchmarkSemaphore) < sizeof(VDeleter<VkSemaphore>), "VHandle is larger than VDeleter");
+	static_assert(sizeof(BenchmarkSemaphore) == sizeof(VSemaphore), "the destroy function changes the size");
+
+	// holders a swapchain recreation or a growing vector goes through
+	const size_t HANDLE_VECTOR_SIZE = 64;
+
+	struct Settings
+	{
+		std::string content_folder = "content";
+		int runs = 0; // 0 takes the default of each benchmark
+		std::string filter;
+		std::string json_path;
+	};
+
+	struct Result
+	{
+		std::string name;
+		size_t iterations = 0; // per run
+		int runs = 0;
+		// nanoseconds per iteration
+		double min = 0.0;
+		double mean = 0.0;
+		double p50 = 0.0;
+		double p90 = 0.0;
+		double max = 0.0;
+		double stddev = 0.0;
+	};
+
+	// Runs are timed as a whole and divided by the iterations in them, so that
+	// short operations are not lost in the clock's resolution. Warm-up runs
+	// fill the caches and let the allocator settle first.
+	Result measure(const std::string& name, size_t iterations, int warmup_runs, int runs
+		, const std::function<void()>& iteration)
+	{
+		for (int i = 0; i < warmup_runs; i++)
+		{
+			for (size_t j = 0; j < iterations; j++)
+			{
+				iteration();
+			}
+		}
+
+		std::vector<double> times;
+		for (int i = 0; i < runs; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (size_t j = 0; j < iterations; j++)
+			{
+				iteration();
+			}
+			auto end = std::chrono::steady_clock::now();
+			times.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / iterations);
+		}
+
+		Result result;
+		result.name = name;
+		result.iterations = iterations;
+		result.runs = runs;
+		result.min = *std::min_element(times.begin(), times.end());
+		result.max = *std::max_element(times.begin(), times.end());
+		result.mean = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+		result.p50 = percentile(times, 0.50);
+		result.p90 = percentile(times, 0.90);
+		double variance = 0.0;
+		for (double time : times)
+		{
+			variance += (time - result.mean) * (time - result.mean);
+		}
+		result.stddev = std::sqrt(variance / times.size());
+		return result;
+	}
+
+	void printResult(const Result& result)
+	{
+		printf("%-32s %10zu %5d %14.1f %14.1f %14.1f %8.2f\n", result.name.c_str(), result.iterations, result.runs
+			, result.p50, result.min, result.p90, result.mean > 0.0 ? result.stddev / result.mean * 100.0 : 0.0);
+	}
+
+	void writeJson(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			throw std::runtime_error("Failed to open " + path + " for the results");
+		}
+		out.precision(9);
+		out << "{" << std::endl
+			<< "  \"unit\": \"ns_per_iteration\"," << std::endl
+			<< "  \"benchmarks\": [";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const auto& r = results[i];
+			out << (i == 0 ? "" : ",") << std::endl
+				<< "    { \"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"runs\": " << r.runs
+				<< ", \"min\": " << r.min << ", \"mean\": " << r.mean << ", \"p50\": " << r.p50
+				<< ", \"p90\": " << r.p90 << ", \"max\": " << r.max << ", \"stddev\": " << r.stddev << " }";
+		}
+		out << std::endl << "  ]" << std::endl
+			<< "}" << std::endl;
+	}
+
+	Settings parseSettings(int argc, char** argv)
+	{
+		Settings settings;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string value = argv[++i];
+			if (arg == "--content")
+			{
+				settings.content_folder = value;
+			}
+			else if (arg == "--runs")
+			{
+				settings.runs = std::stoi(value);
+			}
+			else if (arg == "--filter")
+			{
+				settings.filter = value;
+			}
+			else if (arg == "--json")
+			{
+				settings.json_path = value;
+			}
+			else
+			{
+				throw std::runtime_error("Unknown option " + arg);
+			}
+		}
+		return settings;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		Settings settings = parseSettings(argc, argv);
+		std::string model_path = settings.content_folder + "/chalet.obj";
+		std::string texture_path = settings.content_folder + "/chalet.jpg";
+
+		std::vector<Result> results;
+		auto run = [&](const std::string& name, size_t iterations, int default_runs, const std::function<void()>& iteration)
+		{
+			if (name.find(settings.filter) == std::string::npos)
+			{
+				return;
+			}
+			int runs = settings.runs > 0 ? settings.runs : default_runs;
+			results.push_back(measure(name, iterations, 1, runs, iteration));
+			printResult(results.back());
+		};
+
+		printf("%-32s %10s %5s %14s %14s %14s %8s\n", "benchmark", "iterations", "runs", "p50 ns/iter", "min ns/iter"
+			, "p90 ns/iter", "cv %");
+
+		// assets, a handful of runs as each one takes a while
+		run("readFile chalet.obj", 1, 9, [&]() { sink += readFile(model_path).size(); });
+
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		run("parseObj chalet.obj", 1, 5, [&]()
+		{
+			attrib = tinyobj::attrib_t();
+			shapes.clear();
+			parseObj(model_path, attrib, shapes);
+			sink += attrib.vertices.size();
+		});
+		if (shapes.empty())
+		{
+			parseObj(model_path, attrib, shapes); // filtered out above, still needed for the dedup
+		}
+		run("buildIndexedModel dedup", 1, 5, [&]() { sink += buildIndexedModel(attrib, shapes).vertices.size(); });
+
+		run("stbi_load chalet.jpg", 1, 5, [&]()
+		{
+			int width, height, channels;
+			stbi_uc* pixels = stbi_load(texture_path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+			if (!pixels)
+			{
+				throw std::runtime_error("Failed to load " + texture_path);
+			}
+			sink += (size_t)width * height;
+			stbi_image_free(pixels);
+		});
+
+		// per frame math
+		CameraSetup camera_setup;
+		camera_setup.aspect = 16.0f / 9.0f;
+		camera_setup.model_bounding_sphere = glm::vec4(0.0f, 0.0f, 0.5f, 1.0f);
+		camera_setup.object_spacing = 2.5f;
+		camera_setup.scene_half_extent = 50.0f;
+		for (auto path : { CameraPath::ORBIT, CameraPath::GRAZING, CameraPath::FLYTHROUGH })
+		{
+			camera_setup.path = path;
+			float time = 0.0f;
+			run(std::string("computeCameraMatrices ") + cameraPathName(path), 100000, 21, [&]()
+			{
+				time += 1.0f / 60.0f;
+				sink += (size_t)computeCameraMatrices(camera_setup, time).proj[1][1];
+			});
+		}
+
+		// handle holders, the deleters count instead of calling into a driver
+		printf("sizeof VDeleter<VkDevice> %zu, VRootHandle %zu, VDeleter<VkSemaphore> %zu, VHandle %zu\n"
+			, sizeof(VDeleter<VkDevice>), sizeof(BenchmarkDevice), sizeof(VDeleter<VkSemaphore>), sizeof(BenchmarkSemaphore));
+		auto destroy_semaphore = [](VkSemaphore, const VkAllocationCallbacks*) { destroyed_handles = destroyed_handles + 1; };
+		run("VDeleter<VkSemaphore> plain", 100000, 21, [&]()
+		{
+			VDeleter<VkSemaphore> semaphore{ destroy_semaphore };
+			*&semaphore = (VkSemaphore)(uintptr_t)1;
+		});
+		VDeleter<VkDevice> device{ [](VkDevice, const VkAllocationCallbacks*) {} };
+		auto destroy_device_semaphore = [](VkDevice, VkSemaphore, const VkAllocationCallbacks*) { destroyed_handles = destroyed_handles + 1; };
+		run("VDeleter<VkSemaphore> device", 100000, 21, [&]()
+		{
+			VDeleter<VkSemaphore> semaphore{ device, destroy_device_semaphore };
+			*&semaphore = (VkSemaphore)(uintptr_t)1;
+		});
+		BenchmarkDevice fixed_device;
+		run("VHandle<VkSemaphore> device", 100000, 21, [&]()
+		{
+			BenchmarkSemaphore semaphore{ fixed_device };
+			*&semaphore = (VkSemaphore)(uintptr_t)1;
+		});
+
+		// emplacing without a reserve, so that the vector moves the holders as it grows
+		run("VDeleter<VkSemaphore> vector", 1000, 21, [&]()
+		{
+			std::vector<VDeleter<VkSemaphore>> semaphores;
+			for (size_t i = 0; i < HANDLE_VECTOR_SIZE; i++)
+			{
+				semaphores.emplace_back(device, destroy_device_semaphore);
+				*&semaphores.back() = (VkSemaphore)(uintptr_t)(i + 1);
+			}
+		});
+		run("VHandle<VkSemaphore> vector", 1000, 21, [&]()
+		{
+			std::vector<BenchmarkSemaphore> semaphores;
+			for (size_t i = 0; i < HANDLE_VECTOR_SIZE; i++)
+			{
+				semaphores.emplace_back(fixed_device);
+				*&semaphores.back() = (VkSemaphore)(uintptr_t)(i + 1);
+			}
+		});
+
+		if (!settings.json_path.empty())
+		{
+			writeJson(settings.json_path, results);
+			printf("Results written to %s\n", settings.json_path.c_str());
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+// Microbenchmark of the CPU frustum culling kernels, needs no Vulkan device.
+// usage: culling_benchmark [object count]
+
+#include "CpuCulling.h"
+#include "JobSystem.h"
+#include "Measure.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+	size_t object_count = argc > 1 ? (size_t)std::stoull(argv[1]) : 1000000;
+
+	// objects scattered in a cube around a camera looking at the origin,
+	// with a bit over a third of them visible
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+	SphereBoundsSoA spheres;
+	BoxBoundsSoA boxes;
+	spheres.resize(object_count);
+	boxes.resize(object_count);
+	for (size_t i = 0; i < object_count; i++)
+	{
+		glm::vec3 center = { position(rng), position(rng), position(rng) };
+		float radius = size(rng);
+		spheres.set(i, glm::vec4(center, radius));
+		boxes.set(i, center - glm::vec3(radius), center + glm::vec3(radius));
+	}
+
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, -60.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	Frustum frustum = Frustum::fromMatrix(proj * view);
+
+	unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1 };
+	if (hardware_threads > 1)
+	{
+		thread_counts.push_back(hardware_threads);
+	}
+
+	printf("%zu objects\n", object_count);
+	printf("%-8s %-7s %8s %10s %12s %10s\n", "bounds", "simd", "threads", "visible", "time (us)", "obj/ns");
+
+	std::vector<uint32_t> visible;
+	for (auto level : { SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2 })
+	{
+		if (!isSimdLevelSupported(level))
+		{
+			printf("%-8s %-7s not supported\n", "-", simdLevelName(level));
+			continue;
+		}
+
+		for (unsigned threads : thread_counts)
+		{
+			// the calling thread is one of the threads
+			std::unique_ptr<JobSystem> jobs(threads > 1 ? new JobSystem(threads - 1) : nullptr);
+			CpuCuller culler(level, jobs.get());
+
+			double sphere_ns = measure([&]() { culler.cullSpheres(frustum, spheres, visible); });
+			printf("%-8s %-7s %8u %10zu %12.1f %10.3f\n", "sphere", simdLevelName(level), threads
+				, visible.size(), sphere_ns / 1000.0, object_count / sphere_ns);
+
+			double box_ns = measure([&]() { culler.cullBoxes(frustum, boxes, visible); });
+			printf("%-8s %-7s %8u %10zu %12.1f %10.3f\n", "aabb", simdLevelName(level), threads
+				, visible.size(), box_ns / 1000.0, object_count / box_ns);
+		}
+	}
+
+	return 0;
+}
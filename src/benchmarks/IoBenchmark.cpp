@@ -0,0 +1,294 @@
+// Reads a batch of files the way asset loading used to (readFile, one after the other) and with
+// AsyncFileReader's backends, with the page cache warm and dropped before every run.
+// usage: io_benchmark [--runs <n>] [--json <file>] [files...]
+
+#include "AssetLoading.h"
+#include "AsyncFileReader.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct Settings
+	{
+		int runs = 15;
+		std::string json_path;
+		std::vector<std::string> files;
+	};
+
+	struct Result
+	{
+		std::string name;
+		int runs = 0;
+		// wall time of a batch in milliseconds
+		double min = 0.0;
+		double mean = 0.0;
+		double p50 = 0.0;
+		double p90 = 0.0;
+		double max = 0.0;
+		double stddev = 0.0;
+		double cpu_ms = 0.0; // mean user and system time of the whole process per batch
+		double mb_per_s = 0.0; // at p50
+	};
+
+	// user and system time of every thread of the process
+	double processCpuMs()
+	{
+#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+		auto ms = [](const FILETIME& time) { return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 1e4; };
+		return ms(kernel) + ms(user);
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		auto ms = [](const timeval& time) { return time.tv_sec * 1e3 + time.tv_usec / 1e3; };
+		return ms(usage.ru_utime) + ms(usage.ru_stime);
+#endif
+	}
+
+	// false where the page cache can't be dropped for a file
+	bool dropFromPageCache(const std::string& path)
+	{
+#ifdef _WIN32
+		(void)path;
+		return false;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return false;
+		}
+		// only drops clean pages, which is all a file that is only read has
+		bool dropped = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(file);
+		return dropped;
+#endif
+	}
+
+	Result measure(const std::string& name, const Settings& settings, bool cold, uint64_t batch_bytes
+		, const std::function<void()>& batch)
+	{
+		batch(); // warm-up, and the cache for warm runs
+		std::vector<double> times;
+		double cpu_ms = 0.0;
+		for (int i = 0; i < settings.runs; i++)
+		{
+			if (cold)
+			{
+				for (const auto& file : settings.files)
+				{
+					dropFromPageCache(file);
+				}
+			}
+			double cpu_start = processCpuMs();
+			auto start = std::chrono::steady_clock::now();
+			batch();
+			auto end = std::chrono::steady_clock::now();
+			cpu_ms += processCpuMs() - cpu_start;
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		Result result;
+		result.name = name;
+		result.runs = settings.runs;
+		result.min = *std::min_element(times.begin(), times.end());
+		result.max = *std::max_element(times.begin(), times.end());
+		result.mean = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+		result.p50 = percentile(times, 0.50);
+		result.p90 = percentile(times, 0.90);
+		double variance = 0.0;
+		for (double time : times)
+		{
+			variance += (time - result.mean) * (time - result.mean);
+		}
+		result.stddev = std::sqrt(variance / times.size());
+		result.cpu_ms = cpu_ms / settings.runs;
+		result.mb_per_s = result.p50 > 0.0 ? batch_bytes / 1e6 / (result.p50 / 1e3) : 0.0;
+		return result;
+	}
+
+	void printResult(const Result& result)
+	{
+		printf("%-28s %5d %10.3f %10.3f %10.3f %10.3f %10.1f\n", result.name.c_str(), result.runs
+			, result.p50, result.min, result.p90, result.cpu_ms, result.mb_per_s);
+	}
+
+	void writeJson(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			throw std::runtime_error("Failed to open " + path + " for the results");
+		}
+		out.precision(9);
+		out << "{" << std::endl
+			<< "  \"unit\": \"ms_per_batch\"," << std::endl
+			<< "  \"benchmarks\": [";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const auto& r = results[i];
+			out << (i == 0 ? "" : ",") << std::endl
+				<< "    { \"name\": \"" << r.name << "\", \"iterations\": 1, \"runs\": " << r.runs
+				<< ", \"min\": " << r.min << ", \"mean\": " << r.mean << ", \"p50\": " << r.p50
+				<< ", \"p90\": " << r.p90 << ", \"max\": " << r.max << ", \"stddev\": " << r.stddev
+				<< ", \"cpu_ms\": " << r.cpu_ms << ", \"mb_per_s\": " << r.mb_per_s << " }";
+		}
+		out << std::endl << "  ]" << std::endl
+			<< "}" << std::endl;
+	}
+
+	Settings parseSettings(int argc, char** argv)
+	{
+		Settings settings;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--runs" || arg == "--json")
+			{
+				if (i + 1 >= argc)
+				{
+					throw std::runtime_error("Missing value for " + arg);
+				}
+				std::string value = argv[++i];
+				if (arg == "--runs")
+				{
+					settings.runs = std::max(1, std::stoi(value));
+				}
+				else
+				{
+					settings.json_path = value;
+				}
+			}
+			else
+			{
+				settings.files.push_back(arg);
+			}
+		}
+		if (settings.files.empty())
+		{
+			settings.files = { "content/chalet.obj", "content/chalet.jpg" };
+		}
+		return settings;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		Settings settings = parseSettings(argc, argv);
+
+		// every file of the batch lands at its own offset of one block, like a staging buffer
+		std::vector<uint64_t> offsets;
+		uint64_t batch_bytes = 0;
+		for (const auto& file : settings.files)
+		{
+			offsets.push_back(batch_bytes);
+			batch_bytes += AsyncFileReader::getFileSize(file);
+		}
+		std::vector<char> destination(std::max<uint64_t>(batch_bytes, 1));
+		memset(destination.data(), 0, destination.size());
+
+		size_t failed_reads = 0;
+		auto read_batch = [&](AsyncFileReader& reader)
+		{
+			for (size_t i = 0; i < settings.files.size(); i++)
+			{
+				uint64_t size = (i + 1 < offsets.size() ? offsets[i + 1] : batch_bytes) - offsets[i];
+				reader.read(settings.files[i], destination.data() + offsets[i], (size_t)size, [&](const FileReadResult& result)
+				{
+					if (!result.error.empty())
+					{
+						failed_reads++;
+					}
+				});
+			}
+			reader.wait();
+		};
+
+		AsyncFileReader pool_reader(false);
+		AsyncFileReader uring_reader(true);
+		AsyncFileReader registered_reader(true);
+		registered_reader.registerMemory(destination.data(), destination.size());
+		bool has_io_uring = uring_reader.getBackend() == FileReadBackend::IO_URING;
+		bool can_drop_cache = dropFromPageCache(settings.files[0]);
+
+		printf("%zu files, %.2f MB, io_uring %s\n", settings.files.size(), batch_bytes / 1e6
+			, has_io_uring ? "available" : "unavailable, skipped");
+		if (!can_drop_cache)
+		{
+			printf("The page cache can't be dropped here, cold runs skipped\n");
+		}
+		printf("%-28s %5s %10s %10s %10s %10s %10s\n", "benchmark", "runs", "p50 ms", "min ms", "p90 ms", "cpu ms", "MB/s");
+
+		std::vector<Result> results;
+		for (bool cold : { false, true })
+		{
+			if (cold && !can_drop_cache)
+			{
+				continue;
+			}
+			std::string cache = cold ? " cold" : " warm";
+			results.push_back(measure("ifstream readFile" + cache, settings, cold, batch_bytes, [&]()
+			{
+				for (size_t i = 0; i < settings.files.size(); i++)
+				{
+					auto data = readFile(settings.files[i]);
+					memcpy(destination.data() + offsets[i], data.data(), data.size());
+				}
+			}));
+			printResult(results.back());
+			results.push_back(measure("pread pool" + cache, settings, cold, batch_bytes, [&]() { read_batch(pool_reader); }));
+			printResult(results.back());
+			if (has_io_uring)
+			{
+				results.push_back(measure("io_uring" + cache, settings, cold, batch_bytes, [&]() { read_batch(uring_reader); }));
+				printResult(results.back());
+				results.push_back(measure("io_uring registered" + cache, settings, cold, batch_bytes
+					, [&]() { read_batch(registered_reader); }));
+				printResult(results.back());
+			}
+		}
+		if (failed_reads > 0)
+		{
+			throw std::runtime_error(std::to_string(failed_reads) + " reads failed");
+		}
+
+		if (!settings.json_path.empty())
+		{
+			writeJson(settings.json_path, results);
+			printf("Results written to %s\n", settings.json_path.c_str());
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+// Microbenchmark of the job system against a thread and a std::async per task, needs no Vulkan device.
+// usage: job_benchmark [job count]
+
+#include "JobSystem.h"
+#include "Measure.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// threads and std::async are far slower to start, they get fewer tasks
+	const size_t THREAD_TASK_COUNT = 1000;
+	const size_t CHAIN_LENGTH = 1000;
+	const size_t PARALLEL_ITEMS = 1 << 22;
+
+	void printRow(const char* test, const char* scheduler, unsigned threads, size_t tasks, double time)
+	{
+		printf("%-14s %-10s %8u %10zu %12.1f %10.1f\n", test, scheduler, threads, tasks, time / 1000.0, time / tasks);
+	}
+
+	// a few hundred nanoseconds of work the compiler can't drop
+	float work(size_t i)
+	{
+		float x = (float)i;
+		for (int k = 0; k < 32; k++)
+		{
+			x = std::sqrt(x * x + 1.0f);
+		}
+		return x;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t job_count = argc > 1 ? (size_t)std::stoull(argv[1]) : 100000;
+
+	unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1 };
+	if (hardware_threads > 1)
+	{
+		thread_counts.push_back(hardware_threads);
+	}
+
+	printf("%-14s %-10s %8s %10s %12s %10s\n", "test", "scheduler", "threads", "tasks", "time (us)", "ns/task");
+	std::atomic<size_t> sink{ 0 };
+
+	// what a new thread or a std::async call costs, once
+	double thread_time = measure([&]()
+	{
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < THREAD_TASK_COUNT; i++)
+		{
+			threads.emplace_back([&sink]() { sink.fetch_add(1, std::memory_order_relaxed); });
+			if (threads.size() == hardware_threads)
+			{
+				for (auto& thread : threads)
+				{
+					thread.join();
+				}
+				threads.clear();
+			}
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	});
+	printRow("empty", "thread", hardware_threads, THREAD_TASK_COUNT, thread_time);
+	double async_time = measure([&]()
+	{
+		std::vector<std::future<void>> futures;
+		for (size_t i = 0; i < THREAD_TASK_COUNT; i++)
+		{
+			futures.push_back(std::async(std::launch::async, [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }));
+		}
+		for (auto& future : futures)
+		{
+			future.get();
+		}
+	});
+	printRow("empty", "async", hardware_threads, THREAD_TASK_COUNT, async_time);
+
+	for (unsigned threads : thread_counts)
+	{
+		// the main thread is one of the threads
+		JobSystem jobs(threads - 1);
+
+		// queuing, running and waiting for jobs that do nothing
+		double empty_time = measure([&]()
+		{
+			JobCounter counter;
+			for (size_t i = 0; i < job_count; i++)
+			{
+				jobs.run("empty", [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &counter);
+			}
+			jobs.wait(counter);
+		});
+		printRow("empty", "jobs", threads, job_count, empty_time);
+
+		// jobs queuing jobs, so that workers steal from each other rather than from the main thread
+		size_t fanout = (size_t)std::sqrt((double)job_count);
+		double nested_time = measure([&]()
+		{
+			JobCounter counter;
+			for (size_t i = 0; i < fanout; i++)
+			{
+				jobs.run("spawn", [&jobs, &sink, &counter, fanout]()
+				{
+					for (size_t k = 0; k < fanout; k++)
+					{
+						jobs.run("empty", [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &counter);
+					}
+				}, &counter);
+			}
+			jobs.wait(counter);
+		});
+		printRow("nested", "jobs", threads, fanout * fanout + fanout, nested_time);
+
+		// every job waits for the one before it through runAfter, latency rather than throughput
+		std::unique_ptr<JobCounter[]> chain(new JobCounter[CHAIN_LENGTH]);
+		double chain_time = measure([&]()
+		{
+			jobs.run("link", [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &chain[0]);
+			for (size_t i = 1; i < CHAIN_LENGTH; i++)
+			{
+				jobs.runAfter(chain[i - 1], "link", [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &chain[i]);
+			}
+			for (size_t i = 0; i < CHAIN_LENGTH; i++)
+			{
+				jobs.wait(chain[i]);
+			}
+		});
+		printRow("chain", "jobs", threads, CHAIN_LENGTH, chain_time);
+
+		// items of a few hundred nanoseconds, batched by parallelFor
+		std::vector<float> results(PARALLEL_ITEMS);
+		double parallel_time = measure([&]()
+		{
+			jobs.parallelFor("items", 0, PARALLEL_ITEMS, 1024, [&results](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					results[i] = work(i);
+				}
+			});
+		});
+		printRow("parallelFor", "jobs", threads, PARALLEL_ITEMS, parallel_time);
+
+		// allocated jobs are the ones queued past a full ring, the empty test queues more than it holds
+		uint64_t stolen = 0;
+		uint64_t allocated = 0;
+		for (const auto& thread : jobs.getStats())
+		{
+			stolen += thread.stolen;
+			allocated += thread.allocated;
+		}
+		printf("%-14s %-10s %8u %10llu stolen, %llu allocated\n", "", "jobs", threads
+			, (unsigned long long)stolen, (unsigned long long)allocated);
+	}
+
+	// the same items on threads of their own, a chunk each
+	for (unsigned threads : thread_counts)
+	{
+		std::vector<float> results(PARALLEL_ITEMS);
+		double parallel_time = measure([&]()
+		{
+			size_t chunk_size = (PARALLEL_ITEMS + threads - 1) / threads;
+			std::vector<std::thread> workers;
+			for (unsigned t = 0; t < threads; t++)
+			{
+				workers.emplace_back([&results, t, chunk_size]()
+				{
+					size_t end = std::min(PARALLEL_ITEMS, (t + 1) * chunk_size);
+					for (size_t i = t * chunk_size; i < end; i++)
+					{
+						results[i] = work(i);
+					}
+				});
+			}
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+		});
+		printRow("parallelFor", "thread", threads, PARALLEL_ITEMS, parallel_time);
+	}
+	return sink.load() > 0 ? 0 : 1;
+}
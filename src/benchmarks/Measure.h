@@ -0,0 +1,28 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Timing shared by the microbenchmarks that need no Vulkan device.
+
+// median nanoseconds of a run, after warmup_runs runs that are not timed
+template <typename Function>
+double measure(Function run, int runs = 21, int warmup_runs = 3)
+{
+	for (int i = 0; i < warmup_runs; i++)
+	{
+		run();
+	}
+
+	std::vector<double> times;
+	for (int i = 0; i < runs; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		times.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
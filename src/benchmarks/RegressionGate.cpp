@@ -0,0 +1,704 @@
+// Compares benchmark results against a stored baseline and fails on regressions.
+// Reads the JSON of cpu_benchmark and of vulkan_helloworld --benchmark.
+// usage: regression_gate <baseline.json> <current.json> [--thresholds <file>]
+//        [--default-threshold <fraction>] [--alpha <p>] [--rebaseline] [--skip-without-baseline]
+// Exits with 0 when nothing regressed, 1 on regressions and 2 on errors.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	// just enough JSON for the files the benchmarks write
+	struct JsonValue
+	{
+		enum Type { NULL_VALUE, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NULL_VALUE;
+		bool boolean = false;
+		double number = 0.0;
+		std::string string;
+		std::vector<JsonValue> array;
+		std::vector<std::pair<std::string, JsonValue>> object; // in file order
+
+		const JsonValue* find(const std::string& key) const
+		{
+			for (const auto& member : object)
+			{
+				if (member.first == key)
+				{
+					return &member.second;
+				}
+			}
+			return nullptr;
+		}
+	};
+
+	class JsonParser
+	{
+	public:
+		explicit JsonParser(const std::string& text) : text(text) {}
+
+		JsonValue parse()
+		{
+			JsonValue value = parseValue();
+			skipSpace();
+			if (position != text.size())
+			{
+				fail("trailing characters");
+			}
+			return value;
+		}
+
+	private:
+		const std::string& text;
+		size_t position = 0;
+
+		void fail(const std::string& what) const
+		{
+			throw std::runtime_error("JSON " + what + " at offset " + std::to_string(position));
+		}
+
+		void skipSpace()
+		{
+			while (position < text.size() && std::isspace((unsigned char)text[position]))
+			{
+				position++;
+			}
+		}
+
+		void expect(char c)
+		{
+			skipSpace();
+			if (position >= text.size() || text[position] != c)
+			{
+				fail(std::string("expected '") + c + "'");
+			}
+			position++;
+		}
+
+		bool consume(const char* literal)
+		{
+			size_t length = strlen(literal);
+			if (text.compare(position, length, literal) == 0)
+			{
+				position += length;
+				return true;
+			}
+			return false;
+		}
+
+		bool consumeComma()
+		{
+			skipSpace();
+			if (position < text.size() && text[position] == ',')
+			{
+				position++;
+				return true;
+			}
+			return false;
+		}
+
+		std::string parseString()
+		{
+			expect('"');
+			std::string result;
+			while (position < text.size() && text[position] != '"')
+			{
+				char c = text[position++];
+				if (c == '\\' && position < text.size())
+				{
+					char escaped = text[position++];
+					switch (escaped)
+					{
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'r': c = '\r'; break;
+					case 'u': position += 4; c = '?'; break; // not written by the benchmarks
+					default: c = escaped; break;
+					}
+				}
+				result += c;
+			}
+			expect('"');
+			return result;
+		}
+
+		JsonValue parseValue()
+		{
+			skipSpace();
+			if (position >= text.size())
+			{
+				fail("unexpected end");
+			}
+			JsonValue value;
+			char c = text[position];
+			if (c == '{')
+			{
+				value.type = JsonValue::OBJECT;
+				position++;
+				skipSpace();
+				if (text[position] == '}')
+				{
+					position++;
+					return value;
+				}
+				while (true)
+				{
+					std::string key = parseString();
+					expect(':');
+					value.object.emplace_back(key, parseValue());
+					if (!consumeComma())
+					{
+						break;
+					}
+				}
+				expect('}');
+			}
+			else if (c == '[')
+			{
+				value.type = JsonValue::ARRAY;
+				position++;
+				skipSpace();
+				if (text[position] == ']')
+				{
+					position++;
+					return value;
+				}
+				while (true)
+				{
+					value.array.push_back(parseValue());
+					if (!consumeComma())
+					{
+						break;
+					}
+				}
+				expect(']');
+			}
+			else if (c == '"')
+			{
+				value.type = JsonValue::STRING;
+				value.string = parseString();
+			}
+			else if (consume("true"))
+			{
+				value.type = JsonValue::BOOL;
+				value.boolean = true;
+			}
+			else if (consume("false"))
+			{
+				value.type = JsonValue::BOOL;
+			}
+			else if (consume("null"))
+			{
+				value.type = JsonValue::NULL_VALUE;
+			}
+			else
+			{
+				const char* start = text.c_str() + position;
+				char* end = nullptr;
+				value.type = JsonValue::NUMBER;
+				value.number = strtod(start, &end);
+				if (end == start)
+				{
+					fail("unexpected character");
+				}
+				position += end - start;
+			}
+			return value;
+		}
+	};
+
+	std::string readText(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			throw std::runtime_error("Failed to open " + path);
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		return stream.str();
+	}
+
+	// a lower is better value, with the spread of the samples behind it when known
+	struct Metric
+	{
+		double value = 0.0;
+		double stddev = -1.0; // of the samples, negative when unknown
+		double count = 0.0; // samples
+	};
+
+	struct Results
+	{
+		std::map<std::string, Metric> metrics;
+		std::vector<std::pair<std::string, std::string>> context; // what was measured, should match
+	};
+
+	std::string contextValue(const JsonValue& value)
+	{
+		switch (value.type)
+		{
+		case JsonValue::STRING: return value.string;
+		case JsonValue::BOOL: return value.boolean ? "true" : "false";
+		case JsonValue::NUMBER:
+		{
+			std::ostringstream stream;
+			stream << value.number;
+			return stream.str();
+		}
+		default: return "";
+		}
+	}
+
+	// name.statistic for each number in the summaries of a section, mean gets the stddev and count
+	void addSummaries(Results& results, const JsonValue& section, const std::string& prefix, double count)
+	{
+		for (const auto& summary : section.object)
+		{
+			const JsonValue* stddev = summary.second.find("stddev");
+			for (const auto& statistic : summary.second.object)
+			{
+				if (statistic.second.type != JsonValue::NUMBER || statistic.first == "stddev")
+				{
+					continue;
+				}
+				Metric metric;
+				metric.value = statistic.second.number;
+				if (statistic.first == "mean" && stddev)
+				{
+					metric.stddev = stddev->number;
+					metric.count = count;
+				}
+				results.metrics[prefix + summary.first + "." + statistic.first] = metric;
+			}
+		}
+	}
+
+	Results extractResults(const JsonValue& root)
+	{
+		Results results;
+		if (const JsonValue* benchmarks = root.find("benchmarks"))
+		{
+			// cpu_benchmark
+			for (const auto& benchmark : benchmarks->array)
+			{
+				const JsonValue* name = benchmark.find("name");
+				const JsonValue* runs = benchmark.find("runs");
+				const JsonValue* stddev = benchmark.find("stddev");
+				if (!name)
+				{
+					continue;
+				}
+				for (const char* statistic : { "mean", "p50", "p90", "min", "max" })
+				{
+					const JsonValue* value = benchmark.find(statistic);
+					if (!value)
+					{
+						continue;
+					}
+					Metric metric;
+					metric.value = value->number;
+					if (std::string(statistic) == "mean" && stddev && runs)
+					{
+						metric.stddev = stddev->number;
+						metric.count = runs->number;
+					}
+					results.metrics[name->string + "." + statistic] = metric;
+				}
+			}
+		}
+		else if (const JsonValue* cpu_frame = root.find("cpu_frame_ms"))
+		{
+			// vulkan_helloworld --benchmark
+			const JsonValue* frames = root.find("frames");
+			double count = frames ? frames->number : 0.0;
+			addSummaries(results, *cpu_frame, "cpu_frame_ms.", count);
+			if (const JsonValue* gpu_passes = root.find("gpu_pass_ms"))
+			{
+				addSummaries(results, *gpu_passes, "gpu_pass_ms.", count);
+			}
+			if (const JsonValue* startup = root.find("startup_ms"))
+			{
+				// a single sample each, compared against the threshold only
+				for (const auto& milestone : startup->object)
+				{
+					Metric metric;
+					metric.value = milestone.second.number;
+					results.metrics["startup_ms." + milestone.first] = metric;
+				}
+			}
+			for (const auto& member : root.object)
+			{
+				if (member.first == "settings")
+				{
+					for (const auto& setting : member.second.object)
+					{
+						results.context.emplace_back(setting.first, contextValue(setting.second));
+					}
+				}
+				else if (member.second.type != JsonValue::OBJECT && member.second.type != JsonValue::ARRAY)
+				{
+					results.context.emplace_back(member.first, contextValue(member.second));
+				}
+			}
+		}
+		else
+		{
+			throw std::runtime_error("Neither cpu_benchmark nor frame benchmark results");
+		}
+		return results;
+	}
+
+	Results loadResults(const std::string& path)
+	{
+		try
+		{
+			return extractResults(JsonParser(readText(path)).parse());
+		}
+		catch (const std::runtime_error& e)
+		{
+			throw std::runtime_error(path + ": " + e.what());
+		}
+	}
+
+	// '*' matches any run of characters, '?' any single one
+	bool globMatch(const char* pattern, const char* text)
+	{
+		if (*pattern == '\0')
+		{
+			return *text == '\0';
+		}
+		if (*pattern == '*')
+		{
+			return globMatch(pattern + 1, text) || (*text != '\0' && globMatch(pattern, text + 1));
+		}
+		return *text != '\0' && (*pattern == '?' || *pattern == *text) && globMatch(pattern + 1, text + 1);
+	}
+
+	// the largest relative increase let through, NaN for ignored metrics
+	struct Threshold
+	{
+		std::string pattern;
+		double max_increase;
+	};
+
+	// lines of "<pattern> <fraction, percentage or ignore>", the first matching line applies
+	std::vector<Threshold> loadThresholds(const std::string& path)
+	{
+		std::vector<Threshold> thresholds;
+		std::istringstream lines(readText(path));
+		std::string line;
+		int line_number = 0;
+		while (std::getline(lines, line))
+		{
+			line_number++;
+			line = line.substr(0, line.find('#'));
+			std::istringstream fields(line);
+			std::string pattern, value;
+			if (!(fields >> pattern))
+			{
+				continue;
+			}
+			if (!(fields >> value))
+			{
+				throw std::runtime_error(path + ":" + std::to_string(line_number) + ": missing threshold");
+			}
+			Threshold threshold;
+			threshold.pattern = pattern;
+			if (value == "ignore")
+			{
+				threshold.max_increase = std::numeric_limits<double>::quiet_NaN();
+			}
+			else if (value.back() == '%')
+			{
+				threshold.max_increase = std::stod(value.substr(0, value.size() - 1)) / 100.0;
+			}
+			else
+			{
+				threshold.max_increase = std::stod(value);
+			}
+			thresholds.push_back(threshold);
+		}
+		return thresholds;
+	}
+
+	// continued fraction of the regularized incomplete beta function, as in Numerical Recipes
+	double betaContinuedFraction(double a, double b, double x)
+	{
+		const double TINY = 1e-300;
+		double c = 1.0;
+		double d = 1.0 - (a + b) * x / (a + 1.0);
+		d = std::fabs(d) < TINY ? TINY : d;
+		d = 1.0 / d;
+		double h = d;
+		for (int m = 1; m <= 200; m++)
+		{
+			double aa = m * (b - m) * x / ((a + 2.0 * m - 1.0) * (a + 2.0 * m));
+			d = 1.0 + aa * d;
+			d = std::fabs(d) < TINY ? TINY : d;
+			c = 1.0 + aa / c;
+			c = std::fabs(c) < TINY ? TINY : c;
+			d = 1.0 / d;
+			h *= d * c;
+			aa = -(a + m) * (a + b + m) * x / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+			d = 1.0 + aa * d;
+			d = std::fabs(d) < TINY ? TINY : d;
+			c = 1.0 + aa / c;
+			c = std::fabs(c) < TINY ? TINY : c;
+			d = 1.0 / d;
+			double delta = d * c;
+			h *= delta;
+			if (std::fabs(delta - 1.0) < 1e-12)
+			{
+				break;
+			}
+		}
+		return h;
+	}
+
+	double incompleteBeta(double a, double b, double x)
+	{
+		if (x <= 0.0 || x >= 1.0)
+		{
+			return x <= 0.0 ? 0.0 : 1.0;
+		}
+		double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b)
+			+ a * std::log(x) + b * std::log(1.0 - x));
+		if (x < (a + 1.0) / (a + b + 2.0))
+		{
+			return front * betaContinuedFraction(a, b, x) / a;
+		}
+		return 1.0 - front * betaContinuedFraction(b, a, 1.0 - x) / b;
+	}
+
+	// One sided p-value of Welch's t-test that current's mean is above baseline's.
+	// The summaries hold population standard deviations, they are corrected to sample ones.
+	double welchPValue(const Metric& baseline, const Metric& current)
+	{
+		double n1 = baseline.count, n2 = current.count;
+		double v1 = baseline.stddev * baseline.stddev * n1 / (n1 - 1.0) / n1;
+		double v2 = current.stddev * current.stddev * n2 / (n2 - 1.0) / n2;
+		double difference = current.value - baseline.value;
+		if (v1 + v2 == 0.0)
+		{
+			return difference > 0.0 ? 0.0 : 1.0;
+		}
+		double t = difference / std::sqrt(v1 + v2);
+		double df = (v1 + v2) * (v1 + v2) / (v1 * v1 / (n1 - 1.0) + v2 * v2 / (n2 - 1.0));
+		double tail = 0.5 * incompleteBeta(df / 2.0, 0.5, df / (df + t * t));
+		return t > 0.0 ? tail : 1.0 - tail;
+	}
+
+	struct Settings
+	{
+		std::string baseline_path;
+		std::string current_path;
+		std::string thresholds_path;
+		double default_threshold = 0.05;
+		double alpha = 0.01;
+		bool rebaseline = false;
+		bool skip_without_baseline = false; // exit with 0 when there is no baseline yet
+	};
+
+	Settings parseSettings(int argc, char** argv)
+	{
+		Settings settings;
+		std::vector<std::string> paths;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			auto next_value = [&]()
+			{
+				if (i + 1 >= argc)
+				{
+					throw std::runtime_error("Missing value for " + arg);
+				}
+				return std::string(argv[++i]);
+			};
+			if (arg == "--thresholds")
+			{
+				settings.thresholds_path = next_value();
+			}
+			else if (arg == "--default-threshold")
+			{
+				settings.default_threshold = std::stod(next_value());
+			}
+			else if (arg == "--alpha")
+			{
+				settings.alpha = std::stod(next_value());
+			}
+			else if (arg == "--rebaseline")
+			{
+				settings.rebaseline = true;
+			}
+			else if (arg == "--skip-without-baseline")
+			{
+				settings.skip_without_baseline = true;
+			}
+			else if (arg.compare(0, 2, "--") == 0)
+			{
+				throw std::runtime_error("Unknown option " + arg);
+			}
+			else
+			{
+				paths.push_back(arg);
+			}
+		}
+		if (paths.size() != 2)
+		{
+			throw std::runtime_error("usage: regression_gate <baseline.json> <current.json> [--thresholds <file>]"
+				" [--default-threshold <fraction>] [--alpha <p>] [--rebaseline] [--skip-without-baseline]");
+		}
+		settings.baseline_path = paths[0];
+		settings.current_path = paths[1];
+		return settings;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		Settings settings = parseSettings(argc, argv);
+		Results current = loadResults(settings.current_path);
+
+		if (settings.rebaseline)
+		{
+			// after an intended change: the current results become the baseline
+			std::ofstream baseline(settings.baseline_path, std::ios::binary);
+			if (!baseline)
+			{
+				throw std::runtime_error("Failed to open " + settings.baseline_path + " for writing");
+			}
+			baseline << readText(settings.current_path);
+			printf("Baseline %s replaced by %s, %zu metrics\n", settings.baseline_path.c_str()
+				, settings.current_path.c_str(), current.metrics.size());
+			return EXIT_SUCCESS;
+		}
+
+		if (!std::ifstream(settings.baseline_path))
+		{
+			// an error unless asked for, a gate without a baseline would pass every regression
+			fprintf(stderr, "No baseline at %s, nothing compared. Take one with --rebaseline"
+				" (the rebaseline_performance targets) on a build known to be good.\n", settings.baseline_path.c_str());
+			return settings.skip_without_baseline ? EXIT_SUCCESS : 2;
+		}
+
+		Results baseline = loadResults(settings.baseline_path);
+		std::vector<Threshold> thresholds;
+		if (!settings.thresholds_path.empty())
+		{
+			thresholds = loadThresholds(settings.thresholds_path);
+		}
+
+		for (const auto& entry : baseline.context)
+		{
+			auto match = std::find_if(current.context.begin(), current.context.end()
+				, [&](const std::pair<std::string, std::string>& other) { return other.first == entry.first; });
+			if (match != current.context.end() && match->second != entry.second)
+			{
+				printf("warning: %s was %s in the baseline and is %s now\n", entry.first.c_str()
+					, entry.second.c_str(), match->second.c_str());
+			}
+		}
+
+		printf("%-44s %14s %14s %9s %9s %8s  %s\n", "metric", "baseline", "current", "change %", "limit %", "p", "verdict");
+		int regressions = 0;
+		for (const auto& entry : baseline.metrics)
+		{
+			const std::string& name = entry.first;
+			const Metric& base = entry.second;
+			auto found = current.metrics.find(name);
+			if (found == current.metrics.end())
+			{
+				printf("%-44s %14.4g %14s %9s %9s %8s  missing\n", name.c_str(), base.value, "-", "-", "-", "-");
+				continue;
+			}
+			const Metric& now = found->second;
+
+			double max_increase = settings.default_threshold;
+			for (const auto& threshold : thresholds)
+			{
+				if (globMatch(threshold.pattern.c_str(), name.c_str()))
+				{
+					max_increase = threshold.max_increase;
+					break;
+				}
+			}
+
+			double change = base.value != 0.0 ? (now.value - base.value) / base.value
+				: (now.value > 0.0 ? std::numeric_limits<double>::infinity() : 0.0);
+			bool has_test = base.stddev >= 0.0 && now.stddev >= 0.0 && base.count > 1.0 && now.count > 1.0;
+			double p_value = has_test ? welchPValue(base, now) : 0.0;
+
+			const char* verdict = "ok";
+			if (std::isnan(max_increase))
+			{
+				verdict = "ignored";
+			}
+			else if (change > max_increase)
+			{
+				// without samples behind it a change past the threshold counts as significant
+				if (p_value < settings.alpha)
+				{
+					verdict = "REGRESSION";
+					regressions++;
+				}
+				else
+				{
+					verdict = "noise";
+				}
+			}
+			else if (change < -max_increase && (!has_test || 1.0 - p_value < settings.alpha))
+			{
+				verdict = "improved";
+			}
+
+			char limit[16] = "-";
+			if (!std::isnan(max_increase))
+			{
+				snprintf(limit, sizeof(limit), "%.1f", max_increase * 100.0);
+			}
+			char p_text[16] = "-";
+			if (has_test)
+			{
+				snprintf(p_text, sizeof(p_text), "%.4f", p_value);
+			}
+			printf("%-44s %14.4g %14.4g %+9.1f %9s %8s  %s\n", name.c_str(), base.value, now.value, change * 100.0
+				, limit, p_text, verdict);
+		}
+		for (const auto& entry : current.metrics)
+		{
+			if (baseline.metrics.count(entry.first) == 0)
+			{
+				printf("%-44s %14s %14.4g %9s %9s %8s  new\n", entry.first.c_str(), "-", entry.second.value, "-", "-", "-");
+			}
+		}
+
+		if (regressions > 0)
+		{
+			printf("%d regression%s over the threshold\n", regressions, regressions == 1 ? "" : "s");
+			return 1;
+		}
+		printf("No regressions\n");
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+}
@@ -0,0 +1,136 @@
+// Microbenchmark of scene graph updates with part of the nodes dirty, needs no Vulkan device.
+// usage: scene_benchmark [node count]
+
+#include "JobSystem.h"
+#include "Measure.h"
+#include "SceneGraph.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const uint32_t FANOUT = 10;
+
+	glm::mat4 randomTransform(std::mt19937& rng)
+	{
+		std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+		std::uniform_real_distribution<float> angle(0.0f, 6.28f);
+		glm::mat4 transform = glm::translate(glm::mat4(), glm::vec3(offset(rng), offset(rng), offset(rng)));
+		return glm::rotate(transform, angle(rng), glm::vec3(0.0f, 0.0f, 1.0f));
+	}
+
+	bool matricesMatch(const glm::mat4& a, const glm::mat4& b)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				if (std::abs(a[column][row] - b[column][row]) > 1e-3f * std::max(1.0f, std::abs(b[column][row])))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// a thousandth of the nodes are roots, the others have FANOUT children each level down,
+	// five levels for a million nodes
+	void buildForest(SceneGraph& graph, size_t node_count, const std::vector<glm::mat4>& transforms)
+	{
+		size_t root_count = std::max<size_t>(1, node_count / 1000);
+		graph.reserve(node_count);
+		for (size_t i = 0; i < node_count; i++)
+		{
+			SceneGraph::NodeId parent = i < root_count ? SceneGraph::NO_PARENT : (SceneGraph::NodeId)((i - root_count) / FANOUT);
+			graph.addNode(parent, transforms[i]);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t node_count = argc > 1 ? (size_t)std::stoull(argv[1]) : 1000000;
+
+	std::mt19937 rng(42);
+	std::vector<glm::mat4> transforms(node_count);
+	for (auto& transform : transforms)
+	{
+		transform = randomTransform(rng);
+	}
+	std::vector<SceneGraph::NodeId> shuffled_nodes(node_count);
+	std::iota(shuffled_nodes.begin(), shuffled_nodes.end(), 0);
+	std::shuffle(shuffled_nodes.begin(), shuffled_nodes.end(), rng);
+
+	unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1 };
+	if (hardware_threads > 1)
+	{
+		thread_counts.push_back(hardware_threads);
+	}
+
+	printf("%zu nodes\n", node_count);
+	printf("%-7s %-7s %8s %10s %12s %12s\n", "dirty", "simd", "threads", "updated", "time (us)", "ns/node");
+	glm::mat4 reference_check;
+	for (double dirty_fraction : { 0.01, 0.1, 1.0 })
+	{
+		// the same random nodes change every run, in id order like an animation system would
+		// write them, and their descendants follow them
+		std::vector<SceneGraph::NodeId> dirty_nodes(shuffled_nodes.begin()
+			, shuffled_nodes.begin() + (size_t)(node_count * dirty_fraction));
+		std::sort(dirty_nodes.begin(), dirty_nodes.end());
+		std::string dirty_label = std::to_string((int)(dirty_fraction * 100)) + "%";
+
+		for (auto level : { SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2 })
+		{
+			if (!isSimdLevelSupported(level))
+			{
+				printf("%-7s %-7s not supported\n", dirty_label.c_str(), simdLevelName(level));
+				continue;
+			}
+			for (unsigned threads : thread_counts)
+			{
+				std::unique_ptr<JobSystem> jobs(threads > 1 ? new JobSystem(threads - 1) : nullptr);
+				SceneGraph graph(level, jobs.get());
+				buildForest(graph, node_count, transforms);
+				graph.update();
+
+				size_t updated = 0;
+				double time = measure([&]()
+				{
+					for (SceneGraph::NodeId node : dirty_nodes)
+					{
+						graph.setLocalTransform(node, transforms[node]);
+					}
+					updated = graph.update().size();
+				});
+				printf("%-7s %-7s %8u %10zu %12.1f %12.2f\n", dirty_label.c_str(), simdLevelName(level), threads
+					, updated, time / 1000.0, updated > 0 ? time / updated : 0.0);
+
+				// the kernels sum in glm's order, only fused multiply-adds of a -march build may differ
+				const glm::mat4& last = graph.getWorldTransform((SceneGraph::NodeId)node_count - 1);
+				if (level == SimdLevel::SCALAR && threads == 1)
+				{
+					reference_check = last;
+				}
+				else if (!matricesMatch(last, reference_check))
+				{
+					printf("%-7s %-7s %8u results differ from scalar\n", dirty_label.c_str(), simdLevelName(level), threads);
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
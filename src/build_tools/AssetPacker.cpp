@@ -0,0 +1,257 @@
+// Packs files into an asset archive, which the application maps instead of opening each loose file.
+// usage: asset_packer [--compress] <archive> <folder or file>...
+// Folders are packed without their subfolders. Entries are named by the paths as given, e.g.
+// "asset_packer content.pak content" names them content/chalet.obj and so on, the paths the
+// application asks for. With --compress an entry is stored compressed when that saves an eighth.
+
+#include "AssetArchive.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	struct PackedFile
+	{
+		std::string name;
+		std::vector<char> payload;
+		uint64_t size = 0;
+		uint64_t checksum = 0;
+		uint32_t flags = 0;
+	};
+
+	std::vector<char> readWholeFile(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file)
+		{
+			throw std::runtime_error("Failed to open " + path);
+		}
+		std::vector<char> data((size_t)file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+		return data;
+	}
+
+	// files directly in a folder, sorted, or the path itself when it is a file
+	std::vector<std::string> listFiles(std::string path)
+	{
+		std::replace(path.begin(), path.end(), '\\', '/');
+		while (path.size() > 1 && path.back() == '/')
+		{
+			path.pop_back();
+		}
+		std::vector<std::string> files;
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		if (attributes == INVALID_FILE_ATTRIBUTES)
+		{
+			throw std::runtime_error("No such file or folder " + path);
+		}
+		if (!(attributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			return { path };
+		}
+		WIN32_FIND_DATAA find_data;
+		HANDLE find = FindFirstFileA((path + "/*").c_str(), &find_data);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				{
+					files.push_back(path + "/" + find_data.cFileName);
+				}
+			} while (FindNextFileA(find, &find_data));
+			FindClose(find);
+		}
+#else
+		struct stat path_stat;
+		if (stat(path.c_str(), &path_stat) != 0)
+		{
+			throw std::runtime_error("No such file or folder " + path);
+		}
+		if (!S_ISDIR(path_stat.st_mode))
+		{
+			return { path };
+		}
+		DIR* folder = opendir(path.c_str());
+		if (!folder)
+		{
+			throw std::runtime_error("Failed to list " + path);
+		}
+		while (dirent* entry = readdir(folder))
+		{
+			std::string file = path + "/" + entry->d_name;
+			struct stat file_stat;
+			if (stat(file.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+			{
+				files.push_back(file);
+			}
+		}
+		closedir(folder);
+#endif
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	void writeArchive(const std::string& path, const std::vector<PackedFile>& files)
+	{
+		std::string names;
+		std::vector<AssetArchiveEntry> entries(files.size());
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			entries[i].name_offset = (uint32_t)names.size();
+			entries[i].name_length = (uint32_t)files[i].name.size();
+			names += files[i].name;
+		}
+
+		AssetArchiveHeader header = {};
+		memcpy(header.magic, ASSET_ARCHIVE_MAGIC, sizeof(header.magic));
+		header.version = ASSET_ARCHIVE_VERSION;
+		header.entry_count = (uint32_t)files.size();
+		header.entries_offset = sizeof(AssetArchiveHeader);
+		header.names_offset = header.entries_offset + sizeof(AssetArchiveEntry) * entries.size();
+		header.names_size = names.size();
+
+		uint64_t offset = header.names_offset + header.names_size;
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			offset = alignUp(offset, ASSET_ALIGNMENT);
+			entries[i].offset = offset;
+			entries[i].stored_size = files[i].payload.size();
+			entries[i].size = files[i].size;
+			entries[i].checksum = files[i].checksum;
+			entries[i].flags = files[i].flags;
+			offset += files[i].payload.size();
+		}
+
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			throw std::runtime_error("Failed to open " + path + " for writing");
+		}
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)entries.data(), sizeof(AssetArchiveEntry) * entries.size());
+		out.write(names.data(), names.size());
+		uint64_t written = header.names_offset + header.names_size;
+		const char padding[ASSET_ALIGNMENT] = {};
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			out.write(padding, entries[i].offset - written);
+			out.write(files[i].payload.data(), files[i].payload.size());
+			written = entries[i].offset + files[i].payload.size();
+		}
+		if (!out)
+		{
+			throw std::runtime_error("Failed to write " + path);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		bool compress = false;
+		std::vector<std::string> paths;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--compress")
+			{
+				compress = true;
+			}
+			else
+			{
+				paths.push_back(arg);
+			}
+		}
+		if (paths.size() < 2)
+		{
+			std::cerr << "usage: asset_packer [--compress] <archive> <folder or file>..." << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::vector<PackedFile> files;
+		for (size_t i = 1; i < paths.size(); i++)
+		{
+			for (const auto& file_path : listFiles(paths[i]))
+			{
+				PackedFile file;
+				file.name = file_path;
+				file.payload = readWholeFile(file_path);
+				file.size = file.payload.size();
+				file.checksum = assetChecksum(file.payload.data(), file.payload.size());
+				if (compress)
+				{
+					auto compressed = compressAsset(file.payload.data(), file.payload.size());
+					if (compressed.size() < file.payload.size() - file.payload.size() / 8)
+					{
+						file.payload = std::move(compressed);
+						file.flags |= ASSET_COMPRESSED;
+					}
+				}
+				files.push_back(std::move(file));
+			}
+		}
+
+		// the application looks entries up by binary search
+		std::sort(files.begin(), files.end(), [](const PackedFile& a, const PackedFile& b) { return a.name < b.name; });
+		for (size_t i = 1; i < files.size(); i++)
+		{
+			if (files[i].name == files[i - 1].name)
+			{
+				throw std::runtime_error("Packed twice: " + files[i].name);
+			}
+		}
+
+		writeArchive(paths[0], files);
+		uint64_t total_size = 0;
+		uint64_t total_stored = 0;
+		for (const auto& file : files)
+		{
+			printf("%-40s %12llu %12llu%s\n", file.name.c_str(), (unsigned long long)file.size
+				, (unsigned long long)file.payload.size(), (file.flags & ASSET_COMPRESSED) ? " compressed" : "");
+			total_size += file.size;
+			total_stored += file.payload.size();
+		}
+		printf("%zu files, %llu bytes stored as %llu in %s\n", files.size(), (unsigned long long)total_size
+			, (unsigned long long)total_stored, paths[0].c_str());
+
+		// read everything back, so that a broken archive never leaves the packer
+		AssetArchive archive(paths[0]);
+		for (const auto& file : files)
+		{
+			archive.read(file.name);
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,6 +1,20 @@
 md "../content"
 %VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/helloworld.vert -o ../content/helloworld_vert.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/helloworld_vert.spv
 %VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/helloworld.frag -o ../content/helloworld_frag.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/helloworld_frag.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/depth_prepass.vert -o ../content/depth_prepass_vert.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/depth_prepass_vert.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/cull.comp -o ../content/cull_comp.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/cull_comp.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/occlusion_cull.comp -o ../content/occlusion_cull_comp.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/occlusion_cull_comp.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/depth_reduce.comp -o ../content/depth_reduce_comp.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/depth_reduce_comp.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/depth_pyramid_debug.vert -o ../content/depth_pyramid_debug_vert.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/depth_pyramid_debug_vert.spv
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V ../shaders/depth_pyramid_debug.frag -o ../content/depth_pyramid_debug_frag.spv
+%VK_SDK_PATH%\Bin\spirv-val.exe --target-env vulkan1.0 ../content/depth_pyramid_debug_frag.spv
 
 REM TODO: I want to do this in python... once I have more shaders to compile
 REM like  "python compile_shaders.py?"
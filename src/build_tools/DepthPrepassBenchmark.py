@@ -0,0 +1,46 @@
+"""Compares frame rates with and without the depth pre-pass on every camera path.
+
+usage: python DepthPrepassBenchmark.py <vulkan_helloworld executable> [objects] [frames] [extra options...]
+
+Run it from the folder holding content/, like the executable itself.
+The grazing and flythrough paths look across the object grid, so most pixels
+are covered many times over and the pre-pass has the most to save there.
+"""
+
+import re
+import subprocess
+import sys
+
+CAMERA_PATHS = ["orbit", "grazing", "flythrough"]
+
+
+def measure_fps(executable, camera_path, depth_prepass, objects, frames, extra_options):
+    command = [executable, "--objects", str(objects), "--frames", str(frames), "--camera", camera_path]
+    if depth_prepass:
+        command.append("--depth-prepass")
+    command += extra_options
+    output = subprocess.run(command, stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    match = re.search(r"FPS: ([0-9.eE+-]+)", output)
+    if not match:
+        raise RuntimeError("no FPS reported by " + " ".join(command))
+    return float(match.group(1))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    executable = sys.argv[1]
+    objects = int(sys.argv[2]) if len(sys.argv) > 2 else 10000
+    frames = int(sys.argv[3]) if len(sys.argv) > 3 else 1000
+    extra_options = sys.argv[4:]
+
+    print("%-12s %12s %12s %9s" % ("camera", "no pre-pass", "pre-pass", "speedup"))
+    for camera_path in CAMERA_PATHS:
+        without = measure_fps(executable, camera_path, False, objects, frames, extra_options)
+        with_prepass = measure_fps(executable, camera_path, True, objects, frames, extra_options)
+        print("%-12s %12.1f %12.1f %8.2fx" % (camera_path, without, with_prepass, with_prepass / without))
+
+
+if __name__ == "__main__":
+    main()
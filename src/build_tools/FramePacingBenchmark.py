@@ -0,0 +1,59 @@
+"""Compares the frame pacing presets, optionally under an FPS limit.
+
+usage: python FramePacingBenchmark.py <vulkan_helloworld executable> [frames] [fps limit] [extra options...]
+
+Run it from the folder holding content/, like the executable itself.
+Latency is measured from polling input to the present call returning, so it
+leaves out the time the image then waits in the presentation engine.
+"""
+
+import re
+import subprocess
+import sys
+
+PRESETS = ["default", "low-latency", "throughput"]
+
+PATTERNS = {
+    "fps": r"FPS: ([0-9.eE+-]+)",
+    "mode": r"Frame pacing: [^,]+, ([a-z-]+), ([0-9]+) images",
+    "frame_time": r"Frame time: mean ([0-9.eE+-]+) ms, stddev ([0-9.eE+-]+) ms, p99 ([0-9.eE+-]+) ms",
+    "latency": r"Input to present: mean ([0-9.eE+-]+) ms, p99 ([0-9.eE+-]+) ms",
+    "cpu": r"CPU utilization: ([0-9.eE+-]+) %",
+}
+
+
+def run_preset(executable, preset, frames, fps_limit, extra_options):
+    command = [executable, "--pacing", preset, "--frames", str(frames)]
+    if fps_limit > 0:
+        command += ["--fps-limit", str(fps_limit)]
+    command += extra_options
+    output = subprocess.run(command, stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    results = {}
+    for name, pattern in PATTERNS.items():
+        match = re.search(pattern, output)
+        if not match:
+            raise RuntimeError("no '%s' line in the output of %s" % (name, " ".join(command)))
+        results[name] = match.groups()
+    return results
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    executable = sys.argv[1]
+    frames = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    fps_limit = float(sys.argv[3]) if len(sys.argv) > 3 else 0
+    extra_options = sys.argv[4:]
+
+    print("%-12s %-10s %6s %8s %10s %10s %10s %12s %12s %6s" % ("preset", "mode", "images", "fps"
+        , "frame ms", "stddev ms", "p99 ms", "latency ms", "lat p99 ms", "cpu %"))
+    for preset in PRESETS:
+        r = run_preset(executable, preset, frames, fps_limit, extra_options)
+        print("%-12s %-10s %6s %8.1f %10.2f %10.2f %10.2f %12.2f %12.2f %6.1f" % (preset, r["mode"][0], r["mode"][1]
+            , float(r["fps"][0]), float(r["frame_time"][0]), float(r["frame_time"][1]), float(r["frame_time"][2])
+            , float(r["latency"][0]), float(r["latency"][1]), float(r["cpu"][0])))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,53 @@
+"""Sums the events of a --trace file by name, optionally against a baseline trace.
+
+usage: python TraceSummary.py <trace.json> [baseline trace.json] [--startup]
+
+With --startup only events that end before the first "frame" event of the main
+thread are counted, i.e. window and Vulkan initialization. Nested events are
+counted in their parents as well, so the totals don't add up to the run time.
+"""
+
+import json
+import sys
+
+
+def load_totals(path, startup_only):
+    with open(path) as f:
+        events = [e for e in json.load(f)["traceEvents"] if e.get("ph") == "X"]
+    if startup_only:
+        frames = [e["ts"] for e in events if e["name"] == "frame"]
+        if frames:
+            first_frame = min(frames)
+            events = [e for e in events if e["ts"] + e["dur"] <= first_frame]
+    totals = {}
+    for e in events:
+        total, count = totals.get(e["name"], (0.0, 0))
+        totals[e["name"]] = (total + e["dur"] / 1000.0, count + 1)
+    return totals
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith("--")]
+    if not args:
+        print(__doc__)
+        sys.exit(1)
+    startup_only = "--startup" in sys.argv
+    totals = load_totals(args[0], startup_only)
+    baseline = load_totals(args[1], startup_only) if len(args) > 1 else None
+
+    names = sorted(totals, key=lambda name: totals[name][0], reverse=True)
+    if baseline is None:
+        print("%-36s %8s %12s" % ("event", "count", "total ms"))
+        for name in names:
+            print("%-36s %8d %12.3f" % (name, totals[name][1], totals[name][0]))
+        return
+
+    print("%-36s %12s %12s %12s" % ("event", "baseline ms", "total ms", "change ms"))
+    for name in names + sorted(set(baseline) - set(totals)):
+        total = totals.get(name, (0.0, 0))[0]
+        base = baseline.get(name, (0.0, 0))[0]
+        print("%-36s %12.3f %12.3f %+12.3f" % (name, base, total, total - base))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,14 +1,14 @@
 #include "VulkanShowBase.h"
+#include "AppOptions.h"
 
 #include <stdexcept>
 #include <iostream>
 
-int main() 
+int main(int argc, char** argv) 
 {
-	VulkanShowBase app;
-
 	try 
 	{
+		VulkanShowBase app(AppOptions::parse(argc, argv));
 		app.run();
 	}
 	catch (const std::runtime_error& e) 
@@ -19,5 +19,3 @@ int main()
 
 	return EXIT_SUCCESS;
 }
-
-
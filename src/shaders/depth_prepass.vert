@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth pre-pass: same transform as helloworld.vert, reading only the packed positions.
+// gl_Position is invariant in both, so the EQUAL test of the shading pass matches.
+
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} transform;
+
+struct ObjectData
+{
+    mat4 model;
+    vec4 bounding_sphere;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer ObjectBuffer
+{
+    ObjectData objects[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer VisibleObjectBuffer
+{
+    uint visible_objects[];
+};
+
+layout(location = 0) in vec3 in_position;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+invariant gl_Position;
+
+void main()
+{
+    uint object_index = visible_objects[gl_InstanceIndex];
+    gl_Position = transform.proj * transform.view
+        * transform.model * objects[object_index].model * vec4(in_position, 1.0);
+}
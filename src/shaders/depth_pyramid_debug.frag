@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// shows one level of the depth pyramid, near is dark and far is bright
+
+layout(set = 0, binding = 0) uniform sampler2D depth_pyramid;
+
+layout(push_constant) uniform DebugView
+{
+    ivec2 depth_size; // rendered part of the depth attachment
+    int level;
+} debug;
+
+layout(location = 0) in vec2 frag_uv;
+
+layout(location = 0) out vec4 out_color;
+
+void main()
+{
+    ivec2 level_size = max(ivec2(1), debug.depth_size >> (debug.level + 1));
+    ivec2 texel = min(ivec2(frag_uv * vec2(level_size)), level_size - 1);
+    float depth = texelFetch(depth_pyramid, texel, debug.level).r;
+    // perspective depth crowds near 1, spread it out a bit
+    out_color = vec4(vec3(pow(depth, 32.0)), 1.0);
+}
@@ -8,6 +8,25 @@ layout(set = 0, binding = 0) uniform UniformBufferObject
     mat4 proj;
 } transform;
 
+struct ObjectData
+{
+    mat4 model;
+    vec4 bounding_sphere;
+};
+
+// per-object transforms of the whole scene
+layout(std430, set = 0, binding = 2) readonly buffer ObjectBuffer
+{
+    ObjectData objects[];
+};
+
+// instance index -> object index, identity when drawing objects one by one
+// and the compacted survivor list when culling on the GPU
+layout(std430, set = 0, binding = 3) readonly buffer VisibleObjectBuffer
+{
+    uint visible_objects[];
+};
+
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_color;
 layout(location = 2) in vec2 in_tex_coord;
@@ -19,12 +38,15 @@ out gl_PerVertex
 {
     vec4 gl_Position;
 };
+// must match depth_prepass.vert bit for bit for the EQUAL depth test
+invariant gl_Position;
 
 void main()
 {
     //gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    uint object_index = visible_objects[gl_InstanceIndex];
     gl_Position = transform.proj * transform.view
-        * transform.model * vec4(in_position, 1.0);
+        * transform.model * objects[object_index].model * vec4(in_position, 1.0);
     frag_color = in_color;
     frag_tex_coord = in_tex_coord;
 }